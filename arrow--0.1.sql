@@ -9,3 +9,118 @@ LANGUAGE C;
 -- Access method
 CREATE ACCESS METHOD arrow TYPE TABLE HANDLER arrowam_handler;
 COMMENT ON ACCESS METHOD arrow IS 'In-memory columnar table access method based on Apache Arrow format';
+
+-- Sorted index access method, which keeps a sorted copy of an integer
+-- key column in shared memory.
+CREATE FUNCTION arrow_sorted_handler(internal)
+RETURNS index_am_handler
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE ACCESS METHOD arrow_sorted TYPE INDEX HANDLER arrow_sorted_handler;
+COMMENT ON ACCESS METHOD arrow_sorted IS 'In-memory sorted index for arrow tables';
+
+CREATE OPERATOR CLASS int2_ops
+DEFAULT FOR TYPE int2 USING arrow_sorted AS
+    OPERATOR 1 < ,
+    OPERATOR 2 <= ,
+    OPERATOR 3 = ,
+    OPERATOR 4 >= ,
+    OPERATOR 5 > ;
+
+CREATE OPERATOR CLASS int4_ops
+DEFAULT FOR TYPE int4 USING arrow_sorted AS
+    OPERATOR 1 < ,
+    OPERATOR 2 <= ,
+    OPERATOR 3 = ,
+    OPERATOR 4 >= ,
+    OPERATOR 5 > ;
+
+CREATE OPERATOR CLASS int8_ops
+DEFAULT FOR TYPE int8 USING arrow_sorted AS
+    OPERATOR 1 < ,
+    OPERATOR 2 <= ,
+    OPERATOR 3 = ,
+    OPERATOR 4 >= ,
+    OPERATOR 5 > ;
+
+-- Segments that do not belong to any relation, for example because
+-- the relation was dropped in a backend that did not have the module
+-- loaded.
+CREATE FUNCTION arrow_orphans(OUT dbid oid, OUT relfilenode oid, OUT attnum int2)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION arrow_cleanup()
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION arrow_orphans() FROM PUBLIC;
+REVOKE ALL ON FUNCTION arrow_cleanup() FROM PUBLIC;
+
+-- Segments with their sizes. The number of bytes reserved is the size
+-- of the segment, while the number of bytes used only counts the
+-- chunks that contain rows.
+CREATE FUNCTION arrow_segments(
+    OUT dbid oid, OUT relfilenode oid, OUT attnum int2, OUT relid regclass,
+    OUT row_count bigint, OUT capacity bigint,
+    OUT bytes_used bigint, OUT bytes_reserved bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE VIEW arrow_segments AS SELECT * FROM arrow_segments();
+
+-- Bytes reserved by all segments, which is what arrow.max_memory
+-- limits.
+CREATE FUNCTION arrow_memory_reserved()
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+-- Counters for profiling each relation, shared by all backends. Rows
+-- scanned only counts rows returned by sequential scans, and the time
+-- spent mapping segments is in milliseconds.
+CREATE FUNCTION arrow_profile(
+    OUT dbid oid, OUT relfilenode oid, OUT relid regclass,
+    OUT rows_scanned bigint, OUT rows_inserted bigint,
+    OUT segment_opens bigint, OUT open_time float8,
+    OUT bytes_mapped bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE VIEW arrow_profile AS SELECT * FROM arrow_profile();
+
+-- Storage of each column of an arrow table. The counts include rows
+-- that are deleted or were never committed. Scans, inserts, and dead
+-- rows are reported in pg_stat_user_tables as for other tables.
+CREATE FUNCTION arrow_column_stats(relation regclass,
+    OUT attnum int2, OUT attname name, OUT encoding text,
+    OUT row_count bigint, OUT null_count bigint, OUT chunks bigint,
+    OUT bytes_used bigint, OUT bytes_reserved bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE VIEW pg_stat_arrow AS
+  SELECT c.oid AS relid, n.nspname AS schemaname, c.relname, s.*
+    FROM pg_class c
+    JOIN pg_namespace n ON n.oid = c.relnamespace
+    JOIN pg_am a ON a.oid = c.relam,
+         LATERAL arrow_column_stats(c.oid) s
+   WHERE a.amname = 'arrow'
+     AND c.relkind = 'r'
+     AND NOT pg_is_other_temp_schema(c.relnamespace)
+     AND has_table_privilege(c.oid, 'SELECT');
+
+-- Bulk load a file into an arrow table. The format is one of the
+-- formats of COPY (csv, text, or binary), or arrow for files in the
+-- Arrow IPC stream or file format.
+CREATE FUNCTION arrow_copy_from(relation regclass, filename text,
+                                format text DEFAULT 'csv')
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
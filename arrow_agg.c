@@ -0,0 +1,857 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_agg.h"
+
+#include <postgres.h>
+
+#include <access/tableam.h>
+#include <catalog/pg_class.h>
+#include <catalog/pg_type.h>
+#include <commands/explain.h>
+#include <common/hashfn.h>
+#include <executor/executor.h>
+#include <miscadmin.h>
+#include <nodes/extensible.h>
+#include <nodes/makefuncs.h>
+#include <optimizer/cost.h>
+#include <optimizer/optimizer.h>
+#include <optimizer/pathnode.h>
+#include <optimizer/planner.h>
+#include <optimizer/restrictinfo.h>
+#include <optimizer/tlist.h>
+#include <port/pg_bitutils.h>
+#include <utils/builtins.h>
+#include <utils/fmgroids.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/numeric.h>
+#include <utils/rel.h>
+#include <utils/ruleutils.h>
+#include <utils/selfuncs.h>
+#include <utils/spccache.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_delta.h"
+#include "arrow_tts.h"
+#include "debug.h"
+
+bool ArrowEnableAgg = true;
+
+/**
+ * Contents of a column of the scan tuple.
+ */
+typedef enum ArrowAggKind {
+  ARROW_AGG_COLUMN,     /* Column of the table only used by the quals */
+  ARROW_AGG_KEY,        /* Grouping column */
+  ARROW_AGG_COUNT_STAR, /* count(*) */
+  ARROW_AGG_COUNT,      /* count(column) */
+  ARROW_AGG_SUM,        /* sum(column) */
+  ARROW_AGG_AVG,        /* avg(column) */
+  ARROW_AGG_MIN,        /* min(column) */
+  ARROW_AGG_MAX,        /* max(column) */
+} ArrowAggKind;
+
+#define ArrowAggKindIsAggregate(KIND) ((KIND) >= ARROW_AGG_COUNT_STAR)
+
+/**
+ * Bucket of the group table.
+ */
+typedef struct ArrowAggBucket {
+  int64 key;   /* Key of the group */
+  int32 group; /* Group with the key, or -1 if empty */
+} ArrowAggBucket;
+
+/**
+ * State of an arrow aggregation.
+ *
+ * Each column of the scan tuple is either a column of the table, read
+ * when evaluating the quals, or the result of an aggregate. For each
+ * aggregate and group we keep a value and the number of non-null rows
+ * added to it, which is the result for counts.
+ */
+typedef struct ArrowAggState {
+  CustomScanState css;
+  Oid relid;            /* Arrow table to aggregate */
+  AttrNumber keyattno;  /* Grouping column, or 0 if there is none */
+  int ncolumns;         /* Number of columns of the scan tuple */
+  ArrowAggKind* kinds;  /* Contents of each column of the scan tuple */
+  AttrNumber* attnos;   /* Column of the table read for each column */
+  ExprState* quals;
+  Relation relation;
+  TupleTableSlot* rowslot;
+  ArrowArray* keycolumn;
+  int16 keylen;
+  ArrowArray** columns; /* Column of the table for each aggregate */
+  int16* attlens;
+
+  /* Groups, computed on the first call */
+  MemoryContext aggcxt;
+  bool done;
+  int32 ngroups;
+  int32 maxgroups;
+  int32 next;      /* Next group to return */
+  int64* keys;     /* Key of each group */
+  int32 nullgroup; /* Group of rows with a null key, or -1 */
+  int32* smallmap; /* Group of each smallint key, or -1 */
+  ArrowAggBucket* buckets;
+  uint64 mask;
+  int64** values; /* Value of each group for each aggregate */
+  int64** counts; /* Rows of each group for each aggregate */
+
+  /* Current batch of rows */
+  int64 rows[ARROW_CHUNK_ROWS];
+  int64 batchkeys[ARROW_CHUNK_ROWS];
+  bool batchnulls[ARROW_CHUNK_ROWS];
+  int32 groups[ARROW_CHUNK_ROWS];
+  int64 args[ARROW_CHUNK_ROWS];
+  bool argnulls[ARROW_CHUNK_ROWS];
+} ArrowAggState;
+
+static create_upper_paths_hook_type prev_create_upper_paths_hook = NULL;
+
+static Plan* ArrowAggPlan(PlannerInfo* root, RelOptInfo* rel,
+                          CustomPath* best_path, List* tlist, List* clauses,
+                          List* custom_plans);
+static Node* ArrowAggCreateState(CustomScan* cscan);
+static void ArrowAggBegin(CustomScanState* node, EState* estate, int eflags);
+static TupleTableSlot* ArrowAggExec(CustomScanState* node);
+static void ArrowAggEnd(CustomScanState* node);
+static void ArrowAggRescan(CustomScanState* node);
+static void ArrowAggExplain(CustomScanState* node, List* ancestors,
+                            ExplainState* es);
+
+static const CustomPathMethods ArrowAggPathMethods = {
+    .CustomName = "ArrowAgg",
+    .PlanCustomPath = ArrowAggPlan,
+};
+
+static const CustomScanMethods ArrowAggPlanMethods = {
+    .CustomName = "ArrowAgg",
+    .CreateCustomScanState = ArrowAggCreateState,
+};
+
+static const CustomExecMethods ArrowAggExecMethods = {
+    .CustomName = "ArrowAgg",
+    .BeginCustomScan = ArrowAggBegin,
+    .ExecCustomScan = ArrowAggExec,
+    .EndCustomScan = ArrowAggEnd,
+    .ReScanCustomScan = ArrowAggRescan,
+    .ExplainCustomScan = ArrowAggExplain,
+};
+
+/*
+ * Check if we can compute an aggregate.
+ *
+ * Returns the kind of aggregate, or -1 if it is not supported, and
+ * sets `attno` to the column it aggregates.
+ */
+static int ArrowAggFunction(Aggref* aggref, Index relid, AttrNumber* attno) {
+  ArrowAggKind kind;
+  TargetEntry* tle;
+  Var* var;
+
+  if (aggref->agglevelsup != 0 || aggref->aggdistinct != NIL ||
+      aggref->aggorder != NIL || aggref->aggfilter != NULL ||
+      aggref->aggsplit != AGGSPLIT_SIMPLE || aggref->aggvariadic)
+    return -1;
+
+  switch (aggref->aggfnoid) {
+    case F_COUNT_:
+      *attno = InvalidAttrNumber;
+      return ARROW_AGG_COUNT_STAR;
+    case F_COUNT_ANY:
+      kind = ARROW_AGG_COUNT;
+      break;
+    case F_SUM_INT2:
+    case F_SUM_INT4:
+      kind = ARROW_AGG_SUM;
+      break;
+    case F_AVG_INT2:
+    case F_AVG_INT4:
+      kind = ARROW_AGG_AVG;
+      break;
+    case F_MIN_INT2:
+    case F_MIN_INT4:
+    case F_MIN_INT8:
+      kind = ARROW_AGG_MIN;
+      break;
+    case F_MAX_INT2:
+    case F_MAX_INT4:
+    case F_MAX_INT8:
+      kind = ARROW_AGG_MAX;
+      break;
+    default:
+      return -1;
+  }
+
+  if (list_length(aggref->args) != 1)
+    return -1;
+
+  tle = linitial_node(TargetEntry, aggref->args);
+  var = (Var*)tle->expr;
+  if (!IsA(var, Var) || var->varno != relid || var->varlevelsup != 0 ||
+      var->varattno <= 0)
+    return -1;
+
+  *attno = var->varattno;
+  return kind;
+}
+
+/*
+ * Create an aggregation path.
+ *
+ * Rows are never stored in a slot unless there are quals, so the
+ * per-row cost is only for looking up the group and updating the
+ * aggregates.
+ */
+static Path* ArrowAggPath(PlannerInfo* root, RelOptInfo* grouped_rel,
+                          RelOptInfo* input_rel, Var* key, int naggs) {
+  CustomPath* cpath = makeNode(CustomPath);
+  double spc_seq_page_cost;
+  double groups = 1.0;
+
+  get_tablespace_page_costs(input_rel->reltablespace, NULL,
+                            &spc_seq_page_cost);
+  if (key != NULL)
+    groups = estimate_num_groups(root, list_make1(key), input_rel->rows,
+                                 NULL, NULL);
+
+  cpath->path.pathtype = T_CustomScan;
+  cpath->path.parent = grouped_rel;
+  cpath->path.pathtarget = grouped_rel->reltarget;
+  cpath->path.rows = groups;
+  cpath->path.startup_cost =
+      spc_seq_page_cost * input_rel->pages +
+      input_rel->tuples * input_rel->baserestrictcost.per_tuple +
+      input_rel->rows * cpu_operator_cost * (naggs + 1);
+  cpath->path.total_cost = cpath->path.startup_cost + groups * cpu_tuple_cost;
+  cpath->custom_private = list_make3(
+      key, extract_actual_clauses(input_rel->baserestrictinfo, false),
+      input_rel);
+  cpath->methods = &ArrowAggPathMethods;
+
+  return &cpath->path;
+}
+
+/*
+ * Add an aggregation path for grouping an arrow table.
+ */
+static void ArrowAggPaths(PlannerInfo* root, UpperRelationKind stage,
+                          RelOptInfo* input_rel, RelOptInfo* output_rel,
+                          void* extra) {
+  Query* parse = root->parse;
+  GroupPathExtraData* group_extra = (GroupPathExtraData*)extra;
+  Var* key = NULL;
+  int naggs = 0;
+  RangeTblEntry* rte;
+  Relation relation;
+  bool isarrow;
+  List* exprs;
+  ListCell* lc;
+
+  if (prev_create_upper_paths_hook)
+    prev_create_upper_paths_hook(root, stage, input_rel, output_rel, extra);
+
+  if (!ArrowEnableAgg || stage != UPPERREL_GROUP_AGG || group_extra == NULL ||
+      group_extra->patype != PARTITIONWISE_AGGREGATE_NONE ||
+      group_extra->havingQual != NULL || parse->groupingSets != NIL ||
+      parse->hasTargetSRFs || parse->hasWindowFuncs ||
+      list_length(parse->groupClause) > 1 ||
+      input_rel->reloptkind != RELOPT_BASEREL ||
+      input_rel->rtekind != RTE_RELATION ||
+      !bms_is_empty(input_rel->lateral_relids))
+    return;
+
+  rte = planner_rt_fetch(input_rel->relid, root);
+  if (rte->relkind != RELKIND_RELATION || rte->inh ||
+      rte->tablesample != NULL || rte->securityQuals != NIL)
+    return;
+
+  if (parse->groupClause != NIL) {
+    SortGroupClause* sgc = linitial_node(SortGroupClause, parse->groupClause);
+    key = (Var*)get_sortgroupclause_expr(sgc, parse->targetList);
+    if (!IsA(key, Var) || key->varno != input_rel->relid ||
+        key->varlevelsup != 0 || key->varattno <= 0)
+      return;
+    switch (key->vartype) {
+      case INT2OID:
+      case INT4OID:
+      case INT8OID:
+        break;
+      default:
+        return;
+    }
+  }
+
+  /* The result can only use the grouping column and aggregates that
+   * we can compute. */
+  exprs = pull_var_clause((Node*)output_rel->reltarget->exprs,
+                          PVC_INCLUDE_AGGREGATES | PVC_RECURSE_PLACEHOLDERS);
+  foreach (lc, exprs) {
+    Node* node = (Node*)lfirst(lc);
+    AttrNumber attno;
+
+    if (IsA(node, Aggref)) {
+      if (ArrowAggFunction((Aggref*)node, input_rel->relid, &attno) < 0)
+        return;
+      ++naggs;
+    } else if (!IsA(node, Var) || key == NULL || !equal(node, key)) {
+      return;
+    }
+  }
+
+  /* Quals are evaluated on the rows of the table, so they can only
+   * use user columns. */
+  foreach (lc, input_rel->baserestrictinfo) {
+    RestrictInfo* rinfo = (RestrictInfo*)lfirst(lc);
+    List* vars;
+    ListCell* lv;
+
+    if (rinfo->pseudoconstant)
+      return;
+    vars = pull_var_clause((Node*)rinfo->clause, PVC_RECURSE_PLACEHOLDERS);
+    foreach (lv, vars) {
+      if (((Var*)lfirst(lv))->varattno <= 0)
+        return;
+    }
+  }
+
+  relation = table_open(rte->relid, NoLock);
+  isarrow = (table_slot_callbacks(relation) == &TTSOpsArrowTuple);
+  table_close(relation, NoLock);
+
+  if (isarrow)
+    add_path(output_rel, ArrowAggPath(root, output_rel, input_rel, key, naggs));
+}
+
+/*
+ * Create the plan for an aggregation path.
+ *
+ * The scan tuple has the grouping column, the aggregates, and the
+ * columns needed by the quals. The quals are kept with the custom
+ * expressions since they apply to the rows of the table rather than
+ * to the groups.
+ */
+static Plan* ArrowAggPlan(PlannerInfo* root, RelOptInfo* rel,
+                          CustomPath* best_path, List* tlist, List* clauses,
+                          List* custom_plans) {
+  Var* key = (Var*)linitial(best_path->custom_private);
+  List* quals = (List*)lsecond(best_path->custom_private);
+  RelOptInfo* input_rel = (RelOptInfo*)lthird(best_path->custom_private);
+  CustomScan* cscan = makeNode(CustomScan);
+  List* scan_tlist = NIL;
+  List* kinds = NIL;
+  List* attnos = NIL;
+  List* exprs;
+  ListCell* lc;
+
+  exprs = pull_var_clause((Node*)tlist,
+                          PVC_INCLUDE_AGGREGATES | PVC_RECURSE_PLACEHOLDERS);
+  exprs = list_concat(exprs,
+                      pull_var_clause((Node*)quals, PVC_RECURSE_PLACEHOLDERS));
+  foreach (lc, exprs) {
+    Expr* expr = (Expr*)lfirst(lc);
+    AttrNumber attno;
+    int kind;
+
+    if (tlist_member(expr, scan_tlist))
+      continue;
+
+    if (IsA(expr, Aggref)) {
+      kind = ArrowAggFunction((Aggref*)expr, input_rel->relid, &attno);
+      Assert(kind >= 0);
+    } else {
+      attno = ((Var*)expr)->varattno;
+      kind = (key != NULL && equal(expr, key)) ? ARROW_AGG_KEY
+                                               : ARROW_AGG_COLUMN;
+    }
+
+    scan_tlist = lappend(scan_tlist,
+                         makeTargetEntry(expr, list_length(scan_tlist) + 1,
+                                         NULL, false));
+    kinds = lappend_int(kinds, kind);
+    attnos = lappend_int(attnos, attno);
+  }
+
+  cscan->scan.plan.targetlist = tlist;
+  cscan->scan.plan.qual = NIL;
+  cscan->scan.scanrelid = 0;
+  cscan->flags = best_path->flags;
+  cscan->custom_scan_tlist = scan_tlist;
+  cscan->custom_exprs = quals;
+  cscan->custom_private = list_make4(
+      list_make1_oid(planner_rt_fetch(input_rel->relid, root)->relid),
+      list_make1_int(key != NULL ? key->varattno : InvalidAttrNumber), kinds,
+      attnos);
+  cscan->methods = &ArrowAggPlanMethods;
+
+  return &cscan->scan.plan;
+}
+
+static Node* ArrowAggCreateState(CustomScan* cscan) {
+  ArrowAggState* state = palloc0(sizeof(ArrowAggState));
+  List* kinds = (List*)lthird(cscan->custom_private);
+  List* attnos = (List*)lfourth(cscan->custom_private);
+  ListCell* lc;
+
+  NodeSetTag(state, T_CustomScanState);
+  state->css.methods = &ArrowAggExecMethods;
+  state->relid = linitial_oid((List*)linitial(cscan->custom_private));
+  state->keyattno = linitial_int((List*)lsecond(cscan->custom_private));
+  state->ncolumns = list_length(kinds);
+  state->kinds = palloc(Max(state->ncolumns, 1) * sizeof(ArrowAggKind));
+  state->attnos = palloc(Max(state->ncolumns, 1) * sizeof(AttrNumber));
+  foreach (lc, kinds)
+    state->kinds[foreach_current_index(lc)] = lfirst_int(lc);
+  foreach (lc, attnos)
+    state->attnos[foreach_current_index(lc)] = lfirst_int(lc);
+
+  return (Node*)state;
+}
+
+static void ArrowAggBegin(CustomScanState* node, EState* estate, int eflags) {
+  ArrowAggState* state = (ArrowAggState*)node;
+  CustomScan* cscan = (CustomScan*)node->ss.ps.plan;
+  TupleDesc tupdesc;
+
+  state->relation = table_open(state->relid, AccessShareLock);
+  tupdesc = RelationGetDescr(state->relation);
+  state->rowslot = ExecInitExtraTupleSlot(estate, tupdesc, &TTSOpsArrowTuple);
+  state->quals = ExecInitQual(cscan->custom_exprs, &node->ss.ps);
+  if (state->keyattno != InvalidAttrNumber)
+    state->keylen = TupleDescAttr(tupdesc, state->keyattno - 1)->attlen;
+  state->columns = palloc0(Max(state->ncolumns, 1) * sizeof(ArrowArray*));
+  state->attlens = palloc0(Max(state->ncolumns, 1) * sizeof(int16));
+  state->aggcxt = AllocSetContextCreate(estate->es_query_cxt, "ArrowAgg",
+                                        ALLOCSET_DEFAULT_SIZES);
+}
+
+/*
+ * Add a group with the given key.
+ */
+static int32 ArrowAggNewGroup(ArrowAggState* state, int64 key) {
+  const int32 group = state->ngroups;
+
+  if (state->ngroups == state->maxgroups) {
+    state->maxgroups *= 2;
+    state->keys = repalloc(state->keys, state->maxgroups * sizeof(int64));
+    for (int i = 0; i < state->ncolumns; ++i) {
+      if (!ArrowAggKindIsAggregate(state->kinds[i]))
+        continue;
+      state->values[i] =
+          repalloc(state->values[i], state->maxgroups * sizeof(int64));
+      state->counts[i] =
+          repalloc(state->counts[i], state->maxgroups * sizeof(int64));
+    }
+  }
+
+  state->keys[group] = key;
+  for (int i = 0; i < state->ncolumns; ++i) {
+    if (!ArrowAggKindIsAggregate(state->kinds[i]))
+      continue;
+    state->values[i][group] = 0;
+    state->counts[i][group] = 0;
+  }
+  ++state->ngroups;
+  return group;
+}
+
+/*
+ * Insert a group into the group table, growing it if it gets more
+ * than half full.
+ */
+static void ArrowAggInsertGroup(ArrowAggState* state, int32 group) {
+  uint64 h;
+
+  if (2 * (uint64)state->ngroups > state->mask + 1) {
+    ArrowAggBucket* buckets = state->buckets;
+    const uint64 nbuckets = state->mask + 1;
+
+    state->mask = 2 * nbuckets - 1;
+    state->buckets = palloc(2 * nbuckets * sizeof(ArrowAggBucket));
+    for (uint64 i = 0; i <= state->mask; ++i)
+      state->buckets[i].group = -1;
+    for (uint64 i = 0; i < nbuckets; ++i) {
+      if (buckets[i].group < 0)
+        continue;
+      h = murmurhash64((uint64)buckets[i].key) & state->mask;
+      while (state->buckets[h].group >= 0)
+        h = (h + 1) & state->mask;
+      state->buckets[h] = buckets[i];
+    }
+    pfree(buckets);
+  }
+
+  h = murmurhash64((uint64)state->keys[group]) & state->mask;
+  while (state->buckets[h].group >= 0)
+    h = (h + 1) & state->mask;
+  state->buckets[h].key = state->keys[group];
+  state->buckets[h].group = group;
+}
+
+/*
+ * Find the group of each row of the batch, adding groups for new keys.
+ */
+static void ArrowAggLookup(ArrowAggState* state, int n) {
+  if (state->keyattno == InvalidAttrNumber) {
+    for (int i = 0; i < n; ++i)
+      state->groups[i] = 0;
+    return;
+  }
+
+  ArrowArrayGatherInt(state->keycolumn, state->keylen, state->rows, n,
+                      state->batchkeys, state->batchnulls);
+
+  for (int i = 0; i < n; ++i) {
+    const int64 key = state->batchkeys[i];
+
+    if (state->batchnulls[i]) {
+      if (state->nullgroup < 0)
+        state->nullgroup = ArrowAggNewGroup(state, 0);
+      state->groups[i] = state->nullgroup;
+    } else if (state->smallmap != NULL) {
+      int32* group = &state->smallmap[key - PG_INT16_MIN];
+      if (*group < 0)
+        *group = ArrowAggNewGroup(state, key);
+      state->groups[i] = *group;
+    } else {
+      uint64 h = murmurhash64((uint64)key) & state->mask;
+      while (state->buckets[h].group >= 0 && state->buckets[h].key != key)
+        h = (h + 1) & state->mask;
+      if (state->buckets[h].group >= 0) {
+        state->groups[i] = state->buckets[h].group;
+      } else {
+        state->groups[i] = ArrowAggNewGroup(state, key);
+        ArrowAggInsertGroup(state, state->groups[i]);
+      }
+    }
+  }
+}
+
+/*
+ * Update the aggregates with a batch of rows.
+ *
+ * Each aggregate is updated with a separate loop over the batch, so
+ * that the loops only deal with the values of a single column.
+ */
+static void ArrowAggUpdate(ArrowAggState* state, int n) {
+  const int32* groups = state->groups;
+  const int64* args = state->args;
+  const bool* argnulls = state->argnulls;
+
+  ArrowAggLookup(state, n);
+
+  for (int c = 0; c < state->ncolumns; ++c) {
+    int64* values = state->values[c];
+    int64* counts = state->counts[c];
+
+    if (!ArrowAggKindIsAggregate(state->kinds[c]))
+      continue;
+
+    if (state->kinds[c] == ARROW_AGG_COUNT_STAR) {
+      for (int i = 0; i < n; ++i)
+        ++counts[groups[i]];
+      continue;
+    }
+
+    ArrowArrayGatherInt(state->columns[c], state->attlens[c], state->rows, n,
+                        state->args, state->argnulls);
+
+    switch (state->kinds[c]) {
+      case ARROW_AGG_COUNT:
+        for (int i = 0; i < n; ++i)
+          counts[groups[i]] += !argnulls[i];
+        break;
+      case ARROW_AGG_SUM:
+      case ARROW_AGG_AVG:
+        for (int i = 0; i < n; ++i) {
+          if (argnulls[i])
+            continue;
+          values[groups[i]] += args[i];
+          ++counts[groups[i]];
+        }
+        break;
+      case ARROW_AGG_MIN:
+        for (int i = 0; i < n; ++i) {
+          const int32 g = groups[i];
+          if (argnulls[i])
+            continue;
+          if (counts[g] == 0 || args[i] < values[g])
+            values[g] = args[i];
+          ++counts[g];
+        }
+        break;
+      case ARROW_AGG_MAX:
+        for (int i = 0; i < n; ++i) {
+          const int32 g = groups[i];
+          if (argnulls[i])
+            continue;
+          if (counts[g] == 0 || args[i] > values[g])
+            values[g] = args[i];
+          ++counts[g];
+        }
+        break;
+      default:
+        elog(ERROR, "unexpected aggregate kind %d", state->kinds[c]);
+    }
+  }
+}
+
+/*
+ * Evaluate the quals for the row in the row slot.
+ *
+ * The quals refer to columns of the scan tuple, so we copy the columns
+ * they need there first.
+ */
+static bool ArrowAggQual(ArrowAggState* state) {
+  ExprContext* econtext = state->css.ss.ps.ps_ExprContext;
+  TupleTableSlot* scanslot = state->css.ss.ss_ScanTupleSlot;
+
+  ExecClearTuple(scanslot);
+  for (int i = 0; i < state->ncolumns; ++i) {
+    if (ArrowAggKindIsAggregate(state->kinds[i])) {
+      scanslot->tts_values[i] = (Datum)0;
+      scanslot->tts_isnull[i] = true;
+    } else {
+      scanslot->tts_values[i] = slot_getattr(state->rowslot, state->attnos[i],
+                                             &scanslot->tts_isnull[i]);
+    }
+  }
+  ExecStoreVirtualTuple(scanslot);
+
+  ResetExprContext(econtext);
+  econtext->ecxt_scantuple = scanslot;
+  return ExecQual(state->quals, econtext);
+}
+
+/*
+ * Scan the table and compute the aggregates for all groups.
+ */
+static void ArrowAggRun(ArrowAggState* state) {
+  EState* estate = state->css.ss.ps.state;
+  const RelFileNumber relnumber = state->relation->rd_locator.relNumber;
+  TupleDesc tupdesc = RelationGetDescr(state->relation);
+  MemoryContext oldcxt = MemoryContextSwitchTo(state->aggcxt);
+  TableScanDesc scan;
+
+  /* The aggregated columns are read directly */
+  ArrowDeltaMerge(state->relation);
+
+  state->maxgroups = 64;
+  state->ngroups = 0;
+  state->nullgroup = -1;
+  state->keys = palloc(state->maxgroups * sizeof(int64));
+  state->values = palloc0(Max(state->ncolumns, 1) * sizeof(int64*));
+  state->counts = palloc0(Max(state->ncolumns, 1) * sizeof(int64*));
+  for (int i = 0; i < state->ncolumns; ++i) {
+    if (!ArrowAggKindIsAggregate(state->kinds[i]))
+      continue;
+    state->values[i] = palloc(state->maxgroups * sizeof(int64));
+    state->counts[i] = palloc(state->maxgroups * sizeof(int64));
+    if (state->attnos[i] != InvalidAttrNumber) {
+      Form_pg_attribute attr = TupleDescAttr(tupdesc, state->attnos[i] - 1);
+      state->columns[i] = ArrowArrayGet(relnumber, attr, O_RDWR);
+      state->attlens[i] = attr->attlen;
+    }
+  }
+
+  /* Without a grouping column, there is a single group even if there
+   * are no rows. */
+  if (state->keyattno == InvalidAttrNumber) {
+    ArrowAggNewGroup(state, 0);
+  } else {
+    state->keycolumn = ArrowArrayGet(
+        relnumber, TupleDescAttr(tupdesc, state->keyattno - 1), O_RDWR);
+    state->smallmap = NULL;
+    state->buckets = NULL;
+    if (state->keylen == 2) {
+      state->smallmap = palloc((PG_INT16_MAX - PG_INT16_MIN + 1) *
+                               sizeof(int32));
+      memset(state->smallmap, -1,
+             (PG_INT16_MAX - PG_INT16_MIN + 1) * sizeof(int32));
+    } else {
+      state->mask = 1023;
+      state->buckets = palloc((state->mask + 1) * sizeof(ArrowAggBucket));
+      for (uint64 i = 0; i <= state->mask; ++i)
+        state->buckets[i].group = -1;
+    }
+  }
+
+  scan = table_beginscan(state->relation, estate->es_snapshot, 0, NULL);
+  for (;;) {
+    int n = 0;
+
+    CHECK_FOR_INTERRUPTS();
+    while (n < ARROW_CHUNK_ROWS &&
+           table_scan_getnextslot(scan, ForwardScanDirection,
+                                  state->rowslot)) {
+      if (state->quals != NULL && !ArrowAggQual(state))
+        continue;
+      state->rows[n++] = ArrowItemPointerGetRow(&state->rowslot->tts_tid);
+    }
+
+    if (n == 0)
+      break;
+
+    ArrowAggUpdate(state, n);
+  }
+  table_endscan(scan);
+
+  MemoryContextSwitchTo(oldcxt);
+  state->next = 0;
+  state->done = true;
+
+  DEBUG_LOG("aggregated %d groups", state->ngroups);
+}
+
+static inline Datum ArrowAggIntDatum(int64 value, int16 attlen) {
+  switch (attlen) {
+    case 2:
+      return Int16GetDatum((int16)value);
+    case 4:
+      return Int32GetDatum((int32)value);
+    default:
+      return Int64GetDatum(value);
+  }
+}
+
+static TupleTableSlot* ArrowAggNext(ScanState* ss) {
+  ArrowAggState* state = (ArrowAggState*)ss;
+  TupleTableSlot* scanslot = ss->ss_ScanTupleSlot;
+  int32 group;
+
+  if (!state->done)
+    ArrowAggRun(state);
+
+  if (state->next >= state->ngroups)
+    return NULL;
+
+  group = state->next++;
+
+  ExecClearTuple(scanslot);
+  for (int i = 0; i < state->ncolumns; ++i) {
+    const int64 value = state->values[i] ? state->values[i][group] : 0;
+    const int64 count = state->counts[i] ? state->counts[i][group] : 0;
+    Datum* datum = &scanslot->tts_values[i];
+    bool* isnull = &scanslot->tts_isnull[i];
+
+    *isnull = false;
+    switch (state->kinds[i]) {
+      case ARROW_AGG_COLUMN:
+        *isnull = true;
+        break;
+      case ARROW_AGG_KEY:
+        *isnull = (group == state->nullgroup);
+        *datum = ArrowAggIntDatum(state->keys[group], state->keylen);
+        break;
+      case ARROW_AGG_COUNT_STAR:
+      case ARROW_AGG_COUNT:
+        *datum = Int64GetDatum(count);
+        break;
+      case ARROW_AGG_SUM:
+        *isnull = (count == 0);
+        *datum = Int64GetDatum(value);
+        break;
+      case ARROW_AGG_AVG:
+        /* Same as int8_avg, allocated in the per-tuple memory */
+        *isnull = (count == 0);
+        if (count > 0) {
+          MemoryContext oldcxt = MemoryContextSwitchTo(
+              ss->ps.ps_ExprContext->ecxt_per_tuple_memory);
+          *datum = DirectFunctionCall2(
+              numeric_div, NumericGetDatum(int64_to_numeric(value)),
+              NumericGetDatum(int64_to_numeric(count)));
+          MemoryContextSwitchTo(oldcxt);
+        }
+        break;
+      case ARROW_AGG_MIN:
+      case ARROW_AGG_MAX:
+        *isnull = (count == 0);
+        *datum = ArrowAggIntDatum(value, state->attlens[i]);
+        break;
+    }
+  }
+  return ExecStoreVirtualTuple(scanslot);
+}
+
+static bool ArrowAggRecheck(ScanState* ss, TupleTableSlot* slot) {
+  return true;
+}
+
+static TupleTableSlot* ArrowAggExec(CustomScanState* node) {
+  return ExecScan(&node->ss, ArrowAggNext, ArrowAggRecheck);
+}
+
+static void ArrowAggEnd(CustomScanState* node) {
+  ArrowAggState* state = (ArrowAggState*)node;
+
+  table_close(state->relation, NoLock);
+  MemoryContextDelete(state->aggcxt);
+}
+
+/*
+ * Rescan the aggregation.
+ *
+ * The groups are only recomputed if parameters used by the quals
+ * changed.
+ */
+static void ArrowAggRescan(CustomScanState* node) {
+  ArrowAggState* state = (ArrowAggState*)node;
+
+  if (node->ss.ps.chgParam != NULL) {
+    MemoryContextReset(state->aggcxt);
+    state->done = false;
+  }
+  state->next = 0;
+
+  ExecScanReScan(&node->ss);
+}
+
+static void ArrowAggExplain(CustomScanState* node, List* ancestors,
+                            ExplainState* es) {
+  ArrowAggState* state = (ArrowAggState*)node;
+  CustomScan* cscan = (CustomScan*)node->ss.ps.plan;
+
+  if (state->keyattno != InvalidAttrNumber)
+    ExplainPropertyText("Group Column",
+                        get_attname(state->relid, state->keyattno, false),
+                        es);
+
+  if (cscan->custom_exprs != NIL) {
+    List* context = set_deparse_context_plan(es->deparse_cxt,
+                                             &cscan->scan.plan, ancestors);
+    bool useprefix = (list_length(es->rtable) > 1 || es->verbose);
+    Node* quals = (Node*)make_ands_explicit(cscan->custom_exprs);
+
+    ExplainPropertyText("Filter",
+                        deparse_expression(quals, context, useprefix, false),
+                        es);
+  }
+}
+
+/*
+ * Install the planner hook and register the scan methods.
+ */
+void ArrowAggInit(void) {
+  RegisterCustomScanMethods(&ArrowAggPlanMethods);
+  prev_create_upper_paths_hook = create_upper_paths_hook;
+  create_upper_paths_hook = ArrowAggPaths;
+}
@@ -0,0 +1,43 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Grouped aggregation over arrow tables.
+ *
+ * For queries that group rows of a single arrow table on at most one
+ * integer column and only compute count, sum, min, max, and avg over
+ * integer columns, we add a custom path that does the aggregation
+ * while scanning the table. Rows are processed in batches of up to a
+ * chunk: the group of each row is looked up first, and then each
+ * aggregate is updated with a separate loop over the batch, reading
+ * the values directly from the data buffers of the column.
+ *
+ * Groups on smallint columns are found using an array indexed by the
+ * key, and groups on other columns using an open-addressing table.
+ */
+
+#ifndef ARROW_AGG_H_
+#define ARROW_AGG_H_
+
+#include <postgres.h>
+
+extern bool ArrowEnableAgg;
+
+void ArrowAggInit(void);
+
+#endif /* ARROW_AGG_H_ */
@@ -26,76 +26,281 @@
 
 #include <postgres.h>
 
+#include <access/htup_details.h>
+#include <access/xact.h>
 #include <catalog/pg_attribute.h>
+#include <catalog/pg_type.h>
+#include <common/int.h>
+#include <datatype/timestamp.h>
+#include <funcapi.h>
 #include <miscadmin.h>
+#include <nodes/pg_list.h>
+#include <port/atomics.h>
+#include <port/pg_bitutils.h>
+#include <portability/instr_time.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
 #include <utils/hsearch.h>
+#include <utils/inval.h>
+#include <utils/lsyscache.h>
 #include <utils/memutils.h>
+#include <utils/typcache.h>
 
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include "arrow_probes.h"
 #include "debug.h"
 
 typedef struct ArrowArrayEntry {
   ArrowSegmentKey key;
-  ArrowSegment* segment;
   struct ArrowArray* array;
 } ArrowArrayEntry;
 
-typedef struct SegmentData {
-  /** Pointer to the length field in associated segment */
-  int64* plength;
-} SegmentData;
+/*
+ * Descriptor of a cached array.
+ *
+ * The array, its private data, and its buffer pointers are allocated
+ * together, so opening a segment only allocates once.
+ */
+typedef struct ArrowArrayDescriptor {
+  ArrowArray array;
+  SegmentData data;
+  void* buffers[3];
+} ArrowArrayDescriptor;
+
+/*
+ * Columns of a relation.
+ *
+ * Slots and inserts reference the columns of a relation in this block
+ * instead of allocating their own, and open the arrays as they need
+ * them. When columns are added to the relation, a larger block
+ * replaces the old one. Slots of the current transaction can still
+ * reference the old block, so it is freed when the transaction ends.
+ */
+typedef struct ArrowColumnsEntry {
+  RelFileNumber relnumber;
+  int natts;            /* Number of columns in the block */
+  ArrowArray** columns; /* Arrays of the columns, or NULL */
+} ArrowColumnsEntry;
 
 static void ReleaseSegmentData(struct ArrowArray* array) {
-  pfree(array->private_data);
+  /* The private data is part of the descriptor */
+  pfree(array);
 }
 
-static void IncreaseLength(struct ArrowArray* array, int incr) {
+/*
+ * Extend the array with elements that have already been written.
+ *
+ * The write barrier makes sure that backends that see the new length
+ * also see the new elements.
+ */
+void ArrowArrayExtend(ArrowArray* array, int64 count) {
   SegmentData* data = (SegmentData*)array->private_data;
-  array->length += incr;
-  *data->plength += incr;
+  Assert(array->length + count <= data->capacity);
+  pg_write_barrier();
+  array->length += count;
+  data->segment->length += count;
 }
 
 static bool ArrowArrayIsNull(ArrowArray* array, int64 index) {
-  int8* ptr = array->buffers[0];
+  int8* ptr = ArrowArrayChunkValidity(array, index / ARROW_CHUNK_ROWS);
   Assert(index < array->length);
-  return ptr[index / 8] & (1 << (index % 8));
+  return ArrowValidityIsNull(ptr, index % ARROW_CHUNK_ROWS);
 }
 
-#define MAKE_ARRAY_GETTER(PFX, TYPE)                                      \
-  static NullableDatum ArrowArrayGet##PFX(ArrowArray* array, int index) { \
-    TYPE* ptr = array->buffers[1];                                        \
-    NullableDatum result = {0};                                           \
-    if (ArrowArrayIsNull(array, index))                                   \
-      result.isnull = true;                                               \
-    else                                                                  \
-      result.value = PFX##GetDatum(ptr[index]);                           \
-    return result;                                                        \
+/*
+ * Types that are not stored in their PostgreSQL representation.
+ */
+static const struct {
+  Oid typid;
+  ArrowLayout layout;
+  int64 epoch;
+} ArrowTypes[] = {
+    {BOOLOID, ARROW_LAYOUT_BITMAP, 0},
+    {DATEOID, ARROW_LAYOUT_EPOCH, POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE},
+    {TIMESTAMPOID, ARROW_LAYOUT_EPOCH,
+     (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY},
+    {TIMESTAMPTZOID, ARROW_LAYOUT_EPOCH,
+     (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY},
+};
+
+/*
+ * Look up how values of a fixed-length type are stored.
+ */
+static void ArrowScalarTypeLookup(Oid typid, int16 typlen, bool typbyval,
+                                  char typalign, ArrowType* type) {
+  memset(type, 0, sizeof(*type));
+  type->layout = ARROW_LAYOUT_FIXED;
+  type->typid = typid;
+  type->typmod = -1;
+  type->attlen = typlen;
+  type->byval = typbyval;
+  type->align = typalign;
+
+  for (int i = 0; i < lengthof(ArrowTypes); ++i) {
+    if (ArrowTypes[i].typid == typid) {
+      type->layout = ArrowTypes[i].layout;
+      type->epoch = ArrowTypes[i].epoch;
+      break;
+    }
   }
+}
 
-MAKE_ARRAY_GETTER(Int16, int16);
-MAKE_ARRAY_GETTER(Int32, int32);
-MAKE_ARRAY_GETTER(Int64, int64);
-MAKE_ARRAY_GETTER(Float4, float4);
-MAKE_ARRAY_GETTER(Float8, float8);
+/*
+ * Check if all fields of a composite type are fixed-length.
+ */
+static bool ArrowCompositeIsFixed(Oid typid, int32 typmod) {
+  TupleDesc desc = lookup_rowtype_tupdesc(typid, typmod);
+  bool fixed = true;
 
-#define MAKE_ARRAY_APPENDER(PFX, TYPE)                                \
-  static void ArrowArrayAppend##PFX(ArrowArray* array, Datum datum) { \
-    TYPE* ptr = array->buffers[1];                                    \
-    ptr[array->length] = DatumGet##PFX(datum);                        \
-    IncreaseLength(array, 1);                                         \
+  for (int i = 0; i < desc->natts; ++i) {
+    Form_pg_attribute field = TupleDescAttr(desc, i);
+    if (!field->attisdropped && field->attlen <= 0) {
+      fixed = false;
+      break;
+    }
   }
 
-MAKE_ARRAY_APPENDER(Float4, float4);
-MAKE_ARRAY_APPENDER(Float8, float8);
-MAKE_ARRAY_APPENDER(Int16, int16);
-MAKE_ARRAY_APPENDER(Int32, int32);
-MAKE_ARRAY_APPENDER(Int64, int64);
+  ReleaseTupleDesc(desc);
+  return fixed;
+}
+
+/*
+ * Look up how values of an attribute are stored.
+ *
+ * Returns false if the type of the attribute cannot be stored, which
+ * is the case for variable-length types other than arrays of
+ * fixed-length types and composites with only fixed-length fields.
+ * Dropped attributes are never read, so they are treated as
+ * fixed-size binary values, or as bits if they were variable-length.
+ */
+bool ArrowTypeLookup(Form_pg_attribute attr, ArrowType* type) {
+  Oid elemtype;
+
+  ArrowScalarTypeLookup(attr->atttypid, attr->attlen, attr->attbyval,
+                        attr->attalign, type);
+  type->typmod = attr->atttypmod;
+
+  if (attr->attisdropped) {
+    if (attr->attlen <= 0)
+      type->layout = ARROW_LAYOUT_BITMAP;
+    return true;
+  }
+
+  if (attr->attlen > 0)
+    return true;
+
+  if (attr->attlen != -1)
+    return false;
+
+  elemtype = get_element_type(attr->atttypid);
+  if (OidIsValid(elemtype)) {
+    if (get_typlen(elemtype) <= 0)
+      return false;
+    type->layout = ARROW_LAYOUT_LIST;
+    type->typid = elemtype;
+    return true;
+  }
+
+  if (attr->atttypid != RECORDOID && type_is_rowtype(attr->atttypid) &&
+      ArrowCompositeIsFixed(attr->atttypid, attr->atttypmod)) {
+    type->layout = ARROW_LAYOUT_STRUCT;
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * Length of the elements of the segment for an attribute.
+ *
+ * Lists store the end offset of each element in the child array, in
+ * the same place as the data of other arrays. Structs only have a
+ * validity buffer, but use a bitmap segment to keep the segment
+ * layout the same for all arrays.
+ */
+static int16 ArrowTypeSegmentLength(const ArrowType* type) {
+  switch (type->layout) {
+    case ARROW_LAYOUT_BITMAP:
+    case ARROW_LAYOUT_STRUCT:
+      return ARROW_BITMAP_ATTLEN;
+    case ARROW_LAYOUT_LIST:
+      return sizeof(int64);
+    case ARROW_LAYOUT_FIXED:
+    case ARROW_LAYOUT_EPOCH:
+      break;
+  }
+  return type->attlen;
+}
 
 static HTAB* ArrowArrayCache;
+static HTAB* ArrowColumnsCache;
 static MemoryContext ArrowArrayCacheMemoryContext;
 
+/* Blocks of columns replaced in the current transaction */
+static List* ArrowRetiredColumns = NIL;
+
+static void ReleaseArrowColumns(RelFileNumber relnumber) {
+  ArrowColumnsEntry* entry =
+      hash_search(ArrowColumnsCache, &relnumber, HASH_FIND, NULL);
+  if (entry == NULL)
+    return;
+  if (entry->columns)
+    pfree(entry->columns);
+  hash_search(ArrowColumnsCache, &relnumber, HASH_REMOVE, NULL);
+}
+
+/*
+ * Release cache entries for segments that have been dropped.
+ *
+ * Segments are flagged as dropped before they are unlinked when a
+ * transaction that dropped or truncated a relation commits. The
+ * memory for the segment is not released until all backends have
+ * unmapped it, so we sweep the cache whenever a relation is
+ * invalidated, which happens for both DROP TABLE and TRUNCATE.
+ *
+ * The relation being dropped is locked exclusively, so no scans in
+ * this backend can still be using the arrays.
+ */
+static void InvalidateArrowArrayCacheCallback(Datum arg, Oid relid) {
+  HASH_SEQ_STATUS status;
+  ArrowArrayEntry* entry;
+
+  hash_seq_init(&status, ArrowArrayCache);
+  while ((entry = hash_seq_search(&status)) != NULL) {
+    SegmentData* data = (SegmentData*)entry->array->private_data;
+    if ((data->segment->flags & ARROW_SEGMENT_DROPPED) == 0)
+      continue;
+    ReleaseArrowColumns(data->key.bk_relnumber);
+    munmap(data->segment, data->mapped);
+    ArrowArrayRelease(entry->array);
+    hash_search(ArrowArrayCache, &entry->key, HASH_REMOVE, NULL);
+  }
+}
+
+/*
+ * Free the blocks of columns that were replaced during the transaction.
+ *
+ * Slots do not outlive the transaction that created them, so nobody
+ * can reference the blocks any more.
+ */
+static void ArrowColumnsXactCallback(XactEvent event, void* arg) {
+  switch (event) {
+    case XACT_EVENT_COMMIT:
+    case XACT_EVENT_PARALLEL_COMMIT:
+    case XACT_EVENT_ABORT:
+    case XACT_EVENT_PARALLEL_ABORT:
+    case XACT_EVENT_PREPARE:
+      list_free_deep(ArrowRetiredColumns);
+      ArrowRetiredColumns = NIL;
+      break;
+
+    default:
+      break;
+  }
+}
+
 static void CreateArrowArrayHash() {
   HASHCTL ctl;
 
@@ -108,146 +313,865 @@ static void CreateArrowArrayHash() {
   ctl.hcxt = ArrowArrayCacheMemoryContext;
   ArrowArrayCache = hash_create("Arrow array cache", 400, &ctl,
                                 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+  ctl.keysize = sizeof(RelFileNumber);
+  ctl.entrysize = sizeof(ArrowColumnsEntry);
+  ArrowColumnsCache = hash_create("Arrow columns cache", 64, &ctl,
+                                  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+  CacheRegisterRelcacheCallback(InvalidateArrowArrayCacheCallback, (Datum)0);
+  RegisterXactCallback(ArrowColumnsXactCallback, NULL);
+}
+
+/*
+ * Set the buffer pointers of the array to point into the segment.
+ *
+ * This has to be done whenever the segment is remapped.
+ */
+static void ArrowArraySetBuffers(ArrowArray* array) {
+  SegmentData* data = (SegmentData*)array->private_data;
+  ArrowSegment* segment = data->segment;
+  void* offset_buffer = (int8_t*)segment + segment->offset_buffer_offset;
+  void* data_buffer = (int8_t*)segment + segment->data_buffer_offset;
+  void* validity_buffer = (int8_t*)segment + segment->validity_buffer_offset;
+
+  if (segment->attlen >= 0) {
+    /* Primitive Layout, or Boolean Layout for ARROW_BITMAP_ATTLEN */
+    array->buffers[0] = validity_buffer;
+    array->buffers[1] = data_buffer;
+  } else {
+    /* Variable Binary Layout */
+    array->buffers[0] = validity_buffer;
+    array->buffers[1] = offset_buffer;
+    array->buffers[2] = data_buffer;
+  }
+
+  data->capacity = ArrowSegmentCapacity(segment, data->mapped);
+}
+
+/*
+ * Refresh the array with changes done by other backends.
+ *
+ * This picks up the new length of the array and remaps the segment if
+ * it has grown.
+ */
+void ArrowArrayRefresh(ArrowArray* array) {
+  SegmentData* data = (SegmentData*)array->private_data;
+
+  if (data->segment->size != data->mapped) {
+    data->segment = ArrowSegmentRemap(data->segment, &data->mapped);
+    ArrowArraySetBuffers(array);
+  }
+  array->length = data->segment->length;
+}
+
+/*
+ * Make sure that there is room to append `count` elements to the
+ * array.
+ *
+ * This should be done for all columns before appending to any of them
+ * so that running out of memory does not leave columns with different
+ * lengths. The segment is grown by doubling the capacity, but never by
+ * more than ARROW_MAX_GROWTH elements at a time.
+ */
+void ArrowArrayReserve(ArrowArray* array, int64 count) {
+  SegmentData* data = (SegmentData*)array->private_data;
+  const int64 needed = array->length + count;
+
+  if (needed <= data->capacity)
+    return;
+
+  /* Another backend might already have grown the segment */
+  ArrowArrayRefresh(array);
+  if (needed <= data->capacity)
+    return;
+
+  data->segment = ArrowSegmentResize(
+      &data->key, data->segment, &data->mapped,
+      Max(needed, data->capacity + Min(data->capacity, ARROW_MAX_GROWTH)));
+  ArrowArraySetBuffers(array);
+}
+
+/*
+ * Get the end of the elements of a row of a list array in the child
+ * array, which is also the start of the elements of the next row.
+ *
+ * This is the offsets buffer of the Arrow list layout, except that
+ * each chunk stores the end offsets for its rows and the start offset
+ * of the first row, which is always zero, is not stored.
+ */
+static int64 ArrowListEnd(const ArrowArray* array, int64 row) {
+  if (row < 0)
+    return 0;
+  return ((int64*)ArrowArrayChunkData(array, row / ARROW_CHUNK_ROWS))
+      [row % ARROW_CHUNK_ROWS];
+}
+
+static void ArrowListSetEnd(ArrowArray* array, int64 row, int64 end) {
+  ((int64*)ArrowArrayChunkData(array, row / ARROW_CHUNK_ROWS))
+      [row % ARROW_CHUNK_ROWS] = end;
+}
+
+/*
+ * Make the children of a struct array as long as the array and make
+ * room for `count` more elements in them.
+ *
+ * Children can be longer or shorter than the array if an insert failed
+ * half-way, and those elements are not part of any row.
+ */
+static void ArrowStructPrepare(ArrowArray* array, int64 count) {
+  for (int64 c = 0; c < array->n_children; ++c) {
+    ArrowArray* child = array->children[c];
+    if (child->length > array->length)
+      ArrowArrayTruncate(child, array->length);
+    ArrowArrayReserve(child, array->length - child->length + count);
+    while (child->length < array->length)
+      ArrowArrayAppendNull(child);
+  }
 }
 
 void ArrowArrayAppendNull(ArrowArray* array) {
-  int8* ptr = array->buffers[0];
+  const SegmentData* data = (SegmentData*)array->private_data;
+  int8* ptr = ArrowArrayChunkValidity(array, array->length / ARROW_CHUNK_ROWS);
+  const int64 offset = array->length % ARROW_CHUNK_ROWS;
   DEBUG_ENTER("length: %lu", array->length);
-  ptr[array->length / 8] |= 1 << (array->length % 8);
-  IncreaseLength(array, 1);
+  Assert(array->length < data->capacity);
+  ArrowBitmapSet(ptr, offset);
+
+  /* Null rows still need an end offset, and structs need a null
+   * element in each child to keep the rows of the children aligned */
+  if (data->type.layout == ARROW_LAYOUT_LIST) {
+    ArrowListSetEnd(array, array->length,
+                    ArrowListEnd(array, array->length - 1));
+  } else if (data->type.layout == ARROW_LAYOUT_STRUCT) {
+    ArrowStructPrepare(array, 1);
+    for (int64 c = 0; c < array->n_children; ++c)
+      ArrowArrayAppendNull(array->children[c]);
+  }
+
+  ArrowArrayExtend(array, 1);
   DEBUG_LEAVE("length: %lu", array->length);
 }
 
-void ArrowArrayAppendDatum(ArrowArray* array, Form_pg_attribute attr,
-                           Datum datum) {
-  DEBUG_ENTER("length: %lu, attr: %s", array->length, NameStr(attr->attname));
+/*
+ * Convert a date or timestamp to a count from the Unix epoch.
+ *
+ * Infinite values are kept as they are, so finite values that would
+ * end up as one of them after the conversion are out of range.
+ */
+static int64 ArrowEpochValue(const ArrowType* type, int64 value) {
+  const int64 min = type->attlen == sizeof(int32) ? PG_INT32_MIN : PG_INT64_MIN;
+  const int64 max = type->attlen == sizeof(int32) ? PG_INT32_MAX : PG_INT64_MAX;
+  int64 result;
 
-  switch (attr->atttypid) {
-    case INT8OID:
-      ArrowArrayAppendInt64(array, datum);
-      break;
+  if (value == min || value == max)
+    return value;
+
+  if (pg_add_s64_overflow(value, type->epoch, &result) || result <= min ||
+      result >= max)
+    ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                    errmsg("value out of range for arrow storage")));
+  return result;
+}
+
+/*
+ * Check that a value can be stored using a type, reporting the same
+ * error as appending the value to an array of the type would.
+ */
+void ArrowTypeCheckDatum(const ArrowType* type, Datum datum) {
+  if (type->layout != ARROW_LAYOUT_EPOCH)
+    return;
+  if (type->attlen == sizeof(int32))
+    (void)ArrowEpochValue(type, DatumGetInt32(datum));
+  else
+    (void)ArrowEpochValue(type, DatumGetInt64(datum));
+}
+
+/*
+ * Append the elements of an array to the child of a list array and
+ * write the end offset of the new row.
+ *
+ * Only one-dimensional arrays with the default lower bound can be
+ * stored, since the list layout has no place for the dimensions.
+ */
+static void ArrowListAppend(ArrowArray* array, Form_pg_attribute attr,
+                            Datum datum) {
+  ArrowArray* child = array->children[0];
+  const ArrowType* elemtype = &((SegmentData*)child->private_data)->type;
+  const int64 start = ArrowListEnd(array, array->length - 1);
+  ArrayType* value = DatumGetArrayTypeP(datum);
+  Datum* elems;
+  bool* nulls;
+  int nelems;
+
+  if (ARR_NDIM(value) > 1)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("multidimensional arrays are not supported by arrow "
+                    "tables")));
+  if (ARR_NDIM(value) == 1 && ARR_LBOUND(value)[0] != 1)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("arrays with a lower bound other than 1 are not "
+                    "supported by arrow tables")));
+
+  deconstruct_array(value, elemtype->typid, elemtype->attlen, elemtype->byval,
+                    elemtype->align, &elems, &nulls, &nelems);
+
+  /* Elements after the last row were left behind by a failed insert */
+  if (child->length > start)
+    ArrowArrayTruncate(child, start);
+
+  ArrowArrayReserve(child, nelems);
+  for (int i = 0; i < nelems; ++i) {
+    if (nulls[i])
+      ArrowArrayAppendNull(child);
+    else
+      ArrowArrayAppendDatum(child, attr, elems[i]);
+  }
+  ArrowListSetEnd(array, array->length, start + nelems);
+
+  pfree(elems);
+  pfree(nulls);
+}
+
+/*
+ * Append the fields of a composite to the children of a struct array.
+ */
+static void ArrowStructAppend(ArrowArray* array, Datum datum) {
+  const ArrowType* type = &((SegmentData*)array->private_data)->type;
+  HeapTupleHeader td = DatumGetHeapTupleHeader(datum);
+  TupleDesc desc = lookup_rowtype_tupdesc(type->typid, type->typmod);
+  HeapTupleData tuple;
+  Datum* values = palloc(desc->natts * sizeof(Datum));
+  bool* nulls = palloc(desc->natts * sizeof(bool));
+
+  tuple.t_len = HeapTupleHeaderGetDatumLength(td);
+  ItemPointerSetInvalid(&tuple.t_self);
+  tuple.t_tableOid = InvalidOid;
+  tuple.t_data = td;
+  heap_deform_tuple(&tuple, desc, values, nulls);
+
+  ArrowStructPrepare(array, 1);
+  for (int64 c = 0; c < array->n_children; ++c) {
+    ArrowArray* child = array->children[c];
+    const int field = ((SegmentData*)child->private_data)->key.bk_child - 1;
+    if (nulls[field])
+      ArrowArrayAppendNull(child);
+    else
+      ArrowArrayAppendDatum(child, TupleDescAttr(desc, field), values[field]);
+  }
+
+  ReleaseTupleDesc(desc);
+  pfree(values);
+  pfree(nulls);
+}
 
-    case INT4OID:
-      ArrowArrayAppendInt32(array, datum);
+/*
+ * Store a value at a position of the data buffer.
+ *
+ * The data buffers of new chunks are zeroed, so only true values need
+ * a bit for types stored as bitmaps.
+ */
+static void ArrowArrayStoreValue(ArrowArray* array, int64 index,
+                                 Datum datum) {
+  const ArrowType* type = &((SegmentData*)array->private_data)->type;
+  char* ptr = ArrowArrayChunkData(array, index / ARROW_CHUNK_ROWS);
+  const int64 offset = index % ARROW_CHUNK_ROWS;
+
+  switch (type->layout) {
+    case ARROW_LAYOUT_BITMAP:
+      if (DatumGetBool(datum))
+        ArrowBitmapSet((int8*)ptr, offset);
       break;
 
-    case INT2OID:
-      ArrowArrayAppendInt16(array, datum);
+    case ARROW_LAYOUT_EPOCH:
+      if (type->attlen == sizeof(int32))
+        ((int32*)ptr)[offset] = ArrowEpochValue(type, DatumGetInt32(datum));
+      else
+        ((int64*)ptr)[offset] = ArrowEpochValue(type, DatumGetInt64(datum));
       break;
 
-    case FLOAT4OID:
-      ArrowArrayAppendFloat4(array, datum);
+    case ARROW_LAYOUT_FIXED:
+      if (type->byval)
+        store_att_byval(ptr + offset * type->attlen, datum, type->attlen);
+      else
+        memcpy(ptr + offset * type->attlen, DatumGetPointer(datum),
+               type->attlen);
       break;
 
-    case FLOAT8OID:
-      ArrowArrayAppendFloat8(array, datum);
+    case ARROW_LAYOUT_LIST:
+    case ARROW_LAYOUT_STRUCT:
+      /* Nested values are only appended */
+      Assert(false);
       break;
   }
+}
+
+void ArrowArrayAppendDatum(ArrowArray* array, Form_pg_attribute attr,
+                           Datum datum) {
+  const ArrowType* type = &((SegmentData*)array->private_data)->type;
+
+  DEBUG_ENTER("length: %lu, attr: %s", array->length, NameStr(attr->attname));
+  Assert(array->length < ((SegmentData*)array->private_data)->capacity);
+
+  if (type->layout == ARROW_LAYOUT_LIST)
+    ArrowListAppend(array, attr, datum);
+  else if (type->layout == ARROW_LAYOUT_STRUCT)
+    ArrowStructAppend(array, datum);
+  else
+    ArrowArrayStoreValue(array, array->length, datum);
+  ArrowArrayExtend(array, 1);
+
   DEBUG_LEAVE("length: %lu", array->length);
 }
 
+/*
+ * Set an element of the array to null or to a value.
+ *
+ * These are used to fill rows that were reserved by extending the
+ * array, without holding the relation extension lock. Nested arrays
+ * build their children while appending, so their rows cannot be
+ * reserved.
+ */
+void ArrowArraySetNull(ArrowArray* array, int64 index) {
+  Assert(!ArrowLayoutIsNested(ArrowArrayLayout(array)));
+  Assert(index < array->length);
+  ArrowBitmapSet(ArrowArrayChunkValidity(array, index / ARROW_CHUNK_ROWS),
+                 index % ARROW_CHUNK_ROWS);
+}
+
+void ArrowArraySetDatum(ArrowArray* array, int64 index, Datum datum) {
+  Assert(!ArrowLayoutIsNested(ArrowArrayLayout(array)));
+  Assert(index < array->length);
+  ArrowArrayStoreValue(array, index, datum);
+}
+
 /**
  * Initialize a new arrow array from an arrow segment.
  *
  * This sets all pointers correctly and allows arrow functions to use
  * the arrow array as usual.
  */
-ArrowArray* ArrowArrayInit(ArrowSegment* segment, Form_pg_attribute attr,
-                           MemoryContext cxt) {
-  void* offset_buffer = (int8_t*)segment + segment->offset_buffer_offset;
-  void* data_buffer = (int8_t*)segment + segment->data_buffer_offset;
-  void* validity_buffer = (int8_t*)segment + segment->validity_buffer_offset;
-  MemoryContext oldcontext = MemoryContextSwitchTo(cxt);
-  ArrowArray* array = palloc0(sizeof(ArrowArray));
-  SegmentData* data = palloc0(sizeof(SegmentData));
+ArrowArray* ArrowArrayInit(const ArrowSegmentKey* key, ArrowSegment* segment,
+                           size_t mapped, MemoryContext cxt) {
+  ArrowArrayDescriptor* desc =
+      MemoryContextAllocZero(cxt, sizeof(ArrowArrayDescriptor));
+  ArrowArray* array = &desc->array;
+  SegmentData* data = &desc->data;
 
-  data->plength = &segment->length;
+  data->key = *key;
+  data->segment = segment;
+  data->mapped = mapped;
 
-  array->n_buffers = attr->attlen > 0 ? 2 : 3;
-  array->buffers = palloc0(array->n_buffers * sizeof(*array->buffers));
+  array->n_buffers = segment->attlen >= 0 ? 2 : 3;
+  array->buffers = desc->buffers;
   array->null_count = -1;
   array->private_data = data;
   array->release = ReleaseSegmentData;
   array->length = segment->length;
 
-  if (attr->attlen > 0) {
-    /* Primitive Layout */
-    array->buffers[0] = validity_buffer;
-    array->buffers[1] = data_buffer;
+  ArrowArraySetBuffers(array);
+
+  return array;
+}
+
+/**
+ * Reset an arrow array to be empty.
+ *
+ * This is used when truncating a relation non-transactionally, so the
+ * relation is not visible to any other backends and we can shrink the
+ * segment back to the initial size.
+ */
+void ArrowArrayReset(ArrowArray* array) {
+  ArrowArrayTruncate(array, 0);
+}
+
+/*
+ * Truncate an array to `length` elements.
+ *
+ * The segment is shrunk to the chunks needed for the remaining
+ * elements, which releases the memory of the other chunks. This
+ * should only be used when no other backends can access the array.
+ */
+void ArrowArrayTruncate(ArrowArray* array, int64 length) {
+  SegmentData* data = (SegmentData*)array->private_data;
+  ArrowSegment* segment;
+  int64 chunk = length / ARROW_CHUNK_ROWS;
+  const int64 offset = length % ARROW_CHUNK_ROWS;
+
+  Assert(length <= array->length);
+
+  /* Children lose the elements of the rows that are removed */
+  if (data->type.layout == ARROW_LAYOUT_LIST) {
+    ArrowArray* child = array->children[0];
+    const int64 end = ArrowListEnd(array, length - 1);
+    if (child->length > end)
+      ArrowArrayTruncate(child, end);
+  } else if (data->type.layout == ARROW_LAYOUT_STRUCT) {
+    for (int64 c = 0; c < array->n_children; ++c)
+      if (array->children[c]->length > length)
+        ArrowArrayTruncate(array->children[c], length);
+  }
+
+  data->segment =
+      ArrowSegmentResize(&data->key, data->segment, &data->mapped, length);
+  segment = data->segment;
+  segment->length = length;
+  array->length = length;
+  ArrowArraySetBuffers(array);
+
+  /* Appends assume that the buffers are zeroed. Chunks that were
+   * dropped are zeroed if the segment grows again, but the rest of the
+   * last chunk and any chunks that remain need to be cleared here. */
+  if (offset > 0) {
+    int8* validity = ArrowArrayChunkValidity(array, chunk);
+    const int16 attlen = segment->attlen;
+    for (int64 i = offset; i < ARROW_CHUNK_ROWS; ++i)
+      validity[i / 8] &= ~(1 << (i % 8));
+    if (attlen == ARROW_BITMAP_ATTLEN) {
+      int8* bits = ArrowArrayChunkData(array, chunk);
+      for (int64 i = offset; i < ARROW_CHUNK_ROWS; ++i)
+        bits[i / 8] &= ~(1 << (i % 8));
+    } else if (attlen > 0)
+      memset((int8*)ArrowArrayChunkData(array, chunk) + offset * attlen, 0,
+             (ARROW_CHUNK_ROWS - offset) * attlen);
+    ++chunk;
+  }
+  if (chunk < data->capacity / ARROW_CHUNK_ROWS)
+    memset(ArrowArrayChunkData(array, chunk), 0,
+           segment->size - segment->data_buffer_offset -
+               chunk * segment->chunk_size);
+}
+
+/*
+ * Move element `src` of an array to position `dst`.
+ */
+static void ArrowArrayMove(ArrowArray* array, int64 dst, int64 src) {
+  const int16 attlen = ((SegmentData*)array->private_data)->segment->attlen;
+  const int64 src_chunk = src / ARROW_CHUNK_ROWS;
+  const int64 dst_chunk = dst / ARROW_CHUNK_ROWS;
+  const int64 src_bit = src % ARROW_CHUNK_ROWS;
+  const int64 dst_bit = dst % ARROW_CHUNK_ROWS;
+  int8* src_validity = ArrowArrayChunkValidity(array, src_chunk);
+  int8* dst_validity = ArrowArrayChunkValidity(array, dst_chunk);
+
+  if (attlen == ARROW_BITMAP_ATTLEN) {
+    int8* src_bits = ArrowArrayChunkData(array, src_chunk);
+    int8* dst_bits = ArrowArrayChunkData(array, dst_chunk);
+    if (src_bits[src_bit / 8] & (1 << (src_bit % 8)))
+      dst_bits[dst_bit / 8] |= 1 << (dst_bit % 8);
+    else
+      dst_bits[dst_bit / 8] &= ~(1 << (dst_bit % 8));
   } else {
-    /* Variable Binary Layout */
-    array->buffers[0] = validity_buffer;
-    array->buffers[1] = offset_buffer;
-    array->buffers[2] = data_buffer;
+    memcpy((int8*)ArrowArrayChunkData(array, dst_chunk) + dst_bit * attlen,
+           (int8*)ArrowArrayChunkData(array, src_chunk) + src_bit * attlen,
+           attlen);
   }
+  if (src_validity[src_bit / 8] & (1 << (src_bit % 8)))
+    dst_validity[dst_bit / 8] |= 1 << (dst_bit % 8);
+  else
+    dst_validity[dst_bit / 8] &= ~(1 << (dst_bit % 8));
+}
+
+/*
+ * Remove rows from a list array.
+ *
+ * The elements of the kept rows are moved to consecutive positions in
+ * the child array and the end offsets are rewritten for their new
+ * positions. The end offset of a row is read before anything is
+ * written to its position, since kept rows never move forward.
+ */
+static int64 ArrowListCompact(ArrowArray* array, int64 start,
+                              const uint64* keep) {
+  ArrowArray* child = array->children[0];
+  int64 begin = ArrowListEnd(array, start - 1);
+  int64 next = begin;
+  int64 dst = start;
 
-  MemoryContextSwitchTo(oldcontext);
+  for (int64 src = start; src < array->length; ++src) {
+    const int64 n = src - start;
+    const int64 end = ArrowListEnd(array, src);
 
-  return array;
+    if (keep[n / 64] & (UINT64CONST(1) << (n % 64))) {
+      for (int64 elem = begin; elem < end; ++elem, ++next)
+        if (next != elem)
+          ArrowArrayMove(child, next, elem);
+      if (dst != src)
+        ArrowArrayMove(array, dst, src);
+      ArrowListSetEnd(array, dst, next);
+      ++dst;
+    }
+    begin = end;
+  }
+
+  ArrowArrayTruncate(array, dst);
+  return dst;
+}
+
+/*
+ * Remove elements from an array, keeping the order of the remaining
+ * ones.
+ *
+ * Elements before `start` are left as they are. For the elements from
+ * `start`, bit N of `keep` decides if element `start + N` is kept.
+ * The kept elements are moved to consecutive positions starting at
+ * `start` and the array is truncated after them. Returns the new
+ * length of the array.
+ *
+ * The children of struct arrays have the same rows as the array, so
+ * they are compacted the same way.
+ *
+ * This should only be used when no other backends can access the
+ * array.
+ */
+int64 ArrowArrayCompact(ArrowArray* array, int64 start, const uint64* keep) {
+  SegmentData* data = (SegmentData*)array->private_data;
+  const int16 attlen = data->segment->attlen;
+  int64 dst = start;
+
+  Assert(start % ARROW_CHUNK_ROWS == 0);
+
+  if (attlen < 0)
+    elog(ERROR, "compacting variable-length arrays is not supported");
+
+  if (data->type.layout == ARROW_LAYOUT_LIST)
+    return ArrowListCompact(array, start, keep);
+
+  if (data->type.layout == ARROW_LAYOUT_STRUCT) {
+    ArrowStructPrepare(array, 0);
+    for (int64 c = 0; c < array->n_children; ++c)
+      ArrowArrayCompact(array->children[c], start, keep);
+  }
+
+  for (int64 src = start; src < array->length; ++src) {
+    const int64 n = src - start;
+    if ((keep[n / 64] & (UINT64CONST(1) << (n % 64))) == 0)
+      continue;
+    if (dst != src)
+      ArrowArrayMove(array, dst, src);
+    ++dst;
+  }
+
+  ArrowArrayTruncate(array, dst);
+  return dst;
 }
 
 void ArrowArrayRelease(ArrowArray* array) {
+  /* The children are cached arrays of their own */
+  if (array->children)
+    pfree(array->children);
   (*array->release)(array);
-  array->release = NULL; /* Just for precausion */
-  pfree(array);
 }
 
-NullableDatum ArrowArrayGetDatum(ArrowArray* array, Form_pg_attribute attr,
-                                 int index) {
-  switch (attr->atttypid) {
-    case INT8OID:
-      return ArrowArrayGetInt64(array, index);
+/*
+ * Build an array from the elements of a row of a list array.
+ */
+static Datum ArrowListGetDatum(ArrowArray* array, int64 index) {
+  ArrowArray* child = array->children[0];
+  const ArrowType* elemtype = &((SegmentData*)child->private_data)->type;
+  const int64 start = ArrowListEnd(array, index - 1);
+  const int64 end = ArrowListEnd(array, index);
+  int dims[1] = {end - start};
+  int lbs[1] = {1};
+  Datum* elems;
+  bool* nulls;
+  ArrayType* result;
 
-    case INT4OID:
-      return ArrowArrayGetInt32(array, index);
+  if (end == start)
+    return PointerGetDatum(construct_empty_array(elemtype->typid));
 
-    case INT2OID:
-      return ArrowArrayGetInt16(array, index);
+  /* The elements can have been added by another backend after the
+   * child was last refreshed */
+  if (unlikely(end > child->length))
+    ArrowArrayRefresh(child);
 
-    case FLOAT4OID:
-      return ArrowArrayGetFloat4(array, index);
+  elems = palloc(dims[0] * sizeof(Datum));
+  nulls = palloc(dims[0] * sizeof(bool));
+  for (int i = 0; i < dims[0]; ++i) {
+    const int64 chunk = (start + i) / ARROW_CHUNK_ROWS;
+    const int bit = (start + i) % ARROW_CHUNK_ROWS;
+    const void* data = ArrowArrayChunkData(child, chunk);
+    nulls[i] = ArrowValidityIsNull(ArrowArrayChunkValidity(child, chunk), bit);
+    elems[i] = nulls[i] ? (Datum)0 : ArrowValueGetDatum(elemtype, data, bit);
+  }
 
-    case FLOAT8OID:
-      return ArrowArrayGetFloat8(array, index);
+  result = construct_md_array(elems, nulls, 1, dims, lbs, elemtype->typid,
+                              elemtype->attlen, elemtype->byval,
+                              elemtype->align);
+  pfree(elems);
+  pfree(nulls);
+  return PointerGetDatum(result);
+}
 
-    default:
-      elog(ERROR, "type %d for attribute %s not handled", attr->atttypid,
-           NameStr(attr->attname));
+/*
+ * Build a composite from the fields of a row of a struct array.
+ */
+static Datum ArrowStructGetDatum(ArrowArray* array, int64 index) {
+  const ArrowType* type = &((SegmentData*)array->private_data)->type;
+  TupleDesc desc = lookup_rowtype_tupdesc(type->typid, type->typmod);
+  const int64 chunk = index / ARROW_CHUNK_ROWS;
+  const int bit = index % ARROW_CHUNK_ROWS;
+  Datum* values = palloc0(desc->natts * sizeof(Datum));
+  bool* nulls = palloc(desc->natts * sizeof(bool));
+  HeapTuple tuple;
+
+  memset(nulls, true, desc->natts * sizeof(bool));
+  for (int64 c = 0; c < array->n_children; ++c) {
+    ArrowArray* child = array->children[c];
+    const SegmentData* data = (SegmentData*)child->private_data;
+    const int field = data->key.bk_child - 1;
+
+    if (unlikely(index >= child->length))
+      ArrowArrayRefresh(child);
+    nulls[field] =
+        ArrowValidityIsNull(ArrowArrayChunkValidity(child, chunk), bit);
+    if (!nulls[field])
+      values[field] = ArrowValueGetDatum(
+          &data->type, ArrowArrayChunkData(child, chunk), bit);
   }
+
+  tuple = heap_form_tuple(desc, values, nulls);
+  ReleaseTupleDesc(desc);
+  pfree(values);
+  pfree(nulls);
+  return HeapTupleGetDatum(tuple);
+}
+
+/*
+ * Read the value of an element of an array.
+ *
+ * Values of lists and structs are built in the current memory
+ * context. Other values of pass-by-reference types point into the
+ * segment.
+ */
+NullableDatum ArrowArrayGetDatum(ArrowArray* array, Form_pg_attribute attr,
+                                 int64 index) {
+  const SegmentData* data = (SegmentData*)array->private_data;
+  NullableDatum result = {0};
+
+  if (ArrowArrayIsNull(array, index))
+    result.isnull = true;
+  else if (data->type.layout == ARROW_LAYOUT_LIST)
+    result.value = ArrowListGetDatum(array, index);
+  else if (data->type.layout == ARROW_LAYOUT_STRUCT)
+    result.value = ArrowStructGetDatum(array, index);
+  else
+    result.value = ArrowValueGetDatum(
+        &data->type, ArrowArrayChunkData(array, index / ARROW_CHUNK_ROWS),
+        index % ARROW_CHUNK_ROWS);
+  return result;
 }
 
 /*
  * Map an existing block into memory and save pointers to it in cache.
  *
- * Optionally create the segment if it does not exist.
+ * Optionally create the segment if it does not exist, in which case
+ * it is initialized for elements of size `attlen`. If the array is
+ * already in the cache, it is refreshed with changes done by other
+ * backends.
  */
-ArrowArray* ArrowArrayGet(Oid reloid, Form_pg_attribute attr, int oflags) {
-  const ArrowSegmentKey key = {
-      .bk_dbid = MyDatabaseId,
-      .bk_relid = reloid,
-      .bk_attno = attr->attnum,
-  };
+static ArrowArray* ArrowArrayOpenKey(const ArrowSegmentKey* key, int16 attlen,
+                                     int oflags) {
   bool found;
   ArrowArrayEntry* entry;
 
-  DEBUG_ENTER("relid: %d, attr: %s", reloid, NameStr(attr->attname));
+  DEBUG_ENTER("key: %s", key_to_string(key)->data);
 
   if (ArrowArrayCache == NULL)
     CreateArrowArrayHash();
 
-  entry = hash_search(ArrowArrayCache, &key, HASH_FIND, &found);
+  entry = hash_search(ArrowArrayCache, key, HASH_FIND, &found);
   if (!found) {
     bool created;
-    //    const int oflags = create ? (O_RDWR | O_CREAT) : O_RDWR;
-    ArrowSegment* segment = ArrowSegmentOpen(&key, oflags, 0644, &created);
+    size_t mapped;
+    ArrowArray* array;
+    ArrowSegment* segment;
+    instr_time start;
+    instr_time duration;
+
+    TRACE_ARROW_SEGMENT_OPEN_START(key->bk_relnumber, key->bk_attno);
+    INSTR_TIME_SET_CURRENT(start);
+    segment = ArrowSegmentOpen(key, oflags, 0644, &created, &mapped);
     if (created)
-      ArrowSegmentInit(segment, attr);
-    entry = hash_search(ArrowArrayCache, &key, HASH_ENTER, NULL);
-    entry->segment = segment;
-    entry->array =
-        ArrowArrayInit(entry->segment, attr, ArrowArrayCacheMemoryContext);
+      ArrowSegmentInit(segment, attlen, mapped);
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start);
+
+    /* The counters are zeroed when the segment is initialized, so they
+     * are only updated after that. */
+    pg_atomic_fetch_add_u64(&segment->counters.opens, 1);
+    pg_atomic_fetch_add_u64(&segment->counters.open_time,
+                            INSTR_TIME_GET_MICROSEC(duration));
+    pg_atomic_fetch_add_u64(&segment->counters.bytes_mapped, mapped);
+    TRACE_ARROW_SEGMENT_OPEN_DONE(key->bk_relnumber, key->bk_attno, mapped);
+
+    array = ArrowArrayInit(key, segment, mapped, ArrowArrayCacheMemoryContext);
+    entry = hash_search(ArrowArrayCache, key, HASH_ENTER, NULL);
+    entry->array = array;
+  } else {
+    ArrowArrayRefresh(entry->array);
   }
 
   DEBUG_LEAVE("address: %p", entry->array);
   return entry->array;
 }
+
+ArrowArray* ArrowArrayOpen(RelFileNumber relnumber, int16 attno, int16 attlen,
+                           int oflags) {
+  ArrowSegmentKey key;
+
+  memset(&key, 0, sizeof(key));
+  key.bk_dbid = MyDatabaseId;
+  key.bk_relnumber = relnumber;
+  key.bk_attno = attno;
+  return ArrowArrayOpenKey(&key, attlen, oflags);
+}
+
+/*
+ * Open a child array and remember its type.
+ */
+static ArrowArray* ArrowArrayOpenChild(ArrowArray* array, int16 child,
+                                       const ArrowType* type, int oflags) {
+  ArrowSegmentKey key = ((SegmentData*)array->private_data)->key;
+  ArrowArray* result;
+
+  key.bk_child = child;
+  result = ArrowArrayOpenKey(&key, ArrowTypeSegmentLength(type), oflags);
+  ((SegmentData*)result->private_data)->type = *type;
+  return result;
+}
+
+/*
+ * Open the child arrays of a list or struct array.
+ *
+ * Lists have a single child with the elements. Structs have a child
+ * for each field that is not dropped, numbered by the attribute
+ * number of the field. The children are cached like other arrays, so
+ * after the first time, this just refreshes them.
+ */
+static void ArrowArrayOpenChildren(ArrowArray* array, const ArrowType* type,
+                                   int oflags) {
+  if (type->layout == ARROW_LAYOUT_LIST) {
+    ArrowType elemtype;
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+
+    get_typlenbyvalalign(type->typid, &typlen, &typbyval, &typalign);
+    ArrowScalarTypeLookup(type->typid, typlen, typbyval, typalign, &elemtype);
+    if (array->children == NULL)
+      array->children = MemoryContextAllocZero(ArrowArrayCacheMemoryContext,
+                                               sizeof(*array->children));
+    array->children[0] = ArrowArrayOpenChild(array, 1, &elemtype, oflags);
+    array->n_children = 1;
+  } else {
+    TupleDesc desc = lookup_rowtype_tupdesc(type->typid, type->typmod);
+    int64 n = 0;
+
+    if (array->children == NULL)
+      array->children = MemoryContextAllocZero(
+          ArrowArrayCacheMemoryContext,
+          Max(desc->natts, 1) * sizeof(*array->children));
+    for (int i = 0; i < desc->natts; ++i) {
+      Form_pg_attribute field = TupleDescAttr(desc, i);
+      ArrowType fieldtype;
+
+      if (field->attisdropped)
+        continue;
+      ArrowTypeLookup(field, &fieldtype);
+      array->children[n++] =
+          ArrowArrayOpenChild(array, field->attnum, &fieldtype, oflags);
+    }
+    ReleaseTupleDesc(desc);
+    array->n_children = n;
+    array->n_buffers = 1; /* The Arrow struct layout has no data buffer */
+  }
+}
+
+/*
+ * Get the array for a column of a relation.
+ *
+ * This is also where types that cannot be stored are rejected, since
+ * the arrays for all columns are created with the relation.
+ */
+ArrowArray* ArrowArrayGet(RelFileNumber relnumber, Form_pg_attribute attr,
+                          int oflags) {
+  ArrowArray* array;
+  ArrowType type;
+
+  if (!ArrowTypeLookup(attr, &type))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("type %s is not supported by arrow tables",
+                    format_type_be(attr->atttypid)),
+             errdetail("Only fixed-length types, arrays of fixed-length "
+                       "types, and composite types with fixed-length "
+                       "fields can be stored in arrow tables.")));
+
+  array = ArrowArrayOpen(relnumber, attr->attnum,
+                         ArrowTypeSegmentLength(&type), oflags);
+  ((SegmentData*)array->private_data)->type = type;
+  if (ArrowLayoutIsNested(type.layout))
+    ArrowArrayOpenChildren(array, &type, oflags);
+  return array;
+}
+
+/**
+ * Count the null elements of an array.
+ *
+ * Bits after the last element of the last chunk are not cleared when
+ * an array is truncated, so they are masked out.
+ */
+int64 ArrowArrayNullCount(ArrowArray* array) {
+  int64 count = 0;
+
+  for (int64 chunk = 0; chunk * ARROW_CHUNK_ROWS < array->length; ++chunk) {
+    const uint8* validity = (uint8*)ArrowArrayChunkValidity(array, chunk);
+    const int64 rows =
+        Min(array->length - chunk * ARROW_CHUNK_ROWS, ARROW_CHUNK_ROWS);
+
+    count += pg_popcount((const char*)validity, rows / 8);
+    if (rows % 8 != 0)
+      count += pg_popcount32(validity[rows / 8] & ((1 << (rows % 8)) - 1));
+  }
+  return count;
+}
+
+/**
+ * Get the block of column arrays of a relation.
+ *
+ * The block has room for `natts` columns and is shared by everybody
+ * reading or writing the relation in this backend, so it should not
+ * be freed. Entries are NULL until the column is opened, by storing
+ * the result of ArrowArrayGet() in it.
+ */
+ArrowArray** ArrowArrayGetColumns(RelFileNumber relnumber, int natts) {
+  ArrowColumnsEntry* entry;
+  bool found;
+
+  if (ArrowArrayCache == NULL)
+    CreateArrowArrayHash();
+
+  entry = hash_search(ArrowColumnsCache, &relnumber, HASH_ENTER, &found);
+  if (!found) {
+    entry->natts = 0;
+    entry->columns = NULL;
+  }
+
+  if (entry->natts < natts) {
+    MemoryContext oldcontext =
+        MemoryContextSwitchTo(ArrowArrayCacheMemoryContext);
+    ArrowArray** columns = palloc0(natts * sizeof(*columns));
+
+    if (entry->columns != NULL) {
+      memcpy(columns, entry->columns, entry->natts * sizeof(*columns));
+      ArrowRetiredColumns = lappend(ArrowRetiredColumns, entry->columns);
+    }
+    entry->columns = columns;
+    entry->natts = natts;
+    MemoryContextSwitchTo(oldcontext);
+  }
+
+  return entry->columns;
+}
@@ -21,22 +21,224 @@
 
 #include <postgres.h>
 
+#include <access/tupmacs.h>
 #include <executor/tuptable.h>
+#include <port/atomics.h>
 #include <utils/catcache.h>
 
 #include "arrow_c_data_interface.h"
 #include "arrow_storage.h"
 
-ArrowArray* ArrowArrayInit(ArrowSegment* segment, Form_pg_attribute attr,
-                           MemoryContext cxt)
+/**
+ * Maximum number of elements to grow a segment with at a time.
+ */
+#define ARROW_MAX_GROWTH (1024 * ARROW_CHUNK_ROWS)
+
+/**
+ * Layout of the values of a type in the data buffer.
+ */
+typedef enum ArrowLayout {
+  ARROW_LAYOUT_FIXED,  /* PostgreSQL representation of the value */
+  ARROW_LAYOUT_BITMAP, /* One bit per value, like the Arrow boolean */
+  ARROW_LAYOUT_EPOCH,  /* Integer relative to the Unix epoch */
+  ARROW_LAYOUT_LIST,   /* Offsets into a child array, for arrays */
+  ARROW_LAYOUT_STRUCT, /* Child array per field, for composites */
+} ArrowLayout;
+
+#define ArrowLayoutIsNested(LAYOUT) ((LAYOUT) >= ARROW_LAYOUT_LIST)
+
+/**
+ * Storage of a type in an arrow array.
+ *
+ * Types with a layout other than ARROW_LAYOUT_FIXED are listed in a
+ * table in arrow_array.c. All other fixed-length types are stored as
+ * fixed-size binary values in their PostgreSQL representation, so for
+ * those the bytes in the data buffer are the bytes of the attribute in
+ * a heap tuple.
+ *
+ * Dates and timestamps are stored like the Arrow date32 and timestamp
+ * (in microseconds) types, which count from the Unix epoch rather than
+ * from the PostgreSQL epoch. Infinite values are stored as they are.
+ *
+ * Arrays and composites of fixed-length types are stored in child
+ * arrays, with the list and struct layouts respectively. For those,
+ * `typid` is the element type of the array or the composite type, and
+ * the types of the children are found in the child arrays.
+ */
+typedef struct ArrowType {
+  ArrowLayout layout;
+  Oid typid;    /* Type of the value, or element type for lists */
+  int32 typmod; /* Type modifier of the value */
+  int16 attlen; /* Length of the attribute */
+  bool byval;   /* Attribute is passed by value */
+  char align;   /* Alignment of the attribute */
+  int64 epoch;  /* Added to ARROW_LAYOUT_EPOCH values when stored */
+} ArrowType;
+
+/**
+ * Private data for arrays stored in segments.
+ *
+ * The segment is mapped separately in each backend and can be
+ * remapped when it grows, so the capacity here is for the mapped part
+ * of the segment, which can be smaller than the segment itself.
+ */
+typedef struct SegmentData {
+  ArrowSegmentKey key;
+  ArrowSegment* segment; /* Segment mapped in this backend */
+  size_t mapped;         /* Number of bytes mapped */
+  int64 capacity;        /* Number of elements that fit in mapping */
+  ArrowType type;        /* Type of the values, for columns */
+} SegmentData;
+
+/**
+ * Get a buffer for a chunk of the array.
+ *
+ * The buffers of the array point to the buffers of the first chunk,
+ * and the buffers of the following chunks follow at a fixed stride.
+ */
+static inline void* ArrowArrayChunkBuffer(const ArrowArray* array, int buffer,
+                                          int64 chunk) {
+  const SegmentData* data = (const SegmentData*)array->private_data;
+  return (int8*)array->buffers[buffer] + chunk * data->segment->chunk_size;
+}
+
+#define ArrowArrayChunkValidity(ARRAY, CHUNK) \
+  ((int8*)ArrowArrayChunkBuffer((ARRAY), 0, (CHUNK)))
+#define ArrowArrayChunkData(ARRAY, CHUNK) \
+  ArrowArrayChunkBuffer((ARRAY), 1, (CHUNK))
+
+/**
+ * Check if element `BIT` of a chunk is null.
+ *
+ * Validity bits are set for null elements, so that the zeroed buffers
+ * of a new chunk hold non-null elements.
+ */
+#define ArrowValidityIsNull(VALIDITY, BIT) \
+  (((VALIDITY)[(BIT) / 8] & (1 << ((BIT) % 8))) != 0)
+
+/**
+ * Set bit `bit` of a bitmap of a chunk.
+ *
+ * Rows reserved by different backends are filled without holding a
+ * lock and can share a byte of a bitmap, so the bit is set with an
+ * atomic operation on the word holding it. The buffers of a chunk are
+ * aligned to ARROW_ALIGNMENT, so the word is always aligned.
+ */
+static inline void ArrowBitmapSet(int8* bitmap, int bit) {
+#ifdef WORDS_BIGENDIAN
+  const int shift = (3 - (bit / 8) % 4) * 8 + bit % 8;
+#else
+  const int shift = bit % 32;
+#endif
+  pg_atomic_fetch_or_u32((pg_atomic_uint32*)bitmap + bit / 32,
+                         (uint32)1 << shift);
+}
+
+#define ArrowArrayLayout(ARRAY) \
+  (((const SegmentData*)(ARRAY)->private_data)->type.layout)
+
+/**
+ * Counters in the segment of an array, see ArrowSegmentCounters.
+ */
+#define ArrowArrayCounters(ARRAY) \
+  (&((SegmentData*)(ARRAY)->private_data)->segment->counters)
+
+/**
+ * Read a non-null value from the data buffer of a chunk.
+ *
+ * Values of pass-by-reference types point into the segment and are
+ * only valid until the array is refreshed, so they have to be copied
+ * if they are kept.
+ */
+static inline Datum ArrowValueGetDatum(const ArrowType* type,
+                                       const void* data, int bit) {
+  Assert(!ArrowLayoutIsNested(type->layout));
+  switch (type->layout) {
+    case ARROW_LAYOUT_BITMAP:
+      return BoolGetDatum((((const uint8*)data)[bit / 8] >> (bit % 8)) & 1);
+
+    case ARROW_LAYOUT_EPOCH:
+      if (type->attlen == sizeof(int32)) {
+        const int32 value = ((const int32*)data)[bit];
+        if (value == PG_INT32_MIN || value == PG_INT32_MAX)
+          return Int32GetDatum(value);
+        return Int32GetDatum((int32)((int64)value - type->epoch));
+      } else {
+        const int64 value = ((const int64*)data)[bit];
+        if (value == PG_INT64_MIN || value == PG_INT64_MAX)
+          return Int64GetDatum(value);
+        /* Wraps instead of overflowing for values that are not valid
+         * timestamps, which are rejected before they are stored. */
+        return Int64GetDatum((int64)((uint64)value - (uint64)type->epoch));
+      }
+
+    case ARROW_LAYOUT_FIXED:
+    case ARROW_LAYOUT_LIST:
+    case ARROW_LAYOUT_STRUCT:
+      break;
+  }
+  return fetch_att((const char*)data + bit * type->attlen, type->byval,
+                   type->attlen);
+}
+
+/**
+ * Read the values of a batch of rows of an integer column.
+ *
+ * The values are read directly from the data buffers of the chunks
+ * and widened to 64 bits, and rows that are null are flagged in
+ * `isnull`. For columns of other lengths, only `isnull` is set.
+ */
+static inline void ArrowArrayGatherInt(const ArrowArray* array, int16 attlen,
+                                       const int64* rows, int n,
+                                       int64* values, bool* isnull) {
+  for (int i = 0; i < n; ++i) {
+    const int64 chunk = rows[i] / ARROW_CHUNK_ROWS;
+    const int bit = rows[i] % ARROW_CHUNK_ROWS;
+    const int8* validity = ArrowArrayChunkValidity(array, chunk);
+    const void* data = ArrowArrayChunkData(array, chunk);
+
+    isnull[i] = ArrowValidityIsNull(validity, bit);
+    switch (attlen) {
+      case 2:
+        values[i] = ((const int16*)data)[bit];
+        break;
+      case 4:
+        values[i] = ((const int32*)data)[bit];
+        break;
+      case 8:
+        values[i] = ((const int64*)data)[bit];
+        break;
+      default:
+        values[i] = 0;
+        break;
+    }
+  }
+}
+
+bool ArrowTypeLookup(Form_pg_attribute attr, ArrowType* type);
+void ArrowTypeCheckDatum(const ArrowType* type, Datum datum);
+ArrowArray* ArrowArrayInit(const ArrowSegmentKey* key, ArrowSegment* segment,
+                           size_t mapped, MemoryContext cxt)
     __attribute__((returns_nonnull, warn_unused_result));
 void ArrowArrayRelease(ArrowArray* array);
-ArrowArray* ArrowArrayGet(Oid reloid, Form_pg_attribute attr, int oflags)
-    __attribute__((returns_nonnull));
+void ArrowArrayReset(ArrowArray* array);
+void ArrowArrayTruncate(ArrowArray* array, int64 length);
+int64 ArrowArrayCompact(ArrowArray* array, int64 start, const uint64* keep);
+void ArrowArrayRefresh(ArrowArray* array);
+void ArrowArrayReserve(ArrowArray* array, int64 count);
+void ArrowArrayExtend(ArrowArray* array, int64 count);
+ArrowArray* ArrowArrayOpen(RelFileNumber relnumber, int16 attno, int16 attlen,
+                           int oflags) __attribute__((returns_nonnull));
+ArrowArray* ArrowArrayGet(RelFileNumber relnumber, Form_pg_attribute attr,
+                          int oflags) __attribute__((returns_nonnull));
+ArrowArray** ArrowArrayGetColumns(RelFileNumber relnumber, int natts);
+int64 ArrowArrayNullCount(ArrowArray* array);
 NullableDatum ArrowArrayGetDatum(ArrowArray* array, Form_pg_attribute attr,
-                                 int index);
+                                 int64 index);
 void ArrowArrayAppendNull(ArrowArray* array);
 void ArrowArrayAppendDatum(ArrowArray* array, Form_pg_attribute attr,
                            Datum datum);
+void ArrowArraySetNull(ArrowArray* array, int64 index);
+void ArrowArraySetDatum(ArrowArray* array, int64 index, Datum datum);
 
 #endif /* ARROW_ARRAY_H_ */
@@ -0,0 +1,385 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_cluster.h"
+
+#include <postgres.h>
+
+#include <access/genam.h>
+#include <access/nbtree.h>
+#include <access/transam.h>
+#include <access/xact.h>
+#include <catalog/pg_index.h>
+#include <miscadmin.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/snapmgr.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_delta.h"
+#include "arrow_storage.h"
+#include "arrow_visibility.h"
+#include "debug.h"
+
+/**
+ * Key values of the rows being sorted.
+ *
+ * The values are read once, so comparisons do not have to go through
+ * the segments.
+ */
+typedef struct ArrowSortState {
+  ArrowSortKey* key;
+  Datum* values[INDEX_MAX_KEYS];
+  bool* isnull[INDEX_MAX_KEYS];
+} ArrowSortState;
+
+/*
+ * Get the index the relation is clustered on, if any.
+ */
+Oid ArrowClusterIndex(Relation relation) {
+  List* indexes = RelationGetIndexList(relation);
+  Oid indexOid = InvalidOid;
+  ListCell* lc;
+
+  foreach (lc, indexes) {
+    if (get_index_isclustered(lfirst_oid(lc))) {
+      indexOid = lfirst_oid(lc);
+      break;
+    }
+  }
+  list_free(indexes);
+  return indexOid;
+}
+
+/*
+ * Build a sort key from the key columns of a btree index.
+ *
+ * The sort key uses the same ordering as the index, including the
+ * direction and placement of nulls of each column.
+ */
+void ArrowSortKeyInit(Relation index, ArrowSortKey* key) {
+  memset(key, 0, sizeof(*key));
+  key->nkeys = IndexRelationGetNumberOfKeyAttributes(index);
+
+  for (int k = 0; k < key->nkeys; ++k) {
+    SortSupport ssup = &key->ssup[k];
+    const int16 option = index->rd_indoption[k];
+
+    key->attnums[k] = index->rd_index->indkey.values[k];
+    if (key->attnums[k] == 0)
+      ereport(ERROR,
+              (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+               errmsg("cannot sort arrow table on expression index \"%s\"",
+                      RelationGetRelationName(index))));
+
+    ssup->ssup_cxt = CurrentMemoryContext;
+    ssup->ssup_collation = index->rd_indcollation[k];
+    ssup->ssup_nulls_first = (option & INDOPTION_NULLS_FIRST) != 0;
+    ssup->ssup_attno = k + 1;
+    PrepareSortSupportFromIndexRel(index,
+                                   (option & INDOPTION_DESC)
+                                       ? BTGreaterStrategyNumber
+                                       : BTLessStrategyNumber,
+                                   ssup);
+  }
+}
+
+static int ArrowSortCompare(const void* a, const void* b, void* arg) {
+  ArrowSortState* state = (ArrowSortState*)arg;
+  const int64 i = *(const int64*)a;
+  const int64 j = *(const int64*)b;
+
+  for (int k = 0; k < state->key->nkeys; ++k) {
+    const int cmp = ApplySortComparator(
+        state->values[k][i], state->isnull[k][i], state->values[k][j],
+        state->isnull[k][j], &state->key->ssup[k]);
+    if (cmp != 0)
+      return cmp;
+  }
+
+  /* Rows with equal keys keep their order */
+  return (i > j) - (i < j);
+}
+
+/*
+ * Sort rows of a relation on a sort key.
+ *
+ * Only the key columns are read. Returns the permutation that puts
+ * the rows in order, as positions in `rows`, so that the caller can
+ * copy any number of columns in that order.
+ */
+int64* ArrowSortRows(Relation relation, ArrowSortKey* key, const int64* rows,
+                     int64 nrows) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  const Size count = Max(nrows, 1);
+  int64* order = MemoryContextAllocHuge(CurrentMemoryContext,
+                                        count * sizeof(int64));
+  ArrowSortState state;
+
+  DEBUG_ENTER("relation: %s, nrows: %ld", RelationGetRelationName(relation),
+              nrows);
+
+  /* The key columns are read directly */
+  ArrowDeltaMerge(relation);
+
+  state.key = key;
+  for (int k = 0; k < key->nkeys; ++k) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, key->attnums[k] - 1);
+    ArrowArray* column = ArrowArrayGet(relnumber, attr, O_RDWR);
+
+    state.values[k] =
+        MemoryContextAllocHuge(CurrentMemoryContext, count * sizeof(Datum));
+    state.isnull[k] =
+        MemoryContextAllocHuge(CurrentMemoryContext, count * sizeof(bool));
+    for (int64 i = 0; i < nrows; ++i) {
+      NullableDatum datum = ArrowArrayGetDatum(column, attr, rows[i]);
+      state.values[k][i] = datum.value;
+      state.isnull[k][i] = datum.isnull;
+    }
+  }
+
+  for (int64 i = 0; i < nrows; ++i)
+    order[i] = i;
+  qsort_arg(order, nrows, sizeof(int64), ArrowSortCompare, &state);
+
+  for (int k = 0; k < key->nkeys; ++k) {
+    pfree(state.values[k]);
+    pfree(state.isnull[k]);
+  }
+
+  DEBUG_LEAVE("");
+  return order;
+}
+
+/*
+ * Read the sort info of a relation.
+ *
+ * Returns false if the relation has never been sorted.
+ */
+bool ArrowSortInfoGet(RelFileNumber relnumber, ArrowSortInfo* info) {
+  ArrowSegmentKey key;
+
+  memset(&key, 0, sizeof(key));
+  key.bk_dbid = MyDatabaseId;
+  key.bk_relnumber = relnumber;
+  key.bk_attno = ARROW_SORT_INFO_ATTNO;
+
+  return ArrowSegmentReadFirst(&key, info, sizeof(*info));
+}
+
+/*
+ * Write the sort info of a relation.
+ *
+ * The caller has to hold an exclusive lock on the relation, since
+ * readers do not lock the segment.
+ */
+void ArrowSortInfoSet(RelFileNumber relnumber, Oid indexrelid, int64 nrows) {
+  ArrowArray* array = ArrowArrayOpen(relnumber, ARROW_SORT_INFO_ATTNO,
+                                     sizeof(ArrowSortInfo), O_RDWR | O_CREAT);
+  ArrowSortInfo* info;
+
+  ArrowArrayReset(array);
+  ArrowArrayReserve(array, 1);
+  info = (ArrowSortInfo*)ArrowArrayChunkData(array, 0);
+  info->indexrelid = indexrelid;
+  info->nrows = nrows;
+  ArrowArrayExtend(array, 1);
+}
+
+/*
+ * Copy rows of a relation from one storage to another.
+ *
+ * Row `j` of the target is row `rows[order[j]]` of the source, or
+ * `rows[j]` if no order is given. The rows are appended to the
+ * columns of the target, which is expected to be new storage of the
+ * relation. Dropped columns are filled with nulls.
+ */
+void ArrowCopyRows(Relation relation, RelFileNumber oldnumber,
+                   RelFileNumber newnumber, const int64* rows,
+                   const int64* order, int64 nrows) {
+  TupleDesc tupdesc = RelationGetDescr(relation);
+
+  /* Copy one column at a time, so that only one source and one target
+   * segment are touched at any time. */
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    ArrowArray* source = ArrowArrayGet(oldnumber, attr, O_RDWR);
+    ArrowArray* target = ArrowArrayGet(newnumber, attr, O_RDWR);
+
+    CHECK_FOR_INTERRUPTS();
+
+    ArrowArrayReserve(target, nrows);
+    for (int64 j = 0; j < nrows; ++j) {
+      NullableDatum datum;
+
+      if (attr->attisdropped) {
+        ArrowArrayAppendNull(target);
+        continue;
+      }
+
+      datum = ArrowArrayGetDatum(source, attr, rows[order ? order[j] : j]);
+      if (datum.isnull)
+        ArrowArrayAppendNull(target);
+      else
+        ArrowArrayAppendDatum(target, attr, datum.value);
+    }
+  }
+}
+
+/*
+ * Rewrite the rows of a relation into new storage.
+ *
+ * This is used for CLUSTER and VACUUM FULL. Rows inserted by aborted
+ * transactions and rows deleted by transactions that committed before
+ * `oldestXmin` are not copied. Rows deleted by other transactions can
+ * still be seen by some snapshots, so they are copied together with
+ * their deletes, and counted in `tups_recently_dead` if the delete
+ * committed.
+ *
+ * If an index is given, or the relation is clustered on an index, the
+ * rows are written in the order of the index. Rows keep their
+ * inserting transaction unless it is older than `oldestXmin`, in
+ * which case they are frozen. Returns the number of rows copied.
+ */
+int64 ArrowClusterRelation(Relation OldTable, Relation NewTable,
+                           Relation OldIndex, TransactionId oldestXmin,
+                           double* tups_vacuumed,
+                           double* tups_recently_dead) {
+  const RelFileNumber oldnumber = OldTable->rd_locator.relNumber;
+  const RelFileNumber newnumber = NewTable->rd_locator.relNumber;
+  ArrowArray* runs = ArrowVisibilityGet(oldnumber, O_RDWR);
+  ArrowArray* newruns = ArrowVisibilityGet(newnumber, O_RDWR);
+  const Size count = Max(ArrowVisibilityRows(runs), 1);
+  int64* rows = MemoryContextAllocHuge(CurrentMemoryContext,
+                                       count * sizeof(int64));
+  TransactionId* xmins = MemoryContextAllocHuge(
+      CurrentMemoryContext, count * sizeof(TransactionId));
+  TransactionId* xmaxs = MemoryContextAllocHuge(
+      CurrentMemoryContext, count * sizeof(TransactionId));
+  CommandId* cmaxs = MemoryContextAllocHuge(CurrentMemoryContext,
+                                            count * sizeof(CommandId));
+  Relation index = OldIndex;
+  int64* order = NULL;
+  int64 nrows = 0;
+  ArrowDeletes deletes;
+  ArrowDeletes newdeletes;
+
+  DEBUG_ENTER("relation: %s", RelationGetRelationName(OldTable));
+
+  ArrowDeltaMerge(OldTable);
+  ArrowDeletesGet(oldnumber, O_RDWR, &deletes);
+
+  /* Collect the rows to keep. Runs are checked with SnapshotSelf,
+   * which sees everything that is committed. A delete that does not
+   * precede `oldestXmin` has either committed recently or is still in
+   * progress, which can only be our own transaction. */
+  for (int64 i = 0; i < runs->length; ++i) {
+    ArrowInsertRun* run = ArrowVisibilityRun(runs, i);
+    TransactionId xmin = run->xmin;
+    TransactionId chunkxmax[ARROW_CHUNK_ROWS];
+    CommandId chunkcmax[ARROW_CHUNK_ROWS];
+    int64 chunk = -1;
+    bool deleted = false;
+
+    if (!ArrowRunSatisfiesSnapshot(run, SnapshotSelf)) {
+      *tups_vacuumed += run->count;
+      continue;
+    }
+
+    if ((run->flags & ARROW_RUN_FROZEN) ||
+        TransactionIdPrecedes(xmin, oldestXmin))
+      xmin = FrozenTransactionId;
+
+    for (int64 row = run->first; row < run->first + run->count; ++row) {
+      const int64 bit = row % ARROW_CHUNK_ROWS;
+      TransactionId xmax = InvalidTransactionId;
+
+      if (row / ARROW_CHUNK_ROWS != chunk) {
+        chunk = row / ARROW_CHUNK_ROWS;
+        deleted = ArrowDeletesXmax(&deletes, chunk, chunkxmax, chunkcmax);
+      }
+
+      if (deleted)
+        xmax = chunkxmax[bit];
+
+      if (TransactionIdIsValid(xmax)) {
+        if (TransactionIdPrecedes(xmax, oldestXmin)) {
+          *tups_vacuumed += 1;
+          continue;
+        }
+        if (!TransactionIdIsCurrentTransactionId(xmax))
+          *tups_recently_dead += 1;
+      }
+
+      rows[nrows] = row;
+      xmins[nrows] = xmin;
+      xmaxs[nrows] = xmax;
+      cmaxs[nrows] = deleted ? chunkcmax[bit] : InvalidCommandId;
+      ++nrows;
+    }
+  }
+
+  if (index == NULL) {
+    const Oid indexOid = ArrowClusterIndex(OldTable);
+    if (OidIsValid(indexOid))
+      index = index_open(indexOid, AccessShareLock);
+  }
+
+  if (index != NULL) {
+    ArrowSortKey key;
+    ArrowSortKeyInit(index, &key);
+    order = ArrowSortRows(OldTable, &key, rows, nrows);
+  }
+
+  ArrowCopyRows(OldTable, oldnumber, newnumber, rows, order, nrows);
+
+  /* Consecutive rows with the same inserting transaction end up in the
+   * same run, so all frozen rows form a single run. */
+  for (int64 j = 0; j < nrows; ++j) {
+    ArrowArrayReserve(newruns, 1);
+    ArrowVisibilityAppend(newruns, j, 1, xmins[order ? order[j] : j],
+                          FirstCommandId);
+  }
+  ArrowVisibilityExtendFork(NewTable, 0, nrows);
+
+  ArrowDeletesGet(newnumber, O_RDWR, &newdeletes);
+  for (int64 j = 0; j < nrows; ++j) {
+    const int64 k = order ? order[j] : j;
+    if (TransactionIdIsValid(xmaxs[k]))
+      ArrowDeletesAdd(&newdeletes, j, xmaxs[k], cmaxs[k]);
+  }
+
+  if (index != NULL) {
+    ArrowSortInfoSet(newnumber, RelationGetRelid(index), nrows);
+    if (index != OldIndex)
+      index_close(index, AccessShareLock);
+    pfree(order);
+  }
+
+  pfree(rows);
+  pfree(xmins);
+  pfree(xmaxs);
+  pfree(cmaxs);
+
+  DEBUG_LEAVE("nrows: %ld", nrows);
+  return nrows;
+}
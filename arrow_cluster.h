@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Clustering of arrow tables.
+ *
+ * The sort key of an arrow table is declared by marking a btree index
+ * as the clustered index, using ALTER TABLE ... CLUSTER ON. CLUSTER
+ * and VACUUM FULL then rewrite the rows in the order of that index:
+ * the key columns are read into arrays, a permutation of the rows is
+ * sorted on them, and each column is copied in permutation order.
+ *
+ * The sort info segment records the index used and how many rows,
+ * counting from the start of the relation, are in that order. Rows
+ * appended later are not, so the relation is only known to be sorted
+ * until the next insert.
+ */
+
+#ifndef ARROW_CLUSTER_H_
+#define ARROW_CLUSTER_H_
+
+#include <postgres.h>
+
+#include <utils/rel.h>
+#include <utils/sortsupport.h>
+
+/**
+ * Attribute number used for the sort info segment.
+ */
+#define ARROW_SORT_INFO_ATTNO -5
+
+/**
+ * Sort order of the rows of a relation.
+ */
+typedef struct ArrowSortInfo {
+  Oid indexrelid; /* Index giving the sort order */
+  int64 nrows;    /* Number of rows in sort order */
+} ArrowSortInfo;
+
+/**
+ * Sort key built from the key columns of an index.
+ */
+typedef struct ArrowSortKey {
+  int nkeys;
+  AttrNumber attnums[INDEX_MAX_KEYS];
+  SortSupportData ssup[INDEX_MAX_KEYS];
+} ArrowSortKey;
+
+Oid ArrowClusterIndex(Relation relation);
+void ArrowSortKeyInit(Relation index, ArrowSortKey* key);
+int64* ArrowSortRows(Relation relation, ArrowSortKey* key, const int64* rows,
+                     int64 nrows);
+bool ArrowSortInfoGet(RelFileNumber relnumber, ArrowSortInfo* info);
+void ArrowSortInfoSet(RelFileNumber relnumber, Oid indexrelid, int64 nrows);
+void ArrowCopyRows(Relation relation, RelFileNumber oldnumber,
+                   RelFileNumber newnumber, const int64* rows,
+                   const int64* order, int64 nrows);
+int64 ArrowClusterRelation(Relation OldTable, Relation NewTable,
+                           Relation OldIndex, TransactionId oldestXmin,
+                           double* tups_vacuumed,
+                           double* tups_recently_dead);
+
+#endif /* ARROW_CLUSTER_H_ */
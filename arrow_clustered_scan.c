@@ -0,0 +1,315 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_clustered_scan.h"
+
+#include <postgres.h>
+
+#include <access/genam.h>
+#include <access/tableam.h>
+#include <catalog/pg_class.h>
+#include <commands/explain.h>
+#include <executor/executor.h>
+#include <nodes/extensible.h>
+#include <optimizer/cost.h>
+#include <optimizer/pathnode.h>
+#include <optimizer/paths.h>
+#include <optimizer/restrictinfo.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+
+#include <fcntl.h>
+
+#include "arrow_cluster.h"
+#include "arrow_scan.h"
+#include "arrow_tts.h"
+#include "arrow_visibility.h"
+#include "debug.h"
+
+/**
+ * State of a clustered scan.
+ *
+ * If the rows are still in order when the scan starts, the table scan
+ * is used as is. Otherwise the visible rows are collected and sorted
+ * when the scan starts and returned from `rows`.
+ */
+typedef struct ArrowClusteredScanState {
+  CustomScanState css;
+  Oid indexrelid;     /* Index giving the sort order */
+  TableScanDesc scan; /* Scan of the relation, once started */
+  int64* rows;        /* Rows in sort order, if they had to be sorted */
+  int64 nrows;        /* Number of rows in `rows` */
+  int64 next;         /* Next row in `rows` to return */
+} ArrowClusteredScanState;
+
+static set_rel_pathlist_hook_type prev_set_rel_pathlist_hook = NULL;
+
+static Plan* ArrowClusteredScanPlan(PlannerInfo* root, RelOptInfo* rel,
+                                    CustomPath* best_path, List* tlist,
+                                    List* clauses, List* custom_plans);
+static Node* ArrowClusteredScanCreateState(CustomScan* cscan);
+static void ArrowClusteredScanBegin(CustomScanState* node, EState* estate,
+                                    int eflags);
+static TupleTableSlot* ArrowClusteredScanExec(CustomScanState* node);
+static void ArrowClusteredScanEnd(CustomScanState* node);
+static void ArrowClusteredScanRescan(CustomScanState* node);
+static void ArrowClusteredScanExplain(CustomScanState* node, List* ancestors,
+                                      ExplainState* es);
+
+static const CustomPathMethods ArrowClusteredScanPathMethods = {
+    .CustomName = "ArrowClusteredScan",
+    .PlanCustomPath = ArrowClusteredScanPlan,
+};
+
+static const CustomScanMethods ArrowClusteredScanPlanMethods = {
+    .CustomName = "ArrowClusteredScan",
+    .CreateCustomScanState = ArrowClusteredScanCreateState,
+};
+
+static const CustomExecMethods ArrowClusteredScanExecMethods = {
+    .CustomName = "ArrowClusteredScan",
+    .BeginCustomScan = ArrowClusteredScanBegin,
+    .ExecCustomScan = ArrowClusteredScanExec,
+    .EndCustomScan = ArrowClusteredScanEnd,
+    .ReScanCustomScan = ArrowClusteredScanRescan,
+    .ExplainCustomScan = ArrowClusteredScanExplain,
+};
+
+/*
+ * Create a clustered scan path for a relation.
+ *
+ * The scan reads the same rows as a sequential scan, so it has the
+ * same cost.
+ */
+static Path* ArrowClusteredScanPath(PlannerInfo* root, RelOptInfo* rel,
+                                    IndexOptInfo* index, List* pathkeys) {
+  CustomPath* cpath = makeNode(CustomPath);
+
+  cpath->path.pathtype = T_CustomScan;
+  cpath->path.parent = rel;
+  cpath->path.pathtarget = rel->reltarget;
+  cpath->path.pathkeys = pathkeys;
+  cpath->custom_private = list_make1_oid(index->indexoid);
+  cpath->methods = &ArrowClusteredScanPathMethods;
+  cost_seqscan(&cpath->path, root, rel, NULL);
+
+  return &cpath->path;
+}
+
+/*
+ * Add clustered scan paths for arrow tables that are sorted.
+ *
+ * The path is only added if all rows are in the order of an index
+ * that the planner knows about and that order is useful for the
+ * query.
+ */
+static void ArrowClusteredScanPaths(PlannerInfo* root, RelOptInfo* rel,
+                                    Index rti, RangeTblEntry* rte) {
+  Relation relation;
+  ArrowSortInfo info;
+
+  if (prev_set_rel_pathlist_hook)
+    prev_set_rel_pathlist_hook(root, rel, rti, rte);
+
+  if (rel->reloptkind != RELOPT_BASEREL || rte->rtekind != RTE_RELATION ||
+      rte->relkind != RELKIND_RELATION || rte->inh ||
+      rte->tablesample != NULL || !bms_is_empty(rel->lateral_relids))
+    return;
+
+  relation = table_open(rte->relid, NoLock);
+  if (table_slot_callbacks(relation) == &TTSOpsArrowTuple &&
+      ArrowSortInfoGet(relation->rd_locator.relNumber, &info)) {
+    ArrowArray* runs =
+        ArrowVisibilityGet(relation->rd_locator.relNumber, O_RDWR);
+    ListCell* lc;
+
+    foreach (lc, rel->indexlist) {
+      IndexOptInfo* index = (IndexOptInfo*)lfirst(lc);
+      List* pathkeys;
+
+      if (index->indexoid != info.indexrelid ||
+          info.nrows < ArrowVisibilityRows(runs))
+        continue;
+
+      pathkeys = truncate_useless_pathkeys(
+          root, rel, build_index_pathkeys(root, index, ForwardScanDirection));
+      if (pathkeys != NIL)
+        add_path(rel, ArrowClusteredScanPath(root, rel, index, pathkeys));
+    }
+  }
+  table_close(relation, NoLock);
+}
+
+static Plan* ArrowClusteredScanPlan(PlannerInfo* root, RelOptInfo* rel,
+                                    CustomPath* best_path, List* tlist,
+                                    List* clauses, List* custom_plans) {
+  CustomScan* cscan = makeNode(CustomScan);
+
+  cscan->scan.plan.targetlist = tlist;
+  cscan->scan.plan.qual = extract_actual_clauses(clauses, false);
+  cscan->scan.scanrelid = rel->relid;
+  cscan->flags = best_path->flags;
+  cscan->custom_private = best_path->custom_private;
+  cscan->methods = &ArrowClusteredScanPlanMethods;
+
+  return &cscan->scan.plan;
+}
+
+static Node* ArrowClusteredScanCreateState(CustomScan* cscan) {
+  ArrowClusteredScanState* state = palloc0(sizeof(ArrowClusteredScanState));
+
+  NodeSetTag(state, T_CustomScanState);
+  state->css.methods = &ArrowClusteredScanExecMethods;
+  /* Rows are stored into the scan slot by the table scan and by
+   * ExecStoreArrowRow(), so it has to be an arrow slot. */
+  state->css.slotOps = &TTSOpsArrowTuple;
+  state->indexrelid = linitial_oid(cscan->custom_private);
+
+  return (Node*)state;
+}
+
+static void ArrowClusteredScanBegin(CustomScanState* node, EState* estate,
+                                    int eflags) {
+  /* The scan is started on the first call */
+}
+
+/*
+ * Start the scan.
+ *
+ * If rows were appended after the relation was sorted, the visible
+ * rows are collected and sorted here, since the plan relies on the
+ * order.
+ */
+static void ArrowClusteredScanStart(ArrowClusteredScanState* state) {
+  ScanState* ss = &state->css.ss;
+  Relation relation = ss->ss_currentRelation;
+  TupleTableSlot* slot = ss->ss_ScanTupleSlot;
+  MemoryContext oldcxt = MemoryContextSwitchTo(ss->ps.state->es_query_cxt);
+  ArrowScanDesc* scan;
+  ArrowSortInfo info;
+  ArrowSortKey key;
+  Relation index;
+  int64* rows;
+  int64* order;
+  int64 size = 1024;
+
+  state->scan =
+      table_beginscan(relation, ss->ps.state->es_snapshot, 0, NULL);
+  scan = (ArrowScanDesc*)state->scan;
+  if (ArrowSortInfoGet(relation->rd_locator.relNumber, &info) &&
+      info.indexrelid == state->indexrelid && info.nrows >= scan->nrows) {
+    MemoryContextSwitchTo(oldcxt);
+    return;
+  }
+
+  DEBUG_LOG("sorting %s", RelationGetRelationName(relation));
+
+  rows = palloc(size * sizeof(int64));
+  state->nrows = 0;
+  while (table_scan_getnextslot(state->scan, ForwardScanDirection, slot)) {
+    if (state->nrows == size) {
+      size *= 2;
+      rows = repalloc_huge(rows, size * sizeof(int64));
+    }
+    rows[state->nrows++] = ArrowItemPointerGetRow(&slot->tts_tid);
+  }
+
+  index = index_open(state->indexrelid, AccessShareLock);
+  ArrowSortKeyInit(index, &key);
+  order = ArrowSortRows(relation, &key, rows, state->nrows);
+  index_close(index, AccessShareLock);
+
+  state->rows = MemoryContextAllocHuge(CurrentMemoryContext,
+                                       Max(state->nrows, 1) * sizeof(int64));
+  for (int64 i = 0; i < state->nrows; ++i)
+    state->rows[i] = rows[order[i]];
+  state->next = 0;
+
+  pfree(order);
+  pfree(rows);
+  MemoryContextSwitchTo(oldcxt);
+}
+
+static TupleTableSlot* ArrowClusteredScanNext(ScanState* ss) {
+  ArrowClusteredScanState* state = (ArrowClusteredScanState*)ss;
+  Relation relation = ss->ss_currentRelation;
+  TupleTableSlot* slot = ss->ss_ScanTupleSlot;
+
+  if (state->scan == NULL)
+    ArrowClusteredScanStart(state);
+
+  if (state->rows == NULL) {
+    if (table_scan_getnextslot(state->scan, ForwardScanDirection, slot))
+      return slot;
+    return NULL;
+  }
+
+  if (state->next >= state->nrows)
+    return ExecClearTuple(slot);
+
+  ExecStoreArrowRow(slot, relation->rd_locator.relNumber,
+                    state->rows[state->next++]);
+  slot->tts_tableOid = RelationGetRelid(relation);
+  return slot;
+}
+
+static bool ArrowClusteredScanRecheck(ScanState* ss, TupleTableSlot* slot) {
+  return true;
+}
+
+static TupleTableSlot* ArrowClusteredScanExec(CustomScanState* node) {
+  return ExecScan(&node->ss, ArrowClusteredScanNext,
+                  ArrowClusteredScanRecheck);
+}
+
+static void ArrowClusteredScanReset(ArrowClusteredScanState* state) {
+  if (state->scan != NULL)
+    table_endscan(state->scan);
+  if (state->rows != NULL)
+    pfree(state->rows);
+  state->scan = NULL;
+  state->rows = NULL;
+  state->nrows = 0;
+  state->next = 0;
+}
+
+static void ArrowClusteredScanEnd(CustomScanState* node) {
+  ArrowClusteredScanReset((ArrowClusteredScanState*)node);
+}
+
+static void ArrowClusteredScanRescan(CustomScanState* node) {
+  ArrowClusteredScanReset((ArrowClusteredScanState*)node);
+  ExecScanReScan(&node->ss);
+}
+
+static void ArrowClusteredScanExplain(CustomScanState* node, List* ancestors,
+                                      ExplainState* es) {
+  ArrowClusteredScanState* state = (ArrowClusteredScanState*)node;
+  ExplainPropertyText("Clustered On", get_rel_name(state->indexrelid), es);
+}
+
+/*
+ * Install the planner hook and register the scan methods, so that
+ * plans with clustered scans can be copied and sent to workers.
+ */
+void ArrowClusteredScanInit(void) {
+  RegisterCustomScanMethods(&ArrowClusteredScanPlanMethods);
+  prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+  set_rel_pathlist_hook = ArrowClusteredScanPaths;
+}
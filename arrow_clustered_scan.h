@@ -0,0 +1,38 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Ordered scans of clustered arrow tables.
+ *
+ * A sequential scan of an arrow table returns the rows in the order
+ * they are stored, so right after CLUSTER or VACUUM FULL the rows
+ * come out in the order of the clustered index. For such tables we
+ * add a custom scan path with the pathkeys of the index, which lets
+ * the planner skip sorts and use merge joins directly.
+ *
+ * Rows can be appended between planning and execution, so the scan
+ * checks the sort info when it starts and sorts the rows itself if
+ * they are no longer in order.
+ */
+
+#ifndef ARROW_CLUSTERED_SCAN_H_
+#define ARROW_CLUSTERED_SCAN_H_
+
+void ArrowClusteredScanInit(void);
+
+#endif /* ARROW_CLUSTERED_SCAN_H_ */
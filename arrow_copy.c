@@ -0,0 +1,1285 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_copy.h"
+
+#include <postgres.h>
+
+#include <access/parallel.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/xact.h>
+#include <catalog/objectaddress.h>
+#include <catalog/pg_authid.h>
+#include <catalog/pg_type.h>
+#include <commands/copy.h>
+#include <common/int.h>
+#include <datatype/timestamp.h>
+#include <executor/executor.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <nodes/makefuncs.h>
+#include <pgstat.h>
+#include <storage/fd.h>
+#include <storage/lmgr.h>
+#include <storage/proc.h>
+#include <storage/shm_mq.h>
+#include <tcop/utility.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/rls.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_delta.h"
+#include "arrow_probes.h"
+#include "arrow_tts.h"
+#include "arrow_visibility.h"
+#include "debug.h"
+
+PG_FUNCTION_INFO_V1(arrow_copy_from);
+
+/*
+ * Maximum number of rows in a batch.
+ */
+#define ARROW_COPY_BATCH_ROWS (16 * ARROW_CHUNK_ROWS)
+
+/*
+ * Batches are sent before the values parsed for them take more memory
+ * than this, even if they have fewer rows.
+ */
+#define ARROW_COPY_BATCH_BYTES (64 * 1024 * 1024)
+
+/*
+ * Size of the queue between the worker and the loading backend.
+ */
+#define ARROW_COPY_QUEUE_SIZE (16 * 1024 * 1024)
+
+#define ARROW_COPY_KEY_SHARED UINT64CONST(0xA770C0B100000001)
+#define ARROW_COPY_KEY_QUEUE UINT64CONST(0xA770C0B100000002)
+
+/*
+ * Tags of the Type and MessageHeader unions and units of the types in
+ * the Arrow schema.
+ */
+#define ARROW_IPC_TYPE_INT 2
+#define ARROW_IPC_TYPE_FLOATING_POINT 3
+#define ARROW_IPC_TYPE_BOOL 6
+#define ARROW_IPC_TYPE_DATE 8
+#define ARROW_IPC_TYPE_TIME 9
+#define ARROW_IPC_TYPE_TIMESTAMP 10
+#define ARROW_IPC_TYPE_FIXED_SIZE_BINARY 15
+
+#define ARROW_IPC_HEADER_SCHEMA 1
+#define ARROW_IPC_HEADER_DICTIONARY_BATCH 2
+#define ARROW_IPC_HEADER_RECORD_BATCH 3
+
+#define ARROW_IPC_PRECISION_SINGLE 1
+#define ARROW_IPC_PRECISION_DOUBLE 2
+#define ARROW_IPC_DATE_DAY 0
+#define ARROW_IPC_DATE_MILLISECOND 1
+#define ARROW_IPC_TIME_MILLISECOND 1
+#define ARROW_IPC_TIME_MICROSECOND 2
+
+#define ARROW_IPC_MAGIC "ARROW1"
+
+/**
+ * Arguments of the worker, in the dynamic shared memory segment.
+ */
+typedef struct ArrowCopyShared {
+  Oid relid;                             /* Table to load into */
+  char format[NAMEDATALEN];              /* Format of the file */
+  char filename[FLEXIBLE_ARRAY_MEMBER];  /* File to load */
+} ArrowCopyShared;
+
+/**
+ * Column-major batch of rows.
+ *
+ * Dropped columns are null in all rows.
+ */
+typedef struct ArrowCopyBatch {
+  int nrows;      /* Number of rows in the batch */
+  Datum** values; /* Values of each column, indexed by row */
+  bool** isnull;  /* Null flags of each column, indexed by row */
+} ArrowCopyBatch;
+
+typedef void (*ArrowCopyConsumer)(ArrowCopyBatch* batch, void* arg);
+
+/**
+ * State of the loading backend.
+ */
+typedef struct ArrowCopyState {
+  Relation relation;
+  TransactionId xmin;
+  CommandId cid;
+  ArrowArray** columns;         /* Columns of the relation */
+  ArrowCopyBatch* batch;        /* Batch to read received rows into */
+  int64 count;                  /* Number of rows loaded so far */
+  EState* estate;               /* Executor state for index inserts */
+  ResultRelInfo* resultRelInfo; /* Relation with its indexes opened */
+  TupleTableSlot* slot;         /* Slot for the rows inserted into indexes */
+} ArrowCopyState;
+
+/**
+ * State of the worker.
+ */
+typedef struct ArrowCopySender {
+  TupleDesc tupdesc;
+  shm_mq_handle* mqh;
+  StringInfoData buf; /* Batch being sent */
+} ArrowCopySender;
+
+/**
+ * Arrow IPC file being read.
+ */
+typedef struct ArrowIpcReader {
+  FILE* file;
+  const char* filename;
+  off_t limit; /* Position of the footer, or -1 for streams */
+} ArrowIpcReader;
+
+/**
+ * Flatbuffer holding the metadata of an Arrow IPC message.
+ */
+typedef struct ArrowIpcBuffer {
+  const char* data;
+  Size size;
+} ArrowIpcBuffer;
+
+/**
+ * Table in a flatbuffer.
+ */
+typedef struct ArrowIpcTable {
+  const ArrowIpcBuffer* buf;
+  Size pos;      /* Position of the table */
+  Size vtable;   /* Position of the vtable of the table */
+  uint16 vtsize; /* Size of the vtable */
+} ArrowIpcTable;
+
+/**
+ * Type of a field of an Arrow schema.
+ */
+typedef struct ArrowIpcField {
+  uint8 type;    /* Tag of the Type union */
+  int32 width;   /* Bits for Int and Time, bytes for FixedSizeBinary */
+  int16 unit;    /* Unit of times and dates, precision of floats */
+  bool issigned; /* Int is signed */
+} ArrowIpcField;
+
+static ArrowCopyBatch* ArrowCopyBatchCreate(TupleDesc tupdesc) {
+  ArrowCopyBatch* batch = palloc(sizeof(ArrowCopyBatch));
+
+  batch->nrows = 0;
+  batch->values = palloc(Max(tupdesc->natts, 1) * sizeof(Datum*));
+  batch->isnull = palloc(Max(tupdesc->natts, 1) * sizeof(bool*));
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    batch->values[i] = palloc(ARROW_COPY_BATCH_ROWS * sizeof(Datum));
+    batch->isnull[i] = palloc(ARROW_COPY_BATCH_ROWS * sizeof(bool));
+  }
+  return batch;
+}
+
+/*
+ * Insert index entries for rows that were appended.
+ *
+ * The rows are read back from the columns, the same way as the
+ * executor inserts the index entries after inserting a row, so unique
+ * and exclusion constraints are checked against concurrent inserts.
+ */
+static void ArrowCopyInsertIndexes(ArrowCopyState* state, int64 first,
+                                   int nrows) {
+  const RelFileNumber relnumber = state->relation->rd_locator.relNumber;
+
+  for (int n = 0; n < nrows; ++n) {
+    MemoryContext oldcontext;
+
+    ResetPerTupleExprContext(state->estate);
+    oldcontext = MemoryContextSwitchTo(GetPerTupleMemoryContext(state->estate));
+    ExecStoreArrowRow(state->slot, relnumber, first + n);
+    ExecInsertIndexTuples(state->resultRelInfo, state->slot, state->estate,
+                          false, false, NULL, NIL, false);
+    MemoryContextSwitchTo(oldcontext);
+  }
+}
+
+/*
+ * Append a batch of rows to the columns of the relation.
+ *
+ * This works like ExecInsertArrowSlots, except that the values are
+ * appended one column at a time and the rows never go to the delta
+ * store. Rows that are already in the delta store are merged first,
+ * so that the rows stay consecutive. Like there, the values are only
+ * written after releasing the lock, unless a column is nested. The
+ * index entries for the rows are inserted last.
+ */
+static void ArrowCopyAppend(ArrowCopyBatch* batch, void* arg) {
+  ArrowCopyState* state = (ArrowCopyState*)arg;
+  Relation relation = state->relation;
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  ArrowArray** columns = state->columns;
+  ArrowArray* runs;
+  int64 first = 0;
+  bool reserve = true;
+
+  if (batch->nrows == 0)
+    return;
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    if (!attr->attnotnull)
+      continue;
+    for (int n = 0; n < batch->nrows; ++n)
+      if (batch->isnull[i][n])
+        ereport(ERROR,
+                (errcode(ERRCODE_NOT_NULL_VIOLATION),
+                 errmsg("null value in column \"%s\" of relation \"%s\" "
+                        "violates not-null constraint",
+                        NameStr(attr->attname),
+                        RelationGetRelationName(relation))));
+  }
+
+  LockRelationForExtension(relation, ExclusiveLock);
+
+  runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  ArrowArrayReserve(runs, 1);
+
+  ArrowDeltaMergeLocked(relation);
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    columns[i] = ArrowArrayGet(relnumber, TupleDescAttr(tupdesc, i), O_RDWR);
+    first = Max(first, columns[i]->length);
+  }
+
+  /* Make room in all columns first so that failing to grow a segment
+   * does not leave the columns with different lengths. */
+  for (int i = 0; i < tupdesc->natts; ++i)
+    ArrowArrayReserve(columns[i], first - columns[i]->length + batch->nrows);
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    while (columns[i]->length < first)
+      ArrowArrayAppendNull(columns[i]);
+    if (ArrowLayoutIsNested(ArrowArrayLayout(columns[i])))
+      reserve = false;
+  }
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    const Datum* values = batch->values[i];
+    const bool* isnull = batch->isnull[i];
+
+    if (reserve) {
+      ArrowArrayExtend(columns[i], batch->nrows);
+      continue;
+    }
+
+    for (int n = 0; n < batch->nrows; ++n) {
+      if (isnull[n])
+        ArrowArrayAppendNull(columns[i]);
+      else
+        ArrowArrayAppendDatum(columns[i], attr, values[n]);
+    }
+  }
+
+  ArrowVisibilityAppend(runs, first, batch->nrows, state->xmin, state->cid);
+  ArrowVisibilityExtendFork(relation, first, batch->nrows);
+
+  UnlockRelationForExtension(relation, ExclusiveLock);
+
+  pg_atomic_fetch_add_u64(&ArrowArrayCounters(runs)->rows_inserted,
+                          batch->nrows);
+  pgstat_count_heap_insert(relation, batch->nrows);
+  TRACE_ARROW_INSERT_BATCH(relnumber, first, batch->nrows);
+
+  if (reserve) {
+    for (int i = 0; i < tupdesc->natts; ++i) {
+      const Datum* values = batch->values[i];
+      const bool* isnull = batch->isnull[i];
+
+      for (int n = 0; n < batch->nrows; ++n) {
+        if (isnull[n])
+          ArrowArraySetNull(columns[i], first + n);
+        else
+          ArrowArraySetDatum(columns[i], first + n, values[n]);
+      }
+    }
+  }
+
+  if (state->resultRelInfo->ri_NumIndices > 0)
+    ArrowCopyInsertIndexes(state, first, batch->nrows);
+
+  state->count += batch->nrows;
+}
+
+/*
+ * Parse a file in one of the formats of COPY and pass the rows to the
+ * consumer in batches.
+ */
+static void ArrowCopyParse(Relation relation, const char* filename,
+                           const char* format, ArrowCopyConsumer consumer,
+                           void* arg) {
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  MemoryContext batchcxt = AllocSetContextCreate(
+      CurrentMemoryContext, "arrow copy batch", ALLOCSET_DEFAULT_SIZES);
+  ArrowCopyBatch* batch = ArrowCopyBatchCreate(tupdesc);
+  Datum* values = palloc(Max(tupdesc->natts, 1) * sizeof(Datum));
+  bool* isnull = palloc(Max(tupdesc->natts, 1) * sizeof(bool));
+  EState* estate = CreateExecutorState();
+  List* options = list_make1(
+      makeDefElem("format", (Node*)makeString(pstrdup(format)), -1));
+  ErrorContextCallback errcallback;
+  CopyFromState cstate;
+  bool done = false;
+
+  cstate =
+      BeginCopyFrom(NULL, relation, NULL, filename, false, NULL, NIL, options);
+
+  errcallback.callback = CopyFromErrorCallback;
+  errcallback.arg = cstate;
+
+  while (!done) {
+    MemoryContext oldcontext = MemoryContextSwitchTo(batchcxt);
+
+    /* Errors while parsing report the line, but errors of the consumer
+     * are not about the line that was parsed last. */
+    errcallback.previous = error_context_stack;
+    error_context_stack = &errcallback;
+    done = !NextCopyFrom(cstate, GetPerTupleExprContext(estate), values,
+                         isnull);
+    error_context_stack = errcallback.previous;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    if (!done) {
+      for (int i = 0; i < tupdesc->natts; ++i) {
+        batch->values[i][batch->nrows] = values[i];
+        batch->isnull[i][batch->nrows] = isnull[i];
+      }
+      ++batch->nrows;
+    }
+
+    if (batch->nrows > 0 &&
+        (done || batch->nrows == ARROW_COPY_BATCH_ROWS ||
+         MemoryContextMemAllocated(batchcxt, false) >=
+             ARROW_COPY_BATCH_BYTES)) {
+      consumer(batch, arg);
+      batch->nrows = 0;
+      MemoryContextReset(batchcxt);
+    }
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  EndCopyFrom(cstate);
+  FreeExecutorState(estate);
+  MemoryContextDelete(batchcxt);
+}
+
+/*
+ * Pad a serialized batch to a maximally aligned length.
+ */
+static void ArrowCopyAlign(StringInfo buf) {
+  const int padding = MAXALIGN(buf->len) - buf->len;
+  enlargeStringInfo(buf, padding);
+  memset(buf->data + buf->len, 0, padding);
+  buf->len += padding;
+  buf->data[buf->len] = '\0';
+}
+
+/*
+ * Serialize a batch to send it to the loading backend.
+ *
+ * The number of rows is followed by the null flags and the values of
+ * each column that is not dropped. The values of a column start at a
+ * maximally aligned offset and only the values that are not null are
+ * stored. Fixed-length values are packed, while variable-length values
+ * each start at a maximally aligned offset, so that all values can be
+ * used where they are after receiving the batch.
+ */
+static void ArrowCopyBatchSerialize(TupleDesc tupdesc,
+                                    const ArrowCopyBatch* batch,
+                                    StringInfo buf) {
+  resetStringInfo(buf);
+  appendBinaryStringInfo(buf, (const char*)&batch->nrows,
+                         sizeof(batch->nrows));
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+    if (attr->attisdropped)
+      continue;
+
+    appendBinaryStringInfo(buf, (const char*)batch->isnull[i], batch->nrows);
+    ArrowCopyAlign(buf);
+
+    for (int n = 0; n < batch->nrows; ++n) {
+      const Datum value = batch->values[i][n];
+
+      if (batch->isnull[i][n])
+        continue;
+
+      if (attr->attlen == -1) {
+        struct varlena* varlena = PG_DETOAST_DATUM(value);
+        ArrowCopyAlign(buf);
+        appendBinaryStringInfo(buf, (const char*)varlena, VARSIZE(varlena));
+      } else if (attr->attbyval) {
+        enlargeStringInfo(buf, attr->attlen);
+        store_att_byval(buf->data + buf->len, value, attr->attlen);
+        buf->len += attr->attlen;
+        buf->data[buf->len] = '\0';
+      } else {
+        appendBinaryStringInfo(buf, DatumGetPointer(value), attr->attlen);
+      }
+    }
+    ArrowCopyAlign(buf);
+  }
+}
+
+/*
+ * Read a batch serialized by ArrowCopyBatchSerialize.
+ *
+ * Values of pass-by-reference types point into the serialized batch.
+ */
+static void ArrowCopyBatchDeserialize(TupleDesc tupdesc, const char* data,
+                                      Size nbytes, ArrowCopyBatch* batch) {
+  const char* ptr = data;
+
+  memcpy(&batch->nrows, ptr, sizeof(batch->nrows));
+  ptr += sizeof(batch->nrows);
+  Assert(batch->nrows <= ARROW_COPY_BATCH_ROWS);
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    Datum* values = batch->values[i];
+    bool* isnull = batch->isnull[i];
+
+    if (attr->attisdropped) {
+      memset(isnull, true, batch->nrows);
+      continue;
+    }
+
+    memcpy(isnull, ptr, batch->nrows);
+    ptr = data + MAXALIGN(ptr - data + batch->nrows);
+
+    for (int n = 0; n < batch->nrows; ++n) {
+      if (isnull[n])
+        continue;
+
+      if (attr->attlen == -1) {
+        ptr = data + MAXALIGN(ptr - data);
+        values[n] = PointerGetDatum(ptr);
+        ptr += VARSIZE(ptr);
+      } else {
+        values[n] = fetch_att(ptr, attr->attbyval, attr->attlen);
+        ptr += attr->attlen;
+      }
+    }
+    ptr = data + MAXALIGN(ptr - data);
+  }
+
+  Assert((Size)(ptr - data) == nbytes);
+}
+
+static void ArrowCopySend(ArrowCopyBatch* batch, void* arg) {
+  ArrowCopySender* sender = (ArrowCopySender*)arg;
+
+  ArrowCopyBatchSerialize(sender->tupdesc, batch, &sender->buf);
+  if (shm_mq_send(sender->mqh, sender->buf.len, sender->buf.data, false,
+                  true) != SHM_MQ_SUCCESS)
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("could not send batch to the loading backend")));
+}
+
+/*
+ * Entry point of the worker parsing a file.
+ */
+void ArrowCopyWorkerMain(dsm_segment* seg, shm_toc* toc) {
+  ArrowCopyShared* shared = shm_toc_lookup(toc, ARROW_COPY_KEY_SHARED, false);
+  shm_mq* mq = shm_toc_lookup(toc, ARROW_COPY_KEY_QUEUE, false);
+  ArrowCopySender sender;
+  Relation relation;
+
+  shm_mq_set_sender(mq, MyProc);
+  sender.mqh = shm_mq_attach(mq, seg, NULL);
+  initStringInfo(&sender.buf);
+
+  relation = table_open(shared->relid, AccessShareLock);
+  sender.tupdesc = RelationGetDescr(relation);
+
+  ArrowCopyParse(relation, shared->filename, shared->format, ArrowCopySend,
+                 &sender);
+
+  table_close(relation, AccessShareLock);
+  shm_mq_detach(sender.mqh);
+}
+
+/*
+ * Load a file in one of the formats of COPY.
+ *
+ * A parallel worker parses the file while this backend appends the
+ * batches it receives. The transaction id and command id are taken
+ * before entering parallel mode, since they cannot be assigned in
+ * parallel mode.
+ */
+static void ArrowCopyFromFile(ArrowCopyState* state, const char* filename,
+                              const char* format) {
+  Relation relation = state->relation;
+  const Size sharedsize =
+      add_size(offsetof(ArrowCopyShared, filename), strlen(filename) + 1);
+  ParallelContext* pcxt;
+  ArrowCopyShared* shared;
+  shm_mq_handle* mqh;
+  shm_mq* mq;
+
+  EnterParallelMode();
+
+  pcxt = CreateParallelContext("arrow", "ArrowCopyWorkerMain", 1);
+  shm_toc_estimate_chunk(&pcxt->estimator, sharedsize);
+  shm_toc_estimate_chunk(&pcxt->estimator, ARROW_COPY_QUEUE_SIZE);
+  shm_toc_estimate_keys(&pcxt->estimator, 2);
+  InitializeParallelDSM(pcxt);
+
+  shared = shm_toc_allocate(pcxt->toc, sharedsize);
+  shared->relid = RelationGetRelid(relation);
+  strlcpy(shared->format, format, sizeof(shared->format));
+  strcpy(shared->filename, filename);
+  shm_toc_insert(pcxt->toc, ARROW_COPY_KEY_SHARED, shared);
+
+  mq = shm_mq_create(shm_toc_allocate(pcxt->toc, ARROW_COPY_QUEUE_SIZE),
+                     ARROW_COPY_QUEUE_SIZE);
+  shm_toc_insert(pcxt->toc, ARROW_COPY_KEY_QUEUE, mq);
+  shm_mq_set_receiver(mq, MyProc);
+
+  LaunchParallelWorkers(pcxt);
+
+  /* Parse the file here if there are no workers available */
+  if (pcxt->nworkers_launched == 0) {
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+    ArrowCopyParse(relation, filename, format, ArrowCopyAppend, state);
+    return;
+  }
+
+  mqh = shm_mq_attach(mq, pcxt->seg, pcxt->worker[0].bgwhandle);
+
+  /* The queue is detached once the worker is done, or if it fails,
+   * after all batches it sent have been received. */
+  for (;;) {
+    Size nbytes;
+    void* data;
+
+    if (shm_mq_receive(mqh, &nbytes, &data, false) != SHM_MQ_SUCCESS)
+      break;
+
+    ArrowCopyBatchDeserialize(RelationGetDescr(relation), data, nbytes,
+                              state->batch);
+    ArrowCopyAppend(state->batch, state);
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  /* This reports the error if the worker failed */
+  WaitForParallelWorkersToFinish(pcxt);
+
+  shm_mq_detach(mqh);
+  DestroyParallelContext(pcxt);
+  ExitParallelMode();
+}
+
+static void ArrowIpcInvalid(void) pg_attribute_noreturn();
+
+static void ArrowIpcInvalid(void) {
+  ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+                  errmsg("invalid arrow file")));
+}
+
+/*
+ * Read from an Arrow IPC file.
+ *
+ * Returns false if the end of the file is reached before reading
+ * anything and `eofok` is set.
+ */
+static bool ArrowIpcRead(ArrowIpcReader* reader, void* data, Size len,
+                         bool eofok) {
+  const Size nread = fread(data, 1, len, reader->file);
+
+  if (nread == len)
+    return true;
+  if (ferror(reader->file))
+    ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not read file \"%s\": %m", reader->filename)));
+  if (nread == 0 && eofok)
+    return false;
+  ArrowIpcInvalid();
+}
+
+/*
+ * Check that a range is inside a flatbuffer and return a pointer to
+ * it.
+ */
+static const char* ArrowIpcAt(const ArrowIpcBuffer* buf, Size pos,
+                              Size len) {
+  if (pos > buf->size || len > buf->size - pos)
+    ArrowIpcInvalid();
+  return buf->data + pos;
+}
+
+static uint16 ArrowIpcUInt16(const ArrowIpcBuffer* buf, Size pos) {
+  uint16 value;
+  memcpy(&value, ArrowIpcAt(buf, pos, sizeof(value)), sizeof(value));
+  return value;
+}
+
+static uint32 ArrowIpcUInt32(const ArrowIpcBuffer* buf, Size pos) {
+  uint32 value;
+  memcpy(&value, ArrowIpcAt(buf, pos, sizeof(value)), sizeof(value));
+  return value;
+}
+
+static int64 ArrowIpcInt64(const ArrowIpcBuffer* buf, Size pos) {
+  int64 value;
+  memcpy(&value, ArrowIpcAt(buf, pos, sizeof(value)), sizeof(value));
+  return value;
+}
+
+static ArrowIpcTable ArrowIpcTableAt(const ArrowIpcBuffer* buf, Size pos) {
+  ArrowIpcTable table;
+  const int64 vtable = (int64)pos - (int32)ArrowIpcUInt32(buf, pos);
+
+  if (vtable < 0)
+    ArrowIpcInvalid();
+
+  table.buf = buf;
+  table.pos = pos;
+  table.vtable = vtable;
+  table.vtsize = ArrowIpcUInt16(buf, table.vtable);
+  if (table.vtsize < 4)
+    ArrowIpcInvalid();
+  ArrowIpcAt(buf, table.vtable, table.vtsize);
+  return table;
+}
+
+/*
+ * Get the position of a field of a table, or 0 if it is not present.
+ */
+static Size ArrowIpcFieldPos(const ArrowIpcTable* table, int field) {
+  const Size entry = 4 + 2 * field;
+  uint16 offset;
+
+  if (entry + 2 > table->vtsize)
+    return 0;
+  offset = ArrowIpcUInt16(table->buf, table->vtable + entry);
+  return offset == 0 ? 0 : table->pos + offset;
+}
+
+/*
+ * Get an integer or boolean field of a table.
+ */
+static int64 ArrowIpcGetInt(const ArrowIpcTable* table, int field, int size,
+                            int64 missing) {
+  const Size pos = ArrowIpcFieldPos(table, field);
+
+  if (pos == 0)
+    return missing;
+
+  switch (size) {
+    case 1:
+      return *(const uint8*)ArrowIpcAt(table->buf, pos, 1);
+    case 2:
+      return (int16)ArrowIpcUInt16(table->buf, pos);
+    case 4:
+      return (int32)ArrowIpcUInt32(table->buf, pos);
+    default:
+      return ArrowIpcInt64(table->buf, pos);
+  }
+}
+
+/*
+ * Get the target of a field holding an offset, or 0 if the field is
+ * not present.
+ */
+static Size ArrowIpcGetOffset(const ArrowIpcTable* table, int field) {
+  const Size pos = ArrowIpcFieldPos(table, field);
+
+  if (pos == 0)
+    return 0;
+  return pos + ArrowIpcUInt32(table->buf, pos);
+}
+
+static bool ArrowIpcGetTable(const ArrowIpcTable* table, int field,
+                             ArrowIpcTable* child) {
+  const Size pos = ArrowIpcGetOffset(table, field);
+
+  if (pos == 0)
+    return false;
+  *child = ArrowIpcTableAt(table->buf, pos);
+  return true;
+}
+
+/*
+ * Get a vector field of a table.
+ *
+ * Returns the position of the first element and sets `length` to the
+ * number of elements, which is zero if the field is not present.
+ */
+static Size ArrowIpcGetVector(const ArrowIpcTable* table, int field,
+                              Size elemsize, uint32* length) {
+  const Size pos = ArrowIpcGetOffset(table, field);
+
+  *length = 0;
+  if (pos == 0)
+    return 0;
+  *length = ArrowIpcUInt32(table->buf, pos);
+  ArrowIpcAt(table->buf, pos + 4, (Size)*length * elemsize);
+  return pos + 4;
+}
+
+/*
+ * Get the table that an element of a vector of tables points to.
+ */
+static ArrowIpcTable ArrowIpcGetElement(const ArrowIpcBuffer* buf,
+                                        Size vector, uint32 n) {
+  const Size pos = vector + 4 * (Size)n;
+  return ArrowIpcTableAt(buf, pos + ArrowIpcUInt32(buf, pos));
+}
+
+static void ArrowIpcReadField(const ArrowIpcTable* table,
+                              ArrowIpcField* field) {
+  ArrowIpcTable type;
+  uint32 nchildren;
+
+  memset(field, 0, sizeof(*field));
+  field->type = ArrowIpcGetInt(table, 2, 1, 0);
+
+  ArrowIpcGetVector(table, 5, 4, &nchildren);
+  if (ArrowIpcFieldPos(table, 4) != 0 || nchildren > 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("nested and dictionary-encoded arrow fields are not "
+                    "supported")));
+
+  if (!ArrowIpcGetTable(table, 3, &type))
+    return;
+
+  switch (field->type) {
+    case ARROW_IPC_TYPE_INT:
+      field->width = ArrowIpcGetInt(&type, 0, 4, 0);
+      field->issigned = ArrowIpcGetInt(&type, 1, 1, 0);
+      break;
+    case ARROW_IPC_TYPE_FLOATING_POINT:
+      field->unit = ArrowIpcGetInt(&type, 0, 2, 0);
+      break;
+    case ARROW_IPC_TYPE_DATE:
+      field->unit = ArrowIpcGetInt(&type, 0, 2, ARROW_IPC_DATE_MILLISECOND);
+      break;
+    case ARROW_IPC_TYPE_TIME:
+      field->unit = ArrowIpcGetInt(&type, 0, 2, ARROW_IPC_TIME_MILLISECOND);
+      field->width = ArrowIpcGetInt(&type, 1, 4, 32);
+      break;
+    case ARROW_IPC_TYPE_TIMESTAMP:
+      field->unit = ArrowIpcGetInt(&type, 0, 2, 0);
+      break;
+    case ARROW_IPC_TYPE_FIXED_SIZE_BINARY:
+      field->width = ArrowIpcGetInt(&type, 0, 4, 0);
+      break;
+  }
+}
+
+/*
+ * Check if a field holds values in the same representation as a
+ * column, so that they can be read from the record batches like they
+ * are read from the segments.
+ */
+static bool ArrowIpcFieldMatches(const ArrowIpcField* field,
+                                 const ArrowType* type) {
+  switch (type->layout) {
+    case ARROW_LAYOUT_BITMAP:
+      return field->type == ARROW_IPC_TYPE_BOOL;
+
+    case ARROW_LAYOUT_EPOCH:
+      if (type->attlen == sizeof(int32))
+        return field->type == ARROW_IPC_TYPE_DATE &&
+               field->unit == ARROW_IPC_DATE_DAY;
+      return field->type == ARROW_IPC_TYPE_TIMESTAMP &&
+             field->unit == ARROW_IPC_TIME_MICROSECOND;
+
+    case ARROW_LAYOUT_FIXED:
+      /* Fixed-size binary values are copied without any checks, so
+       * they are only accepted for types where any value is valid. */
+      if (field->type == ARROW_IPC_TYPE_FIXED_SIZE_BINARY)
+        return type->typid == UUIDOID && field->width == type->attlen;
+      switch (type->typid) {
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+          return field->type == ARROW_IPC_TYPE_INT && field->issigned &&
+                 field->width == type->attlen * 8;
+        case FLOAT4OID:
+          return field->type == ARROW_IPC_TYPE_FLOATING_POINT &&
+                 field->unit == ARROW_IPC_PRECISION_SINGLE;
+        case FLOAT8OID:
+          return field->type == ARROW_IPC_TYPE_FLOATING_POINT &&
+                 field->unit == ARROW_IPC_PRECISION_DOUBLE;
+        case TIMEOID:
+          return field->type == ARROW_IPC_TYPE_TIME &&
+                 field->unit == ARROW_IPC_TIME_MICROSECOND &&
+                 field->width == 64;
+        default:
+          return false;
+      }
+
+    case ARROW_LAYOUT_LIST:
+    case ARROW_LAYOUT_STRUCT:
+      break;
+  }
+  return false;
+}
+
+/*
+ * Check that the fields of a schema match the columns of the relation.
+ */
+static void ArrowIpcCheckSchema(Relation relation,
+                                const ArrowIpcTable* schema,
+                                const ArrowType* types) {
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  uint32 nfields;
+  const Size fields = ArrowIpcGetVector(schema, 1, 4, &nfields);
+  uint32 ncolumns = 0;
+  uint32 k = 0;
+
+  if (ArrowIpcGetInt(schema, 0, 2, 0) != 0)
+    ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                    errmsg("big-endian arrow files are not supported")));
+
+  for (int i = 0; i < tupdesc->natts; ++i)
+    if (!TupleDescAttr(tupdesc, i)->attisdropped)
+      ++ncolumns;
+
+  if (nfields != ncolumns)
+    ereport(ERROR,
+            (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+             errmsg("arrow file has %u fields, but relation \"%s\" has %u "
+                    "columns",
+                    nfields, RelationGetRelationName(relation), ncolumns)));
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    ArrowIpcTable table;
+    ArrowIpcField field;
+
+    if (attr->attisdropped)
+      continue;
+
+    table = ArrowIpcGetElement(schema->buf, fields, k++);
+    ArrowIpcReadField(&table, &field);
+    if (get_typtype(attr->atttypid) == TYPTYPE_DOMAIN ||
+        (attr->atttypmod >= 0 && attr->atttypmod < MAX_TIMESTAMP_PRECISION) ||
+        !ArrowIpcFieldMatches(&field, &types[i]))
+      ereport(ERROR,
+              (errcode(ERRCODE_DATATYPE_MISMATCH),
+               errmsg("arrow field %u cannot be loaded into column \"%s\" "
+                      "of type %s",
+                      k, NameStr(attr->attname),
+                      format_type_be(attr->atttypid))));
+  }
+}
+
+/*
+ * Get a buffer of a record batch, checking that it is inside the body
+ * and holds at least `needed` bytes.
+ */
+static const char* ArrowIpcGetBuffer(const ArrowIpcBuffer* buf, Size buffers,
+                                     uint32 n, const char* body,
+                                     int64 bodylen, int64 needed) {
+  const int64 offset = ArrowIpcInt64(buf, buffers + 16 * (Size)n);
+  const int64 length = ArrowIpcInt64(buf, buffers + 16 * (Size)n + 8);
+
+  if (offset < 0 || offset % 8 != 0 || length < needed || offset > bodylen ||
+      length > bodylen - offset)
+    ArrowIpcInvalid();
+  return body + offset;
+}
+
+/*
+ * Check that a value read from a record batch is valid for the type
+ * of the column, the same way as the input function of the type would.
+ *
+ * Only dates, timestamps, and times have values that the fields can
+ * hold but the type cannot. The largest and smallest values of dates
+ * and timestamps stand for infinity, like in the columns.
+ */
+static void ArrowIpcCheckValue(const ArrowType* type, const char* data,
+                               int64 row, Form_pg_attribute attr) {
+  bool valid = true;
+
+  if (type->layout == ARROW_LAYOUT_EPOCH && type->attlen == sizeof(int32)) {
+    const int32 value = ((const int32*)data)[row];
+    const int64 date = (int64)value - type->epoch;
+
+    valid = value == PG_INT32_MIN || value == PG_INT32_MAX ||
+            IS_VALID_DATE(date);
+  } else if (type->layout == ARROW_LAYOUT_EPOCH) {
+    const int64 value = ((const int64*)data)[row];
+    int64 timestamp;
+
+    valid = value == PG_INT64_MIN || value == PG_INT64_MAX ||
+            (!pg_sub_s64_overflow(value, type->epoch, &timestamp) &&
+             IS_VALID_TIMESTAMP(timestamp));
+  } else if (type->typid == TIMEOID) {
+    const int64 value = ((const int64*)data)[row];
+
+    valid = value >= 0 && value <= USECS_PER_DAY;
+  }
+
+  if (!valid)
+    ereport(ERROR,
+            (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+             errmsg("value out of range for column \"%s\" of type %s",
+                    NameStr(attr->attname),
+                    format_type_be(attr->atttypid))));
+}
+
+/*
+ * Load a record batch.
+ *
+ * Values are read from the buffers of the record batch the same way as
+ * from the chunks of a column, except that a set validity bit means
+ * that the value is not null, and are appended in batches.
+ */
+static void ArrowIpcLoadBatch(ArrowCopyState* state,
+                              const ArrowIpcTable* header, const char* body,
+                              int64 bodylen, const ArrowType* types) {
+  TupleDesc tupdesc = RelationGetDescr(state->relation);
+  ArrowCopyBatch* batch = state->batch;
+  const int64 length = ArrowIpcGetInt(header, 0, 8, 0);
+  const uint8** validity = palloc0(Max(tupdesc->natts, 1) * sizeof(uint8*));
+  const char** data = palloc0(Max(tupdesc->natts, 1) * sizeof(char*));
+  uint32 nnodes;
+  uint32 nbuffers;
+  const Size nodes = ArrowIpcGetVector(header, 1, 16, &nnodes);
+  const Size buffers = ArrowIpcGetVector(header, 2, 16, &nbuffers);
+  uint32 k = 0;
+
+  if (ArrowIpcFieldPos(header, 3) != 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("compressed arrow record batches are not supported")));
+
+  if (length < 0 || length > PG_INT32_MAX)
+    ArrowIpcInvalid();
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    int64 datalen;
+
+    if (TupleDescAttr(tupdesc, i)->attisdropped)
+      continue;
+
+    if (k >= nnodes || 2 * k + 1 >= nbuffers ||
+        ArrowIpcInt64(header->buf, nodes + 16 * (Size)k) != length)
+      ArrowIpcInvalid();
+
+    if (types[i].layout == ARROW_LAYOUT_BITMAP)
+      datalen = (length + 7) / 8;
+    else
+      datalen = length * types[i].attlen;
+
+    /* The validity buffer can be left out if there are no nulls */
+    if (ArrowIpcInt64(header->buf, nodes + 16 * (Size)k + 8) > 0)
+      validity[i] = (const uint8*)ArrowIpcGetBuffer(
+          header->buf, buffers, 2 * k, body, bodylen, (length + 7) / 8);
+    data[i] = ArrowIpcGetBuffer(header->buf, buffers, 2 * k + 1, body,
+                                bodylen, datalen);
+    ++k;
+  }
+
+  for (int64 start = 0; start < length; start += ARROW_COPY_BATCH_ROWS) {
+    batch->nrows = Min(ARROW_COPY_BATCH_ROWS, length - start);
+
+    for (int i = 0; i < tupdesc->natts; ++i) {
+      Datum* values = batch->values[i];
+      bool* isnull = batch->isnull[i];
+
+      if (TupleDescAttr(tupdesc, i)->attisdropped) {
+        memset(isnull, true, batch->nrows);
+        continue;
+      }
+
+      for (int n = 0; n < batch->nrows; ++n) {
+        const int row = start + n;
+        isnull[n] = validity[i] != NULL &&
+                    (validity[i][row / 8] & (1 << (row % 8))) == 0;
+        if (isnull[n]) {
+          values[n] = (Datum)0;
+          continue;
+        }
+        ArrowIpcCheckValue(&types[i], data[i], row,
+                           TupleDescAttr(tupdesc, i));
+        values[n] = ArrowValueGetDatum(&types[i], data[i], row);
+      }
+    }
+
+    ArrowCopyAppend(batch, state);
+
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  pfree(validity);
+  pfree(data);
+}
+
+/*
+ * Find the end of the messages of an Arrow IPC file.
+ *
+ * Files start with the magic string and hold the messages in the
+ * stream format, followed by a footer, the length of the footer, and
+ * the magic string again. The footer repeats the schema and lists the
+ * record batches, but the messages are read in order anyway, so it is
+ * skipped.
+ */
+static void ArrowIpcFindFooter(ArrowIpcReader* reader) {
+  char trailer[sizeof(int32) + 6];
+  int32 footerlen;
+
+  if (fseeko(reader->file, -(off_t)sizeof(trailer), SEEK_END) != 0)
+    ArrowIpcInvalid();
+  ArrowIpcRead(reader, trailer, sizeof(trailer), false);
+  if (memcmp(trailer + sizeof(int32), ARROW_IPC_MAGIC, 6) != 0)
+    ArrowIpcInvalid();
+
+  memcpy(&footerlen, trailer, sizeof(footerlen));
+  reader->limit = ftello(reader->file) - sizeof(trailer) - footerlen;
+  if (footerlen < 0 || reader->limit < 8)
+    ArrowIpcInvalid();
+
+  if (fseeko(reader->file, 8, SEEK_SET) != 0)
+    ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not seek in file \"%s\": %m", reader->filename)));
+}
+
+/*
+ * Load a file in the Arrow IPC stream or file format.
+ *
+ * Only flat fields where the values are stored the same way as in the
+ * columns are supported, so values are not converted, and dictionary
+ * batches and compressed bodies are not supported.
+ */
+static void ArrowCopyFromIpc(ArrowCopyState* state, const char* filename) {
+  TupleDesc tupdesc = RelationGetDescr(state->relation);
+  ArrowType* types = palloc(Max(tupdesc->natts, 1) * sizeof(ArrowType));
+  ArrowIpcReader reader;
+  char magic[8];
+  bool haveschema = false;
+
+#ifdef WORDS_BIGENDIAN
+  ereport(ERROR,
+          (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+           errmsg("loading arrow files is not supported on big-endian "
+                  "machines")));
+#endif
+
+  for (int i = 0; i < tupdesc->natts; ++i)
+    ArrowTypeLookup(TupleDescAttr(tupdesc, i), &types[i]);
+
+  reader.filename = filename;
+  reader.limit = -1;
+  reader.file = AllocateFile(filename, PG_BINARY_R);
+  if (reader.file == NULL)
+    ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not open file \"%s\" for reading: %m", filename)));
+
+  if (ArrowIpcRead(&reader, magic, sizeof(magic), true) &&
+      memcmp(magic, ARROW_IPC_MAGIC, 6) == 0)
+    ArrowIpcFindFooter(&reader);
+  else if (fseeko(reader.file, 0, SEEK_SET) != 0)
+    ereport(ERROR,
+            (errcode_for_file_access(),
+             errmsg("could not seek in file \"%s\": %m", filename)));
+
+  for (;;) {
+    ArrowIpcBuffer metadata;
+    ArrowIpcTable message;
+    ArrowIpcTable header;
+    char* buf;
+    char* body;
+    int32 length;
+    int64 bodylen;
+
+    if (reader.limit >= 0 && ftello(reader.file) >= reader.limit)
+      break;
+
+    /* Messages start with a continuation marker, except in files
+     * written by old versions of Arrow. A length of zero marks the end
+     * of the stream. */
+    if (!ArrowIpcRead(&reader, &length, sizeof(length), true))
+      break;
+    if (length == -1 && !ArrowIpcRead(&reader, &length, sizeof(length), true))
+      break;
+    if (length == 0)
+      break;
+    if (length < 0)
+      ArrowIpcInvalid();
+
+    buf = palloc(length);
+    ArrowIpcRead(&reader, buf, length, false);
+    metadata.data = buf;
+    metadata.size = length;
+
+    message = ArrowIpcTableAt(&metadata, ArrowIpcUInt32(&metadata, 0));
+    bodylen = ArrowIpcGetInt(&message, 3, 8, 0);
+    if (!ArrowIpcGetTable(&message, 2, &header) || bodylen < 0 ||
+        bodylen > MaxAllocHugeSize)
+      ArrowIpcInvalid();
+
+    body = MemoryContextAllocHuge(CurrentMemoryContext, Max(bodylen, 1));
+    ArrowIpcRead(&reader, body, bodylen, false);
+
+    switch (ArrowIpcGetInt(&message, 1, 1, 0)) {
+      case ARROW_IPC_HEADER_SCHEMA:
+        if (haveschema)
+          ArrowIpcInvalid();
+        ArrowIpcCheckSchema(state->relation, &header, types);
+        haveschema = true;
+        break;
+
+      case ARROW_IPC_HEADER_RECORD_BATCH:
+        if (!haveschema)
+          ArrowIpcInvalid();
+        ArrowIpcLoadBatch(state, &header, body, bodylen, types);
+        break;
+
+      default:
+        ArrowIpcInvalid();
+    }
+
+    pfree(buf);
+    pfree(body);
+  }
+
+  FreeFile(reader.file);
+  pfree(types);
+}
+
+/*
+ * Check that rows can be loaded into the relation.
+ *
+ * Rows are appended to the columns directly, so tables where inserts
+ * have to run triggers or compute values are not supported.
+ */
+static void ArrowCopyCheckRelation(Relation relation) {
+  TupleConstr* constr = RelationGetDescr(relation)->constr;
+  AclResult aclresult;
+
+  aclresult =
+      pg_class_aclcheck(RelationGetRelid(relation), GetUserId(), ACL_INSERT);
+  if (aclresult != ACLCHECK_OK)
+    aclcheck_error(aclresult, get_relkind_objtype(relation->rd_rel->relkind),
+                   RelationGetRelationName(relation));
+
+  if (table_slot_callbacks(relation) != &TTSOpsArrowTuple)
+    ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                    errmsg("\"%s\" is not an arrow table",
+                           RelationGetRelationName(relation))));
+
+  if (relation->trigdesc != NULL ||
+      (constr != NULL &&
+       (constr->num_check > 0 || constr->has_generated_stored)) ||
+      check_enable_rls(RelationGetRelid(relation), InvalidOid, false) ==
+          RLS_ENABLED)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("cannot bulk load into table \"%s\"",
+                    RelationGetRelationName(relation)),
+             errdetail("Tables with triggers, check constraints, generated "
+                       "columns, or row-level security are not supported."),
+             errhint("Use COPY instead.")));
+}
+
+/*
+ * Load a file into an arrow table.
+ *
+ * Returns the number of rows loaded.
+ */
+Datum arrow_copy_from(PG_FUNCTION_ARGS) {
+  const Oid relid = PG_GETARG_OID(0);
+  char* filename = text_to_cstring(PG_GETARG_TEXT_PP(1));
+  char* format = text_to_cstring(PG_GETARG_TEXT_PP(2));
+  ArrowCopyState state;
+  Relation relation;
+
+  if (strcmp(format, "csv") != 0 && strcmp(format, "text") != 0 &&
+      strcmp(format, "binary") != 0 && strcmp(format, "arrow") != 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("format \"%s\" not recognized", format),
+             errhint("Valid formats are \"csv\", \"text\", \"binary\", and "
+                     "\"arrow\".")));
+
+  if (!has_privs_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES))
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+             errmsg("permission denied to load from a file"),
+             errdetail("Only roles with privileges of the \"%s\" role may "
+                       "load from a file.",
+                       "pg_read_server_files")));
+
+  PreventCommandIfReadOnly("arrow_copy_from()");
+
+  relation = table_open(relid, RowExclusiveLock);
+  ArrowCopyCheckRelation(relation);
+
+  DEBUG_ENTER("relation: %s, filename: %s, format: %s",
+              RelationGetRelationName(relation), filename, format);
+
+  state.relation = relation;
+  state.xmin = GetCurrentTransactionId();
+  state.cid = GetCurrentCommandId(true);
+  state.columns = ArrowArrayGetColumns(relation->rd_locator.relNumber,
+                                       RelationGetNumberOfAttributes(relation));
+  state.batch = ArrowCopyBatchCreate(RelationGetDescr(relation));
+  state.count = 0;
+  state.estate = CreateExecutorState();
+  state.resultRelInfo = makeNode(ResultRelInfo);
+  InitResultRelInfo(state.resultRelInfo, relation, 1, NULL, 0);
+  ExecOpenIndices(state.resultRelInfo, false);
+  state.slot = MakeSingleTupleTableSlot(RelationGetDescr(relation),
+                                        &TTSOpsArrowTuple);
+  state.slot->tts_tableOid = relid;
+
+  if (strcmp(format, "arrow") == 0)
+    ArrowCopyFromIpc(&state, filename);
+  else
+    ArrowCopyFromFile(&state, filename, format);
+
+  ExecDropSingleTupleTableSlot(state.slot);
+  ExecCloseIndices(state.resultRelInfo);
+  FreeExecutorState(state.estate);
+
+  DEBUG_LEAVE("relation: %s, count: %ld", RelationGetRelationName(relation),
+              state.count);
+
+  table_close(relation, NoLock);
+
+  PG_RETURN_INT64(state.count);
+}
@@ -0,0 +1,52 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Bulk loading of files into arrow tables.
+ *
+ * `arrow_copy_from()` loads a file in one of the formats of COPY, or
+ * in the Arrow IPC format, into an arrow table. Rows are collected in
+ * column-major batches, and each batch is appended to the columns one
+ * column at a time under a single extension lock and recorded as a
+ * single run, so the cost per row is a few stores per column rather
+ * than a call to the insert path of the table access method.
+ *
+ * Files in the COPY formats are parsed by a parallel worker, using
+ * the parser of COPY, while the backend that called the function
+ * appends the batches that the worker has parsed so far, so parsing
+ * and appending overlap. The batches are sent over a shared memory
+ * queue, and if no worker can be started, the backend parses the file
+ * itself. Files in the Arrow IPC format already hold their values in
+ * column-major record batches, so these are read and appended by the
+ * backend directly.
+ *
+ * The loaded rows do not get index entries while they are appended,
+ * so the indexes of the table are rebuilt after the load.
+ */
+
+#ifndef ARROW_COPY_H_
+#define ARROW_COPY_H_
+
+#include <postgres.h>
+
+#include <storage/dsm.h>
+#include <storage/shm_toc.h>
+
+PGDLLEXPORT void ArrowCopyWorkerMain(dsm_segment* seg, shm_toc* toc);
+
+#endif /* ARROW_COPY_H_ */
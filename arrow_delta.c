@@ -0,0 +1,439 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_delta.h"
+
+#include <postgres.h>
+
+#include <access/tupmacs.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/lmgr.h>
+#include <utils/memutils.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "debug.h"
+
+/*
+ * Maximum number of rows in the delta store of a relation, or zero if
+ * inserts do not use the delta store.
+ */
+int ArrowDeltaRows = 0;
+
+/*
+ * Layout of the delta records of a relation.
+ *
+ * This is kept in the relation cache entry, which is rebuilt when
+ * columns are added or dropped, or the relation gets new storage.
+ * Only new storage creates a delta segment, so whether the segment
+ * exists cannot change while the entry is valid.
+ */
+typedef struct ArrowDeltaColumn {
+  int32 offset;   /* Offset in the values of a record, or -1 */
+  ArrowType type; /* Storage of the column */
+} ArrowDeltaColumn;
+
+typedef struct ArrowDeltaInfo {
+  RelFileNumber relnumber; /* Storage the info is for */
+  bool exists;             /* The storage has a delta segment */
+  int32 datalen;           /* Length of the values, or -1 */
+  Size size;               /* Size of a record, or 0 if not possible */
+  ArrowDeltaColumn columns[FLEXIBLE_ARRAY_MEMBER];
+} ArrowDeltaInfo;
+
+static ArrowDeltaInfo* ArrowDeltaGetInfo(Relation relation) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  ArrowDeltaInfo* info = relation->rd_amcache;
+  int32* offsets;
+  ArrowSegmentKey key;
+
+  if (info != NULL && info->relnumber == relnumber)
+    return info;
+
+  info = MemoryContextAlloc(CacheMemoryContext,
+                            offsetof(ArrowDeltaInfo, columns) +
+                                tupdesc->natts * sizeof(ArrowDeltaColumn));
+  offsets = palloc(Max(tupdesc->natts, 1) * sizeof(int32));
+  info->relnumber = relnumber;
+  info->datalen = ArrowDeltaLayout(tupdesc, offsets);
+  info->size = 0;
+  if (info->datalen >= 0 &&
+      ArrowDeltaRecordSize(tupdesc->natts, info->datalen) <=
+          ARROW_DELTA_MAX_RECORD)
+    info->size = ArrowDeltaRecordSize(tupdesc->natts, info->datalen);
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    info->columns[i].offset = offsets[i];
+    ArrowTypeLookup(TupleDescAttr(tupdesc, i), &info->columns[i].type);
+  }
+  pfree(offsets);
+
+  memset(&key, 0, sizeof(key));
+  key.bk_dbid = MyDatabaseId;
+  key.bk_relnumber = relnumber;
+  key.bk_attno = ARROW_DELTA_ATTNO;
+  info->exists = ArrowSegmentExists(&key);
+
+  if (relation->rd_amcache)
+    pfree(relation->rd_amcache);
+  relation->rd_amcache = info;
+  return info;
+}
+
+/*
+ * Open the delta segment of a relation that is known to have one.
+ */
+static ArrowArray* ArrowDeltaArray(RelFileNumber relnumber) {
+  return ArrowArrayOpen(relnumber, ARROW_DELTA_ATTNO, 0, O_RDWR);
+}
+
+static inline ArrowDeltaRecord* ArrowDeltaRecordAt(ArrowArray* delta,
+                                                   int64 n) {
+  const SegmentData* data = (const SegmentData*)delta->private_data;
+  return (ArrowDeltaRecord*)((char*)ArrowArrayChunkData(
+                                 delta, n / ARROW_CHUNK_ROWS) +
+                             (n % ARROW_CHUNK_ROWS) * data->segment->attlen);
+}
+
+/*
+ * Compute the offsets of the columns in the values of a delta record.
+ *
+ * Columns are aligned the same way as in a heap tuple. Columns that
+ * are not of a fixed length get no place and an offset of -1. Returns
+ * the length of the values, or -1 if a column that is not dropped is
+ * not of a fixed length, in which case the relation cannot use the
+ * delta store.
+ */
+int32 ArrowDeltaLayout(TupleDesc tupdesc, int32* offsets) {
+  Size off = 0;
+  bool fixed = true;
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+    if (attr->attlen <= 0) {
+      fixed &= attr->attisdropped;
+      offsets[i] = -1;
+      continue;
+    }
+    off = att_align_nominal(off, attr->attalign);
+    offsets[i] = off;
+    off += attr->attlen;
+  }
+  return fixed ? (int32)off : -1;
+}
+
+/*
+ * Create the delta segment for new storage of a relation, if the
+ * relation can use the delta store.
+ */
+void ArrowDeltaCreate(RelFileNumber relnumber, TupleDesc tupdesc) {
+  int32* offsets = palloc(Max(tupdesc->natts, 1) * sizeof(int32));
+  const int32 datalen = ArrowDeltaLayout(tupdesc, offsets);
+
+  pfree(offsets);
+  if (datalen < 0 ||
+      ArrowDeltaRecordSize(tupdesc->natts, datalen) > ARROW_DELTA_MAX_RECORD)
+    return;
+  ArrowArrayOpen(relnumber, ARROW_DELTA_ATTNO,
+                 ArrowDeltaRecordSize(tupdesc->natts, datalen),
+                 O_RDWR | O_CREAT | O_EXCL);
+}
+
+/*
+ * Open the delta segment of a relation, or return NULL if it does not
+ * have one.
+ */
+ArrowArray* ArrowDeltaOpen(RelFileNumber relnumber) {
+  ArrowSegmentKey key;
+
+  memset(&key, 0, sizeof(key));
+  key.bk_dbid = MyDatabaseId;
+  key.bk_relnumber = relnumber;
+  key.bk_attno = ARROW_DELTA_ATTNO;
+  if (!ArrowSegmentExists(&key))
+    return NULL;
+  return ArrowDeltaArray(relnumber);
+}
+
+/*
+ * Remove all rows from the delta store when the relation is truncated.
+ */
+void ArrowDeltaReset(Relation relation) {
+  if (ArrowDeltaGetInfo(relation)->exists)
+    ArrowArrayReset(ArrowDeltaArray(relation->rd_locator.relNumber));
+}
+
+/*
+ * Copy the record of a row from the delta store.
+ *
+ * Returns false if the row is not in the delta store, which means
+ * that it is in the columns. In either case, `merged` is set to a
+ * number of rows, counting from the start of the relation, that are
+ * known to be in the columns. `record` has to have room for a record
+ * of the delta segment.
+ */
+bool ArrowDeltaFetch(ArrowArray* delta, int64 row, ArrowDeltaRecord* record,
+                     int64* merged) {
+  const SegmentData* data = (const SegmentData*)delta->private_data;
+  volatile ArrowDeltaRecord* entry;
+  int64 first;
+
+  ArrowArrayRefresh(delta);
+  *merged = PG_INT64_MAX;
+  if (delta->length == 0)
+    return false;
+
+  pg_read_barrier();
+  first = ((volatile ArrowDeltaRecord*)ArrowDeltaRecordAt(delta, 0))->row;
+
+  /* The first record is being written, so the rows that were in the
+   * delta store have been merged. */
+  if (first < 0) {
+    *merged = row + 1;
+    return false;
+  }
+
+  *merged = first;
+  if (row < first || row - first >= delta->length)
+    return false;
+
+  entry = ArrowDeltaRecordAt(delta, row - first);
+  if (entry->row == row) {
+    pg_read_barrier();
+    memcpy(record, (const void*)entry, data->segment->attlen);
+    pg_read_barrier();
+    if (entry->row == row)
+      return true;
+  }
+
+  /* The record was reused after the row was merged */
+  *merged = row + 1;
+  return false;
+}
+
+/*
+ * Get the value of a column from a delta record.
+ */
+Datum ArrowDeltaGetValue(const ArrowDeltaRecord* record,
+                         Form_pg_attribute attr, int32 offset, bool* isnull) {
+  const int i = attr->attnum - 1;
+
+  *isnull = i >= record->natts || offset < 0 ||
+            (ArrowDeltaRecordNulls(record)[i / 8] & (1 << (i % 8))) != 0;
+  if (*isnull)
+    return (Datum)0;
+  return fetch_att(ArrowDeltaRecordData(record) + offset, attr->attbyval,
+                   attr->attlen);
+}
+
+/*
+ * Prepare to insert rows into the delta store of a relation.
+ *
+ * This has to be called with the relation extension lock held.
+ * Returns the delta segment, with room for `nslots` records, and sets
+ * `first` to the row number of the first row to insert. If the rows
+ * should be appended to the columns instead, the rows in the delta
+ * store are merged first, so that the rows in the columns stay
+ * consecutive, and NULL is returned.
+ */
+ArrowArray* ArrowDeltaPrepare(Relation relation, int nslots, int64* first) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  const ArrowDeltaInfo* info = ArrowDeltaGetInfo(relation);
+  ArrowArray* delta;
+  bool usable;
+
+  if (!info->exists)
+    return NULL;
+
+  /* Columns added since the delta segment was created can make the
+   * records too large for it. */
+  delta = ArrowDeltaArray(relnumber);
+  usable = info->size > 0 &&
+           info->size <=
+               ((SegmentData*)delta->private_data)->segment->attlen &&
+           nslots <= ArrowDeltaRows;
+
+  if (delta->length > 0 &&
+      (!usable || delta->length + nslots > ArrowDeltaRows))
+    ArrowDeltaMergeLocked(relation);
+
+  if (!usable)
+    return NULL;
+
+  if (delta->length > 0) {
+    *first = ArrowDeltaRecordAt(delta, 0)->row + delta->length;
+  } else {
+    *first = 0;
+    for (int i = 0; i < tupdesc->natts; ++i) {
+      ArrowArray* column =
+          ArrowArrayGet(relnumber, TupleDescAttr(tupdesc, i), O_RDWR);
+      *first = Max(*first, column->length);
+    }
+  }
+
+  ArrowArrayReserve(delta, nslots);
+  return delta;
+}
+
+/*
+ * Write the values of slots into the delta store.
+ *
+ * The records are written after the last record of the delta store,
+ * which ArrowDeltaPrepare() made room for, and are only added to the
+ * delta store once all of them are written. A record is marked as
+ * being written first, since readers can still be looking at a row
+ * that was in the same place before the delta store was merged.
+ */
+void ArrowDeltaAppend(Relation relation, ArrowArray* delta, int64 first,
+                      TupleTableSlot** slots, int nslots) {
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  const ArrowDeltaInfo* info = ArrowDeltaGetInfo(relation);
+
+  for (int n = 0; n < nslots; ++n) {
+    TupleTableSlot* slot = slots[n];
+    ArrowDeltaRecord* record = ArrowDeltaRecordAt(delta, delta->length + n);
+    char* data;
+    bits8* nulls;
+
+    record->row = -1;
+    pg_write_barrier();
+
+    record->natts = tupdesc->natts;
+    record->datalen = info->datalen;
+    data = ArrowDeltaRecordData(record);
+    nulls = ArrowDeltaRecordNulls(record);
+    memset(data, 0, info->datalen + BITMAPLEN(tupdesc->natts));
+
+    for (int i = 0; i < tupdesc->natts; ++i) {
+      Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+      const ArrowDeltaColumn* column = &info->columns[i];
+      const Datum value = slot->tts_values[i];
+
+      if (attr->attisdropped || slot->tts_isnull[i]) {
+        nulls[i / 8] |= 1 << (i % 8);
+        continue;
+      }
+
+      /* Values that cannot be stored in the columns have to be
+       * rejected now rather than when the rows are merged. */
+      ArrowTypeCheckDatum(&column->type, value);
+      if (attr->attbyval)
+        store_att_byval(data + column->offset, value, attr->attlen);
+      else
+        memcpy(data + column->offset, DatumGetPointer(value), attr->attlen);
+    }
+
+    pg_write_barrier();
+    record->row = first + n;
+  }
+
+  ArrowArrayExtend(delta, nslots);
+}
+
+/*
+ * Merge the rows in the delta store into the columns.
+ *
+ * This has to be called with the relation extension lock held.
+ * Readers look for a row in the delta store before looking in the
+ * columns, so the rows are appended to all columns before they are
+ * removed from the delta store. Returns the number of rows merged.
+ */
+int64 ArrowDeltaMergeLocked(Relation relation) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  const ArrowDeltaInfo* info = ArrowDeltaGetInfo(relation);
+  ArrowArray** columns;
+  ArrowArray* delta;
+  int64 count;
+  int64 first;
+
+  if (!info->exists)
+    return 0;
+
+  delta = ArrowDeltaArray(relnumber);
+  count = delta->length;
+  if (count == 0)
+    return 0;
+
+  DEBUG_ENTER("relation: %s, count: %ld", RelationGetRelationName(relation),
+              count);
+
+  first = ArrowDeltaRecordAt(delta, 0)->row;
+  columns = ArrowArrayGetColumns(relnumber, tupdesc->natts);
+
+  /* Make room in all columns first so that failing to grow a segment
+   * leaves the rows in the delta store. Columns can be shorter than
+   * the first row if an insert failed half-way. */
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    columns[i] = ArrowArrayGet(relnumber, TupleDescAttr(tupdesc, i), O_RDWR);
+    Assert(columns[i]->length <= first);
+    ArrowArrayReserve(columns[i], first - columns[i]->length + count);
+  }
+
+  /* Merge one column at a time, so that only one column segment is
+   * touched at any time. */
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    const int32 offset = info->columns[i].offset;
+
+    while (columns[i]->length < first)
+      ArrowArrayAppendNull(columns[i]);
+
+    for (int64 n = 0; n < count; ++n) {
+      bool isnull;
+      Datum value = ArrowDeltaGetValue(ArrowDeltaRecordAt(delta, n), attr,
+                                       offset, &isnull);
+      if (isnull)
+        ArrowArrayAppendNull(columns[i]);
+      else
+        ArrowArrayAppendDatum(columns[i], attr, value);
+    }
+  }
+
+  /* Rewind the delta store, keeping its memory for the next rows */
+  pg_write_barrier();
+  ((SegmentData*)delta->private_data)->segment->length = 0;
+  delta->length = 0;
+
+  DEBUG_LEAVE("relation: %s", RelationGetRelationName(relation));
+  return count;
+}
+
+/*
+ * Merge the rows in the delta store of a relation into the columns.
+ *
+ * This is done before reading the columns of a relation directly,
+ * rather than through a slot, and when vacuuming the relation.
+ */
+int64 ArrowDeltaMerge(Relation relation) {
+  const ArrowDeltaInfo* info = ArrowDeltaGetInfo(relation);
+  int64 merged;
+
+  if (!info->exists ||
+      ArrowDeltaArray(relation->rd_locator.relNumber)->length == 0)
+    return 0;
+
+  LockRelationForExtension(relation, ExclusiveLock);
+  merged = ArrowDeltaMergeLocked(relation);
+  UnlockRelationForExtension(relation, ExclusiveLock);
+  return merged;
+}
@@ -0,0 +1,110 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Delta store for arrow tables.
+ *
+ * Appending a row to the columns touches a segment for each column,
+ * so for small inserts the cost grows with the number of columns. To
+ * keep that cost flat, small inserts can instead write each row as a
+ * single record in the delta segment of the relation. The rows are
+ * later merged into the columns in one batch, when the delta store is
+ * full, before a command that reads the columns directly, or when the
+ * relation is vacuumed.
+ *
+ * Rows in the delta store get their row numbers and their run in the
+ * visibility segment when they are inserted, just like other rows, so
+ * they have item pointers and can be indexed and deleted as usual.
+ * The delta store always holds the rows following the last row of the
+ * columns, so a row is either in the columns or in the delta store,
+ * and the first record tells which rows are in the delta store.
+ *
+ * A record holds the values of a row in their PostgreSQL
+ * representation, laid out the same way as the data area of a heap
+ * tuple without nulls, followed by a null bitmap. Dropped columns
+ * keep their place, so records stay valid when columns are dropped.
+ * Only relations where all columns have a fixed length can use the
+ * delta store, and it is created together with the other segments of
+ * the relation.
+ *
+ * Merging rewinds the delta store while other backends can read it,
+ * so readers check that the record still holds the row after copying
+ * it, the same way as reading a sequence lock.
+ */
+
+#ifndef ARROW_DELTA_H_
+#define ARROW_DELTA_H_
+
+#include <postgres.h>
+
+#include <access/htup_details.h>
+#include <access/tupdesc.h>
+#include <executor/tuptable.h>
+#include <utils/rel.h>
+
+#include "arrow_c_data_interface.h"
+#include "arrow_storage.h"
+
+/**
+ * Attribute number used for the delta segment.
+ */
+#define ARROW_DELTA_ATTNO -6
+
+/**
+ * Largest record that is kept in a delta segment.
+ */
+#define ARROW_DELTA_MAX_RECORD 2048
+
+/**
+ * Row in the delta store.
+ *
+ * The values follow the header at a maximally aligned offset, and the
+ * null bitmap, where a set bit means null, follows the values.
+ * Columns added after the row was inserted are null.
+ */
+typedef struct ArrowDeltaRecord {
+  int64 row;     /* Row number, or -1 while the record is written */
+  int16 natts;   /* Number of columns of the row */
+  int16 datalen; /* Length of the values */
+} ArrowDeltaRecord;
+
+#define ArrowDeltaRecordData(RECORD) \
+  ((char*)(RECORD) + MAXALIGN(sizeof(ArrowDeltaRecord)))
+#define ArrowDeltaRecordNulls(RECORD) \
+  ((bits8*)ArrowDeltaRecordData(RECORD) + (RECORD)->datalen)
+#define ArrowDeltaRecordSize(NATTS, DATALEN)                \
+  MAXALIGN(MAXALIGN(sizeof(ArrowDeltaRecord)) + (DATALEN) + \
+           BITMAPLEN(NATTS))
+
+extern int ArrowDeltaRows;
+
+int32 ArrowDeltaLayout(TupleDesc tupdesc, int32* offsets);
+void ArrowDeltaCreate(RelFileNumber relnumber, TupleDesc tupdesc);
+ArrowArray* ArrowDeltaOpen(RelFileNumber relnumber);
+void ArrowDeltaReset(Relation relation);
+bool ArrowDeltaFetch(ArrowArray* delta, int64 row, ArrowDeltaRecord* record,
+                     int64* merged);
+Datum ArrowDeltaGetValue(const ArrowDeltaRecord* record,
+                         Form_pg_attribute attr, int32 offset, bool* isnull);
+ArrowArray* ArrowDeltaPrepare(Relation relation, int nslots, int64* first);
+void ArrowDeltaAppend(Relation relation, ArrowArray* delta, int64 first,
+                      TupleTableSlot** slots, int nslots);
+int64 ArrowDeltaMergeLocked(Relation relation);
+int64 ArrowDeltaMerge(Relation relation);
+
+#endif /* ARROW_DELTA_H_ */
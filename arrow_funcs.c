@@ -0,0 +1,401 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * SQL-callable functions for inspecting and managing the shared
+ * memory segments used by arrow tables.
+ */
+
+#include <postgres.h>
+
+#include <access/genam.h>
+#include <access/htup_details.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <catalog/objectaddress.h>
+#include <catalog/pg_class.h>
+#include <funcapi.h>
+#include <miscadmin.h>
+#include <storage/procarray.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/relfilenumbermap.h>
+#include <utils/snapmgr.h>
+#include <utils/syscache.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_storage.h"
+#include "arrow_tts.h"
+
+PG_FUNCTION_INFO_V1(arrow_orphans);
+PG_FUNCTION_INFO_V1(arrow_cleanup);
+PG_FUNCTION_INFO_V1(arrow_segments);
+PG_FUNCTION_INFO_V1(arrow_memory_reserved);
+PG_FUNCTION_INFO_V1(arrow_profile);
+PG_FUNCTION_INFO_V1(arrow_column_stats);
+
+/*
+ * Counters of the segments of a relation.
+ */
+typedef struct ArrowProfileEntry {
+  ArrowSegmentKey key; /* Relation, with attribute and child zero */
+  uint64 rows_scanned;
+  uint64 rows_inserted;
+  uint64 opens;
+  uint64 open_time;
+  uint64 bytes_mapped;
+} ArrowProfileEntry;
+
+/*
+ * Collect the relation file numbers of all relations in the current
+ * database.
+ */
+static HTAB *BuildRelFileNumberSet(void) {
+  HASHCTL ctl;
+  HTAB *set;
+  Relation rel;
+  SysScanDesc scan;
+  HeapTuple tuple;
+
+  ctl.keysize = sizeof(RelFileNumber);
+  ctl.entrysize = sizeof(RelFileNumber);
+  ctl.hcxt = CurrentMemoryContext;
+  set = hash_create("Arrow relation file numbers", 1024, &ctl,
+                    HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+  rel = table_open(RelationRelationId, AccessShareLock);
+  scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+  while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+    Form_pg_class form = (Form_pg_class)GETSTRUCT(tuple);
+    RelFileNumber relnumber = form->relfilenode;
+    if (RelFileNumberIsValid(relnumber))
+      hash_search(set, &relnumber, HASH_ENTER, NULL);
+  }
+  systable_endscan(scan);
+  table_close(rel, AccessShareLock);
+
+  return set;
+}
+
+/*
+ * Find segments that do not belong to any relation.
+ *
+ * A segment is an orphan if it belongs to a database that no longer
+ * exists, or if it belongs to the current database and no relation
+ * uses its relation file number. We cannot check relations in other
+ * databases, so those segments are never considered orphans. Segments
+ * of other clusters on the same machine are never listed at all.
+ *
+ * Segments created by transactions that are still in progress belong
+ * to relations that are not yet visible, so we skip them. This check
+ * is done before reading the catalog, so that any transaction that
+ * has finished also is visible in the catalog snapshot.
+ */
+static List *ArrowFindOrphans(void) {
+  List *candidates = NIL;
+  List *orphans = NIL;
+  ListCell *lc;
+  HTAB *relnumbers;
+
+  foreach (lc, ArrowSegmentList()) {
+    ArrowSegmentKey *key = lfirst(lc);
+    ArrowSegment header;
+
+    if (key->bk_dbid != MyDatabaseId) {
+      if (!SearchSysCacheExists1(DATABASEOID, ObjectIdGetDatum(key->bk_dbid)))
+        orphans = lappend(orphans, key);
+      continue;
+    }
+
+    if (!ArrowSegmentReadHeader(key, &header, NULL) ||
+        !TransactionIdIsValid(header.xmin) ||
+        TransactionIdIsInProgress(header.xmin))
+      continue;
+
+    candidates = lappend(candidates, key);
+  }
+
+  InvalidateCatalogSnapshot();
+  relnumbers = BuildRelFileNumberSet();
+
+  foreach (lc, candidates) {
+    ArrowSegmentKey *key = lfirst(lc);
+    if (!hash_search(relnumbers, &key->bk_relnumber, HASH_FIND, NULL))
+      orphans = lappend(orphans, key);
+  }
+
+  hash_destroy(relnumbers);
+  return orphans;
+}
+
+/*
+ * List segments that do not belong to any relation.
+ */
+Datum arrow_orphans(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  ListCell *lc;
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  foreach (lc, ArrowFindOrphans()) {
+    ArrowSegmentKey *key = lfirst(lc);
+    Datum values[3];
+    bool nulls[3] = {0};
+
+    values[0] = ObjectIdGetDatum(key->bk_dbid);
+    values[1] = ObjectIdGetDatum(key->bk_relnumber);
+    values[2] = Int16GetDatum(key->bk_attno);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
+
+/*
+ * Unlink segments that do not belong to any relation.
+ *
+ * Returns the number of segments unlinked.
+ */
+Datum arrow_cleanup(PG_FUNCTION_ARGS) {
+  int64 count = 0;
+  ListCell *lc;
+
+  foreach (lc, ArrowFindOrphans()) {
+    ArrowSegmentUnlink(lfirst(lc));
+    ++count;
+  }
+
+  PG_RETURN_INT64(count);
+}
+
+/*
+ * List all segments with their sizes.
+ *
+ * The relation is only resolved for segments in the current
+ * database.
+ */
+Datum arrow_segments(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  ListCell *lc;
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  foreach (lc, ArrowSegmentList()) {
+    ArrowSegmentKey *key = lfirst(lc);
+    ArrowSegment header;
+    size_t size;
+    Datum values[8];
+    bool nulls[8] = {0};
+    Oid relid = InvalidOid;
+
+    if (!ArrowSegmentReadHeader(key, &header, &size))
+      continue;
+
+    if (key->bk_dbid == MyDatabaseId)
+      relid = RelidByRelfilenumber(InvalidOid, key->bk_relnumber);
+
+    values[0] = ObjectIdGetDatum(key->bk_dbid);
+    values[1] = ObjectIdGetDatum(key->bk_relnumber);
+    values[2] = Int16GetDatum(key->bk_attno);
+    values[3] = ObjectIdGetDatum(relid);
+    nulls[3] = !OidIsValid(relid);
+    values[4] = Int64GetDatum(header.length);
+    values[5] = Int64GetDatum(ArrowSegmentCapacity(&header, size));
+    values[6] = Int64GetDatum(ArrowSegmentUsed(&header));
+    values[7] = Int64GetDatum(size);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
+
+/*
+ * Total number of bytes reserved by all segments.
+ *
+ * This is the number that is compared with arrow.max_memory.
+ */
+Datum arrow_memory_reserved(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(ArrowReservedMemory());
+}
+
+/*
+ * Counters of the segments, summed for each relation.
+ *
+ * Rows scanned and inserted are only counted in the visibility
+ * segment, while the number of times segments were mapped, the time
+ * spent mapping them, and the bytes mapped are summed over all
+ * segments of the relation, including the children of nested columns.
+ */
+Datum arrow_profile(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  HASHCTL ctl;
+  HTAB *relations;
+  List *entries = NIL;
+  ListCell *lc;
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  ctl.keysize = sizeof(ArrowSegmentKey);
+  ctl.entrysize = sizeof(ArrowProfileEntry);
+  ctl.hcxt = CurrentMemoryContext;
+  relations = hash_create("Arrow profile relations", 64, &ctl,
+                          HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+  foreach (lc, ArrowSegmentList()) {
+    ArrowSegmentKey *segkey = lfirst(lc);
+    ArrowSegmentCounters *counters;
+    ArrowProfileEntry *entry;
+    ArrowSegmentKey key;
+    ArrowSegment header;
+    bool found;
+
+    if (!ArrowSegmentReadHeader(segkey, &header, NULL))
+      continue;
+
+    memset(&key, 0, sizeof(key));
+    key.bk_dbid = segkey->bk_dbid;
+    key.bk_relnumber = segkey->bk_relnumber;
+    entry = hash_search(relations, &key, HASH_ENTER, &found);
+    if (!found) {
+      memset(entry, 0, sizeof(*entry));
+      entry->key = key;
+      entries = lappend(entries, entry);
+    }
+
+    /* This is a copy of the header, so the counters are read without
+     * any atomic operations on the segment. */
+    counters = &header.counters;
+    if (segkey->bk_attno == 0 && segkey->bk_child == 0) {
+      entry->rows_scanned = pg_atomic_read_u64(&counters->rows_scanned);
+      entry->rows_inserted = pg_atomic_read_u64(&counters->rows_inserted);
+    }
+    entry->opens += pg_atomic_read_u64(&counters->opens);
+    entry->open_time += pg_atomic_read_u64(&counters->open_time);
+    entry->bytes_mapped += pg_atomic_read_u64(&counters->bytes_mapped);
+  }
+
+  foreach (lc, entries) {
+    ArrowProfileEntry *entry = lfirst(lc);
+    Datum values[8];
+    bool nulls[8] = {0};
+    Oid relid = InvalidOid;
+
+    if (entry->key.bk_dbid == MyDatabaseId)
+      relid = RelidByRelfilenumber(InvalidOid, entry->key.bk_relnumber);
+
+    values[0] = ObjectIdGetDatum(entry->key.bk_dbid);
+    values[1] = ObjectIdGetDatum(entry->key.bk_relnumber);
+    values[2] = ObjectIdGetDatum(relid);
+    nulls[2] = !OidIsValid(relid);
+    values[3] = Int64GetDatum(entry->rows_scanned);
+    values[4] = Int64GetDatum(entry->rows_inserted);
+    values[5] = Int64GetDatum(entry->opens);
+    values[6] = Float8GetDatum(entry->open_time / 1000.0);
+    values[7] = Int64GetDatum(entry->bytes_mapped);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  hash_destroy(relations);
+
+  return (Datum)0;
+}
+
+/*
+ * Add the sizes of the segments of a column, including the segments
+ * of its children.
+ */
+static void ArrowColumnSize(ArrowArray *array, int64 *used,
+                            int64 *reserved) {
+  const ArrowSegment *segment =
+      ((SegmentData *)array->private_data)->segment;
+
+  *used += ArrowSegmentUsed(segment);
+  *reserved += segment->size;
+  for (int64 c = 0; c < array->n_children; ++c)
+    ArrowColumnSize(array->children[c], used, reserved);
+}
+
+/*
+ * Storage of each column of an arrow table.
+ *
+ * The counts are for the rows stored in the column, including rows
+ * that are deleted or were never committed, so they describe the
+ * storage rather than what a scan returns. There are no compressed
+ * encodings, so the encoding is the layout of the values.
+ */
+Datum arrow_column_stats(PG_FUNCTION_ARGS) {
+  static const char *const encodings[] = {
+      [ARROW_LAYOUT_FIXED] = "fixed",   [ARROW_LAYOUT_BITMAP] = "bitmap",
+      [ARROW_LAYOUT_EPOCH] = "epoch",   [ARROW_LAYOUT_LIST] = "list",
+      [ARROW_LAYOUT_STRUCT] = "struct",
+  };
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  Oid relid = PG_GETARG_OID(0);
+  Relation relation;
+  TupleDesc tupdesc;
+  AclResult aclresult;
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  relation = relation_open(relid, AccessShareLock);
+
+  aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+  if (aclresult != ACLCHECK_OK)
+    aclcheck_error(aclresult, get_relkind_objtype(relation->rd_rel->relkind),
+                   RelationGetRelationName(relation));
+
+  if (relation->rd_rel->relkind != RELKIND_RELATION ||
+      table_slot_callbacks(relation) != &TTSOpsArrowTuple)
+    ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                    errmsg("\"%s\" is not an arrow table",
+                           RelationGetRelationName(relation))));
+
+  tupdesc = RelationGetDescr(relation);
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    ArrowArray *array;
+    int64 used = 0;
+    int64 reserved = 0;
+    Datum values[8];
+    bool nulls[8] = {0};
+
+    if (attr->attisdropped)
+      continue;
+
+    array = ArrowArrayGet(relation->rd_locator.relNumber, attr, O_RDWR);
+    ArrowColumnSize(array, &used, &reserved);
+
+    values[0] = Int16GetDatum(attr->attnum);
+    values[1] = NameGetDatum(&attr->attname);
+    values[2] = CStringGetTextDatum(encodings[ArrowArrayLayout(array)]);
+    values[3] = Int64GetDatum(array->length);
+    values[4] = Int64GetDatum(ArrowArrayNullCount(array));
+    values[5] = Int64GetDatum((array->length + ARROW_CHUNK_ROWS - 1) /
+                              ARROW_CHUNK_ROWS);
+    values[6] = Int64GetDatum(used);
+    values[7] = Int64GetDatum(reserved);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  relation_close(relation, AccessShareLock);
+
+  return (Datum)0;
+}
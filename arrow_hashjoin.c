@@ -0,0 +1,681 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_hashjoin.h"
+
+#include <postgres.h>
+
+#include <access/tableam.h>
+#include <catalog/pg_class.h>
+#include <commands/explain.h>
+#include <common/hashfn.h>
+#include <executor/executor.h>
+#include <miscadmin.h>
+#include <nodes/extensible.h>
+#include <optimizer/clauses.h>
+#include <optimizer/cost.h>
+#include <optimizer/optimizer.h>
+#include <optimizer/pathnode.h>
+#include <optimizer/paths.h>
+#include <optimizer/restrictinfo.h>
+#include <optimizer/tlist.h>
+#include <port/pg_bitutils.h>
+#include <utils/fmgroids.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/spccache.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_delta.h"
+#include "arrow_tts.h"
+#include "debug.h"
+
+bool ArrowEnableHashJoin = true;
+
+/**
+ * Bucket of the hash table.
+ *
+ * Inner rows with the same key are chained from the bucket, so a probe
+ * stops at the first bucket with the key.
+ */
+typedef struct ArrowHashBucket {
+  int64 key;  /* Key of the inner rows in the bucket */
+  int32 head; /* First inner row with the key, or -1 if empty */
+} ArrowHashBucket;
+
+/**
+ * State of an arrow hash join.
+ *
+ * Columns of the scan tuple are read from the arrow table if the
+ * source is positive, and from the inner plan if it is negative.
+ */
+typedef struct ArrowHashJoinState {
+  CustomScanState css;
+  Oid relid;            /* Arrow table probing the hash table */
+  AttrNumber outerkey;  /* Key column of the arrow table */
+  AttrNumber innerkey;  /* Key column of the inner plan */
+  int nsources;         /* Number of columns of the scan tuple */
+  AttrNumber* sources;  /* Source of each column of the scan tuple */
+  Relation relation;
+  TableScanDesc scan;
+  ArrowArray* keycolumn;
+  int16 keylen;
+  TupleTableSlot* outerslot;
+  TupleTableSlot* innerslot;
+
+  /* Hash table, built from the inner plan on the first call */
+  MemoryContext hashcxt;
+  bool built;
+  MinimalTuple* tuples; /* Inner rows */
+  int32* next;          /* Next inner row with the same key, or -1 */
+  int32 ntuples;
+  ArrowHashBucket* buckets;
+  uint64 mask;
+
+  /* Current batch of rows of the arrow table */
+  int nmatched; /* Number of rows with a match */
+  int pos;      /* Next row with a match to return */
+  int32 match;  /* Next inner row for the current row, or -1 */
+  int64 rows[ARROW_CHUNK_ROWS];
+  int64 keys[ARROW_CHUNK_ROWS];
+  uint64 hashes[ARROW_CHUNK_ROWS];
+  bool isnull[ARROW_CHUNK_ROWS];
+  int64 matched[ARROW_CHUNK_ROWS]; /* Rows with a match */
+  int32 matches[ARROW_CHUNK_ROWS]; /* First inner row for each match */
+} ArrowHashJoinState;
+
+static set_join_pathlist_hook_type prev_set_join_pathlist_hook = NULL;
+
+static Plan* ArrowHashJoinPlan(PlannerInfo* root, RelOptInfo* rel,
+                               CustomPath* best_path, List* tlist,
+                               List* clauses, List* custom_plans);
+static Node* ArrowHashJoinCreateState(CustomScan* cscan);
+static void ArrowHashJoinBegin(CustomScanState* node, EState* estate,
+                               int eflags);
+static TupleTableSlot* ArrowHashJoinExec(CustomScanState* node);
+static void ArrowHashJoinEnd(CustomScanState* node);
+static void ArrowHashJoinRescan(CustomScanState* node);
+static void ArrowHashJoinExplain(CustomScanState* node, List* ancestors,
+                                 ExplainState* es);
+
+static const CustomPathMethods ArrowHashJoinPathMethods = {
+    .CustomName = "ArrowHashJoin",
+    .PlanCustomPath = ArrowHashJoinPlan,
+};
+
+static const CustomScanMethods ArrowHashJoinPlanMethods = {
+    .CustomName = "ArrowHashJoin",
+    .CreateCustomScanState = ArrowHashJoinCreateState,
+};
+
+static const CustomExecMethods ArrowHashJoinExecMethods = {
+    .CustomName = "ArrowHashJoin",
+    .BeginCustomScan = ArrowHashJoinBegin,
+    .ExecCustomScan = ArrowHashJoinExec,
+    .EndCustomScan = ArrowHashJoinEnd,
+    .ReScanCustomScan = ArrowHashJoinRescan,
+    .ExplainCustomScan = ArrowHashJoinExplain,
+};
+
+/*
+ * Check if a join clause can be used as the hash key.
+ *
+ * The clause has to compare a column of the arrow table with a column
+ * of the inner relation using integer equality of the same type, so
+ * that keys can be compared as 64-bit integers.
+ */
+static bool ArrowHashJoinKey(RestrictInfo* rinfo, Index outerrelid,
+                             Relids innerrelids, Var** outerkey,
+                             Var** innerkey) {
+  OpExpr* op;
+  Var* left;
+  Var* right;
+
+  if (rinfo->pseudoconstant || !IsA(rinfo->clause, OpExpr))
+    return false;
+
+  op = (OpExpr*)rinfo->clause;
+  if (list_length(op->args) != 2)
+    return false;
+
+  switch (get_opcode(op->opno)) {
+    case F_INT2EQ:
+    case F_INT4EQ:
+    case F_INT8EQ:
+      break;
+    default:
+      return false;
+  }
+
+  left = (Var*)linitial(op->args);
+  right = (Var*)lsecond(op->args);
+  if (!IsA(left, Var) || !IsA(right, Var) || left->varlevelsup != 0 ||
+      right->varlevelsup != 0)
+    return false;
+
+  if (left->varno == outerrelid && bms_is_member(right->varno, innerrelids)) {
+    *outerkey = left;
+    *innerkey = right;
+  } else if (right->varno == outerrelid &&
+             bms_is_member(left->varno, innerrelids)) {
+    *outerkey = right;
+    *innerkey = left;
+  } else {
+    return false;
+  }
+
+  return (*outerkey)->varattno > 0;
+}
+
+/*
+ * Check that all columns of the arrow table used in the expressions
+ * are user columns, which are the only ones we can read.
+ */
+static bool ArrowHashJoinColumnsSupported(List* exprs, Index outerrelid) {
+  List* vars = pull_var_clause((Node*)exprs, PVC_RECURSE_PLACEHOLDERS);
+  ListCell* lc;
+  bool supported = true;
+
+  foreach (lc, vars) {
+    Var* var = (Var*)lfirst(lc);
+    if (var->varno == outerrelid && var->varattno <= 0)
+      supported = false;
+  }
+  list_free(vars);
+  return supported;
+}
+
+/*
+ * Create a hash join path.
+ *
+ * Rows of the arrow table that have no match are never stored in a
+ * slot, so the per-row cost is only for hashing and probing. Rows that
+ * match pay for forming the scan tuple and for the quals.
+ */
+static Path* ArrowHashJoinPath(PlannerInfo* root, RelOptInfo* joinrel,
+                               RelOptInfo* outerrel, Path* innerpath,
+                               RestrictInfo* hashinfo, List* restrictlist) {
+  CustomPath* cpath = makeNode(CustomPath);
+  double spc_seq_page_cost;
+  QualCost quals;
+
+  get_tablespace_page_costs(outerrel->reltablespace, NULL,
+                            &spc_seq_page_cost);
+  cost_qual_eval(&quals, restrictlist, root);
+
+  cpath->path.pathtype = T_CustomScan;
+  cpath->path.parent = joinrel;
+  cpath->path.pathtarget = joinrel->reltarget;
+  cpath->path.rows = joinrel->rows;
+  cpath->path.startup_cost =
+      innerpath->total_cost + innerpath->rows * cpu_operator_cost;
+  cpath->path.total_cost =
+      cpath->path.startup_cost + spc_seq_page_cost * outerrel->pages +
+      outerrel->tuples * cpu_operator_cost +
+      joinrel->rows * (cpu_tuple_cost + quals.per_tuple +
+                       outerrel->baserestrictcost.per_tuple);
+  cpath->custom_paths = list_make1(innerpath);
+  cpath->custom_private = list_make3(hashinfo, restrictlist, outerrel);
+  cpath->methods = &ArrowHashJoinPathMethods;
+
+  return &cpath->path;
+}
+
+/*
+ * Add hash join paths where the outer relation is an arrow table.
+ */
+static void ArrowHashJoinPaths(PlannerInfo* root, RelOptInfo* joinrel,
+                               RelOptInfo* outerrel, RelOptInfo* innerrel,
+                               JoinType jointype, JoinPathExtraData* extra) {
+  Path* innerpath = innerrel->cheapest_total_path;
+  RestrictInfo* hashinfo = NULL;
+  RangeTblEntry* rte;
+  Relation relation;
+  bool isarrow;
+  List* exprs;
+  ListCell* lc;
+
+  if (prev_set_join_pathlist_hook)
+    prev_set_join_pathlist_hook(root, joinrel, outerrel, innerrel, jointype,
+                                extra);
+
+  if (!ArrowEnableHashJoin || jointype != JOIN_INNER ||
+      outerrel->reloptkind != RELOPT_BASEREL ||
+      outerrel->rtekind != RTE_RELATION || innerpath == NULL ||
+      innerpath->param_info != NULL ||
+      !bms_is_empty(joinrel->lateral_relids) ||
+      !bms_is_empty(outerrel->lateral_relids))
+    return;
+
+  /* The hash table is kept in memory */
+  if (innerpath->rows * (innerrel->reltarget->width +
+                         MAXALIGN(SizeofMinimalTupleHeader)) >
+      work_mem * 1024.0)
+    return;
+
+  rte = planner_rt_fetch(outerrel->relid, root);
+  if (rte->relkind != RELKIND_RELATION || rte->inh ||
+      rte->tablesample != NULL || rte->securityQuals != NIL)
+    return;
+
+  /* Restrictions of the arrow table are applied after the join, so
+   * they should not care about how often they are evaluated. */
+  foreach (lc, outerrel->baserestrictinfo) {
+    RestrictInfo* rinfo = (RestrictInfo*)lfirst(lc);
+    if (rinfo->pseudoconstant ||
+        contain_volatile_functions((Node*)rinfo->clause))
+      return;
+  }
+
+  foreach (lc, extra->restrictlist) {
+    RestrictInfo* rinfo = (RestrictInfo*)lfirst(lc);
+    Var* outerkey;
+    Var* innerkey;
+
+    if (rinfo->pseudoconstant)
+      return;
+    if (hashinfo == NULL && ArrowHashJoinKey(rinfo, outerrel->relid,
+                                             innerrel->relids, &outerkey,
+                                             &innerkey))
+      hashinfo = rinfo;
+  }
+
+  if (hashinfo == NULL)
+    return;
+
+  /* All columns have to be plain columns, which rules out
+   * placeholders and system columns of the arrow table. */
+  foreach (lc, joinrel->reltarget->exprs) {
+    if (!IsA(lfirst(lc), Var))
+      return;
+  }
+  exprs = list_concat_copy(extract_actual_clauses(extra->restrictlist, false),
+                           extract_actual_clauses(outerrel->baserestrictinfo,
+                                                  false));
+  exprs = list_concat(exprs, joinrel->reltarget->exprs);
+  if (!ArrowHashJoinColumnsSupported(exprs, outerrel->relid))
+    return;
+
+  relation = table_open(rte->relid, NoLock);
+  isarrow = (table_slot_callbacks(relation) == &TTSOpsArrowTuple);
+  table_close(relation, NoLock);
+
+  if (isarrow)
+    add_path(joinrel, ArrowHashJoinPath(root, joinrel, outerrel, innerpath,
+                                        hashinfo, extra->restrictlist));
+}
+
+/*
+ * Find the column of the inner plan that produces a variable.
+ */
+static AttrNumber ArrowHashJoinInnerColumn(Plan* plan, Var* var) {
+  ListCell* lc;
+
+  foreach (lc, plan->targetlist) {
+    TargetEntry* tle = (TargetEntry*)lfirst(lc);
+    Var* other = (Var*)tle->expr;
+    if (IsA(other, Var) && other->varno == var->varno &&
+        other->varattno == var->varattno)
+      return tle->resno;
+  }
+  elog(ERROR, "variable not found in inner plan target list");
+  return InvalidAttrNumber; /* keep compiler quiet */
+}
+
+/*
+ * Create the plan for a hash join path.
+ *
+ * The scan tuple has the columns needed by the target list and the
+ * quals, and we record for each of them if it comes from the arrow
+ * table or the inner plan.
+ */
+static Plan* ArrowHashJoinPlan(PlannerInfo* root, RelOptInfo* rel,
+                               CustomPath* best_path, List* tlist,
+                               List* clauses, List* custom_plans) {
+  RestrictInfo* hashinfo = (RestrictInfo*)linitial(best_path->custom_private);
+  List* restrictlist = (List*)lsecond(best_path->custom_private);
+  RelOptInfo* outerrel = (RelOptInfo*)lthird(best_path->custom_private);
+  Plan* innerplan = (Plan*)linitial(custom_plans);
+  CustomScan* cscan = makeNode(CustomScan);
+  List* scan_tlist = NIL;
+  List* sources = NIL;
+  Var* outerkey;
+  Var* innerkey;
+  List* quals;
+  List* vars;
+  ListCell* lc;
+
+  ArrowHashJoinKey(hashinfo, outerrel->relid,
+                   bms_difference(rel->relids, outerrel->relids), &outerkey,
+                   &innerkey);
+
+  quals = extract_actual_clauses(
+      list_delete_ptr(list_copy(restrictlist), hashinfo), false);
+  quals = list_concat(
+      quals, extract_actual_clauses(outerrel->baserestrictinfo, false));
+
+  vars = pull_var_clause((Node*)list_concat_copy(tlist, quals),
+                         PVC_RECURSE_PLACEHOLDERS);
+  foreach (lc, vars) {
+    Var* var = (Var*)lfirst(lc);
+
+    if (tlist_member((Expr*)var, scan_tlist))
+      continue;
+
+    scan_tlist = lappend(
+        scan_tlist, makeTargetEntry((Expr*)var, list_length(scan_tlist) + 1,
+                                    NULL, false));
+    if (var->varno == outerrel->relid)
+      sources = lappend_int(sources, var->varattno);
+    else
+      sources = lappend_int(sources, -ArrowHashJoinInnerColumn(innerplan, var));
+  }
+
+  cscan->scan.plan.targetlist = tlist;
+  cscan->scan.plan.qual = quals;
+  cscan->scan.scanrelid = 0;
+  cscan->flags = best_path->flags;
+  cscan->custom_plans = custom_plans;
+  cscan->custom_scan_tlist = scan_tlist;
+  cscan->custom_private = list_make3(
+      list_make1_oid(planner_rt_fetch(outerrel->relid, root)->relid),
+      list_make2_int(outerkey->varattno,
+                     ArrowHashJoinInnerColumn(innerplan, innerkey)),
+      sources);
+  cscan->methods = &ArrowHashJoinPlanMethods;
+
+  return &cscan->scan.plan;
+}
+
+static Node* ArrowHashJoinCreateState(CustomScan* cscan) {
+  ArrowHashJoinState* state = palloc0(sizeof(ArrowHashJoinState));
+  List* keys = (List*)lsecond(cscan->custom_private);
+  List* sources = (List*)lthird(cscan->custom_private);
+  ListCell* lc;
+
+  NodeSetTag(state, T_CustomScanState);
+  state->css.methods = &ArrowHashJoinExecMethods;
+  state->relid = linitial_oid((List*)linitial(cscan->custom_private));
+  state->outerkey = linitial_int(keys);
+  state->innerkey = lsecond_int(keys);
+  state->nsources = list_length(sources);
+  state->sources = palloc(Max(state->nsources, 1) * sizeof(AttrNumber));
+  foreach (lc, sources)
+    state->sources[foreach_current_index(lc)] = lfirst_int(lc);
+  state->match = -1;
+
+  return (Node*)state;
+}
+
+static void ArrowHashJoinBegin(CustomScanState* node, EState* estate,
+                               int eflags) {
+  ArrowHashJoinState* state = (ArrowHashJoinState*)node;
+  CustomScan* cscan = (CustomScan*)node->ss.ps.plan;
+  PlanState* inner =
+      ExecInitNode((Plan*)linitial(cscan->custom_plans), estate, eflags);
+  TupleDesc tupdesc;
+
+  node->custom_ps = list_make1(inner);
+
+  state->relation = table_open(state->relid, AccessShareLock);
+  tupdesc = RelationGetDescr(state->relation);
+  state->keylen = TupleDescAttr(tupdesc, state->outerkey - 1)->attlen;
+  state->outerslot =
+      ExecInitExtraTupleSlot(estate, tupdesc, &TTSOpsArrowTuple);
+  state->innerslot = ExecInitExtraTupleSlot(estate, ExecGetResultType(inner),
+                                            &TTSOpsMinimalTuple);
+  state->hashcxt = AllocSetContextCreate(
+      estate->es_query_cxt, "ArrowHashJoin", ALLOCSET_DEFAULT_SIZES);
+}
+
+static inline int64 ArrowHashJoinKeyValue(Datum datum, int16 keylen) {
+  switch (keylen) {
+    case 2:
+      return DatumGetInt16(datum);
+    case 4:
+      return DatumGetInt32(datum);
+    default:
+      return DatumGetInt64(datum);
+  }
+}
+
+/*
+ * Build the hash table from the inner plan.
+ *
+ * Rows are inserted in reverse, so that the chain for each key returns
+ * them in the order of the inner plan.
+ */
+static void ArrowHashJoinBuild(ArrowHashJoinState* state) {
+  PlanState* inner = (PlanState*)linitial(state->css.custom_ps);
+  MemoryContext oldcxt = MemoryContextSwitchTo(state->hashcxt);
+  int32 size = 1024;
+  int64* keys = palloc(size * sizeof(int64));
+  uint32 nbuckets;
+
+  state->tuples = palloc(size * sizeof(MinimalTuple));
+  state->ntuples = 0;
+
+  for (;;) {
+    TupleTableSlot* slot = ExecProcNode(inner);
+    bool isnull;
+    Datum key;
+
+    if (TupIsNull(slot))
+      break;
+
+    /* Nulls never match */
+    key = slot_getattr(slot, state->innerkey, &isnull);
+    if (isnull)
+      continue;
+
+    if (state->ntuples == size) {
+      size *= 2;
+      keys = repalloc(keys, size * sizeof(int64));
+      state->tuples = repalloc(state->tuples, size * sizeof(MinimalTuple));
+    }
+    keys[state->ntuples] = ArrowHashJoinKeyValue(key, state->keylen);
+    state->tuples[state->ntuples] = ExecCopySlotMinimalTuple(slot);
+    ++state->ntuples;
+  }
+
+  nbuckets = pg_nextpower2_32(Max(2 * state->ntuples, 16));
+  state->mask = nbuckets - 1;
+  state->buckets = palloc(nbuckets * sizeof(ArrowHashBucket));
+  for (uint32 i = 0; i < nbuckets; ++i)
+    state->buckets[i].head = -1;
+  state->next = palloc(Max(state->ntuples, 1) * sizeof(int32));
+
+  for (int32 t = state->ntuples - 1; t >= 0; --t) {
+    uint64 h = murmurhash64((uint64)keys[t]) & state->mask;
+    while (state->buckets[h].head >= 0 && state->buckets[h].key != keys[t])
+      h = (h + 1) & state->mask;
+    state->buckets[h].key = keys[t];
+    state->next[t] = state->buckets[h].head;
+    state->buckets[h].head = t;
+  }
+
+  pfree(keys);
+  state->built = true;
+  MemoryContextSwitchTo(oldcxt);
+
+  DEBUG_LOG("built hash table with %d rows and %u buckets", state->ntuples,
+            nbuckets);
+}
+
+/*
+ * Read the next batch of rows of the arrow table and probe the hash
+ * table with them.
+ *
+ * Returns false if there are no more rows.
+ */
+static bool ArrowHashJoinNextBatch(ArrowHashJoinState* state) {
+  TupleTableSlot* slot = state->outerslot;
+  int n = 0;
+
+  while (n < ARROW_CHUNK_ROWS &&
+         table_scan_getnextslot(state->scan, ForwardScanDirection, slot))
+    state->rows[n++] = ArrowItemPointerGetRow(&slot->tts_tid);
+
+  if (n == 0)
+    return false;
+
+  ArrowArrayGatherInt(state->keycolumn, state->keylen, state->rows, n,
+                      state->keys, state->isnull);
+
+  for (int i = 0; i < n; ++i)
+    state->hashes[i] = murmurhash64((uint64)state->keys[i]);
+
+  state->nmatched = 0;
+  for (int i = 0; i < n; ++i) {
+    uint64 h = state->hashes[i] & state->mask;
+
+    if (state->isnull[i])
+      continue;
+
+    while (state->buckets[h].head >= 0) {
+      if (state->buckets[h].key == state->keys[i]) {
+        state->matched[state->nmatched] = state->rows[i];
+        state->matches[state->nmatched] = state->buckets[h].head;
+        ++state->nmatched;
+        break;
+      }
+      h = (h + 1) & state->mask;
+    }
+  }
+  state->pos = 0;
+
+  return true;
+}
+
+static TupleTableSlot* ArrowHashJoinNext(ScanState* ss) {
+  ArrowHashJoinState* state = (ArrowHashJoinState*)ss;
+  TupleTableSlot* scanslot = ss->ss_ScanTupleSlot;
+  const RelFileNumber relnumber = state->relation->rd_locator.relNumber;
+
+  if (!state->built)
+    ArrowHashJoinBuild(state);
+
+  if (state->ntuples == 0)
+    return NULL;
+
+  if (state->scan == NULL) {
+    TupleDesc tupdesc = RelationGetDescr(state->relation);
+    state->scan = table_beginscan(state->relation, ss->ps.state->es_snapshot,
+                                  0, NULL);
+
+    /* The key column is read directly */
+    ArrowDeltaMerge(state->relation);
+    state->keycolumn = ArrowArrayGet(
+        relnumber, TupleDescAttr(tupdesc, state->outerkey - 1), O_RDWR);
+    state->nmatched = 0;
+    state->pos = 0;
+    state->match = -1;
+  }
+
+  while (state->match < 0) {
+    if (state->pos >= state->nmatched) {
+      CHECK_FOR_INTERRUPTS();
+      if (!ArrowHashJoinNextBatch(state))
+        return NULL;
+      continue;
+    }
+    ExecStoreArrowRow(state->outerslot, relnumber,
+                      state->matched[state->pos]);
+    state->match = state->matches[state->pos];
+    ++state->pos;
+  }
+
+  ExecStoreMinimalTuple(state->tuples[state->match], state->innerslot, false);
+  state->match = state->next[state->match];
+
+  ExecClearTuple(scanslot);
+  for (int i = 0; i < state->nsources; ++i) {
+    const AttrNumber source = state->sources[i];
+    if (source > 0)
+      scanslot->tts_values[i] =
+          slot_getattr(state->outerslot, source, &scanslot->tts_isnull[i]);
+    else
+      scanslot->tts_values[i] =
+          slot_getattr(state->innerslot, -source, &scanslot->tts_isnull[i]);
+  }
+  return ExecStoreVirtualTuple(scanslot);
+}
+
+static bool ArrowHashJoinRecheck(ScanState* ss, TupleTableSlot* slot) {
+  return true;
+}
+
+static TupleTableSlot* ArrowHashJoinExec(CustomScanState* node) {
+  return ExecScan(&node->ss, ArrowHashJoinNext, ArrowHashJoinRecheck);
+}
+
+static void ArrowHashJoinEnd(CustomScanState* node) {
+  ArrowHashJoinState* state = (ArrowHashJoinState*)node;
+
+  ExecEndNode((PlanState*)linitial(node->custom_ps));
+  if (state->scan != NULL)
+    table_endscan(state->scan);
+  table_close(state->relation, NoLock);
+  MemoryContextDelete(state->hashcxt);
+}
+
+/*
+ * Rescan the join.
+ *
+ * The hash table is kept unless parameters of the inner plan changed,
+ * in which case the inner plan is rescanned when it is next called.
+ */
+static void ArrowHashJoinRescan(CustomScanState* node) {
+  ArrowHashJoinState* state = (ArrowHashJoinState*)node;
+  PlanState* inner = (PlanState*)linitial(node->custom_ps);
+
+  if (state->scan != NULL)
+    table_endscan(state->scan);
+  state->scan = NULL;
+  state->nmatched = 0;
+  state->pos = 0;
+  state->match = -1;
+
+  if (node->ss.ps.chgParam != NULL)
+    UpdateChangedParamSet(inner, node->ss.ps.chgParam);
+  if (inner->chgParam != NULL) {
+    MemoryContextReset(state->hashcxt);
+    state->built = false;
+  }
+
+  ExecScanReScan(&node->ss);
+}
+
+static void ArrowHashJoinExplain(CustomScanState* node, List* ancestors,
+                                 ExplainState* es) {
+  ArrowHashJoinState* state = (ArrowHashJoinState*)node;
+  ExplainPropertyText("Probe Column",
+                      get_attname(state->relid, state->outerkey, false), es);
+}
+
+/*
+ * Install the planner hook and register the scan methods.
+ */
+void ArrowHashJoinInit(void) {
+  RegisterCustomScanMethods(&ArrowHashJoinPlanMethods);
+  prev_set_join_pathlist_hook = set_join_pathlist_hook;
+  set_join_pathlist_hook = ArrowHashJoinPaths;
+}
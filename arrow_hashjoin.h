@@ -0,0 +1,44 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Hash joins probing arrow tables.
+ *
+ * For inner equi-joins on an integer column of an arrow table, we add
+ * a custom join path that builds a hash table from the other side of
+ * the join and then probes it with the key column of the arrow table
+ * directly. Rows are read in batches of up to a chunk: the keys are
+ * copied from the data buffers of the column, hashed, and looked up
+ * in an open-addressing table, each step as a separate loop over the
+ * batch. Only rows with a match are stored in a slot, so the other
+ * columns are only read for rows that are part of the result.
+ *
+ * The hash table has to fit in work_mem, and restrictions on the
+ * arrow table are applied to the joined rows.
+ */
+
+#ifndef ARROW_HASHJOIN_H_
+#define ARROW_HASHJOIN_H_
+
+#include <postgres.h>
+
+extern bool ArrowEnableHashJoin;
+
+void ArrowHashJoinInit(void);
+
+#endif /* ARROW_HASHJOIN_H_ */
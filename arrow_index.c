@@ -0,0 +1,593 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_index.h"
+
+#include <postgres.h>
+
+#include <access/amapi.h>
+#include <access/genam.h>
+#include <access/relscan.h>
+#include <access/stratnum.h>
+#include <access/tableam.h>
+#include <catalog/index.h>
+#include <commands/vacuum.h>
+#include <miscadmin.h>
+#include <nodes/tidbitmap.h>
+#include <storage/lmgr.h>
+#include <utils/rel.h>
+#include <utils/selfuncs.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_storage.h"
+#include "arrow_tts.h"
+#include "debug.h"
+
+PG_FUNCTION_INFO_V1(arrow_sorted_handler);
+
+/**
+ * Entries collected during an index build.
+ */
+typedef struct ArrowIndexBuildState {
+  ArrowIndexEntry* entries;
+  int64 nentries;
+  int64 size;
+} ArrowIndexBuildState;
+
+/**
+ * State of an index scan.
+ *
+ * All matching rows are collected on the first call, since the sorted
+ * part can change between calls.
+ */
+typedef struct ArrowIndexScanOpaque {
+  ItemPointerData* tids; /* Matching rows */
+  int64 ntids;
+  int64 size;
+  int64 next; /* Next row to return */
+  bool searched;
+} ArrowIndexScanOpaque;
+
+static IndexBuildResult* arrow_sorted_build(Relation heap, Relation index,
+                                            IndexInfo* indexInfo);
+
+bool RelationIsArrowIndex(Relation relation) {
+  return relation->rd_rel->relkind == RELKIND_INDEX &&
+         relation->rd_indam != NULL &&
+         relation->rd_indam->ambuild == arrow_sorted_build;
+}
+
+static ArrowArray* ArrowIndexMetaArray(RelFileNumber relnumber, int oflags) {
+  return ArrowArrayOpen(relnumber, ARROW_INDEX_META_ATTNO,
+                        sizeof(ArrowIndexMeta), oflags);
+}
+
+static ArrowArray* ArrowIndexEntries(RelFileNumber relnumber, int oflags) {
+  return ArrowArrayOpen(relnumber, ARROW_INDEX_ENTRIES_ATTNO,
+                        sizeof(ArrowIndexEntry), oflags);
+}
+
+static ArrowIndexMeta* ArrowIndexMetaGet(Relation index) {
+  ArrowArray* meta = ArrowIndexMetaArray(index->rd_locator.relNumber, O_RDWR);
+  return (ArrowIndexMeta*)ArrowArrayChunkData(meta, 0);
+}
+
+static inline ArrowIndexEntry* ArrowIndexEntryAt(ArrowArray* entries,
+                                                 int64 n) {
+  ArrowIndexEntry* chunk = ArrowArrayChunkData(entries, n / ARROW_CHUNK_ROWS);
+  return &chunk[n % ARROW_CHUNK_ROWS];
+}
+
+/*
+ * Convert a key to a 64-bit integer.
+ *
+ * The operator classes only contain operators for a single integer
+ * type, so the length of the key type is enough to convert it.
+ */
+static int64 ArrowIndexKey(Relation index, Datum datum) {
+  switch (TupleDescAttr(RelationGetDescr(index), 0)->attlen) {
+    case 2:
+      return DatumGetInt16(datum);
+    case 4:
+      return DatumGetInt32(datum);
+    case 8:
+      return DatumGetInt64(datum);
+  }
+  elog(ERROR, "unsupported key type for index \"%s\"",
+       RelationGetRelationName(index));
+  pg_unreachable();
+}
+
+static int ArrowIndexEntryCmp(const void* a, const void* b) {
+  const ArrowIndexEntry* lhs = a;
+  const ArrowIndexEntry* rhs = b;
+
+  if (lhs->key != rhs->key)
+    return lhs->key < rhs->key ? -1 : 1;
+  if (lhs->row != rhs->row)
+    return lhs->row < rhs->row ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Find the first of the `n` sorted entries with a key that is not
+ * less than `key`, or that is greater than `key` if `strict` is true.
+ *
+ * The loop runs the same number of iterations for every key and the
+ * comparison only selects the next position, so the compiler can use
+ * a conditional move instead of a branch.
+ */
+static int64 ArrowIndexBound(ArrowArray* entries, int64 n, int64 key,
+                             bool strict) {
+  int64 base = 0;
+
+  if (n == 0)
+    return 0;
+
+  while (n > 1) {
+    const int64 half = n / 2;
+    const int64 probe = ArrowIndexEntryAt(entries, base + half)->key;
+    const bool before = strict ? probe <= key : probe < key;
+    base = before ? base + half : base;
+    n -= half;
+  }
+
+  {
+    const int64 probe = ArrowIndexEntryAt(entries, base)->key;
+    return base + (strict ? probe <= key : probe < key);
+  }
+}
+
+/*
+ * Sort the tail of the index and merge it into the sorted part.
+ *
+ * The tail is sorted in a local buffer and then merged from the end,
+ * so entries of the sorted part only move if their key is larger than
+ * the smallest key of the tail. The version is odd while the sorted
+ * part is modified, which makes concurrent lookups retry. This has to
+ * be called with the relation extension lock of the index held.
+ */
+static void ArrowIndexSeal(ArrowIndexMeta* meta, ArrowArray* entries) {
+  const int64 nsorted = meta->nsorted;
+  const int64 length = entries->length;
+  const int64 ntail = length - nsorted;
+  ArrowIndexEntry* tail = palloc(ntail * sizeof(ArrowIndexEntry));
+  int64 i = nsorted - 1;
+  int64 j = ntail - 1;
+  int64 k = length - 1;
+
+  for (int64 n = 0; n < ntail; ++n)
+    tail[n] = *ArrowIndexEntryAt(entries, nsorted + n);
+  qsort(tail, ntail, sizeof(ArrowIndexEntry), ArrowIndexEntryCmp);
+
+  pg_atomic_fetch_add_u64(&meta->version, 1);
+
+  while (j >= 0) {
+    ArrowIndexEntry* entry = i >= 0 ? ArrowIndexEntryAt(entries, i) : NULL;
+    if (entry != NULL && ArrowIndexEntryCmp(entry, &tail[j]) > 0) {
+      *ArrowIndexEntryAt(entries, k--) = *entry;
+      --i;
+    } else {
+      *ArrowIndexEntryAt(entries, k--) = tail[j--];
+    }
+  }
+  meta->nsorted = length;
+
+  pg_atomic_fetch_add_u64(&meta->version, 1);
+
+  pfree(tail);
+}
+
+/*
+ * Schedule the segments of earlier storage of an index for unlinking
+ * at commit.
+ *
+ * Rebuilding an index (REINDEX, TRUNCATE, or compaction of the table)
+ * gives it a new relation file number without telling the access
+ * method about the old one, so the old segments are found using the
+ * index OID stored in the meta segment.
+ */
+static void ArrowIndexUnlinkOld(Relation index) {
+  List* keys = ArrowSegmentList();
+  ListCell* lc;
+
+  foreach (lc, keys) {
+    ArrowSegmentKey* key = lfirst(lc);
+    ArrowIndexMeta meta;
+
+    if (key->bk_dbid != MyDatabaseId ||
+        key->bk_attno != ARROW_INDEX_META_ATTNO ||
+        key->bk_relnumber == index->rd_locator.relNumber)
+      continue;
+
+    if (ArrowSegmentReadFirst(key, &meta, sizeof(meta)) &&
+        meta.indexrelid == RelationGetRelid(index))
+      ArrowScheduleUnlink(MyDatabaseId, key->bk_relnumber, true);
+  }
+  list_free_deep(keys);
+}
+
+static void ArrowIndexBuildCallback(Relation index, ItemPointer tid,
+                                    Datum* values, bool* isnull,
+                                    bool tupleIsAlive, void* state) {
+  ArrowIndexBuildState* bs = (ArrowIndexBuildState*)state;
+  ArrowIndexEntry* entry;
+
+  if (isnull[0])
+    return;
+
+  if (bs->nentries >= bs->size) {
+    bs->size *= 2;
+    bs->entries =
+        repalloc_huge(bs->entries, bs->size * sizeof(ArrowIndexEntry));
+  }
+
+  entry = &bs->entries[bs->nentries++];
+  entry->key = ArrowIndexKey(index, values[0]);
+  entry->row = ArrowItemPointerGetRow(tid);
+}
+
+static IndexBuildResult* arrow_sorted_build(Relation heap, Relation index,
+                                            IndexInfo* indexInfo) {
+  const RelFileNumber relnumber = index->rd_locator.relNumber;
+  IndexBuildResult* result;
+  ArrowIndexBuildState state;
+  ArrowArray* metaarray;
+  ArrowArray* entries;
+  ArrowIndexMeta* meta;
+  double reltuples;
+
+  DEBUG_ENTER("index: %s", RelationGetRelationName(index));
+
+  if (table_slot_callbacks(heap) != &TTSOpsArrowTuple)
+    ereport(ERROR,
+            (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+             errmsg("index \"%s\" can only be created on arrow tables",
+                    RelationGetRelationName(index))));
+
+  /*
+   * The segments should go away if the transaction aborts. The index
+   * can be rebuilt with the same relation file number when the table
+   * was created in the same transaction, so existing segments are
+   * reused.
+   */
+  ArrowIndexUnlinkOld(index);
+  ArrowScheduleUnlink(MyDatabaseId, relnumber, false);
+
+  metaarray = ArrowIndexMetaArray(relnumber, O_RDWR | O_CREAT);
+  ArrowArrayReset(metaarray);
+  ArrowArrayReserve(metaarray, 1);
+  meta = (ArrowIndexMeta*)ArrowArrayChunkData(metaarray, 0);
+  meta->indexrelid = RelationGetRelid(index);
+  pg_atomic_init_u64(&meta->version, 0);
+  meta->nsorted = 0;
+  ArrowArrayExtend(metaarray, 1);
+
+  entries = ArrowIndexEntries(relnumber, O_RDWR | O_CREAT);
+  ArrowArrayReset(entries);
+
+  state.size = 1024;
+  state.nentries = 0;
+  state.entries = palloc(state.size * sizeof(ArrowIndexEntry));
+  reltuples = table_index_build_scan(heap, index, indexInfo, true, false,
+                                     ArrowIndexBuildCallback, &state, NULL);
+
+  qsort(state.entries, state.nentries, sizeof(ArrowIndexEntry),
+        ArrowIndexEntryCmp);
+
+  ArrowArrayReserve(entries, state.nentries);
+  for (int64 n = 0; n < state.nentries; ++n)
+    *ArrowIndexEntryAt(entries, n) = state.entries[n];
+  ArrowArrayExtend(entries, state.nentries);
+  meta->nsorted = state.nentries;
+
+  pfree(state.entries);
+
+  result = palloc(sizeof(IndexBuildResult));
+  result->heap_tuples = reltuples;
+  result->index_tuples = state.nentries;
+
+  DEBUG_LEAVE("index: %s, entries: %ld", RelationGetRelationName(index),
+              state.nentries);
+  return result;
+}
+
+static void arrow_sorted_buildempty(Relation index) {
+  /* nothing to do, entries are only kept in memory */
+}
+
+static bool arrow_sorted_insert(Relation index, Datum* values, bool* isnull,
+                                ItemPointer tid, Relation heap,
+                                IndexUniqueCheck checkUnique,
+                                bool indexUnchanged, IndexInfo* indexInfo) {
+  const RelFileNumber relnumber = index->rd_locator.relNumber;
+  ArrowIndexMeta* meta;
+  ArrowArray* entries;
+  ArrowIndexEntry* entry;
+
+  if (isnull[0])
+    return false;
+
+  LockRelationForExtension(index, ExclusiveLock);
+
+  meta = ArrowIndexMetaGet(index);
+  entries = ArrowIndexEntries(relnumber, O_RDWR);
+  ArrowArrayReserve(entries, 1);
+  entry = ArrowIndexEntryAt(entries, entries->length);
+  entry->key = ArrowIndexKey(index, values[0]);
+  entry->row = ArrowItemPointerGetRow(tid);
+  ArrowArrayExtend(entries, 1);
+
+  if (entries->length - meta->nsorted >= ARROW_CHUNK_ROWS)
+    ArrowIndexSeal(meta, entries);
+
+  UnlockRelationForExtension(index, ExclusiveLock);
+
+  return false;
+}
+
+/*
+ * Rows are never removed from arrow tables by VACUUM, only by
+ * compaction, which rebuilds the indexes, so there is nothing to do
+ * here.
+ */
+static IndexBulkDeleteResult* arrow_sorted_bulkdelete(
+    IndexVacuumInfo* info, IndexBulkDeleteResult* stats,
+    IndexBulkDeleteCallback callback, void* callback_state) {
+  if (stats == NULL)
+    stats = palloc0(sizeof(IndexBulkDeleteResult));
+  return stats;
+}
+
+static IndexBulkDeleteResult* arrow_sorted_vacuumcleanup(
+    IndexVacuumInfo* info, IndexBulkDeleteResult* stats) {
+  if (stats == NULL) {
+    stats = palloc0(sizeof(IndexBulkDeleteResult));
+    stats->num_index_tuples =
+        ArrowIndexEntries(info->index->rd_locator.relNumber, O_RDWR)->length;
+  }
+  return stats;
+}
+
+static void arrow_sorted_costestimate(PlannerInfo* root, IndexPath* path,
+                                      double loop_count,
+                                      Cost* indexStartupCost,
+                                      Cost* indexTotalCost,
+                                      Selectivity* indexSelectivity,
+                                      double* indexCorrelation,
+                                      double* indexPages) {
+  GenericCosts costs = {0};
+
+  genericcostestimate(root, path, loop_count, &costs);
+
+  *indexStartupCost = costs.indexStartupCost;
+  *indexTotalCost = costs.indexTotalCost;
+  *indexSelectivity = costs.indexSelectivity;
+  *indexCorrelation = costs.indexCorrelation;
+  *indexPages = costs.numIndexPages;
+}
+
+static bytea* arrow_sorted_options(Datum reloptions, bool validate) {
+  return NULL;
+}
+
+static bool arrow_sorted_validate(Oid opclassoid) {
+  return true;
+}
+
+static IndexScanDesc arrow_sorted_beginscan(Relation index, int nkeys,
+                                            int norderbys) {
+  IndexScanDesc scan = RelationGetIndexScan(index, nkeys, norderbys);
+  scan->opaque = palloc0(sizeof(ArrowIndexScanOpaque));
+  return scan;
+}
+
+static void arrow_sorted_rescan(IndexScanDesc scan, ScanKey keys, int nkeys,
+                                ScanKey orderbys, int norderbys) {
+  ArrowIndexScanOpaque* so = (ArrowIndexScanOpaque*)scan->opaque;
+
+  if (keys && scan->numberOfKeys > 0)
+    memmove(scan->keyData, keys, scan->numberOfKeys * sizeof(ScanKeyData));
+  so->searched = false;
+  so->ntids = 0;
+  so->next = 0;
+}
+
+static void ArrowIndexAddRow(ArrowIndexScanOpaque* so, int64 row) {
+  if (so->ntids >= so->size) {
+    so->size = Max(so->size * 2, 64);
+    so->tids = so->tids ? repalloc_huge(so->tids, so->size * sizeof(*so->tids))
+                        : palloc(so->size * sizeof(*so->tids));
+  }
+  ArrowRowSetItemPointer(&so->tids[so->ntids++], row);
+}
+
+/*
+ * Collect the rows with keys in the range given by the scan keys.
+ */
+static void ArrowIndexSearch(IndexScanDesc scan) {
+  ArrowIndexScanOpaque* so = (ArrowIndexScanOpaque*)scan->opaque;
+  Relation index = scan->indexRelation;
+  int64 low = PG_INT64_MIN;
+  int64 high = PG_INT64_MAX;
+  ArrowIndexMeta* meta;
+  ArrowArray* entries;
+
+  so->searched = true;
+  so->ntids = 0;
+  so->next = 0;
+
+  /* Turn the scan keys into an inclusive range */
+  for (int i = 0; i < scan->numberOfKeys; ++i) {
+    ScanKey skey = &scan->keyData[i];
+    int64 value;
+
+    if (skey->sk_flags & SK_ISNULL)
+      return;
+
+    value = ArrowIndexKey(index, skey->sk_argument);
+    switch (skey->sk_strategy) {
+      case BTLessStrategyNumber:
+        if (value == PG_INT64_MIN)
+          return;
+        high = Min(high, value - 1);
+        break;
+      case BTLessEqualStrategyNumber:
+        high = Min(high, value);
+        break;
+      case BTEqualStrategyNumber:
+        low = Max(low, value);
+        high = Min(high, value);
+        break;
+      case BTGreaterEqualStrategyNumber:
+        low = Max(low, value);
+        break;
+      case BTGreaterStrategyNumber:
+        if (value == PG_INT64_MAX)
+          return;
+        low = Max(low, value + 1);
+        break;
+      default:
+        elog(ERROR, "unrecognized strategy number: %d", skey->sk_strategy);
+    }
+  }
+
+  if (low > high)
+    return;
+
+  meta = ArrowIndexMetaGet(index);
+  entries = ArrowIndexEntries(index->rd_locator.relNumber, O_RDWR);
+
+  for (;;) {
+    const uint64 version = pg_atomic_read_u64(&meta->version);
+    int64 nsorted;
+    int64 first;
+    int64 last;
+
+    CHECK_FOR_INTERRUPTS();
+
+    if (version % 2 != 0) {
+      pg_spin_delay();
+      continue;
+    }
+
+    pg_read_barrier();
+    nsorted = meta->nsorted;
+    ArrowArrayRefresh(entries);
+
+    first = ArrowIndexBound(entries, nsorted, low, false);
+    last = ArrowIndexBound(entries, nsorted, high, true);
+    for (int64 n = first; n < last; ++n)
+      ArrowIndexAddRow(so, ArrowIndexEntryAt(entries, n)->row);
+
+    for (int64 n = nsorted; n < entries->length; ++n) {
+      ArrowIndexEntry* entry = ArrowIndexEntryAt(entries, n);
+      if (entry->key >= low && entry->key <= high)
+        ArrowIndexAddRow(so, entry->row);
+    }
+
+    pg_read_barrier();
+    if (pg_atomic_read_u64(&meta->version) == version)
+      break;
+
+    /* The sorted part changed while we were reading it */
+    so->ntids = 0;
+  }
+}
+
+static bool arrow_sorted_gettuple(IndexScanDesc scan, ScanDirection dir) {
+  ArrowIndexScanOpaque* so = (ArrowIndexScanOpaque*)scan->opaque;
+
+  if (!so->searched)
+    ArrowIndexSearch(scan);
+
+  if (so->next >= so->ntids)
+    return false;
+
+  scan->xs_heaptid = so->tids[so->next++];
+  scan->xs_recheck = false;
+  return true;
+}
+
+static int64 arrow_sorted_getbitmap(IndexScanDesc scan, TIDBitmap* tbm) {
+  ArrowIndexScanOpaque* so = (ArrowIndexScanOpaque*)scan->opaque;
+
+  ArrowIndexSearch(scan);
+  tbm_add_tuples(tbm, so->tids, so->ntids, false);
+  return so->ntids;
+}
+
+static void arrow_sorted_endscan(IndexScanDesc scan) {
+  ArrowIndexScanOpaque* so = (ArrowIndexScanOpaque*)scan->opaque;
+
+  if (so->tids)
+    pfree(so->tids);
+  pfree(so);
+}
+
+Datum arrow_sorted_handler(PG_FUNCTION_ARGS) {
+  IndexAmRoutine* amroutine = makeNode(IndexAmRoutine);
+
+  amroutine->amstrategies = BTMaxStrategyNumber;
+  amroutine->amsupport = 0;
+  amroutine->amoptsprocnum = 0;
+  amroutine->amcanorder = false;
+  amroutine->amcanorderbyop = false;
+  amroutine->amcanbackward = false;
+  amroutine->amcanunique = false;
+  amroutine->amcanmulticol = false;
+  amroutine->amoptionalkey = false;
+  amroutine->amsearcharray = false;
+  amroutine->amsearchnulls = false;
+  amroutine->amstorage = false;
+  amroutine->amclusterable = false;
+  amroutine->ampredlocks = false;
+  amroutine->amcanparallel = false;
+  amroutine->amcaninclude = false;
+  amroutine->amusemaintenanceworkmem = false;
+  amroutine->amsummarizing = false;
+  amroutine->amparallelvacuumoptions = VACUUM_OPTION_NO_PARALLEL;
+  amroutine->amkeytype = InvalidOid;
+
+  amroutine->ambuild = arrow_sorted_build;
+  amroutine->ambuildempty = arrow_sorted_buildempty;
+  amroutine->aminsert = arrow_sorted_insert;
+  amroutine->ambulkdelete = arrow_sorted_bulkdelete;
+  amroutine->amvacuumcleanup = arrow_sorted_vacuumcleanup;
+  amroutine->amcanreturn = NULL;
+  amroutine->amcostestimate = arrow_sorted_costestimate;
+  amroutine->amoptions = arrow_sorted_options;
+  amroutine->amproperty = NULL;
+  amroutine->ambuildphasename = NULL;
+  amroutine->amvalidate = arrow_sorted_validate;
+  amroutine->amadjustmembers = NULL;
+  amroutine->ambeginscan = arrow_sorted_beginscan;
+  amroutine->amrescan = arrow_sorted_rescan;
+  amroutine->amgettuple = arrow_sorted_gettuple;
+  amroutine->amgetbitmap = arrow_sorted_getbitmap;
+  amroutine->amendscan = arrow_sorted_endscan;
+  amroutine->ammarkpos = NULL;
+  amroutine->amrestrpos = NULL;
+  amroutine->amestimateparallelscan = NULL;
+  amroutine->aminitparallelscan = NULL;
+  amroutine->amparallelrescan = NULL;
+
+  PG_RETURN_POINTER(amroutine);
+}
@@ -0,0 +1,82 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Sorted indexes for arrow tables.
+ *
+ * A sorted index keeps a copy of the key column together with the row
+ * number of each row, sorted on the key, in segments of its own. It
+ * answers equality and range lookups using a binary search, so there
+ * is none of the page overhead of a btree.
+ *
+ * New entries are appended to an unsorted tail, which is searched
+ * linearly. When the tail has grown to a full chunk, the chunk is
+ * sealed: the tail is sorted and merged into the sorted part. The
+ * merge is done in place from the end, so only entries with keys
+ * larger than the smallest key of the tail move, which makes sealing
+ * cheap when keys are mostly increasing.
+ *
+ * Lookups do not take any locks. Instead, sealing bumps a version
+ * counter in the meta segment before and after it modifies the sorted
+ * part, and lookups that overlap with a seal are retried. Inserts are
+ * serialized using the relation extension lock of the index.
+ *
+ * Only integer keys are supported. They are stored as 64-bit integers
+ * so that comparing keys does not need any function calls.
+ */
+
+#ifndef ARROW_INDEX_H_
+#define ARROW_INDEX_H_
+
+#include <postgres.h>
+
+#include <port/atomics.h>
+#include <utils/rel.h>
+
+/**
+ * Attribute numbers used for the index segments.
+ *
+ * These are distinct from the attribute numbers used for tables, so
+ * segments of indexes and tables can be told apart.
+ */
+#define ARROW_INDEX_META_ATTNO -3
+#define ARROW_INDEX_ENTRIES_ATTNO -4
+
+/**
+ * Meta data of a sorted index.
+ *
+ * The index OID is stored so that segments of earlier storage of the
+ * index can be found when it is rebuilt.
+ */
+typedef struct ArrowIndexMeta {
+  Oid indexrelid;           /* Index the segments belong to */
+  pg_atomic_uint64 version; /* Odd while the sorted part changes */
+  int64 nsorted;            /* Number of entries in the sorted part */
+} ArrowIndexMeta;
+
+/**
+ * Entry of a sorted index.
+ */
+typedef struct ArrowIndexEntry {
+  int64 key; /* Key, as a 64-bit integer */
+  int64 row; /* Row number in the table */
+} ArrowIndexEntry;
+
+bool RelationIsArrowIndex(Relation relation);
+
+#endif /* ARROW_INDEX_H_ */
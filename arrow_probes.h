@@ -0,0 +1,84 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Static probes for tracing arrow tables in production.
+ *
+ * The probes are USDT probes, defined the same way as the probes of
+ * PostgreSQL itself, so they are only compiled in when PostgreSQL was
+ * configured with --enable-dtrace. A probe that nobody is attached to
+ * is a single no-op instruction, so unlike the DEBUG_ENTER() tracing,
+ * which needs a build with AM_TRACE, they can stay enabled. The probes
+ * are in the `arrow` provider, for example:
+ *
+ *    bpftrace -e 'usdt:arrow.so:arrow:insert__batch { @[arg0] = sum(arg2); }'
+ */
+
+#ifndef ARROW_PROBES_H_
+#define ARROW_PROBES_H_
+
+#include <postgres.h>
+
+#ifdef ENABLE_DTRACE
+
+#include <sys/sdt.h>
+
+/* Scan of a relation started or ended, with the rows returned */
+#define TRACE_ARROW_SCAN_START(RELNUMBER) \
+  DTRACE_PROBE1(arrow, scan__start, RELNUMBER)
+#define TRACE_ARROW_SCAN_DONE(RELNUMBER, NROWS) \
+  DTRACE_PROBE2(arrow, scan__done, RELNUMBER, NROWS)
+
+/* Segment mapped into the backend, with the bytes mapped */
+#define TRACE_ARROW_SEGMENT_OPEN_START(RELNUMBER, ATTNO) \
+  DTRACE_PROBE2(arrow, segment__open__start, RELNUMBER, ATTNO)
+#define TRACE_ARROW_SEGMENT_OPEN_DONE(RELNUMBER, ATTNO, MAPPED) \
+  DTRACE_PROBE3(arrow, segment__open__done, RELNUMBER, ATTNO, MAPPED)
+
+/* Segment resized, with the old and new size in bytes */
+#define TRACE_ARROW_SEGMENT_RESIZE(RELNUMBER, ATTNO, OLDSIZE, SIZE) \
+  DTRACE_PROBE4(arrow, segment__resize, RELNUMBER, ATTNO, OLDSIZE, SIZE)
+
+/* Rows appended to the relation by a single insert or load batch */
+#define TRACE_ARROW_INSERT_BATCH(RELNUMBER, FIRST, NROWS) \
+  DTRACE_PROBE3(arrow, insert__batch, RELNUMBER, FIRST, NROWS)
+
+#else
+
+#define TRACE_ARROW_SCAN_START(RELNUMBER) \
+  do {                                    \
+  } while (0)
+#define TRACE_ARROW_SCAN_DONE(RELNUMBER, NROWS) \
+  do {                                          \
+  } while (0)
+#define TRACE_ARROW_SEGMENT_OPEN_START(RELNUMBER, ATTNO) \
+  do {                                                   \
+  } while (0)
+#define TRACE_ARROW_SEGMENT_OPEN_DONE(RELNUMBER, ATTNO, MAPPED) \
+  do {                                                          \
+  } while (0)
+#define TRACE_ARROW_SEGMENT_RESIZE(RELNUMBER, ATTNO, OLDSIZE, SIZE) \
+  do {                                                              \
+  } while (0)
+#define TRACE_ARROW_INSERT_BATCH(RELNUMBER, FIRST, NROWS) \
+  do {                                                    \
+  } while (0)
+
+#endif /* ENABLE_DTRACE */
+
+#endif /* ARROW_PROBES_H_ */
@@ -22,19 +22,64 @@
 #include <postgres.h>
 
 #include <access/heapam.h>
+#include <access/relscan.h>
 #include <executor/tuptable.h>
 #include <utils/relcache.h>
 
 #include "arrow_storage.h"
 #include "arrow_tts.h"
+#include "arrow_visibility.h"
 
 /**
  * Arrow array scan descriptor.
+ *
+ * The scan walks the runs of the visibility segment and returns the
+ * rows of the runs that are visible to the snapshot, skipping rows
+ * that are deleted using a mask computed once for each chunk. Parallel
+ * scans claim chunks the way heap scans claim blocks, and only return
+ * the rows of the runs that are in the claimed chunk.
+ *
+ * Bitmap scans instead resolve the visibility of all rows of a block
+ * at once, when moving to the block, and sample scans only check the
+ * rows picked by the sampling method. ANALYZE returns all rows of the
+ * chunks it picks, sorted into live and dead rows.
  */
 typedef struct ArrowScanDesc {
   TableScanDescData base;
-  int64 index;
-  int64 length;
+  ArrowArray *runs;      /* Visibility segment of the relation */
+  ArrowDeletes deletes;  /* Delete segments of the relation */
+  int64 nruns;           /* Number of runs when the scan started */
+  int64 nrows;           /* Number of rows when the scan started */
+  int64 run;             /* Next run to check */
+  int64 index;           /* Next row to return */
+  int64 end;             /* End of the current run */
+  int64 start;           /* First row of the claimed chunk */
+  int64 limit;           /* End of the claimed chunk */
+  int64 chunk;           /* Chunk that the mask is for, or -1 */
+  bool masked;           /* Chunk has deletes and the mask is valid */
+  int64 nscanned;        /* Rows returned, added to the counters */
+  uint64 mask[ARROW_CHUNK_WORDS]; /* Rows of chunk not deleted */
+
+  /* Chunks claimed by this participant of a parallel scan */
+  ParallelBlockTableScanWorkerData pscanwork;
+  bool pscanstarted;
+
+  /* Visible rows of the current block of a bitmap scan, as positions
+   * in the chunk. */
+  int ntuples;
+  int tuple;
+  uint16 tuples[ARROW_CHUNK_ROWS];
+
+  /* Run of the last row checked by a sample scan or ANALYZE. Only the
+   * bounds are kept, since the visibility segment can be remapped. */
+  int64 sample_first;    /* First row of the run */
+  int64 sample_end;      /* End of the run, or 0 if there is none */
+  bool sample_visible;   /* The run is visible to the snapshot */
+  bool sample_aborted;   /* The inserting transaction aborted */
+
+  /* Rows of the current chunk of ANALYZE that are not in the dead
+   * bitmap, valid if the mask is. */
+  uint64 kept[ARROW_CHUNK_WORDS];
 } ArrowScanDesc;
 
 #endif /* ARROW_SCAN_H_*/
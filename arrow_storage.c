@@ -29,7 +29,12 @@
 
 #include <postgres.h>
 
+#include <access/xact.h>
+#include <access/xlog.h>
+#include <port/atomics.h>
+#include <storage/fd.h>
 #include <utils/catcache.h>
+#include <utils/memutils.h>
 
 #include <fcntl.h> /* For O_* constants */
 #include <limits.h>
@@ -38,27 +43,271 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "arrow_probes.h"
 #include "arrow_tts.h"
 #include "debug.h"
 
+/*
+ * Directory where POSIX shared memory objects are visible as
+ * files. This is where shm_open(3) place segments on Linux.
+ */
+#define ARROW_SHM_DIR "/dev/shm"
+
+/*
+ * Name of the shared memory object used to account for the memory
+ * reserved by all segments of a cluster, given the system identifier
+ * of the cluster.
+ */
+#define ARROW_ACCOUNTING_FORMAT "/arrow." UINT64_FORMAT ".accounting"
+
 size_t ArrowPageSize;
 
-void ArrowSegmentInit(ArrowSegment* segment, Form_pg_attribute attr) {
-  const size_t bytes = (ArrowPageSize - sizeof(ArrowSegment)) / 8;
-  const size_t validity_buffer_size = 64 * (bytes / 64 + 1);
+/*
+ * Maximum memory, in kilobytes, that segments may reserve. This is
+ * enforced when segments are created or grow. A value of -1 means no
+ * limit.
+ */
+int ArrowMaxMemory = -1;
+
+/*
+ * Memory accounting for all segments of the cluster.
+ *
+ * This lives in a dedicated shared memory object so that it is shared
+ * by all backends regardless of whether the module is preloaded. The
+ * backend that creates the object initializes it with the size of
+ * the segments that already exist, and if the module is preloaded,
+ * the counter is recomputed whenever the server starts, see
+ * ArrowAccountingReset().
+ */
+typedef struct ArrowAccounting {
+  pg_atomic_uint64 reserved; /* Bytes reserved by all segments */
+} ArrowAccounting;
+
+static ArrowAccounting* Accounting = NULL;
+
+/*
+ * Pending unlinks of segments for a relation.
+ *
+ * This works the same way as the pending deletes for relation files
+ * in PostgreSQL: segments for relations that are dropped (or given a
+ * new relation file number) are unlinked when the transaction commits
+ * and segments that were created in the transaction are unlinked if
+ * the transaction aborts.
+ */
+typedef struct PendingUnlink {
+  Oid dbid;                  /* Database of the relation */
+  RelFileNumber relnumber;   /* Relation file number */
+  bool atCommit;             /* T=unlink at commit; F=unlink at abort */
+  int nestLevel;             /* Transaction nesting level of request */
+  struct PendingUnlink* next;
+} PendingUnlink;
+
+static PendingUnlink* pendingUnlinks = NULL;
+
+void ArrowSegmentInit(ArrowSegment* segment, int16 attlen, size_t size) {
+  const size_t data_size =
+      TYPEALIGN(ARROW_ALIGNMENT, attlen == ARROW_BITMAP_ATTLEN
+                                     ? ARROW_CHUNK_ROWS / 8
+                                     : ARROW_CHUNK_ROWS * Max(attlen, 0));
+  const size_t validity_size = TYPEALIGN(ARROW_ALIGNMENT, ARROW_CHUNK_ROWS / 8);
 
   memset(segment, 0, sizeof(*segment));
 
-  segment->attlen = attr->attlen;
-  segment->validity_buffer_offset = ArrowPageSize - validity_buffer_size;
-  segment->data_buffer_offset = sizeof(*segment);
+  pg_atomic_init_u64(&segment->counters.rows_scanned, 0);
+  pg_atomic_init_u64(&segment->counters.rows_inserted, 0);
+  pg_atomic_init_u64(&segment->counters.opens, 0);
+  pg_atomic_init_u64(&segment->counters.open_time, 0);
+  pg_atomic_init_u64(&segment->counters.bytes_mapped, 0);
+
+  segment->attlen = attlen;
+  segment->xmin = GetTopTransactionId();
+  segment->size = size;
+  segment->chunk_size = data_size + validity_size;
+  segment->data_buffer_offset = TYPEALIGN(ARROW_ALIGNMENT, sizeof(*segment));
+  segment->validity_buffer_offset = segment->data_buffer_offset + data_size;
   /* offset_buffer_offset not yet used */
 }
 
+/*
+ * Number of elements that fit in the first `size` bytes of a segment.
+ */
+int64 ArrowSegmentCapacity(const ArrowSegment* segment, size_t size) {
+  if (size <= segment->data_buffer_offset)
+    return 0;
+  return ARROW_CHUNK_ROWS *
+         ((size - segment->data_buffer_offset) / segment->chunk_size);
+}
+
+/*
+ * Number of bytes of the segment that are used by the elements
+ * stored.
+ */
+size_t ArrowSegmentUsed(const ArrowSegment* segment) {
+  const int64 nchunks =
+      (segment->length + ARROW_CHUNK_ROWS - 1) / ARROW_CHUNK_ROWS;
+  return segment->data_buffer_offset + nchunks * segment->chunk_size;
+}
+
+/*
+ * Sum of the sizes of all existing segments.
+ */
+static uint64 ArrowSegmentTotalSize(void) {
+  uint64 total = 0;
+  ListCell* lc;
+
+  foreach (lc, ArrowSegmentList()) {
+    ArrowSegment header;
+    size_t size;
+    if (ArrowSegmentReadHeader(lfirst(lc), &header, &size))
+      total += size;
+  }
+  return total;
+}
+
+/*
+ * Map the accounting object, creating it if necessary.
+ *
+ * Returns NULL if the object could not be mapped and `elevel` is
+ * less than ERROR.
+ */
+static ArrowAccounting* GetAccounting(int elevel) {
+  char path[64];
+  struct stat sb;
+  bool created = false;
+  void* ptr;
+  int fd;
+
+  if (Accounting)
+    return Accounting;
+
+  snprintf(path, sizeof(path), ARROW_ACCOUNTING_FORMAT, GetSystemIdentifier());
+
+  fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd >= 0)
+    created = true;
+  else if (errno == EEXIST)
+    fd = shm_open(path, O_RDWR, 0644);
+
+  if (fd < 0) {
+    ereport(elevel, (errcode_for_file_access(),
+                     errmsg("could not open path \"%s\": %m", path)));
+    return NULL;
+  }
+
+  /* The creator might not have extended the object yet, but extending
+   * it with zeroes again is harmless. */
+  if (fstat(fd, &sb) != 0 ||
+      (sb.st_size == 0 && ftruncate(fd, ArrowPageSize) != 0)) {
+    close(fd);
+    ereport(elevel, (errcode_for_file_access(),
+                     errmsg("could not extend path \"%s\": %m", path)));
+    return NULL;
+  }
+
+  ptr = mmap(NULL, ArrowPageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    ereport(elevel, (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("could not map \"%s\": %m", path)));
+    return NULL;
+  }
+
+  Accounting = ptr;
+  if (created)
+    pg_atomic_add_fetch_u64(&Accounting->reserved, ArrowSegmentTotalSize());
+  return Accounting;
+}
+
+/*
+ * Reserve memory for a segment, enforcing the memory limit.
+ */
+static void ArrowReserveMemory(size_t bytes, const char* path) {
+  ArrowAccounting* accounting = GetAccounting(ERROR);
+  uint64 reserved = pg_atomic_add_fetch_u64(&accounting->reserved, bytes);
+
+  if (ArrowMaxMemory >= 0 && reserved > (uint64)ArrowMaxMemory * 1024) {
+    pg_atomic_sub_fetch_u64(&accounting->reserved, bytes);
+    ereport(ERROR,
+            (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+             errmsg("arrow memory limit exceeded"),
+             errdetail("Could not reserve %zu bytes for segment \"%s\" since "
+                       UINT64_FORMAT
+                       " bytes are in use and the limit is %d kB.",
+                       bytes, path, reserved - bytes, ArrowMaxMemory),
+             errhint("Increase \"arrow.max_memory\", or drop or truncate "
+                     "arrow tables.")));
+  }
+}
+
+/*
+ * Release memory reserved for a segment.
+ *
+ * This is called when cleaning up, so errors are reported as
+ * warnings.
+ */
+static void ArrowReleaseMemory(size_t bytes) {
+  ArrowAccounting* accounting = GetAccounting(WARNING);
+  if (accounting)
+    pg_atomic_sub_fetch_u64(&accounting->reserved, bytes);
+}
+
+/*
+ * Recompute the memory reserved from the sizes of the segments.
+ *
+ * Backends that crash between reserving memory and growing a segment,
+ * or between shrinking a segment and releasing the memory, leave the
+ * counter off. This is called by the postmaster when the server
+ * starts, and again after a crash, while no backend can reserve
+ * memory. An error would stop the postmaster, so errors are reported
+ * as warnings and the counter is left as it is.
+ */
+void ArrowAccountingReset(void) {
+  MemoryContext oldcontext = CurrentMemoryContext;
+
+  PG_TRY();
+  {
+    ArrowAccounting* accounting = GetAccounting(ERROR);
+    pg_atomic_write_u64(&accounting->reserved, ArrowSegmentTotalSize());
+  }
+  PG_CATCH();
+  {
+    ErrorData* edata;
+
+    MemoryContextSwitchTo(oldcontext);
+    edata = CopyErrorData();
+    FlushErrorState();
+    ereport(WARNING,
+            (errmsg("could not recompute arrow memory accounting: %s",
+                    edata->message)));
+    FreeErrorData(edata);
+  }
+  PG_END_TRY();
+}
+
+/*
+ * Number of bytes reserved by all segments.
+ */
+uint64 ArrowReservedMemory(void) {
+  return pg_atomic_read_u64(&GetAccounting(ERROR)->reserved);
+}
+
+/*
+ * Build the name of the shared memory object of a segment.
+ *
+ * Several clusters on the same machine share the shared memory
+ * directory and can use the same database and relation file numbers,
+ * so the name starts with the system identifier of the cluster.
+ */
 static void ArrowBuildPath(const ArrowSegmentKey* key, char* path,
                            size_t path_size) {
-  size_t count = snprintf(path, path_size, "/arrow.%u.%u.%u", key->bk_dbid,
-                          key->bk_relid, key->bk_attno);
+  const uint64 sysid = GetSystemIdentifier();
+  size_t count =
+      key->bk_child > 0
+          ? snprintf(path, path_size, "/arrow." UINT64_FORMAT ".%u.%u.%d.%d",
+                     sysid, key->bk_dbid, key->bk_relnumber, key->bk_attno,
+                     key->bk_child)
+          : snprintf(path, path_size, "/arrow." UINT64_FORMAT ".%u.%u.%d",
+                     sysid, key->bk_dbid, key->bk_relnumber, key->bk_attno);
   if (count >= path_size)
     ereport(ERROR, (errcode(errcode(ERRCODE_STRING_DATA_RIGHT_TRUNCATION)),
                     errmsg("buffer not large enough for shared buffer name"),
@@ -66,35 +315,108 @@ static void ArrowBuildPath(const ArrowSegmentKey* key, char* path,
                               path_size - 1)));
 }
 
+/*
+ * Parse the name of a file in the shared memory directory into a
+ * segment key.
+ *
+ * Returns false if the name is not the name of an arrow segment of
+ * this cluster, so segments of other clusters are never listed.
+ */
+static bool ArrowParseName(const char* name, ArrowSegmentKey* key) {
+  char prefix[32];
+  unsigned int dbid, relnumber;
+  int attno, child = 0, count = 0;
+  int len = snprintf(prefix, sizeof(prefix), "arrow." UINT64_FORMAT ".",
+                     GetSystemIdentifier());
+
+  if (strncmp(name, prefix, len) != 0)
+    return false;
+  name += len;
+
+  if (sscanf(name, "%u.%u.%d%n", &dbid, &relnumber, &attno, &count) != 3)
+    return false;
+  if (name[count] == '.') {
+    const char* rest = name + count;
+    if (sscanf(rest, ".%d%n", &child, &count) != 1 || child <= 0 ||
+        rest[count] != '\0')
+      return false;
+  } else if (name[count] != '\0') {
+    return false;
+  }
+
+  memset(key, 0, sizeof(*key));
+  key->bk_dbid = dbid;
+  key->bk_relnumber = relnumber;
+  key->bk_attno = attno;
+  key->bk_child = child;
+  return true;
+}
+
 /*
  * Open an (arrow array) shared memory block.
  *
  * A shared segment arrow array is opened using the oflags and
- * mode. The resulting path is stored in `path`, which points to a
- * buffer of size `size`.
+ * mode. The number of bytes mapped is stored in `mapped`, if
+ * provided, and is needed to unmap the segment.
+ *
+ * If the memory for a segment that this call created cannot be
+ * reserved, the segment is removed again, since an empty segment
+ * cannot be mapped when it is unlinked later.
  */
 ArrowSegment* ArrowSegmentOpen(const ArrowSegmentKey* key, int oflag,
-                               mode_t mode, bool* created) {
+                               mode_t mode, bool* created, size_t* mapped) {
   char path[256];
   int fd;
+  bool made = false;
   struct stat sb;
   ArrowSegment* segment;
   DEBUG_ENTER("key: %s", key_to_string(key)->data);
 
   ArrowBuildPath(key, path, sizeof(path));
-  fd = shm_open(path, oflag, mode);
+  if (oflag & O_CREAT) {
+    fd = shm_open(path, oflag | O_EXCL, mode);
+    if (fd >= 0)
+      made = true;
+    else if (errno == EEXIST && !(oflag & O_EXCL))
+      fd = shm_open(path, oflag & ~O_CREAT, mode);
+  } else {
+    fd = shm_open(path, oflag, mode);
+  }
   if (fd < 0)
     ereport(ERROR, (errcode_for_file_access(),
                     errmsg("could not open path \"%s\": %m", path)));
 
-  if (fstat(fd, &sb) == -1)
+  if (fstat(fd, &sb) == -1) {
+    int save_errno = errno;
+    close(fd);
+    if (made)
+      shm_unlink(path);
+    errno = save_errno;
     ereport(ERROR, (errcode_for_file_access(),
                     errmsg("unable to stat file \"%s\": %m", path)));
+  }
   if (sb.st_size == 0) {
-    if (ftruncate(fd, ArrowPageSize) != 0)
+    PG_TRY();
+    { ArrowReserveMemory(ArrowPageSize, path); }
+    PG_CATCH();
+    {
+      close(fd);
+      if (made)
+        shm_unlink(path);
+      PG_RE_THROW();
+    }
+    PG_END_TRY();
+    if (ftruncate(fd, ArrowPageSize) != 0) {
+      int save_errno = errno;
+      close(fd);
+      if (made)
+        shm_unlink(path);
+      ArrowReleaseMemory(ArrowPageSize);
+      errno = save_errno;
       ereport(ERROR, (errcode_for_file_access(),
                       errmsg("could not truncate file \"%s\" to %lu: %m", path,
                              ArrowPageSize)));
+    }
     if (created)
       *created = true;
   } else if (created) {
@@ -105,10 +427,196 @@ ArrowSegment* ArrowSegmentOpen(const ArrowSegmentKey* key, int oflag,
                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   close(fd);
 
+  if (segment == MAP_FAILED)
+    ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+                    errmsg("could not map \"%s\": %m", path)));
+
+  if (mapped)
+    *mapped = sb.st_size == 0 ? ArrowPageSize : sb.st_size;
+
   DEBUG_LEAVE("path %s", path);
   return segment;
 }
 
+/*
+ * Read a copy of the header of a segment without adding the segment
+ * to any cache.
+ *
+ * The size of the segment is stored in `size`, if provided. Returns
+ * false if the segment does not exist or is not yet initialized.
+ */
+bool ArrowSegmentReadHeader(const ArrowSegmentKey* key, ArrowSegment* header,
+                            size_t* size) {
+  char path[256];
+  struct stat sb;
+  ArrowSegment* segment;
+  int fd;
+
+  ArrowBuildPath(key, path, sizeof(path));
+  fd = shm_open(path, O_RDONLY, 0644);
+  if (fd < 0 && errno == ENOENT)
+    return false;
+  if (fd < 0)
+    ereport(ERROR, (errcode_for_file_access(),
+                    errmsg("could not open path \"%s\": %m", path)));
+
+  if (fstat(fd, &sb) == -1) {
+    close(fd);
+    ereport(ERROR, (errcode_for_file_access(),
+                    errmsg("unable to stat file \"%s\": %m", path)));
+  }
+
+  if (sb.st_size < sizeof(ArrowSegment)) {
+    close(fd);
+    return false;
+  }
+
+  segment = mmap(NULL, sizeof(ArrowSegment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED)
+    ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+                    errmsg("could not map \"%s\": %m", path)));
+
+  memcpy(header, segment, sizeof(*header));
+  munmap(segment, sizeof(ArrowSegment));
+
+  if (size)
+    *size = sb.st_size;
+  return true;
+}
+
+/*
+ * Read a copy of the first element of a segment without adding the
+ * segment to any cache.
+ *
+ * Returns false if the segment does not exist or has no elements.
+ */
+bool ArrowSegmentReadFirst(const ArrowSegmentKey* key, void* element,
+                           size_t size) {
+  char path[256];
+  struct stat sb;
+  ArrowSegment* segment;
+  bool found = false;
+  int fd;
+
+  ArrowBuildPath(key, path, sizeof(path));
+  fd = shm_open(path, O_RDONLY, 0644);
+  if (fd < 0 && errno == ENOENT)
+    return false;
+  if (fd < 0)
+    ereport(ERROR, (errcode_for_file_access(),
+                    errmsg("could not open path \"%s\": %m", path)));
+
+  if (fstat(fd, &sb) == -1) {
+    close(fd);
+    ereport(ERROR, (errcode_for_file_access(),
+                    errmsg("unable to stat file \"%s\": %m", path)));
+  }
+
+  if (sb.st_size < sizeof(ArrowSegment)) {
+    close(fd);
+    return false;
+  }
+
+  segment = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED)
+    ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+                    errmsg("could not map \"%s\": %m", path)));
+
+  if (segment->length > 0 && segment->attlen == size &&
+      segment->data_buffer_offset + size <= sb.st_size) {
+    memcpy(element, (int8*)segment + segment->data_buffer_offset, size);
+    found = true;
+  }
+  munmap(segment, sb.st_size);
+
+  return found;
+}
+
+/*
+ * Remap a segment in this backend if its size has changed.
+ *
+ * Other backends can grow a segment, so this needs to be done before
+ * accessing elements past what is mapped. Remapping might move the
+ * segment, so the new address is returned and `mapped` updated.
+ */
+ArrowSegment* ArrowSegmentRemap(ArrowSegment* segment, size_t* mapped) {
+  const size_t size = segment->size;
+  void* addr;
+
+  if (size == *mapped)
+    return segment;
+
+  addr = mremap(segment, *mapped, size, MREMAP_MAYMOVE);
+  if (addr == MAP_FAILED)
+    ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+                    errmsg("could not remap segment to %zu bytes: %m", size)));
+  if (size > *mapped)
+    pg_atomic_fetch_add_u64(&((ArrowSegment*)addr)->counters.bytes_mapped,
+                            size - *mapped);
+  *mapped = size;
+  return addr;
+}
+
+/*
+ * Resize a segment to hold `capacity` elements.
+ *
+ * The segment grows or shrinks in whole chunks at the end of the
+ * segment, so existing data never moves and other backends can
+ * continue to use their mappings. Growing the segment reserves
+ * memory and fails if that would exceed the memory limit.
+ *
+ * Shrinking a segment that other backends have mapped is not safe,
+ * so that is only done for relations that are not visible to other
+ * backends.
+ */
+ArrowSegment* ArrowSegmentResize(const ArrowSegmentKey* key,
+                                 ArrowSegment* segment, size_t* mapped,
+                                 int64 capacity) {
+  const int64 nchunks = (capacity + ARROW_CHUNK_ROWS - 1) / ARROW_CHUNK_ROWS;
+  const size_t size =
+      TYPEALIGN(ArrowPageSize,
+                segment->data_buffer_offset + nchunks * segment->chunk_size);
+  const size_t oldsize = segment->size;
+  char path[256];
+  int fd;
+
+  DEBUG_ENTER("key: %s, size: %zu, new size: %zu", key_to_string(key)->data,
+              oldsize, size);
+
+  if (size != oldsize) {
+    TRACE_ARROW_SEGMENT_RESIZE(key->bk_relnumber, key->bk_attno, oldsize, size);
+    ArrowBuildPath(key, path, sizeof(path));
+
+    if (size > oldsize)
+      ArrowReserveMemory(size - oldsize, path);
+
+    fd = shm_open(path, O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+      int save_errno = errno;
+      if (fd >= 0)
+        close(fd);
+      if (size > oldsize)
+        ArrowReleaseMemory(size - oldsize);
+      errno = save_errno;
+      ereport(ERROR, (errcode_for_file_access(),
+                      errmsg("could not resize \"%s\" to %zu bytes: %m", path,
+                             size)));
+    }
+    close(fd);
+
+    if (size < oldsize)
+      ArrowReleaseMemory(oldsize - size);
+    segment->size = size;
+  }
+
+  segment = ArrowSegmentRemap(segment, mapped);
+
+  DEBUG_LEAVE("size: %zu", size);
+  return segment;
+}
+
 bool ArrowSegmentExists(const ArrowSegmentKey* key) {
   char path[256];
   int fd;
@@ -123,3 +631,190 @@ bool ArrowSegmentExists(const ArrowSegmentKey* key) {
   close(fd);
   return true;
 }
+
+/*
+ * Unlink a segment.
+ *
+ * The segment is flagged as dropped before it is unlinked so that
+ * other backends that have it mapped can release their mappings. The
+ * memory is not returned to the system until all mappings are gone.
+ *
+ * This is called when cleaning up at the end of transactions, so
+ * errors are reported as warnings.
+ */
+void ArrowSegmentUnlink(const ArrowSegmentKey* key) {
+  char path[256];
+  ArrowSegment* segment;
+  struct stat sb;
+  int fd;
+
+  ArrowBuildPath(key, path, sizeof(path));
+  fd = shm_open(path, O_RDWR, 0644);
+  if (fd < 0) {
+    if (errno != ENOENT)
+      ereport(WARNING, (errcode_for_file_access(),
+                        errmsg("could not open path \"%s\": %m", path)));
+    return;
+  }
+
+  if (fstat(fd, &sb) != 0)
+    sb.st_size = 0;
+
+  /* A segment that was never sized has no header, and writing to the
+   * mapping of an empty object would raise SIGBUS. */
+  if (sb.st_size >= sizeof(ArrowSegment)) {
+    segment =
+        mmap(NULL, ArrowPageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (segment != MAP_FAILED) {
+      segment->flags |= ARROW_SEGMENT_DROPPED;
+      munmap(segment, ArrowPageSize);
+    }
+  }
+  close(fd);
+
+  if (shm_unlink(path) != 0) {
+    if (errno != ENOENT)
+      ereport(WARNING, (errcode_for_file_access(),
+                        errmsg("could not unlink path \"%s\": %m", path)));
+    return;
+  }
+
+  ArrowReleaseMemory(sb.st_size);
+}
+
+/*
+ * List keys for existing segments, optionally restricted to a
+ * database and a relation file number.
+ *
+ * The shared memory directory is the registry of all segments, so
+ * this will find segments no matter which backend created them.
+ */
+static List* ArrowSegmentListExtended(int elevel, Oid dbid,
+                                      RelFileNumber relnumber) {
+  List* result = NIL;
+  struct dirent* de;
+  DIR* dir = AllocateDir(ARROW_SHM_DIR);
+
+  while ((de = ReadDirExtended(dir, ARROW_SHM_DIR, elevel)) != NULL) {
+    ArrowSegmentKey key;
+    if (!ArrowParseName(de->d_name, &key))
+      continue;
+    if (OidIsValid(dbid) && key.bk_dbid != dbid)
+      continue;
+    if (RelFileNumberIsValid(relnumber) && key.bk_relnumber != relnumber)
+      continue;
+    result = lappend(result, memcpy(palloc(sizeof(key)), &key, sizeof(key)));
+  }
+
+  FreeDir(dir);
+  return result;
+}
+
+List* ArrowSegmentList(void) {
+  return ArrowSegmentListExtended(ERROR, InvalidOid, InvalidRelFileNumber);
+}
+
+/*
+ * Unlink all segments for a relation.
+ */
+void ArrowSegmentDropRelation(Oid dbid, RelFileNumber relnumber) {
+  List* keys = ArrowSegmentListExtended(WARNING, dbid, relnumber);
+  ListCell* lc;
+
+  DEBUG_ENTER("dbid: %u, relnumber: %u", dbid, relnumber);
+
+  foreach (lc, keys)
+    ArrowSegmentUnlink(lfirst(lc));
+  list_free_deep(keys);
+
+  DEBUG_LEAVE("dbid: %u, relnumber: %u", dbid, relnumber);
+}
+
+/*
+ * Schedule unlinking of all segments of a relation at commit or
+ * abort.
+ */
+void ArrowScheduleUnlink(Oid dbid, RelFileNumber relnumber, bool atCommit) {
+  PendingUnlink* pending =
+      MemoryContextAlloc(TopMemoryContext, sizeof(PendingUnlink));
+  pending->dbid = dbid;
+  pending->relnumber = relnumber;
+  pending->atCommit = atCommit;
+  pending->nestLevel = GetCurrentTransactionNestLevel();
+  pending->next = pendingUnlinks;
+  pendingUnlinks = pending;
+}
+
+/*
+ * Execute pending unlinks for the current (sub)transaction level.
+ */
+static void ArrowDoPendingUnlinks(bool isCommit) {
+  int nestLevel = GetCurrentTransactionNestLevel();
+  PendingUnlink* pending;
+  PendingUnlink* prev = NULL;
+  PendingUnlink* next;
+
+  for (pending = pendingUnlinks; pending != NULL; pending = next) {
+    next = pending->next;
+    if (pending->nestLevel < nestLevel) {
+      prev = pending;
+      continue;
+    }
+
+    if (prev)
+      prev->next = next;
+    else
+      pendingUnlinks = next;
+
+    if (pending->atCommit == isCommit)
+      ArrowSegmentDropRelation(pending->dbid, pending->relnumber);
+    pfree(pending);
+  }
+}
+
+void ArrowStorageXactCallback(XactEvent event, void* arg) {
+  switch (event) {
+    case XACT_EVENT_PRE_PREPARE:
+      if (pendingUnlinks)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("cannot PREPARE a transaction that has created, "
+                        "truncated, or dropped arrow tables")));
+      break;
+
+    case XACT_EVENT_COMMIT:
+    case XACT_EVENT_PARALLEL_COMMIT:
+      ArrowDoPendingUnlinks(true);
+      break;
+
+    case XACT_EVENT_ABORT:
+    case XACT_EVENT_PARALLEL_ABORT:
+      ArrowDoPendingUnlinks(false);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void ArrowStorageSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+                                 SubTransactionId parentSubid, void* arg) {
+  int nestLevel = GetCurrentTransactionNestLevel();
+  PendingUnlink* pending;
+
+  switch (event) {
+    case SUBXACT_EVENT_COMMIT_SUB:
+      /* Reassign pending unlinks to the parent transaction */
+      for (pending = pendingUnlinks; pending != NULL; pending = pending->next)
+        if (pending->nestLevel >= nestLevel)
+          pending->nestLevel = nestLevel - 1;
+      break;
+
+    case SUBXACT_EVENT_ABORT_SUB:
+      ArrowDoPendingUnlinks(false);
+      break;
+
+    default:
+      break;
+  }
+}
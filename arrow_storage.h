@@ -19,9 +19,15 @@
 /**
  * Module for primitives handling shared blocks.
  *
- * Blocks are allocated based on database OID, the table OID, and the
- * attribute id. The shared memory block is resized as needed using
- * mremap(2), so it is limited to Linux.
+ * Blocks are allocated based on database OID, the relation file
+ * number, and the attribute id. The shared memory block is resized as
+ * needed using mremap(2), so it is limited to Linux.
+ *
+ * We use the relation file number rather than the relation OID so
+ * that operations that assign new storage to a relation (TRUNCATE,
+ * for example) get a fresh set of segments and the old segments can
+ * be dropped when the transaction commits, in the same way as files
+ * for heap relations.
  */
 
 #ifndef ARROW_STORAGE_H_
@@ -34,6 +40,9 @@
 
 #include "arrow_c_data_interface.h"
 
+#include <access/xact.h>
+#include <nodes/pg_list.h>
+#include <port/atomics.h>
 #include <utils/rel.h>
 
 /**
@@ -41,14 +50,66 @@
  *
  * Each ArrowArray is stored in a separate (named) shared memory
  * segment with database, relation, and attribute used as part of the
- * name.
+ * name. Columns using the list or struct layouts have child arrays,
+ * which are stored in segments of their own, numbered from 1.
  */
 typedef struct ArrowSegmentKey {
-  Oid bk_dbid;    /* Database OID */
-  Oid bk_relid;   /* Relation OID */
-  int16 bk_attno; /* Attribute number */
+  Oid bk_dbid;                /* Database OID */
+  RelFileNumber bk_relnumber; /* Relation file number */
+  int16 bk_attno;             /* Attribute number */
+  int16 bk_child;             /* Child array number, or 0 */
 } ArrowSegmentKey;
 
+/**
+ * Segment flags.
+ *
+ * ARROW_SEGMENT_DROPPED is set just before the segment is unlinked so
+ * that backends that still have the segment mapped can notice that
+ * the mapping is stale and release it.
+ */
+#define ARROW_SEGMENT_DROPPED 0x0001
+
+/**
+ * Number of elements in each chunk of a segment.
+ *
+ * Segments are divided into chunks, each holding the data buffer and
+ * the validity buffer for a fixed number of elements. When a segment
+ * grows, new chunks are added at the end of the segment so existing
+ * data never moves. This is a multiple of 64 so that the validity
+ * buffer of each chunk is a whole number of 64-bit words.
+ */
+#define ARROW_CHUNK_ROWS 256
+
+/**
+ * Alignment of buffers in segments, as recommended by the Arrow
+ * Columnar Format.
+ */
+#define ARROW_ALIGNMENT 64
+
+/**
+ * Element length of segments that store one bit per element.
+ *
+ * Attribute lengths are never zero, so this does not clash with the
+ * length of any type.
+ */
+#define ARROW_BITMAP_ATTLEN 0
+
+/**
+ * Counters kept in the header of each segment, for profiling.
+ *
+ * The counters are cumulative and shared by all backends, so they are
+ * only updated once for each scan, insert, or mapping of a segment.
+ * Rows scanned and inserted are counted in the visibility segment of
+ * the relation, while the other counters are kept for every segment.
+ */
+typedef struct ArrowSegmentCounters {
+  pg_atomic_uint64 rows_scanned;  /* Rows returned by sequential scans */
+  pg_atomic_uint64 rows_inserted; /* Rows inserted or loaded */
+  pg_atomic_uint64 opens;         /* Times mapped by a backend */
+  pg_atomic_uint64 open_time;     /* Microseconds spent mapping */
+  pg_atomic_uint64 bytes_mapped;  /* Bytes mapped, including remaps */
+} ArrowSegmentCounters;
+
 /**
  * Column array inspired by the Apache Arrow specification, but with
  * some tweaks to support a shared memory implementation.
@@ -59,17 +120,29 @@ typedef struct ArrowSegmentKey {
  * In particular, we do not store pointers in this structure and
  * rather offsets relative the start of the arrow segment.
  *
- * For now, we store the offsets explicitly named, but we might well store all
- * buffer offsets later and mimic the structure of the ArrowArray structure, but
- * using offsets relative start of segment instead.
+ * The buffer offsets are for the first chunk, and the buffers of
+ * chunk N are found `N * chunk_size` bytes after the buffers of the
+ * first chunk.
  */
 typedef struct ArrowSegment {
   /** Length of the array, in number of elements */
   int64 length;
 
-  /** Attribute length, same as for PostgreSQL */
+  /** Attribute length, same as for PostgreSQL, or ARROW_BITMAP_ATTLEN */
   int16 attlen;
 
+  /** Segment flags */
+  uint16 flags;
+
+  /** Transaction that created the segment */
+  TransactionId xmin;
+
+  /** Size of the segment in bytes. */
+  size_t size;
+
+  /** Size of each chunk in bytes. */
+  size_t chunk_size;
+
   /** Offset to validity buffer relative to start of segment. */
   size_t validity_buffer_offset;
 
@@ -81,13 +154,37 @@ typedef struct ArrowSegment {
    *  relative to start of segment if using variable length data,
    *  otherwise 0 */
   size_t offset_buffer_offset;
+
+  /** Counters for the arrow_profile view */
+  ArrowSegmentCounters counters;
 } ArrowSegment;
 
 extern size_t ArrowPageSize;
+extern int ArrowMaxMemory;
 
 ArrowSegment* ArrowSegmentOpen(const ArrowSegmentKey* key, int oflag,
-                               mode_t mode, bool* created);
+                               mode_t mode, bool* created, size_t* mapped);
 bool ArrowSegmentExists(const ArrowSegmentKey* key);
-void ArrowSegmentInit(ArrowSegment* segment, Form_pg_attribute attr);
+bool ArrowSegmentReadHeader(const ArrowSegmentKey* key, ArrowSegment* header,
+                            size_t* size);
+bool ArrowSegmentReadFirst(const ArrowSegmentKey* key, void* element,
+                           size_t size);
+void ArrowSegmentInit(ArrowSegment* segment, int16 attlen, size_t size);
+ArrowSegment* ArrowSegmentResize(const ArrowSegmentKey* key,
+                                 ArrowSegment* segment, size_t* mapped,
+                                 int64 capacity);
+ArrowSegment* ArrowSegmentRemap(ArrowSegment* segment, size_t* mapped);
+int64 ArrowSegmentCapacity(const ArrowSegment* segment, size_t size);
+uint64 ArrowReservedMemory(void);
+void ArrowAccountingReset(void);
+size_t ArrowSegmentUsed(const ArrowSegment* segment);
+void ArrowSegmentUnlink(const ArrowSegmentKey* key);
+List* ArrowSegmentList(void);
+void ArrowSegmentDropRelation(Oid dbid, RelFileNumber relnumber);
+
+void ArrowScheduleUnlink(Oid dbid, RelFileNumber relnumber, bool atCommit);
+void ArrowStorageXactCallback(XactEvent event, void* arg);
+void ArrowStorageSubXactCallback(SubXactEvent event, SubTransactionId mySubid,
+                                 SubTransactionId parentSubid, void* arg);
 
 #endif /* ARROW_STORAGE_H_*/
@@ -20,25 +20,98 @@
 
 #include <postgres.h>
 
+#include <access/htup_details.h>
+#include <access/tableam.h>
+#include <access/transam.h>
+#include <access/xact.h>
 #include <executor/tuptable.h>
 #include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/lmgr.h>
+#include <utils/datum.h>
+#include <utils/memutils.h>
+
+#include <fcntl.h>
 
 #include "arrow_array.h"
+#include "arrow_delta.h"
+#include "arrow_probes.h"
+#include "arrow_visibility.h"
 #include "debug.h"
 
 static void tts_arrow_init(TupleTableSlot *slot) {
   ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
-  int natts = slot->tts_tupleDescriptor->natts;
+  TupleDesc tupdesc = slot->tts_tupleDescriptor;
+  int natts = tupdesc->natts;
+  Size off = 0;
+
+  aslot->index = -1;
+  aslot->relnumber = InvalidRelFileNumber;
+  aslot->columns = NULL;
+  aslot->types = palloc(natts * sizeof(*aslot->types));
+  aslot->offsets = palloc(natts * sizeof(*aslot->offsets));
+  aslot->rownulls = palloc(natts * sizeof(*aslot->rownulls));
+
+  /* Dropped columns are always null, so they are not part of the
+   * layout for rows without nulls. Columns that are not stored in
+   * their PostgreSQL representation, or are passed by reference, need
+   * the generic loop, and so do arrays and composites, which also need
+   * a memory context for the values built for each row. Types that
+   * cannot be stored are rejected when the column is opened. */
+  aslot->attlen = -1;
+  aslot->rowcxt = NULL;
+  for (int i = 0; i < natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    ArrowType *type = &aslot->types[i];
+    const bool stored = ArrowTypeLookup(attr, type);
 
-  aslot->index = 0;
-  aslot->columns = palloc0(natts * sizeof(*aslot->columns));
+    if (attr->attisdropped) {
+      aslot->offsets[i] = -1;
+      continue;
+    }
+    if (attr->attlen < 0) {
+      if (aslot->rowcxt == NULL)
+        aslot->rowcxt = AllocSetContextCreate(
+            slot->tts_mcxt, "arrow slot row", ALLOCSET_SMALL_SIZES);
+      aslot->attlen = 0;
+    }
+    if (!stored || attr->attlen < 0) {
+      aslot->offsets[i] = -1;
+      continue;
+    }
+    if (type->layout != ARROW_LAYOUT_FIXED || !type->byval)
+      aslot->attlen = 0;
+    else if (aslot->attlen < 0)
+      aslot->attlen = attr->attlen;
+    else if (aslot->attlen != attr->attlen)
+      aslot->attlen = 0;
+    off = att_align_nominal(off, attr->attalign);
+    aslot->offsets[i] = off;
+    off += attr->attlen;
+  }
+  aslot->datalen = off;
+  aslot->refdata = palloc(Max(off, 1));
+
+  aslot->merged = 0;
+  aslot->delta = NULL;
+  aslot->deltaoffsets = NULL;
+  aslot->deltarec = NULL;
+  aslot->indelta = false;
 }
 
 static void tts_arrow_release(TupleTableSlot *slot) {
   ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
-  for (int i = 0; i < aslot->base.tts_nvalid; ++i)
-    ArrowArrayRelease(aslot->columns[i]);
-  pfree(aslot->columns);
+  /* The columns belong to the array cache */
+  pfree(aslot->types);
+  pfree(aslot->offsets);
+  pfree(aslot->refdata);
+  pfree(aslot->rownulls);
+  if (aslot->rowcxt)
+    MemoryContextDelete(aslot->rowcxt);
+  if (aslot->deltarec)
+    pfree(aslot->deltarec);
+  if (aslot->deltaoffsets)
+    pfree(aslot->deltaoffsets);
 }
 
 /**
@@ -49,6 +122,9 @@ static void tts_arrow_release(TupleTableSlot *slot) {
  * reference to the associated arrow arrays
  */
 static void tts_arrow_clear(TupleTableSlot *slot) {
+  ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
+  if (aslot->rowcxt)
+    MemoryContextReset(aslot->rowcxt);
   slot->tts_nvalid = 0;
   slot->tts_flags |= TTS_FLAG_EMPTY;
   ItemPointerSetInvalid(&slot->tts_tid);
@@ -67,13 +143,32 @@ static void tts_arrow_copyslot(TupleTableSlot *dstslot,
 
   slot_getallattrs(srcslot);
 
+  /* Pass-by-reference values of the source can point into its own
+   * copies of the values, which change with the next row. */
   for (int natt = 0; natt < srcdesc->natts; natt++) {
-    dstslot->tts_values[natt] = srcslot->tts_values[natt];
+    Form_pg_attribute attr = TupleDescAttr(dstslot->tts_tupleDescriptor, natt);
+    ArrowTupleTableSlot *dst = (ArrowTupleTableSlot *)dstslot;
+    const int32 off = dst->offsets[natt];
+    Datum value = srcslot->tts_values[natt];
+
+    if (srcslot->tts_isnull[natt] || attr->attbyval) {
+      /* Nothing to copy */
+    } else if (attr->attlen < 0) {
+      MemoryContext oldcxt = MemoryContextSwitchTo(dst->rowcxt);
+      value = datumCopy(value, false, attr->attlen);
+      MemoryContextSwitchTo(oldcxt);
+    } else if (off >= 0) {
+      char *copy = dst->refdata + off;
+      memcpy(copy, DatumGetPointer(value), attr->attlen);
+      value = PointerGetDatum(copy);
+    }
+    dstslot->tts_values[natt] = value;
     dstslot->tts_isnull[natt] = srcslot->tts_isnull[natt];
   }
 
   dstslot->tts_nvalid = srcdesc->natts;
   dstslot->tts_flags &= ~TTS_FLAG_EMPTY;
+  ((ArrowTupleTableSlot *)dstslot)->index = -1;
 
   /* TTSOpsVirtualTuple has this, not entirely sure if it is
      needed. Comment is "make sure storage doesn't depend on external
@@ -82,111 +177,553 @@ static void tts_arrow_copyslot(TupleTableSlot *dstslot,
   DEBUG_LEAVE("dstslot: %s", show_slot(dstslot)->data);
 }
 
+/*
+ * Get a system column of the row in the slot.
+ *
+ * Only the inserting transaction is known for a row, which is what
+ * INSERT ... ON CONFLICT needs to check the row it found.
+ */
 static Datum tts_arrow_getsysattr(TupleTableSlot *slot, int attnum,
                                   bool *isnull) {
-  DEBUG_ENTER("slot: %s, attnum: %d, isnull: %d", show_slot(slot)->data, attnum,
-              *isnull);
-  DEBUG_LEAVE("");
-  return 0; /* silence compiler warnings */
+  ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
+  ArrowInsertRun *run = NULL;
+
+  DEBUG_ENTER("slot: %s, attnum: %d", show_slot(slot)->data, attnum);
+
+  if (attnum == MinTransactionIdAttributeNumber && aslot->index >= 0)
+    run = ArrowVisibilityFind(ArrowVisibilityGet(aslot->relnumber, O_RDWR),
+                              aslot->index);
+  if (run == NULL)
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("cannot retrieve a system column in this context")));
+  *isnull = false;
+
+  DEBUG_LEAVE("xmin: %u", run->xmin);
+  if (run->flags & ARROW_RUN_FROZEN)
+    return TransactionIdGetDatum(FrozenTransactionId);
+  return TransactionIdGetDatum(run->xmin);
 }
 
-static void tts_arrow_getsomeattrs(TupleTableSlot *slot, int natts) {
+/*
+ * Read the values of columns `first` to `natts` of the current row.
+ *
+ * If `attlen` is not zero, all columns are pass-by-value types of that
+ * length stored in their PostgreSQL representation, so values are read
+ * from the data buffers the same way fetch_att() reads them from a
+ * heap tuple. Since this is always inlined, the compiler produces a
+ * separate loop for each length without any dispatch on the type of
+ * the column. Other columns are converted using the type of the
+ * column, and pass-by-reference values are copied into `refdata`.
+ * Arrays and composites are built in `rowcxt`.
+ */
+static pg_attribute_always_inline void tts_arrow_deform(
+    ArrowTupleTableSlot *aslot, int first, int natts, int16 attlen) {
+  TupleTableSlot *slot = &aslot->base;
+  TupleDesc tupdesc = slot->tts_tupleDescriptor;
+  const int64 chunk = aslot->index / ARROW_CHUNK_ROWS;
+  const int bit = aslot->index % ARROW_CHUNK_ROWS;
+
+  for (int i = first; i < natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    const ArrowType *type = &aslot->types[i];
+    const int8 *validity;
+    const char *data;
+
+    if (attr->attisdropped) {
+      slot->tts_values[i] = (Datum)0;
+      slot->tts_isnull[i] = true;
+      continue;
+    }
+
+    if (unlikely(aslot->columns[i] == NULL))
+      aslot->columns[i] = ArrowArrayGet(aslot->relnumber, attr, O_RDWR);
+
+    validity = ArrowArrayChunkValidity(aslot->columns[i], chunk);
+    data = ArrowArrayChunkData(aslot->columns[i], chunk);
+    slot->tts_isnull[i] = ArrowValidityIsNull(validity, bit);
+
+    if (attlen != 0) {
+      slot->tts_values[i] = fetch_att(data + bit * attlen, true, attlen);
+    } else if (slot->tts_isnull[i]) {
+      slot->tts_values[i] = (Datum)0;
+    } else if (ArrowLayoutIsNested(type->layout)) {
+      MemoryContext oldcxt = MemoryContextSwitchTo(aslot->rowcxt);
+      slot->tts_values[i] =
+          ArrowArrayGetDatum(aslot->columns[i], attr, aslot->index).value;
+      MemoryContextSwitchTo(oldcxt);
+    } else if (type->byval) {
+      slot->tts_values[i] = ArrowValueGetDatum(type, data, bit);
+    } else {
+      char *copy = aslot->refdata + aslot->offsets[i];
+      memcpy(copy, data + bit * type->attlen, type->attlen);
+      slot->tts_values[i] = PointerGetDatum(copy);
+    }
+  }
+}
+
+/*
+ * Check if the current row is in the delta store of the relation and
+ * copy its record into `deltarec` if it is.
+ *
+ * This is only done for rows that are not known to be in the columns.
+ * Rows are written before they are added to a run, so visible rows
+ * that are not in the delta store are in the columns, which are
+ * refreshed in case the rows were merged after they were opened.
+ */
+static bool tts_arrow_fetch_delta(ArrowTupleTableSlot *aslot) {
+  TupleTableSlot *slot = &aslot->base;
   TupleDesc tupdesc = slot->tts_tupleDescriptor;
+  int64 merged = PG_INT64_MAX;
+  int64 nrows;
+
+  if (aslot->indelta)
+    return true;
+
+  /* All rows in runs are in the columns unless they are in the delta
+   * store when it is checked after this. */
+  nrows = ArrowVisibilityRows(ArrowVisibilityGet(aslot->relnumber, O_RDWR));
+  pg_read_barrier();
+
+  if (aslot->delta == NULL) {
+    aslot->delta = ArrowDeltaOpen(aslot->relnumber);
+    if (aslot->delta != NULL) {
+      const SegmentData *data = (SegmentData *)aslot->delta->private_data;
+      aslot->deltarec =
+          MemoryContextAlloc(slot->tts_mcxt, data->segment->attlen);
+      aslot->deltaoffsets = MemoryContextAlloc(
+          slot->tts_mcxt, Max(tupdesc->natts, 1) * sizeof(int32));
+      ArrowDeltaLayout(tupdesc, aslot->deltaoffsets);
+    }
+  }
+
+  if (aslot->delta != NULL &&
+      ArrowDeltaFetch(aslot->delta, aslot->index, aslot->deltarec, &merged)) {
+    aslot->merged = Min(nrows, merged);
+    aslot->indelta = true;
+    return true;
+  }
+
+  pg_read_barrier();
+  for (int i = 0; i < tupdesc->natts; ++i)
+    if (aslot->columns[i] != NULL)
+      ArrowArrayRefresh(aslot->columns[i]);
+  aslot->merged = Min(nrows, merged);
+  return false;
+}
+
+/*
+ * Read the values of columns `first` to `natts` of the current row
+ * from its delta record.
+ */
+static void tts_arrow_deform_delta(ArrowTupleTableSlot *aslot, int first,
+                                   int natts) {
+  TupleTableSlot *slot = &aslot->base;
+  TupleDesc tupdesc = slot->tts_tupleDescriptor;
+
+  for (int i = first; i < natts; ++i)
+    slot->tts_values[i] = ArrowDeltaGetValue(
+        aslot->deltarec, TupleDescAttr(tupdesc, i), aslot->deltaoffsets[i],
+        &slot->tts_isnull[i]);
+}
+
+/**
+ * Read the values of the columns of the current row up to `natts`.
+ *
+ * Columns before `tts_nvalid` have already been read for the current
+ * row, so only the columns from there on are read. Storing a row in
+ * the slot does not read any columns, so columns after the last one
+ * needed by the quals and projections of a scan are never read.
+ */
+static void tts_arrow_getsomeattrs(TupleTableSlot *slot, int natts) {
   ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
+  const int first = slot->tts_nvalid;
 
   DEBUG_ENTER("slot.tts_tableOid=%d, slot.nvalid=%d, natts=%d",
               slot->tts_tableOid, slot->tts_nvalid, natts);
 
-  ExecClearTuple(slot);
+  Assert(!TTS_EMPTY(slot));
 
-  /* Fetch missing columns */
-  while (slot->tts_nvalid < natts) {
-    Form_pg_attribute attr = TupleDescAttr(tupdesc, slot->tts_nvalid);
-    if (aslot->columns[slot->tts_nvalid] == NULL)
-      aslot->columns[slot->tts_nvalid] =
-          ArrowArrayGet(slot->tts_tableOid, attr, O_RDWR);
-    ++slot->tts_nvalid;
+  if (unlikely(aslot->index < 0))
+    elog(ERROR, "arrow slot does not refer to a row");
+
+  if (unlikely(aslot->index >= aslot->merged) &&
+      tts_arrow_fetch_delta(aslot)) {
+    tts_arrow_deform_delta(aslot, first, natts);
+  } else {
+    switch (aslot->attlen) {
+      case 8:
+        tts_arrow_deform(aslot, first, natts, 8);
+        break;
+      case 4:
+        tts_arrow_deform(aslot, first, natts, 4);
+        break;
+      case 2:
+        tts_arrow_deform(aslot, first, natts, 2);
+        break;
+      default:
+        tts_arrow_deform(aslot, first, natts, 0);
+        break;
+    }
   }
 
-  ExecStoreArrowTuple(slot);
+  slot->tts_nvalid = Max(slot->tts_nvalid, natts);
 
   DEBUG_LEAVE("slot.nvalid=%d", slot->tts_nvalid);
 }
 
+/*
+ * Read the validity of each column of the current row into
+ * `rownulls` and return the size of the data area of a tuple for it.
+ */
+static Size tts_arrow_row_layout(ArrowTupleTableSlot *aslot, bool *hasnull) {
+  TupleDesc tupdesc = aslot->base.tts_tupleDescriptor;
+  const int64 chunk = aslot->index / ARROW_CHUNK_ROWS;
+  const int bit = aslot->index % ARROW_CHUNK_ROWS;
+  Size size = 0;
+
+  *hasnull = false;
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    const int8 *validity;
+
+    if (attr->attisdropped) {
+      aslot->rownulls[i] = true;
+      *hasnull = true;
+      continue;
+    }
+
+    if (aslot->columns[i] == NULL)
+      aslot->columns[i] = ArrowArrayGet(aslot->relnumber, attr, O_RDWR);
+
+    validity = ArrowArrayChunkValidity(aslot->columns[i], chunk);
+    aslot->rownulls[i] = ArrowValidityIsNull(validity, bit);
+    *hasnull |= aslot->rownulls[i];
+  }
+
+  if (!*hasnull)
+    return aslot->datalen;
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    if (aslot->rownulls[i])
+      continue;
+    size = att_align_nominal(size, attr->attalign) + attr->attlen;
+  }
+  return size;
+}
+
+/*
+ * Fill the data area and null bitmap of a tuple for the current row.
+ *
+ * This does the same as heap_fill_tuple(), but copies the values
+ * straight from the data buffers of the columns. For columns stored in
+ * their PostgreSQL representation, the bytes in the buffer are the
+ * bytes of the attribute. Booleans, dates, and timestamps are
+ * converted first.
+ */
+static void tts_arrow_fill_tuple(ArrowTupleTableSlot *aslot, bool hasnull,
+                                 char *data, uint16 *infomask, bits8 *bits) {
+  TupleDesc tupdesc = aslot->base.tts_tupleDescriptor;
+  const int64 chunk = aslot->index / ARROW_CHUNK_ROWS;
+  const int bit = aslot->index % ARROW_CHUNK_ROWS;
+  Size off = 0;
+
+  if (hasnull)
+    *infomask |= HEAP_HASNULL;
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    const char *buffer;
+
+    if (aslot->rownulls[i])
+      continue;
+
+    if (hasnull) {
+      bits[i / 8] |= 1 << (i % 8);
+      off = att_align_nominal(off, attr->attalign);
+    } else {
+      off = aslot->offsets[i];
+    }
+
+    buffer = ArrowArrayChunkData(aslot->columns[i], chunk);
+    if (aslot->types[i].layout == ARROW_LAYOUT_FIXED)
+      memcpy(data + off, buffer + bit * attr->attlen, attr->attlen);
+    else
+      store_att_byval(data + off,
+                      ArrowValueGetDatum(&aslot->types[i], buffer, bit),
+                      attr->attlen);
+    off += attr->attlen;
+  }
+}
+
+/*
+ * Form a heap tuple for the slot.
+ *
+ * If the slot refers to a row, the tuple is formed directly from the
+ * columns, without reading the values into the slot first. The layout
+ * follows heap_form_tuple().
+ */
 static HeapTuple tts_arrow_copy_heap_tuple(TupleTableSlot *slot) {
+  ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
+  TupleDesc tupdesc = slot->tts_tupleDescriptor;
+  HeapTuple tuple;
+  HeapTupleHeader td;
+  Size len, hoff, datalen;
+  bool hasnull;
+
   Assert(!TTS_EMPTY(slot));
 
-  return heap_form_tuple(slot->tts_tupleDescriptor, slot->tts_values,
-                         slot->tts_isnull);
+  /* Arrays and composites are built as values anyway, and so are the
+   * values of rows that might be in the delta store. */
+  if (aslot->index >= 0 &&
+      (aslot->rowcxt != NULL || aslot->index >= aslot->merged))
+    slot_getallattrs(slot);
+
+  if (aslot->index < 0 || slot->tts_nvalid == tupdesc->natts)
+    return heap_form_tuple(tupdesc, slot->tts_values, slot->tts_isnull);
+
+  datalen = tts_arrow_row_layout(aslot, &hasnull);
+
+  len = offsetof(HeapTupleHeaderData, t_bits);
+  if (hasnull)
+    len += BITMAPLEN(tupdesc->natts);
+  hoff = len = MAXALIGN(len);
+  len += datalen;
+
+  tuple = (HeapTuple)palloc0(HEAPTUPLESIZE + len);
+  tuple->t_data = td = (HeapTupleHeader)((char *)tuple + HEAPTUPLESIZE);
+  tuple->t_len = len;
+  tuple->t_self = slot->tts_tid;
+  tuple->t_tableOid = slot->tts_tableOid;
+
+  HeapTupleHeaderSetDatumLength(td, len);
+  HeapTupleHeaderSetTypeId(td, tupdesc->tdtypeid);
+  HeapTupleHeaderSetTypMod(td, tupdesc->tdtypmod);
+  ItemPointerSetInvalid(&td->t_ctid);
+  HeapTupleHeaderSetNatts(td, tupdesc->natts);
+  td->t_hoff = hoff;
+
+  tts_arrow_fill_tuple(aslot, hasnull, (char *)td + hoff, &td->t_infomask,
+                       td->t_bits);
+  return tuple;
 }
 
+/*
+ * Form a minimal tuple for the slot.
+ *
+ * This is what sorts, hash tables, and materialization store, so for
+ * slots that refer to a row the tuple is formed directly from the
+ * columns. The layout follows heap_form_minimal_tuple().
+ */
 static MinimalTuple tts_arrow_copy_minimal_tuple(TupleTableSlot *slot) {
+  ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
+  TupleDesc tupdesc = slot->tts_tupleDescriptor;
+  MinimalTuple tuple;
+  Size len, hoff, datalen;
+  bool hasnull;
+
   Assert(!TTS_EMPTY(slot));
 
-  return heap_form_minimal_tuple(slot->tts_tupleDescriptor, slot->tts_values,
-                                 slot->tts_isnull);
+  if (aslot->index >= 0 &&
+      (aslot->rowcxt != NULL || aslot->index >= aslot->merged))
+    slot_getallattrs(slot);
+
+  if (aslot->index < 0 || slot->tts_nvalid == tupdesc->natts)
+    return heap_form_minimal_tuple(tupdesc, slot->tts_values,
+                                   slot->tts_isnull);
+
+  datalen = tts_arrow_row_layout(aslot, &hasnull);
+
+  len = SizeofMinimalTupleHeader;
+  if (hasnull)
+    len += BITMAPLEN(tupdesc->natts);
+  hoff = len = MAXALIGN(len);
+  len += datalen;
+
+  tuple = (MinimalTuple)palloc0(len);
+  tuple->t_len = len;
+  HeapTupleHeaderSetNatts(tuple, tupdesc->natts);
+  tuple->t_hoff = hoff + MINIMAL_TUPLE_OFFSET;
+
+  tts_arrow_fill_tuple(aslot, hasnull, (char *)tuple + hoff,
+                       &tuple->t_infomask, tuple->t_bits);
+  return tuple;
 }
 
-/**
- * Store arrow tuple into slot.
- *
- * An Arrow tuple here is actually a subset of the columns for the
- * table. This function is rather used to fill in the datum and isnull
- * arrays and mark the TTS as filled and should be used as follows:
- *
- * - Call ExecClearTuple to mark it as clear. This will just remove
- *   the isnull and datum arrays, not the arrow array columns nor
- *   change the  * - Make sure that the ArrowArray is properly set up and the
- * index is correctly set.
+/*
+ * Make the slot read rows from the storage of a relation.
  *
- * - Call this function to fill in the datum array and isnull array
- *   based on the arrow arrays and the index.
+ * The slot might have been used for another relation, or another
+ * storage of the same relation, so the columns and the delta segment
+ * are forgotten if the storage is not the same.
+ */
+static void tts_arrow_set_relnumber(ArrowTupleTableSlot *aslot,
+                                    RelFileNumber relnumber) {
+  if (aslot->relnumber == relnumber)
+    return;
+
+  aslot->relnumber = relnumber;
+  aslot->columns = ArrowArrayGetColumns(
+      relnumber, aslot->base.tts_tupleDescriptor->natts);
+  aslot->merged = 0;
+  aslot->delta = NULL;
+  if (aslot->deltarec) {
+    pfree(aslot->deltarec);
+    pfree(aslot->deltaoffsets);
+    aslot->deltarec = NULL;
+    aslot->deltaoffsets = NULL;
+  }
+}
+
+/**
+ * Store a reference to a row of a relation into a slot.
  *
- * Note that we could, similar to how the virtual tuple works, release
- * the arrow arrays if they are owned by the tuple, but since these
- * are allocated in shared memory, we can not "release" them by
- * setting the array to zero and drop the arrow array.
+ * No values are read here, they are read from the columns when they
+ * are requested using slot_getsomeattrs(), and only for the columns
+ * that were not already read for the row.
  */
-TupleTableSlot *ExecStoreArrowTuple(TupleTableSlot *slot) {
+TupleTableSlot *ExecStoreArrowRow(TupleTableSlot *slot, RelFileNumber relnumber,
+                                  int64 row) {
   ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
-  Assert(slot != NULL);
-  Assert(slot->tts_tupleDescriptor != NULL);
-  Assert(TTS_EMPTY(slot));
 
   if (unlikely(!TTS_IS_ARROWTUPLE(slot)))
-    elog(ERROR, "trying to store an Arrow array into wrong type of slot");
-
-  for (int i = 0; i < slot->tts_nvalid; ++i) {
-    Form_pg_attribute attr = TupleDescAttr(slot->tts_tupleDescriptor, i);
-    if (aslot->columns[i] != NULL) {
-      NullableDatum datum =
-          ArrowArrayGetDatum(aslot->columns[i], attr, aslot->index);
-      slot->tts_values[i] = datum.value;
-      slot->tts_isnull[i] = datum.isnull;
-    }
-  }
+    elog(ERROR, "trying to store an Arrow row into wrong type of slot");
+
+  tts_arrow_set_relnumber(aslot, relnumber);
 
+  aslot->index = row;
+  aslot->indelta = false;
+  slot->tts_nvalid = 0;
+  if (aslot->rowcxt)
+    MemoryContextReset(aslot->rowcxt);
   slot->tts_flags &= ~TTS_FLAG_EMPTY;
+  ArrowRowSetItemPointer(&slot->tts_tid, row);
 
   return slot;
 }
 
 /**
- * Insert data in a slot into the corresponding arrow arrays.
+ * Insert data in slots into the corresponding arrow arrays.
+ *
+ * Appends are serialized using the relation extension lock, so the
+ * rows of one call get consecutive row numbers and are recorded as a
+ * single run in the visibility segment. Small inserts write the rows
+ * to the delta store instead of the columns, if the relation has one.
+ *
+ * Only reserving the rows is done while holding the lock: the columns
+ * are extended and the run is recorded, and the values are written
+ * after releasing the lock, so backends loading the same table fill
+ * their rows in parallel. Nobody else reads the rows before the
+ * inserting transaction commits, so it is safe to fill them late.
+ * Nested columns build their children while appending, so tables with
+ * such columns are filled while holding the lock.
  */
-void ExecInsertArrowSlot(Relation relation, Oid relid, TupleTableSlot *slot,
-                         CommandId cid, int options) {
-  ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
-  TupleDesc tupdesc = slot->tts_tupleDescriptor;
+void ExecInsertArrowSlots(Relation relation, TupleTableSlot **slots,
+                          int nslots, CommandId cid, int options) {
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  ArrowArray **columns = ArrowArrayGetColumns(relnumber, tupdesc->natts);
+  ArrowArray *runs;
+  ArrowArray *delta;
+  TransactionId xmin;
+  int64 first = 0;
+  bool reserve = true;
+
+  /* Slots can be arrow slots from a scan of another table, so make
+   * sure that all values are available before taking the extension
+   * lock. */
+  for (int n = 0; n < nslots; ++n)
+    slot_getallattrs(slots[n]);
+
+  /* This can assign a transaction id, which takes a lock, so it has
+   * to be done before taking the extension lock. */
+  if (options & TABLE_INSERT_FROZEN)
+    xmin = FrozenTransactionId;
+  else
+    xmin = GetCurrentTransactionId();
+
+  LockRelationForExtension(relation, ExclusiveLock);
+
+  runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  ArrowArrayReserve(runs, 1);
+
+  delta = ArrowDeltaPrepare(relation, nslots, &first);
+  if (delta != NULL) {
+    ArrowDeltaAppend(relation, delta, first, slots, nslots);
+  } else {
+    for (int i = 0; i < tupdesc->natts; ++i) {
+      columns[i] = ArrowArrayGet(relnumber, TupleDescAttr(tupdesc, i), O_RDWR);
+      first = Max(first, columns[i]->length);
+    }
 
-  /* Iterate over all the columns and add the value to each column. */
-  for (int i = 0; i < tupdesc->natts; ++i) {
-    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-    aslot->columns[i] = ArrowArrayGet(relid, attr, O_RDWR);
-    if (slot->tts_isnull[i])
-      ArrowArrayAppendNull(aslot->columns[i]);
-    else
-      ArrowArrayAppendDatum(aslot->columns[i], attr, slot->tts_values[i]);
+    /* Make room in all columns first so that failing to grow a segment
+     * does not leave the columns with different lengths. */
+    for (int i = 0; i < tupdesc->natts; ++i)
+      ArrowArrayReserve(columns[i], first - columns[i]->length + nslots);
+
+    /* Columns can still have different lengths if an earlier insert
+     * failed half-way. Those rows are not part of any run, so we just
+     * pad the shorter columns. */
+    for (int i = 0; i < tupdesc->natts; ++i)
+      while (columns[i]->length < first)
+        ArrowArrayAppendNull(columns[i]);
+
+    for (int i = 0; i < tupdesc->natts; ++i)
+      if (ArrowLayoutIsNested(ArrowArrayLayout(columns[i])))
+        reserve = false;
+
+    if (reserve) {
+      for (int i = 0; i < tupdesc->natts; ++i)
+        ArrowArrayExtend(columns[i], nslots);
+    } else {
+      /* Iterate over all the columns and add the value to each column. */
+      for (int n = 0; n < nslots; ++n) {
+        TupleTableSlot *slot = slots[n];
+        for (int i = 0; i < tupdesc->natts; ++i) {
+          Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+          if (slot->tts_isnull[i])
+            ArrowArrayAppendNull(columns[i]);
+          else
+            ArrowArrayAppendDatum(columns[i], attr, slot->tts_values[i]);
+        }
+      }
+    }
+  }
+
+  for (int n = 0; n < nslots; ++n) {
+    TupleTableSlot *slot = slots[n];
+
+    if (TTS_IS_ARROWTUPLE(slot)) {
+      ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
+      tts_arrow_set_relnumber(aslot, relnumber);
+      aslot->index = first + n;
+      aslot->indelta = false;
+    }
+    slot->tts_tableOid = RelationGetRelid(relation);
+    ArrowRowSetItemPointer(&slot->tts_tid, first + n);
+  }
+
+  ArrowVisibilityAppend(runs, first, nslots, xmin, cid);
+  ArrowVisibilityExtendFork(relation, first, nslots);
+
+  UnlockRelationForExtension(relation, ExclusiveLock);
+
+  pg_atomic_fetch_add_u64(&ArrowArrayCounters(runs)->rows_inserted, nslots);
+  TRACE_ARROW_INSERT_BATCH(relnumber, first, nslots);
+
+  /* Fill the rows reserved above. Other backends can fill rows next to
+   * ours at the same time, which is why bits are set atomically. */
+  if (delta == NULL && reserve) {
+    for (int n = 0; n < nslots; ++n) {
+      TupleTableSlot *slot = slots[n];
+      for (int i = 0; i < tupdesc->natts; ++i) {
+        if (slot->tts_isnull[i])
+          ArrowArraySetNull(columns[i], first + n);
+        else
+          ArrowArraySetDatum(columns[i], first + n, slot->tts_values[i]);
+      }
+    }
   }
 }
 
@@ -23,9 +23,13 @@
 
 #include <access/tupdesc.h>
 #include <executor/tuptable.h>
+#include <storage/itemptr.h>
 #include <utils/rel.h>
 
+#include "arrow_array.h"
 #include "arrow_c_data_interface.h"
+#include "arrow_delta.h"
+#include "arrow_storage.h"
 
 /**
  * Arrow Tuple Table Slot.
@@ -41,6 +45,31 @@
  * The index cannot be negative, but since arrow array offsets are
  * signed, we stick to the same convention for the indexes. It will
  * allow us to encode additional information using negative numbers.
+ * An index of -1 means that the slot does not refer to a row and all
+ * values are in `tts_values`, for example after copying another slot
+ * into it.
+ *
+ * Tuples are formed directly from the column buffers of the row. The
+ * offsets of the columns in the data area of a tuple without nulls
+ * are computed once when the slot is created, and so is the length
+ * shared by all columns, if any, which selects a specialized loop for
+ * reading the values. The same offsets are used for `refdata`, which
+ * holds copies of the pass-by-reference values of the current row, so
+ * that they do not point into segments that can be remapped.
+ *
+ * Arrays and composites are built from the child arrays of their
+ * columns in `rowcxt`, which is reset for each row. Tables with such
+ * columns form tuples from `tts_values` instead of from the columns.
+ *
+ * The columns are the block of column arrays of the relation, which
+ * is owned by the array cache and shared with other slots, so the slot
+ * neither allocates nor releases them. Columns are opened the first
+ * time they are read.
+ *
+ * Rows after the first `merged` rows can be in the delta store of the
+ * relation, in which case the record of the row is copied and the
+ * values are read from the copy. Tuples for those rows are also
+ * formed from `tts_values`.
  *
  * The length of the array is copied from the ArrowArray columns. They
  * should all have the same length, which is the logical length of the
@@ -48,18 +77,52 @@
  */
 typedef struct ArrowTupleTableSlot {
   TupleTableSlot base;
+  RelFileNumber relnumber; /* Storage the columns are read from */
   int64 index;
 #if 0
   int64 length; /* Copied from the arrays */
 #endif
-  ArrowArray **columns;
+  ArrowArray **columns; /* Columns of the relation, not owned */
+  ArrowType *types; /* Storage of each column */
+  int32 *offsets;   /* Offset of each column in a tuple without nulls */
+  Size datalen;     /* Size of the data of a tuple without nulls */
+  char *refdata;    /* Pass-by-reference values of the current row */
+  bool *rownulls;   /* Nulls of the row being formed into a tuple */
+  int16 attlen;     /* Length of all columns, or 0 if they differ */
+  MemoryContext rowcxt; /* Values built for the row, or NULL */
+
+  /* Rows that might be in the delta store are looked up there first */
+  int64 merged;               /* Rows known to be in the columns */
+  ArrowArray *delta;          /* Delta segment, once known to exist */
+  int32 *deltaoffsets;        /* Offsets of the columns in records */
+  ArrowDeltaRecord *deltarec; /* Record of the current row */
+  bool indelta;               /* Current row was read from deltarec */
 } ArrowTupleTableSlot;
 
 extern PGDLLIMPORT const TupleTableSlotOps TTSOpsArrowTuple;
 
 #define TTS_IS_ARROWTUPLE(SLOT) ((slot)->tts_ops == &TTSOpsArrowTuple)
 
-TupleTableSlot *ExecStoreArrowTuple(TupleTableSlot *slot);
-void ExecInsertArrowSlot(Relation relation, Oid relid, TupleTableSlot *slot,
-                         CommandId cid, int options);
+/**
+ * Convert between row numbers and item pointers.
+ *
+ * Each chunk is used as a block, so the block number is the chunk
+ * number and the offset number is the position in the chunk, starting
+ * at 1. Rows only move when VACUUM compacts the relation, and the
+ * indexes are rebuilt when that happens, so the item pointer of a row
+ * is stable for as long as anybody can hold on to it.
+ */
+static inline void ArrowRowSetItemPointer(ItemPointer tid, int64 row) {
+  ItemPointerSet(tid, row / ARROW_CHUNK_ROWS, row % ARROW_CHUNK_ROWS + 1);
+}
+
+static inline int64 ArrowItemPointerGetRow(ItemPointer tid) {
+  return (int64)ItemPointerGetBlockNumber(tid) * ARROW_CHUNK_ROWS +
+         ItemPointerGetOffsetNumber(tid) - 1;
+}
+
+TupleTableSlot *ExecStoreArrowRow(TupleTableSlot *slot, RelFileNumber relnumber,
+                                  int64 row);
+void ExecInsertArrowSlots(Relation relation, TupleTableSlot **slots,
+                          int nslots, CommandId cid, int options);
 #endif
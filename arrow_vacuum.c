@@ -0,0 +1,282 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_vacuum.h"
+
+#include <postgres.h>
+
+#include <access/multixact.h>
+#include <access/transam.h>
+#include <catalog/index.h>
+#include <commands/vacuum.h>
+#include <pgstat.h>
+#include <port/pg_bitutils.h>
+#include <storage/bufmgr.h>
+#include <storage/lmgr.h>
+#include <storage/procarray.h>
+#include <utils/rel.h>
+#include <utils/relcache.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_cluster.h"
+#include "arrow_delta.h"
+#include "arrow_visibility.h"
+#include "debug.h"
+
+/*
+ * Fraction of rows in a chunk that have to be deleted for the chunk
+ * to be compacted.
+ */
+double ArrowCompactionThreshold = 0.2;
+
+/*
+ * Build a bitmap of the rows that are visible to everybody.
+ *
+ * Returns NULL if the visibility of some rows still depends on the
+ * snapshot, that is, if there are runs that are not frozen or deletes
+ * that are not folded into the dead bitmaps.
+ */
+static uint64* ArrowLiveRows(ArrowArray* runs, ArrowDeletes* deletes,
+                             int64 nrows) {
+  uint64* live = palloc0(sizeof(uint64) * ((nrows + 63) / 64));
+
+  for (int64 i = 0; i < runs->length; ++i) {
+    ArrowInsertRun* run = ArrowVisibilityRun(runs, i);
+
+    if (run->flags & ARROW_XID_INVALID)
+      continue;
+    if ((run->flags & ARROW_RUN_FROZEN) == 0) {
+      pfree(live);
+      return NULL;
+    }
+
+    for (int64 row = run->first; row < run->first + run->count; ++row)
+      live[row / 64] |= UINT64CONST(1) << (row % 64);
+  }
+
+  for (int64 chunk = 0; chunk < deletes->chunks->length; ++chunk) {
+    ArrowDeleteChunk* entry = ArrowArrayChunkData(
+        deletes->chunks, chunk / ARROW_CHUNK_ROWS);
+
+    entry += chunk % ARROW_CHUNK_ROWS;
+    if (entry->head != 0) {
+      pfree(live);
+      return NULL;
+    }
+
+    for (int w = 0; w < ARROW_CHUNK_WORDS; ++w) {
+      const int64 word = chunk * ARROW_CHUNK_WORDS + w;
+      if (word * 64 < nrows)
+        live[word] &= ~entry->dead[w];
+    }
+  }
+
+  return live;
+}
+
+/*
+ * Compact the rows of a relation.
+ *
+ * This finds the first chunk where the fraction of rows that are not
+ * visible to anybody is at least `threshold` and writes the relation
+ * to new storage: rows before that chunk are copied as they are,
+ * while only the rows that are visible from that chunk onwards are
+ * copied, to consecutive positions.
+ *
+ * The new storage replaces the old storage when the transaction
+ * commits, the same way as for TRUNCATE, so if the transaction aborts
+ * the old rows are still in place for the old indexes. The relation
+ * is only compacted if all rows are either visible or invisible to
+ * everybody, so moving rows does not change what any snapshot sees.
+ * The caller has to hold an exclusive lock on the relation until the
+ * end of the transaction. Returns the number of rows removed.
+ */
+int64 ArrowCompactRelation(Relation relation, double threshold) {
+  const RelFileNumber oldnumber = relation->rd_locator.relNumber;
+  RelFileNumber newnumber;
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  ArrowArray* runs = ArrowVisibilityGet(oldnumber, O_RDWR);
+  ArrowArray* newruns;
+  ArrowDeletes deletes;
+  ArrowDeletes newdeletes;
+  ArrowInsertRun* run;
+  int64 nrows = 0;
+  int64 start;
+  int64 kept = 0;
+  int64 ncopied = 0;
+  int64 nchunks;
+  int64* keep;
+  uint64* live;
+  ArrowSortInfo info;
+  bool sorted;
+
+  ArrowDeletesGet(oldnumber, O_RDWR, &deletes);
+
+  for (int i = 0; i < tupdesc->natts; ++i) {
+    ArrowArray* column =
+        ArrowArrayGet(oldnumber, TupleDescAttr(tupdesc, i), O_RDWR);
+    nrows = Max(nrows, column->length);
+  }
+
+  if (runs->length > 0) {
+    run = ArrowVisibilityRun(runs, runs->length - 1);
+    nrows = Max(nrows, run->first + run->count);
+  }
+
+  live = ArrowLiveRows(runs, &deletes, nrows);
+  if (live == NULL)
+    return 0;
+
+  /* Find the first chunk with enough rows to remove */
+  for (start = 0; start < nrows; start += ARROW_CHUNK_ROWS) {
+    const int64 rows = Min(nrows - start, ARROW_CHUNK_ROWS);
+    int64 count = 0;
+    for (int64 w = start / 64; w * 64 < start + rows; ++w)
+      count += pg_popcount64(live[w]);
+    if (rows - count > 0 && rows - count >= threshold * rows)
+      break;
+  }
+
+  if (start >= nrows)
+    return 0;
+
+  DEBUG_LOG("compacting %s from row %ld of %ld",
+            RelationGetRelationName(relation), start, nrows);
+
+  for (int64 w = start / 64; w * 64 < nrows; ++w)
+    kept += pg_popcount64(live[w]);
+
+  keep = MemoryContextAllocHuge(CurrentMemoryContext,
+                                Max(start + kept, 1) * sizeof(int64));
+  for (int64 row = 0; row < start; ++row)
+    keep[ncopied++] = row;
+  for (int64 row = start; row < nrows; ++row)
+    if (live[row / 64] & (UINT64CONST(1) << (row % 64)))
+      keep[ncopied++] = row;
+
+  sorted = ArrowSortInfoGet(oldnumber, &info);
+
+  RelationSetNewRelfilenumber(relation, relation->rd_rel->relpersistence);
+  newnumber = relation->rd_locator.relNumber;
+
+  ArrowCopyRows(relation, oldnumber, newnumber, keep, NULL, ncopied);
+
+  /* Keep the runs before the start, clipped to the start, and add a
+   * frozen run for the rows that were moved. All runs are frozen, so
+   * adjacent runs are merged. */
+  newruns = ArrowVisibilityGet(newnumber, O_RDWR);
+  for (int64 i = 0; i < runs->length; ++i) {
+    run = ArrowVisibilityRun(runs, i);
+    if (run->first >= start || (run->flags & ARROW_XID_INVALID))
+      continue;
+    ArrowArrayReserve(newruns, 1);
+    ArrowVisibilityAppend(newruns, run->first,
+                          Min(run->count, start - run->first),
+                          FrozenTransactionId, FirstCommandId);
+  }
+  if (kept > 0) {
+    ArrowArrayReserve(newruns, 1);
+    ArrowVisibilityAppend(newruns, start, kept, FrozenTransactionId,
+                          FirstCommandId);
+  }
+  ArrowVisibilityExtendFork(relation, 0, start + kept);
+
+  /* All delete records are folded, so only the dead bitmaps of the
+   * chunks before the start are needed. */
+  nchunks = Min(deletes.chunks->length, start / ARROW_CHUNK_ROWS);
+  ArrowDeletesGet(newnumber, O_RDWR, &newdeletes);
+  ArrowArrayReserve(newdeletes.chunks, nchunks);
+  ArrowArrayExtend(newdeletes.chunks, nchunks);
+  for (int64 chunk = 0; chunk < nchunks; ++chunk) {
+    ArrowDeleteChunk* source = ArrowArrayChunkData(
+        deletes.chunks, chunk / ARROW_CHUNK_ROWS);
+    ArrowDeleteChunk* target = ArrowArrayChunkData(
+        newdeletes.chunks, chunk / ARROW_CHUNK_ROWS);
+
+    /* Update links point into the old storage, and nobody can still
+     * follow them. */
+    target[chunk % ARROW_CHUNK_ROWS] = source[chunk % ARROW_CHUNK_ROWS];
+    target[chunk % ARROW_CHUNK_ROWS].links = 0;
+  }
+
+  /* Sorted rows stay in order when they move, but fewer of them are
+   * left. */
+  if (sorted) {
+    int64 nsorted = Min(info.nrows, start);
+    for (int64 row = start; row < Min(info.nrows, nrows); ++row)
+      if (live[row / 64] & (UINT64CONST(1) << (row % 64)))
+        ++nsorted;
+    ArrowSortInfoSet(newnumber, info.indexrelid, nsorted);
+  }
+
+  pfree(keep);
+  pfree(live);
+
+  return nrows - start - kept;
+}
+
+/*
+ * Vacuum a relation, compacting it if `compact` is set.
+ */
+void ArrowVacuumRelation(Relation relation, int elevel, bool compact) {
+  TransactionId oldestXmin = GetOldestNonRemovableTransactionId(relation);
+  int64 merged = ArrowDeltaMerge(relation);
+  int64 frozen = ArrowVisibilityFreeze(relation, oldestXmin);
+  int64 pruned = ArrowDeletesPrune(relation, oldestXmin);
+  int64 removed = 0;
+  int64 live;
+  int64 dead;
+  bool frozenxid_updated;
+  bool minmulti_updated;
+
+  /* The lock is kept until the end of the transaction, since other
+   * backends must not use the old indexes, or the old storage, before
+   * the new storage is committed. */
+  if (compact && ConditionalLockRelation(relation, AccessExclusiveLock)) {
+    removed = ArrowCompactRelation(relation, ArrowCompactionThreshold);
+
+    /* Compaction moves rows, so index entries point to the wrong rows
+     * and the indexes have to be rebuilt. */
+    if (removed > 0 && relation->rd_rel->relhasindex) {
+      ReindexParams params = {0};
+      reindex_relation(RelationGetRelid(relation), 0, &params);
+    }
+  }
+
+  /* Report the rows left, so that autovacuum knows that the relation
+   * was vacuumed, also when done by the maintenance worker. Older
+   * transaction ids are no longer needed, so relfrozenxid can move
+   * forward, which keeps autovacuum from forcing anti-wraparound
+   * vacuums of the relation. Multixacts are never used. */
+  ArrowVisibilityCount(relation, &live, &dead);
+  vac_update_relstats(relation, RelationGetNumberOfBlocks(relation), live, 0,
+                      relation->rd_rel->relhasindex,
+                      ArrowVisibilityFrozenXid(relation, oldestXmin),
+                      GetOldestMultiXactId(), &frozenxid_updated,
+                      &minmulti_updated, false);
+  pgstat_report_vacuum(RelationGetRelid(relation),
+                       relation->rd_rel->relisshared, live, dead);
+
+  ereport(elevel,
+          (errmsg("\"%s\": merged %lld rows, froze %lld rows, pruned %lld "
+                  "deleted rows, and removed %lld rows",
+                  RelationGetRelationName(relation), (long long)merged,
+                  (long long)frozen, (long long)pruned, (long long)removed)));
+}
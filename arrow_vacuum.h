@@ -0,0 +1,43 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Vacuuming of arrow tables.
+ *
+ * Vacuum merges the delta store into the columns, freezes runs of
+ * rows, and folds deletes that are visible to everybody, and then
+ * compacts the relation if enough rows are deleted. Compaction moves
+ * rows to new storage and rebuilds the indexes, and needs an exclusive
+ * lock on the relation until the transaction commits, so it is only
+ * done by a manual VACUUM, and only if the lock can be taken without
+ * waiting.
+ */
+
+#ifndef ARROW_VACUUM_H_
+#define ARROW_VACUUM_H_
+
+#include <postgres.h>
+
+#include <utils/rel.h>
+
+extern double ArrowCompactionThreshold;
+
+int64 ArrowCompactRelation(Relation relation, double threshold);
+void ArrowVacuumRelation(Relation relation, int elevel, bool compact);
+
+#endif /* ARROW_VACUUM_H_ */
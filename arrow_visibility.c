@@ -0,0 +1,1030 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_visibility.h"
+
+#include <postgres.h>
+
+#include <access/transam.h>
+#include <access/xact.h>
+#include <port/atomics.h>
+#include <port/pg_bitutils.h>
+#include <storage/lmgr.h>
+#include <storage/procarray.h>
+#include <storage/smgr.h>
+#include <utils/snapmgr.h>
+
+#include <fcntl.h>
+
+#include "arrow_array.h"
+#include "arrow_tts.h"
+#include "debug.h"
+
+/*
+ * Get the visibility segment for a relation.
+ */
+ArrowArray* ArrowVisibilityGet(RelFileNumber relnumber, int oflags) {
+  return ArrowArrayOpen(relnumber, ARROW_VISIBILITY_ATTNO,
+                        sizeof(ArrowInsertRun), oflags);
+}
+
+ArrowInsertRun* ArrowVisibilityRun(ArrowArray* runs, int64 n) {
+  ArrowInsertRun* chunk = ArrowArrayChunkData(runs, n / ARROW_CHUNK_ROWS);
+  Assert(n < runs->length ||
+         n < ((SegmentData*)runs->private_data)->capacity);
+  return &chunk[n % ARROW_CHUNK_ROWS];
+}
+
+/*
+ * Find the run containing a row.
+ *
+ * Runs are appended in row order, so we can use a binary search.
+ * Returns NULL if the row is not part of any run.
+ */
+ArrowInsertRun* ArrowVisibilityFind(ArrowArray* runs, int64 row) {
+  int64 low = 0;
+  int64 high = runs->length;
+
+  /* Find the first run that starts after the row */
+  while (low < high) {
+    const int64 mid = low + (high - low) / 2;
+    if (ArrowVisibilityRun(runs, mid)->first <= row)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  if (low > 0) {
+    ArrowInsertRun* run = ArrowVisibilityRun(runs, low - 1);
+    if (row < run->first + run->count)
+      return run;
+  }
+  return NULL;
+}
+
+/*
+ * Number of rows covered by the runs.
+ *
+ * This includes rows inserted by aborted transactions, so it is the
+ * number of row positions in use rather than the number of rows.
+ */
+int64 ArrowVisibilityRows(ArrowArray* runs) {
+  ArrowInsertRun* run;
+
+  if (runs->length == 0)
+    return 0;
+  run = ArrowVisibilityRun(runs, runs->length - 1);
+  return run->first + run->count;
+}
+
+/*
+ * Record that rows were inserted.
+ *
+ * This has to be called with the relation extension lock held, after
+ * the rows have been written to all columns, and after reserving room
+ * for one more run. The last run is extended if it is for the same
+ * command and ends where the new rows start, otherwise a new run is
+ * added.
+ */
+void ArrowVisibilityAppend(ArrowArray* runs, int64 first, int64 count,
+                           TransactionId xmin, CommandId cid) {
+  ArrowInsertRun* run;
+
+  DEBUG_ENTER("first: %ld, count: %ld, xmin: %u, cid: %u", first, count, xmin,
+              cid);
+
+  if (runs->length > 0) {
+    run = ArrowVisibilityRun(runs, runs->length - 1);
+    if (run->xmin == xmin && run->cmin == cid &&
+        run->first + run->count == first) {
+      pg_write_barrier();
+      run->count += count;
+      DEBUG_LEAVE("extended run: %ld", runs->length - 1);
+      return;
+    }
+  }
+
+  run = ArrowVisibilityRun(runs, runs->length);
+  memset(run, 0, sizeof(*run));
+  run->first = first;
+  run->count = count;
+  run->xmin = xmin;
+  run->cmin = cid;
+  if (xmin == FrozenTransactionId)
+    run->flags = ARROW_XID_COMMITTED | ARROW_RUN_FROZEN;
+  ArrowArrayExtend(runs, 1);
+
+  DEBUG_LEAVE("new run: %ld", runs->length - 1);
+}
+
+/*
+ * Make sure that the main fork covers the block of the last row.
+ *
+ * The main fork holds no data, but bitmap heap scans and ANALYZE
+ * prefetch the blocks of item pointers, and prefetching a block fails
+ * unless the segment files of the fork before it are full. So when the
+ * rows reach a new segment file, a zeroed block is written at the
+ * start of it, which fills the earlier segment files with holes.
+ * Blocks past the end of the last segment file can be prefetched, so
+ * the fork grows by one block for each RELSEG_SIZE chunks and stays
+ * empty for smaller relations.
+ *
+ * This has to be called with the relation extension lock held, or an
+ * exclusive lock on the relation, with the rows just appended.
+ */
+void ArrowVisibilityExtendFork(Relation relation, int64 first, int64 count) {
+  const BlockNumber last = (first + count - 1) / ARROW_CHUNK_ROWS;
+  const BlockNumber target = last - last % RELSEG_SIZE;
+  SMgrRelation srel;
+  PGIOAlignedBlock zero;
+
+  if (count <= 0 || target == 0)
+    return;
+
+  /* Only check the fork when the rows cross into a new segment file */
+  if (first > 0 && (first - 1) / ARROW_CHUNK_ROWS >= target)
+    return;
+
+  srel = RelationGetSmgr(relation);
+  if (smgrnblocks(srel, MAIN_FORKNUM) > target)
+    return;
+
+  DEBUG_LOG("relation: %s, block: %u", RelationGetRelationName(relation),
+            target);
+  memset(zero.data, 0, BLCKSZ);
+  smgrextend(srel, MAIN_FORKNUM, target, zero.data, true);
+}
+
+/*
+ * Check if the inserting or deleting transaction committed.
+ *
+ * The outcome is cached in the flags once the transaction has
+ * finished. Flags are updated without locking, which is fine since
+ * losing an update just means that it has to be done again.
+ */
+static bool ArrowXidCommitted(TransactionId xid, uint16* flags,
+                              bool* in_progress) {
+  *in_progress = false;
+
+  if (*flags & ARROW_XID_COMMITTED)
+    return true;
+  if (*flags & ARROW_XID_INVALID)
+    return false;
+
+  if (TransactionIdIsInProgress(xid)) {
+    *in_progress = true;
+    return false;
+  }
+
+  if (TransactionIdDidCommit(xid)) {
+    *flags |= ARROW_XID_COMMITTED;
+    return true;
+  }
+
+  /* Aborted or crashed */
+  *flags |= ARROW_XID_INVALID;
+  return false;
+}
+
+#define ArrowRunXminCommitted(RUN, IN_PROGRESS) \
+  ArrowXidCommitted((RUN)->xmin, &(RUN)->flags, (IN_PROGRESS))
+
+/*
+ * Check if the rows of a run are visible to a snapshot.
+ *
+ * This follows the rules in heapam_visibility.c for tuples that have
+ * not been deleted.
+ */
+bool ArrowRunSatisfiesSnapshot(ArrowInsertRun* run, Snapshot snapshot) {
+  bool in_progress;
+
+  if (run->flags & ARROW_RUN_FROZEN)
+    return true;
+  if (run->flags & ARROW_XID_INVALID)
+    return false;
+
+  switch (snapshot->snapshot_type) {
+    case SNAPSHOT_ANY:
+      return true;
+
+    case SNAPSHOT_MVCC:
+      if (TransactionIdIsCurrentTransactionId(run->xmin))
+        return run->cmin < snapshot->curcid;
+      if (XidInMVCCSnapshot(run->xmin, snapshot))
+        return false;
+      return ArrowRunXminCommitted(run, &in_progress);
+
+    case SNAPSHOT_SELF:
+    case SNAPSHOT_TOAST:
+      if (TransactionIdIsCurrentTransactionId(run->xmin))
+        return true;
+      return ArrowRunXminCommitted(run, &in_progress);
+
+    case SNAPSHOT_DIRTY:
+      if (TransactionIdIsCurrentTransactionId(run->xmin))
+        return true;
+      if (ArrowRunXminCommitted(run, &in_progress))
+        return true;
+      if (in_progress)
+        snapshot->xmin = run->xmin;
+      return in_progress;
+
+    case SNAPSHOT_NON_VACUUMABLE:
+      if (TransactionIdIsCurrentTransactionId(run->xmin))
+        return true;
+      return ArrowRunXminCommitted(run, &in_progress) || in_progress;
+
+    case SNAPSHOT_HISTORIC_MVCC:
+      elog(ERROR, "historic snapshots are not supported for arrow tables");
+  }
+
+  return false;
+}
+
+/*
+ * Freeze runs inserted by committed transactions older than
+ * `oldestXmin`.
+ *
+ * Scans do not need to check visibility for rows in frozen runs.
+ * Runs of aborted transactions are marked as invalid as a side
+ * effect. Returns the number of rows frozen.
+ */
+int64 ArrowVisibilityFreeze(Relation relation, TransactionId oldestXmin) {
+  ArrowArray* runs =
+      ArrowVisibilityGet(relation->rd_locator.relNumber, O_RDWR);
+  int64 frozen = 0;
+
+  for (int64 i = 0; i < runs->length; ++i) {
+    ArrowInsertRun* run = ArrowVisibilityRun(runs, i);
+    bool in_progress;
+
+    if (run->flags & (ARROW_RUN_FROZEN | ARROW_XID_INVALID))
+      continue;
+
+    if (ArrowRunXminCommitted(run, &in_progress) &&
+        TransactionIdPrecedes(run->xmin, oldestXmin)) {
+      run->flags |= ARROW_RUN_FROZEN;
+      frozen += run->count;
+    }
+  }
+
+  return frozen;
+}
+
+/*
+ * Get the delete segments for a relation.
+ */
+void ArrowDeletesGet(RelFileNumber relnumber, int oflags,
+                     ArrowDeletes* deletes) {
+  deletes->chunks = ArrowArrayOpen(relnumber, ARROW_DELETE_CHUNK_ATTNO,
+                                   sizeof(ArrowDeleteChunk), oflags);
+  deletes->records = ArrowArrayOpen(relnumber, ARROW_DELETE_RECORD_ATTNO,
+                                    sizeof(ArrowDeleteRecord), oflags);
+}
+
+/*
+ * Get an element of an array of fixed-size elements.
+ *
+ * Other backends can add elements and grow the segment, so we remap
+ * the segment if the element is outside the mapped part.
+ */
+static void* ArrowArrayElement(ArrowArray* array, int64 n, size_t size) {
+  if (n >= ((SegmentData*)array->private_data)->capacity)
+    ArrowArrayRefresh(array);
+  return (int8*)ArrowArrayChunkData(array, n / ARROW_CHUNK_ROWS) +
+         (n % ARROW_CHUNK_ROWS) * size;
+}
+
+static ArrowDeleteChunk* ArrowDeleteChunkGet(ArrowDeletes* deletes,
+                                             int64 chunk) {
+  if (chunk >= deletes->chunks->length)
+    ArrowArrayRefresh(deletes->chunks);
+  if (chunk >= deletes->chunks->length)
+    return NULL;
+  return ArrowArrayElement(deletes->chunks, chunk, sizeof(ArrowDeleteChunk));
+}
+
+static ArrowDeleteRecord* ArrowDeleteRecordGet(ArrowDeletes* deletes,
+                                               int64 ref) {
+  Assert(ref > 0);
+  return ArrowArrayElement(deletes->records, ref - 1,
+                           sizeof(ArrowDeleteRecord));
+}
+
+/*
+ * Check if the delete of a record is visible to a snapshot.
+ *
+ * This follows the rules in heapam_visibility.c for the xmax of
+ * tuples that are not locked only. Records that only lock rows never
+ * hide them.
+ */
+static bool ArrowDeleteSatisfiesSnapshot(ArrowDeleteRecord* record,
+                                         Snapshot snapshot) {
+  bool in_progress;
+
+  if (record->flags & (ARROW_XID_INVALID | ARROW_RECORD_LOCK))
+    return false;
+
+  switch (snapshot->snapshot_type) {
+    case SNAPSHOT_ANY:
+      return false;
+
+    case SNAPSHOT_MVCC:
+      if (TransactionIdIsCurrentTransactionId(record->xmax))
+        return record->cmax < snapshot->curcid;
+      if (XidInMVCCSnapshot(record->xmax, snapshot))
+        return false;
+      return ArrowXidCommitted(record->xmax, &record->flags, &in_progress);
+
+    case SNAPSHOT_SELF:
+    case SNAPSHOT_TOAST:
+      if (TransactionIdIsCurrentTransactionId(record->xmax))
+        return true;
+      return ArrowXidCommitted(record->xmax, &record->flags, &in_progress);
+
+    case SNAPSHOT_DIRTY:
+      if (TransactionIdIsCurrentTransactionId(record->xmax))
+        return true;
+      if (ArrowXidCommitted(record->xmax, &record->flags, &in_progress))
+        return true;
+      if (in_progress)
+        snapshot->xmax = record->xmax;
+      return false;
+
+    case SNAPSHOT_NON_VACUUMABLE:
+      if (!ArrowXidCommitted(record->xmax, &record->flags, &in_progress))
+        return false;
+      return GlobalVisTestIsRemovableXid(snapshot->vistest, record->xmax);
+
+    case SNAPSHOT_HISTORIC_MVCC:
+      elog(ERROR, "historic snapshots are not supported for arrow tables");
+  }
+
+  return false;
+}
+
+/*
+ * Compute a mask of the rows in a chunk that are not deleted.
+ *
+ * Returns false, without touching the mask, if nothing in the chunk
+ * has been deleted, in which case the mask can be ignored.
+ */
+bool ArrowDeletesMask(ArrowDeletes* deletes, int64 chunk, Snapshot snapshot,
+                      uint64* mask) {
+  ArrowDeleteChunk* entry = ArrowDeleteChunkGet(deletes, chunk);
+  int64 ref;
+
+  if (entry == NULL)
+    return false;
+
+  ref = entry->head;
+  pg_read_barrier();
+
+  if (ref == 0) {
+    bool any = false;
+    for (int w = 0; w < ARROW_CHUNK_WORDS; ++w)
+      any |= (entry->dead[w] != 0);
+    if (!any)
+      return false;
+  }
+
+  for (int w = 0; w < ARROW_CHUNK_WORDS; ++w)
+    mask[w] = ~entry->dead[w];
+
+  while (ref != 0) {
+    ArrowDeleteRecord* record = ArrowDeleteRecordGet(deletes, ref);
+    if (ArrowDeleteSatisfiesSnapshot(record, snapshot))
+      for (int w = 0; w < ARROW_CHUNK_WORDS; ++w)
+        mask[w] &= ~record->rows[w];
+    ref = record->next;
+  }
+
+  return true;
+}
+
+/*
+ * Get the deleting transaction of each row in a chunk.
+ *
+ * Rows in the dead bitmap get FrozenTransactionId, rows of delete
+ * records that did not abort get the transaction and command of the
+ * record, and other rows get InvalidTransactionId. Returns false,
+ * without touching the arrays, if the chunk has no deletes.
+ */
+bool ArrowDeletesXmax(ArrowDeletes* deletes, int64 chunk,
+                      TransactionId* xmaxs, CommandId* cmaxs) {
+  ArrowDeleteChunk* entry = ArrowDeleteChunkGet(deletes, chunk);
+  int64 ref;
+
+  if (entry == NULL)
+    return false;
+
+  ref = entry->head;
+  pg_read_barrier();
+
+  for (int bit = 0; bit < ARROW_CHUNK_ROWS; ++bit) {
+    const uint64 rowbit = UINT64CONST(1) << (bit % 64);
+    xmaxs[bit] = (entry->dead[bit / 64] & rowbit) ? FrozenTransactionId
+                                                  : InvalidTransactionId;
+    cmaxs[bit] = InvalidCommandId;
+  }
+
+  while (ref != 0) {
+    ArrowDeleteRecord* record = ArrowDeleteRecordGet(deletes, ref);
+    bool in_progress;
+
+    if ((record->flags & ARROW_RECORD_LOCK) == 0 &&
+        (ArrowXidCommitted(record->xmax, &record->flags, &in_progress) ||
+         in_progress)) {
+      for (int bit = 0; bit < ARROW_CHUNK_ROWS; ++bit) {
+        const uint64 rowbit = UINT64CONST(1) << (bit % 64);
+        if ((record->rows[bit / 64] & rowbit) &&
+            !TransactionIdIsValid(xmaxs[bit])) {
+          xmaxs[bit] = record->xmax;
+          cmaxs[bit] = record->cmax;
+        }
+      }
+    }
+    ref = record->next;
+  }
+
+  return true;
+}
+
+/*
+ * Add a delete of a row to segments that nobody else uses yet.
+ *
+ * This is used to carry deletes over when rows are copied to new
+ * storage, so no locking is done. Rows deleted by the same command
+ * share a record, whatever the order they are added in.
+ */
+void ArrowDeletesAdd(ArrowDeletes* deletes, int64 row, TransactionId xmax,
+                     CommandId cmax) {
+  const int64 chunk = row / ARROW_CHUNK_ROWS;
+  const int64 bit = row % ARROW_CHUNK_ROWS;
+  const uint64 rowbit = UINT64CONST(1) << (bit % 64);
+  ArrowDeleteChunk* entry;
+  ArrowDeleteRecord* record;
+
+  if (chunk >= deletes->chunks->length) {
+    ArrowArrayReserve(deletes->chunks, chunk + 1 - deletes->chunks->length);
+    ArrowArrayExtend(deletes->chunks, chunk + 1 - deletes->chunks->length);
+  }
+  ArrowArrayReserve(deletes->records, 1);
+  entry = ArrowDeleteChunkGet(deletes, chunk);
+
+  for (int64 ref = entry->head; ref != 0; ref = record->next) {
+    record = ArrowDeleteRecordGet(deletes, ref);
+    if (record->xmax == xmax && record->cmax == cmax) {
+      record->rows[bit / 64] |= rowbit;
+      return;
+    }
+  }
+
+  record = ArrowArrayElement(deletes->records, deletes->records->length,
+                             sizeof(ArrowDeleteRecord));
+  memset(record, 0, sizeof(*record));
+  record->rows[bit / 64] = rowbit;
+  record->next = entry->head;
+  record->xmax = xmax;
+  record->cmax = cmax;
+  ArrowArrayExtend(deletes->records, 1);
+  entry->head = deletes->records->length;
+}
+
+/*
+ * Check if a single row is deleted as seen by a snapshot.
+ */
+bool ArrowRowDeleted(ArrowDeletes* deletes, int64 row, Snapshot snapshot) {
+  uint64 mask[ARROW_CHUNK_WORDS];
+  const int64 bit = row % ARROW_CHUNK_ROWS;
+
+  if (!ArrowDeletesMask(deletes, row / ARROW_CHUNK_ROWS, snapshot, mask))
+    return false;
+  return (mask[bit / 64] & (UINT64CONST(1) << (bit % 64))) == 0;
+}
+
+/*
+ * Get the update link segment for a relation.
+ */
+ArrowArray* ArrowUpdateLinksGet(RelFileNumber relnumber, int oflags) {
+  return ArrowArrayOpen(relnumber, ARROW_UPDATE_LINK_ATTNO,
+                        sizeof(ArrowUpdateLink), oflags);
+}
+
+/*
+ * Find the new version of an updated row.
+ *
+ * Returns false if the row has no link, which means that it was
+ * deleted rather than updated.
+ */
+static bool ArrowUpdateLinkFind(RelFileNumber relnumber,
+                                ArrowDeleteChunk* entry, int64 row,
+                                int64* successor) {
+  ArrowArray* links;
+
+  if (entry->links == 0)
+    return false;
+
+  links = ArrowUpdateLinksGet(relnumber, O_RDWR);
+  for (int64 ref = entry->links; ref != 0;) {
+    ArrowUpdateLink* link =
+        ArrowArrayElement(links, ref - 1, sizeof(ArrowUpdateLink));
+    if (link->row == row) {
+      *successor = link->successor;
+      return true;
+    }
+    ref = link->next;
+  }
+  return false;
+}
+
+/*
+ * Record the new version of a row updated by the current transaction.
+ *
+ * This has to be called after deleting the old version, so the chunk
+ * entry exists, and before the transaction commits, since others wait
+ * for the transaction to finish before following the link.
+ */
+void ArrowUpdateLinkAdd(Relation relation, int64 row, int64 successor) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  ArrowArray* links;
+  ArrowUpdateLink* link;
+  ArrowDeleteChunk* entry;
+  ArrowDeletes deletes;
+
+  LockRelationForExtension(relation, ExclusiveLock);
+
+  links = ArrowUpdateLinksGet(relnumber, O_RDWR);
+  ArrowArrayReserve(links, 1);
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+  entry = ArrowDeleteChunkGet(&deletes, row / ARROW_CHUNK_ROWS);
+  Assert(entry != NULL);
+
+  link = ArrowArrayElement(links, links->length, sizeof(ArrowUpdateLink));
+  link->row = row;
+  link->successor = successor;
+  link->next = entry->links;
+  ArrowArrayExtend(links, 1);
+  pg_write_barrier();
+  entry->links = links->length;
+
+  UnlockRelationForExtension(relation, ExclusiveLock);
+}
+
+/*
+ * Check the delete and lock records of a row before deleting or
+ * locking it.
+ *
+ * `lockflags` are the record flags the caller is about to add, so
+ * zero for a delete. Locks of other transactions conflict unless both
+ * are shared, and only while the locking transaction is running. Our
+ * own locks never conflict. Returns TM_Ok if nothing stands in the
+ * way, and TM_BeingModified, with the transaction in `tmfd->xmax`, if
+ * the caller has to wait for another transaction. A delete by a
+ * committed transaction is reported as TM_Updated, with the new
+ * version in `tmfd->ctid`, if it was an update.
+ */
+static TM_Result ArrowCheckRecords(RelFileNumber relnumber,
+                                   ArrowDeletes* deletes,
+                                   ArrowDeleteChunk* entry, int64 row,
+                                   uint16 lockflags, TM_FailureData* tmfd) {
+  const int64 bit = row % ARROW_CHUNK_ROWS;
+  const uint64 rowbit = UINT64CONST(1) << (bit % 64);
+  ArrowDeleteRecord* record;
+  int64 successor;
+
+  if (entry->dead[bit / 64] & rowbit) {
+    if (ArrowUpdateLinkFind(relnumber, entry, row, &successor)) {
+      ArrowRowSetItemPointer(&tmfd->ctid, successor);
+      return TM_Updated;
+    }
+    return TM_Deleted;
+  }
+
+  for (int64 ref = entry->head; ref != 0; ref = record->next) {
+    bool in_progress;
+
+    record = ArrowDeleteRecordGet(deletes, ref);
+    if ((record->rows[bit / 64] & rowbit) == 0)
+      continue;
+
+    if (record->flags & ARROW_RECORD_LOCK) {
+      if (TransactionIdIsCurrentTransactionId(record->xmax) ||
+          ((record->flags & lockflags) & ARROW_RECORD_SHARED))
+        continue;
+      if (ArrowXidCommitted(record->xmax, &record->flags, &in_progress) ||
+          !in_progress)
+        continue;
+      tmfd->xmax = record->xmax;
+      return TM_BeingModified;
+    }
+
+    if (TransactionIdIsCurrentTransactionId(record->xmax)) {
+      tmfd->xmax = record->xmax;
+      tmfd->cmax = record->cmax;
+      return TM_SelfModified;
+    }
+
+    if (ArrowXidCommitted(record->xmax, &record->flags, &in_progress)) {
+      tmfd->xmax = record->xmax;
+      if (ArrowUpdateLinkFind(relnumber, entry, row, &successor)) {
+        ArrowRowSetItemPointer(&tmfd->ctid, successor);
+        return TM_Updated;
+      }
+      return TM_Deleted;
+    }
+
+    if (in_progress) {
+      tmfd->xmax = record->xmax;
+      return TM_BeingModified;
+    }
+
+    /* Deleting transaction aborted, so look further */
+  }
+
+  return TM_Ok;
+}
+
+/*
+ * Add a row to the records of a chunk for the current command.
+ *
+ * The row is added to the latest record if it is for the same command
+ * and of the same kind, otherwise a new record is added for the chunk.
+ * Room for one more record has to be reserved.
+ */
+static void ArrowAddRecord(ArrowDeletes* deletes, ArrowDeleteChunk* entry,
+                           int64 row, TransactionId xid, CommandId cid,
+                           uint16 flags) {
+  const int64 bit = row % ARROW_CHUNK_ROWS;
+  const uint64 rowbit = UINT64CONST(1) << (bit % 64);
+  ArrowDeleteRecord* record;
+
+  record = entry->head ? ArrowDeleteRecordGet(deletes, entry->head) : NULL;
+  if (record != NULL && record->xmax == xid && record->cmax == cid &&
+      (record->flags & (ARROW_RECORD_LOCK | ARROW_RECORD_SHARED)) == flags) {
+    record->rows[bit / 64] |= rowbit;
+  } else {
+    record = ArrowArrayElement(deletes->records, deletes->records->length,
+                               sizeof(ArrowDeleteRecord));
+    memset(record, 0, sizeof(*record));
+    record->rows[bit / 64] = rowbit;
+    record->next = entry->head;
+    record->xmax = xid;
+    record->cmax = cid;
+    record->flags = flags;
+    ArrowArrayExtend(deletes->records, 1);
+    entry->head = deletes->records->length;
+  }
+}
+
+/*
+ * Get the chunk entry of a row, adding entries up to it if needed.
+ *
+ * Has to be called with the relation extension lock held. Room for
+ * one more record is reserved as well.
+ */
+static ArrowDeleteChunk* ArrowPrepareRecord(ArrowDeletes* deletes,
+                                            int64 chunk) {
+  ArrowArrayReserve(deletes->records, 1);
+  if (chunk >= deletes->chunks->length) {
+    ArrowArrayReserve(deletes->chunks, chunk + 1 - deletes->chunks->length);
+    ArrowArrayExtend(deletes->chunks, chunk + 1 - deletes->chunks->length);
+  }
+  return ArrowDeleteChunkGet(deletes, chunk);
+}
+
+/*
+ * Mark a row as deleted by the current command.
+ *
+ * Deletes are serialized with inserts using the relation extension
+ * lock. If the row is being deleted or locked by another transaction,
+ * we wait for it to finish, which cannot be done while holding the
+ * extension lock, and then check again.
+ */
+TM_Result ArrowDeleteRow(Relation relation, ItemPointer tid, CommandId cid,
+                         Snapshot crosscheck, bool wait,
+                         TM_FailureData* tmfd) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  const int64 row = ArrowItemPointerGetRow(tid);
+  const TransactionId xid = GetCurrentTransactionId();
+  ArrowDeletes deletes;
+  ArrowArray* runs;
+  ArrowInsertRun* run;
+  ArrowDeleteChunk* entry;
+  TM_Result result;
+
+retry:
+  LockRelationForExtension(relation, ExclusiveLock);
+
+  runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  run = ArrowVisibilityFind(runs, row);
+  if (run == NULL)
+    elog(ERROR, "attempted to delete invisible tuple");
+
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+  entry = ArrowPrepareRecord(&deletes, row / ARROW_CHUNK_ROWS);
+
+  tmfd->ctid = *tid;
+  tmfd->xmax = InvalidTransactionId;
+  tmfd->cmax = InvalidCommandId;
+  tmfd->traversed = false;
+
+  result = ArrowCheckRecords(relnumber, &deletes, entry, row, 0, tmfd);
+  if (result == TM_BeingModified) {
+    const TransactionId xmax = tmfd->xmax;
+    UnlockRelationForExtension(relation, ExclusiveLock);
+    if (!wait)
+      return TM_BeingModified;
+    XactLockTableWait(xmax, relation, tid, XLTW_Delete);
+    goto retry;
+  }
+
+  if (result == TM_Ok && crosscheck != InvalidSnapshot &&
+      !ArrowRunSatisfiesSnapshot(run, crosscheck))
+    result = TM_Updated;
+
+  if (result == TM_Ok)
+    ArrowAddRecord(&deletes, entry, row, xid, cid, 0);
+
+  UnlockRelationForExtension(relation, ExclusiveLock);
+
+  return result;
+}
+
+/*
+ * Delete a row inserted by INSERT ... ON CONFLICT that turned out to
+ * conflict with another row.
+ *
+ * The row is marked as dead right away, so that it is not visible to
+ * anybody, including the inserting transaction and other transactions
+ * checking for conflicts.
+ */
+void ArrowDeleteSpeculative(Relation relation, int64 row) {
+  const int64 bit = row % ARROW_CHUNK_ROWS;
+  ArrowDeletes deletes;
+  ArrowDeleteChunk* entry;
+
+  LockRelationForExtension(relation, ExclusiveLock);
+
+  ArrowDeletesGet(relation->rd_locator.relNumber, O_RDWR, &deletes);
+  entry = ArrowPrepareRecord(&deletes, row / ARROW_CHUNK_ROWS);
+  entry->dead[bit / 64] |= UINT64CONST(1) << (bit % 64);
+
+  UnlockRelationForExtension(relation, ExclusiveLock);
+}
+
+/*
+ * Lock a row for the current transaction.
+ *
+ * Shared locks (FOR SHARE and FOR KEY SHARE) are compatible with each
+ * other, while other locks conflict with all locks and with deletes,
+ * which is stricter than for heap tables, where FOR KEY SHARE does
+ * not block updates that keep the key. If `follow` is set and the row
+ * was updated by a committed transaction, the newest version of the
+ * row is locked instead, and `tid` is changed to point to it.
+ */
+TM_Result ArrowLockRow(Relation relation, ItemPointer tid, CommandId cid,
+                       LockTupleMode mode, LockWaitPolicy wait_policy,
+                       bool follow, TM_FailureData* tmfd) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  const TransactionId xid = GetCurrentTransactionId();
+  const uint16 lockflags =
+      ARROW_RECORD_LOCK |
+      (mode <= LockTupleShare ? ARROW_RECORD_SHARED : 0);
+  ArrowDeletes deletes;
+  ArrowArray* runs;
+  ArrowInsertRun* run;
+  ArrowDeleteChunk* entry;
+  TM_Result result;
+  int64 row;
+  bool in_progress;
+
+  tmfd->traversed = false;
+
+retry:
+  row = ArrowItemPointerGetRow(tid);
+
+  LockRelationForExtension(relation, ExclusiveLock);
+
+  tmfd->ctid = *tid;
+  tmfd->xmax = InvalidTransactionId;
+  tmfd->cmax = InvalidCommandId;
+
+  /* Rows inserted by later commands, or by transactions that aborted
+   * or are still running, cannot be locked. */
+  runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  run = ArrowVisibilityFind(runs, row);
+  if (run == NULL || (run->flags & ARROW_XID_INVALID) ||
+      (!(run->flags & ARROW_RUN_FROZEN) &&
+       (TransactionIdIsCurrentTransactionId(run->xmin)
+            ? run->cmin >= cid
+            : !ArrowRunXminCommitted(run, &in_progress)))) {
+    UnlockRelationForExtension(relation, ExclusiveLock);
+    return TM_Invisible;
+  }
+
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+  entry = ArrowPrepareRecord(&deletes, row / ARROW_CHUNK_ROWS);
+
+  result = ArrowCheckRecords(relnumber, &deletes, entry, row, lockflags,
+                             tmfd);
+  switch (result) {
+    case TM_Ok:
+      ArrowAddRecord(&deletes, entry, row, xid, cid, lockflags);
+      break;
+
+    case TM_Updated:
+      if (follow) {
+        UnlockRelationForExtension(relation, ExclusiveLock);
+        *tid = tmfd->ctid;
+        tmfd->traversed = true;
+        goto retry;
+      }
+      break;
+
+    case TM_BeingModified: {
+      const TransactionId xmax = tmfd->xmax;
+      UnlockRelationForExtension(relation, ExclusiveLock);
+      switch (wait_policy) {
+        case LockWaitBlock:
+          XactLockTableWait(xmax, relation, tid, XLTW_Lock);
+          goto retry;
+        case LockWaitSkip:
+          return TM_WouldBlock;
+        case LockWaitError:
+          ereport(ERROR,
+                  (errcode(ERRCODE_LOCK_NOT_AVAILABLE),
+                   errmsg("could not obtain lock on row in relation \"%s\"",
+                          RelationGetRelationName(relation))));
+      }
+      return TM_WouldBlock;
+    }
+
+    default:
+      break;
+  }
+
+  UnlockRelationForExtension(relation, ExclusiveLock);
+
+  return result;
+}
+
+/*
+ * Fold deletes that are visible to everybody into the dead bitmaps.
+ *
+ * Records of committed deletes older than `oldestXmin` are merged
+ * into the bitmap of rows deleted for everybody and records of
+ * aborted deletes are dropped. Chunks where all records are folded
+ * are scanned without checking any transaction status. Returns the
+ * number of rows that became dead.
+ *
+ * The dead bitmap is updated before the record is unlinked, so
+ * concurrent scans see the delete either way.
+ */
+int64 ArrowDeletesPrune(Relation relation, TransactionId oldestXmin) {
+  ArrowDeletes deletes;
+  int64 pruned = 0;
+
+  LockRelationForExtension(relation, ExclusiveLock);
+
+  ArrowDeletesGet(relation->rd_locator.relNumber, O_RDWR, &deletes);
+
+  for (int64 chunk = 0; chunk < deletes.chunks->length; ++chunk) {
+    ArrowDeleteChunk* entry = ArrowDeleteChunkGet(&deletes, chunk);
+    int64* link = &entry->head;
+
+    while (*link != 0) {
+      ArrowDeleteRecord* record = ArrowDeleteRecordGet(&deletes, *link);
+      bool in_progress;
+
+      if (record->flags & ARROW_RECORD_LOCK) {
+        /* Locks only matter while the locking transaction runs */
+        if (!ArrowXidCommitted(record->xmax, &record->flags, &in_progress) &&
+            in_progress) {
+          link = &record->next;
+          continue;
+        }
+      } else if (ArrowXidCommitted(record->xmax, &record->flags,
+                                   &in_progress)) {
+        if (!TransactionIdPrecedes(record->xmax, oldestXmin)) {
+          link = &record->next;
+          continue;
+        }
+        for (int w = 0; w < ARROW_CHUNK_WORDS; ++w) {
+          pruned += pg_popcount64(record->rows[w] & ~entry->dead[w]);
+          entry->dead[w] |= record->rows[w];
+        }
+        pg_write_barrier();
+      } else if (in_progress) {
+        link = &record->next;
+        continue;
+      }
+
+      /* Folded into the dead bitmap, aborted, or a released lock */
+      *link = record->next;
+    }
+  }
+
+  UnlockRelationForExtension(relation, ExclusiveLock);
+
+  return pruned;
+}
+
+/*
+ * Count the live and dead rows of a relation for the cumulative
+ * statistics.
+ *
+ * This is used after VACUUM pruned the deletes, so rows in the dead
+ * bitmaps are neither live nor dead, like tuples that VACUUM removed
+ * from a heap table. Rows deleted by transactions that committed but
+ * are not yet visible to everybody are dead, while rows of deletes in
+ * progress are still live, which is how VACUUM counts heap tuples.
+ */
+void ArrowVisibilityCount(Relation relation, int64* live, int64* dead) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  ArrowArray* runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  ArrowDeletes deletes;
+  int64 rows = 0;
+  int64 removed = 0;
+
+  for (int64 i = 0; i < runs->length; ++i) {
+    ArrowInsertRun* run = ArrowVisibilityRun(runs, i);
+    if ((run->flags & ARROW_XID_INVALID) == 0)
+      rows += run->count;
+  }
+
+  *dead = 0;
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+  for (int64 chunk = 0; chunk < deletes.chunks->length; ++chunk) {
+    ArrowDeleteChunk* entry = ArrowDeleteChunkGet(&deletes, chunk);
+
+    for (int w = 0; w < ARROW_CHUNK_WORDS; ++w)
+      removed += pg_popcount64(entry->dead[w]);
+
+    for (int64 ref = entry->head; ref != 0;) {
+      ArrowDeleteRecord* record = ArrowDeleteRecordGet(&deletes, ref);
+      if ((record->flags & (ARROW_XID_COMMITTED | ARROW_RECORD_LOCK)) ==
+          ARROW_XID_COMMITTED)
+        for (int w = 0; w < ARROW_CHUNK_WORDS; ++w)
+          *dead += pg_popcount64(record->rows[w] & ~entry->dead[w]);
+      ref = record->next;
+    }
+  }
+
+  *live = Max(rows - removed - *dead, 0);
+}
+
+/*
+ * Get the oldest transaction id that is still needed for the runs and
+ * records of a relation.
+ *
+ * This is used after VACUUM froze the runs and pruned the deletes, so
+ * that the ids of frozen runs and folded records are never looked at
+ * again, and is the new relfrozenxid of the relation.
+ */
+TransactionId ArrowVisibilityFrozenXid(Relation relation,
+                                       TransactionId oldestXmin) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  ArrowArray* runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  TransactionId frozenXid = oldestXmin;
+  ArrowDeletes deletes;
+
+  for (int64 i = 0; i < runs->length; ++i) {
+    ArrowInsertRun* run = ArrowVisibilityRun(runs, i);
+    if ((run->flags & (ARROW_RUN_FROZEN | ARROW_XID_INVALID)) == 0 &&
+        TransactionIdIsNormal(run->xmin) &&
+        TransactionIdPrecedes(run->xmin, frozenXid))
+      frozenXid = run->xmin;
+  }
+
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+  for (int64 chunk = 0; chunk < deletes.chunks->length; ++chunk) {
+    ArrowDeleteChunk* entry = ArrowDeleteChunkGet(&deletes, chunk);
+
+    for (int64 ref = entry->head; ref != 0;) {
+      ArrowDeleteRecord* record = ArrowDeleteRecordGet(&deletes, ref);
+      if ((record->flags & ARROW_XID_INVALID) == 0 &&
+          TransactionIdIsNormal(record->xmax) &&
+          TransactionIdPrecedes(record->xmax, frozenXid))
+        frozenXid = record->xmax;
+      ref = record->next;
+    }
+  }
+
+  return frozenXid;
+}
@@ -0,0 +1,181 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Row visibility for arrow tables.
+ *
+ * Rows are only ever appended to an arrow table, so instead of
+ * storing transaction information for each row, we store it for each
+ * run of consecutive rows inserted by the same command. The runs are
+ * stored in a separate segment for the relation, the visibility
+ * segment, which uses attribute number zero.
+ *
+ * Visibility is decided once for each run, and commit status of the
+ * inserting transaction is cached in the run flags, similar to the
+ * hint bits for heap tuples. Runs that are frozen are visible to
+ * everybody and need no further checks.
+ *
+ * Deleted rows are tracked using bitmaps, with one bitmap word for
+ * each 64 rows of a chunk. For each chunk there is an entry in the
+ * delete chunk segment with a bitmap of rows that are deleted for
+ * everybody and a list of delete records, each holding the rows in
+ * the chunk deleted by a command together with the deleting
+ * transaction. Chunks without deletes need no further checks.
+ *
+ * Row locks use the same records, flagged as locks, which are ignored
+ * when checking visibility and only make deletes and other locks wait
+ * while the locking transaction is running. An update deletes the old
+ * version of a row and appends the new one, and records a link from
+ * the old row to the new row in the update link segment, so that a
+ * concurrent update can move on to the new version.
+ */
+
+#ifndef ARROW_VISIBILITY_H_
+#define ARROW_VISIBILITY_H_
+
+#include <postgres.h>
+
+#include <access/tableam.h>
+#include <storage/itemptr.h>
+#include <utils/rel.h>
+#include <utils/snapshot.h>
+
+#include "arrow_c_data_interface.h"
+#include "arrow_storage.h"
+
+/**
+ * Attribute numbers used for the visibility segments.
+ */
+#define ARROW_VISIBILITY_ATTNO 0
+#define ARROW_DELETE_CHUNK_ATTNO -1
+#define ARROW_DELETE_RECORD_ATTNO -2
+#define ARROW_UPDATE_LINK_ATTNO -7
+
+/**
+ * Number of bitmap words for the rows of a chunk.
+ */
+#define ARROW_CHUNK_WORDS (ARROW_CHUNK_ROWS / 64)
+
+/**
+ * Run and delete record flags.
+ *
+ * ARROW_XID_COMMITTED and ARROW_XID_INVALID cache the outcome of the
+ * inserting (or deleting) transaction. ARROW_RUN_FROZEN means that
+ * the rows of a run are visible to all transactions.
+ * ARROW_RECORD_LOCK means that the record only locks the rows, and
+ * ARROW_RECORD_SHARED that the locks are shared.
+ */
+#define ARROW_XID_COMMITTED 0x0001
+#define ARROW_XID_INVALID 0x0002
+#define ARROW_RUN_FROZEN 0x0004
+#define ARROW_RECORD_LOCK 0x0008
+#define ARROW_RECORD_SHARED 0x0010
+
+/**
+ * Run of rows inserted by the same command.
+ *
+ * A run only grows while the command that created it is inserting
+ * rows, and only as long as no other transaction inserts rows in
+ * between. Rows that are not part of any run, for example because the
+ * insert failed half-way, are not visible to anybody.
+ */
+typedef struct ArrowInsertRun {
+  int64 first;         /* First row of the run */
+  int64 count;         /* Number of rows in the run */
+  TransactionId xmin;  /* Inserting transaction */
+  CommandId cmin;      /* Inserting command */
+  uint16 flags;        /* Run flags, see above */
+} ArrowInsertRun;
+
+/**
+ * Deletes for a chunk of rows.
+ *
+ * Records are referenced by their position plus one, so that zero
+ * means no record.
+ */
+typedef struct ArrowDeleteChunk {
+  uint64 dead[ARROW_CHUNK_WORDS]; /* Rows deleted for everybody */
+  int64 head;                     /* Latest delete record */
+  int64 links;                    /* Latest update link */
+} ArrowDeleteChunk;
+
+/**
+ * Rows of a chunk deleted by a command.
+ */
+typedef struct ArrowDeleteRecord {
+  uint64 rows[ARROW_CHUNK_WORDS]; /* Rows deleted */
+  int64 next;                     /* Previous delete record of chunk */
+  TransactionId xmax;             /* Deleting transaction */
+  CommandId cmax;                 /* Deleting command */
+  uint16 flags;                   /* Flags, see above */
+} ArrowDeleteRecord;
+
+/**
+ * Link from an updated row to its new version.
+ *
+ * Links are referenced like delete records and form a list for each
+ * chunk, which is only searched when following an update.
+ */
+typedef struct ArrowUpdateLink {
+  int64 row;       /* Updated row */
+  int64 successor; /* New version of the row */
+  int64 next;      /* Previous link of chunk */
+} ArrowUpdateLink;
+
+/**
+ * Delete segments of a relation.
+ */
+typedef struct ArrowDeletes {
+  ArrowArray* chunks;  /* ArrowDeleteChunk for each chunk */
+  ArrowArray* records; /* ArrowDeleteRecord entries */
+} ArrowDeletes;
+
+ArrowArray* ArrowVisibilityGet(RelFileNumber relnumber, int oflags);
+ArrowInsertRun* ArrowVisibilityRun(ArrowArray* runs, int64 n);
+ArrowInsertRun* ArrowVisibilityFind(ArrowArray* runs, int64 row);
+int64 ArrowVisibilityRows(ArrowArray* runs);
+void ArrowVisibilityAppend(ArrowArray* runs, int64 first, int64 count,
+                           TransactionId xmin, CommandId cid);
+void ArrowVisibilityExtendFork(Relation relation, int64 first, int64 count);
+bool ArrowRunSatisfiesSnapshot(ArrowInsertRun* run, Snapshot snapshot);
+int64 ArrowVisibilityFreeze(Relation relation, TransactionId oldestXmin);
+
+void ArrowDeletesGet(RelFileNumber relnumber, int oflags,
+                     ArrowDeletes* deletes);
+bool ArrowDeletesMask(ArrowDeletes* deletes, int64 chunk, Snapshot snapshot,
+                      uint64* mask);
+bool ArrowRowDeleted(ArrowDeletes* deletes, int64 row, Snapshot snapshot);
+bool ArrowDeletesXmax(ArrowDeletes* deletes, int64 chunk,
+                      TransactionId* xmaxs, CommandId* cmaxs);
+void ArrowDeletesAdd(ArrowDeletes* deletes, int64 row, TransactionId xmax,
+                     CommandId cmax);
+TM_Result ArrowDeleteRow(Relation relation, ItemPointer tid, CommandId cid,
+                         Snapshot crosscheck, bool wait,
+                         TM_FailureData* tmfd);
+void ArrowDeleteSpeculative(Relation relation, int64 row);
+TM_Result ArrowLockRow(Relation relation, ItemPointer tid, CommandId cid,
+                       LockTupleMode mode, LockWaitPolicy wait_policy,
+                       bool follow, TM_FailureData* tmfd);
+ArrowArray* ArrowUpdateLinksGet(RelFileNumber relnumber, int oflags);
+void ArrowUpdateLinkAdd(Relation relation, int64 row, int64 successor);
+int64 ArrowDeletesPrune(Relation relation, TransactionId oldestXmin);
+void ArrowVisibilityCount(Relation relation, int64* live, int64* dead);
+TransactionId ArrowVisibilityFrozenXid(Relation relation,
+                                       TransactionId oldestXmin);
+
+#endif /* ARROW_VISIBILITY_H_ */
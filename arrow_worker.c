@@ -0,0 +1,230 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "arrow_worker.h"
+
+#include <postgres.h>
+
+#include <access/heapam.h>
+#include <access/htup_details.h>
+#include <access/relation.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/xact.h>
+#include <catalog/pg_class.h>
+#include <commands/defrem.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <postmaster/bgworker.h>
+#include <postmaster/interrupt.h>
+#include <storage/latch.h>
+#include <storage/lmgr.h>
+#include <tcop/tcopprot.h>
+#include <utils/guc.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/snapmgr.h>
+
+#include "arrow_tts.h"
+#include "arrow_vacuum.h"
+
+/*
+ * Database that the worker connects to. The worker is not started if
+ * this is empty.
+ */
+char* ArrowWorkerDatabase = NULL;
+
+/*
+ * Time in milliseconds between two rounds over the arrow tables.
+ */
+int ArrowWorkerNaptime = 10000;
+
+/*
+ * Time in milliseconds to sleep after maintaining a table.
+ */
+int ArrowWorkerDelay = 100;
+
+/*
+ * Register the worker with the postmaster.
+ *
+ * This has to be called while the shared preload libraries are
+ * loaded.
+ */
+void ArrowWorkerRegister(void) {
+  BackgroundWorker worker;
+
+  if (ArrowWorkerDatabase == NULL || ArrowWorkerDatabase[0] == '\0')
+    return;
+
+  memset(&worker, 0, sizeof(worker));
+  worker.bgw_flags =
+      BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+  worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+  worker.bgw_restart_time = 10;
+  strlcpy(worker.bgw_library_name, "arrow", sizeof(worker.bgw_library_name));
+  strlcpy(worker.bgw_function_name, "ArrowWorkerMain",
+          sizeof(worker.bgw_function_name));
+  strlcpy(worker.bgw_name, "arrow maintenance worker",
+          sizeof(worker.bgw_name));
+  strlcpy(worker.bgw_type, "arrow maintenance worker",
+          sizeof(worker.bgw_type));
+  RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Sleep for the given number of milliseconds, or until the latch is
+ * set, and then handle interrupts and configuration reloads.
+ */
+static void ArrowWorkerSleep(int timeout) {
+  if (timeout > 0) {
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                    timeout, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+  }
+
+  CHECK_FOR_INTERRUPTS();
+
+  if (ConfigReloadPending) {
+    ConfigReloadPending = false;
+    ProcessConfigFile(PGC_SIGHUP);
+  }
+}
+
+/*
+ * Collect the arrow tables of the database in the given memory
+ * context.
+ *
+ * Temporary tables belong to other sessions and their segments can
+ * only be used there, so they are skipped.
+ */
+static List* ArrowWorkerRelations(MemoryContext context) {
+  Oid amoid = get_table_am_oid("arrow", true);
+  List* relids = NIL;
+  Relation pg_class;
+  TableScanDesc scan;
+  HeapTuple tuple;
+
+  /* The extension is not installed in this database. */
+  if (!OidIsValid(amoid))
+    return NIL;
+
+  pg_class = table_open(RelationRelationId, AccessShareLock);
+  scan = table_beginscan_catalog(pg_class, 0, NULL);
+  while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL) {
+    Form_pg_class form = (Form_pg_class)GETSTRUCT(tuple);
+
+    if (form->relam == amoid && form->relkind == RELKIND_RELATION &&
+        form->relpersistence != RELPERSISTENCE_TEMP) {
+      MemoryContext oldcontext = MemoryContextSwitchTo(context);
+      relids = lappend_oid(relids, form->oid);
+      MemoryContextSwitchTo(oldcontext);
+    }
+  }
+  table_endscan(scan);
+  table_close(pg_class, AccessShareLock);
+
+  return relids;
+}
+
+/*
+ * Maintain a table, unless it is locked by somebody else or has been
+ * dropped.
+ *
+ * The table is locked the same way as by vacuum, so the worker does
+ * not block inserts, updates, or deletes, and is kept out while the
+ * table is vacuumed or altered. Compaction needs an exclusive lock
+ * until the indexes are rebuilt, so it is left to manual VACUUM.
+ *
+ * Returns true if the table was maintained.
+ */
+static bool ArrowWorkerMaintain(Oid relid) {
+  Relation relation;
+
+  if (!ConditionalLockRelationOid(relid, ShareUpdateExclusiveLock))
+    return false;
+
+  relation = try_relation_open(relid, NoLock);
+  if (relation == NULL) {
+    UnlockRelationOid(relid, ShareUpdateExclusiveLock);
+    return false;
+  }
+
+  if (table_slot_callbacks(relation) == &TTSOpsArrowTuple)
+    ArrowVacuumRelation(relation, DEBUG1, false);
+
+  relation_close(relation, ShareUpdateExclusiveLock);
+  return true;
+}
+
+/*
+ * Maintain all arrow tables of the database, each in a transaction of
+ * its own.
+ */
+static void ArrowWorkerRound(MemoryContext context) {
+  List* relids;
+  ListCell* lc;
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  pgstat_report_activity(STATE_RUNNING, "listing arrow tables");
+  relids = ArrowWorkerRelations(context);
+  CommitTransactionCommand();
+
+  foreach (lc, relids) {
+    bool maintained;
+
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    PushActiveSnapshot(GetTransactionSnapshot());
+    pgstat_report_activity(STATE_RUNNING, "maintaining arrow table");
+    maintained = ArrowWorkerMaintain(lfirst_oid(lc));
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+
+    if (maintained)
+      ArrowWorkerSleep(ArrowWorkerDelay);
+  }
+
+  pgstat_report_stat(true);
+  pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/*
+ * Entry point of the worker.
+ *
+ * Errors are not caught: they terminate the worker, which the
+ * postmaster then restarts.
+ */
+void ArrowWorkerMain(Datum main_arg) {
+  MemoryContext context;
+
+  pqsignal(SIGHUP, SignalHandlerForConfigReload);
+  pqsignal(SIGTERM, die);
+  BackgroundWorkerUnblockSignals();
+
+  BackgroundWorkerInitializeConnection(ArrowWorkerDatabase, NULL, 0);
+
+  context = AllocSetContextCreate(TopMemoryContext, "arrow worker",
+                                  ALLOCSET_DEFAULT_SIZES);
+
+  for (;;) {
+    ArrowWorkerSleep(ArrowWorkerNaptime);
+    ArrowWorkerRound(context);
+    MemoryContextReset(context);
+  }
+}
@@ -0,0 +1,49 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed
+ * with this work for additional information regarding copyright
+ * ownership.  The ASF licenses this file to you under the Apache
+ * License, Version 2.0 (the "License"); you may not use this file
+ * except in compliance with the License.  You may obtain a copy of
+ * the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.  See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Background maintenance of arrow tables.
+ *
+ * When the module is loaded using shared_preload_libraries, a
+ * background worker connects to one database and periodically visits
+ * its arrow tables, doing the same work as vacuum: it merges the delta
+ * store into the columns, freezes runs of rows, and folds deletes that
+ * are visible to everybody. This keeps the work out of the foreground
+ * and keeps scans on the fast path without depending on vacuum being
+ * run. Compaction holds an exclusive lock while the indexes are
+ * rebuilt, so it is left to manual vacuum.
+ *
+ * The worker never waits for a lock. Tables that are locked by
+ * someone else are skipped until the next round. After each
+ * table the worker sleeps for a configurable delay so that it does not
+ * compete with foreground queries for the segments.
+ */
+
+#ifndef ARROW_WORKER_H_
+#define ARROW_WORKER_H_
+
+#include <postgres.h>
+
+extern char* ArrowWorkerDatabase;
+extern int ArrowWorkerNaptime;
+extern int ArrowWorkerDelay;
+
+void ArrowWorkerRegister(void);
+PGDLLEXPORT void ArrowWorkerMain(Datum main_arg);
+
+#endif /* ARROW_WORKER_H_ */
@@ -38,24 +38,46 @@
 
 #include <access/amapi.h>
 #include <access/heapam.h>
+#include <access/multixact.h>
 #include <access/tableam.h>
+#include <access/tsmapi.h>
 #include <access/xact.h>
 #include <catalog/index.h>
+#include <catalog/objectaccess.h>
+#include <catalog/pg_class.h>
+#include <catalog/storage.h>
 #include <commands/tablespace.h>
 #include <commands/vacuum.h>
+#include <executor/executor.h>
 #include <executor/tuptable.h>
 #include <miscadmin.h>
+#include <pgstat.h>
+#include <port/atomics.h>
+#include <postmaster/autovacuum.h>
+#include <port/pg_bitutils.h>
+#include <storage/ipc.h>
 #include <storage/predicate.h>
+#include <utils/guc.h>
 #include <utils/lsyscache.h>
 #include <utils/rel.h>
 #include <utils/snapmgr.h>
 
 #include <math.h>
 
+#include "arrow_agg.h"
 #include "arrow_array.h"
+#include "arrow_cluster.h"
+#include "arrow_clustered_scan.h"
+#include "arrow_delta.h"
+#include "arrow_hashjoin.h"
+#include "arrow_index.h"
+#include "arrow_probes.h"
 #include "arrow_scan.h"
 #include "arrow_storage.h"
 #include "arrow_tts.h"
+#include "arrow_vacuum.h"
+#include "arrow_visibility.h"
+#include "arrow_worker.h"
 #include "debug.h"
 
 PG_MODULE_MAGIC;
@@ -66,6 +88,9 @@ void _PG_init(void);
 
 static const TableAmRoutine arrowam_methods;
 
+static object_access_hook_type prev_object_access_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
 static const TupleTableSlotOps *arrowam_slot_callbacks(Relation relation) {
   return &TTSOpsArrowTuple;
 }
@@ -75,17 +100,15 @@ static TableScanDesc arrowam_scan_begin(Relation relation, Snapshot snapshot,
                                         ParallelTableScanDesc parallel_scan,
                                         uint32 flags) {
   ArrowScanDesc *scan = NULL;
-  Oid relid;
-  const char *relname;
 
   RelationIncrementReferenceCount(relation);
 
-  relid = RelationGetRelid(relation);
-  relname = RelationGetRelationName(relation);
-
-  DEBUG_ENTER("relation: %s.%s, relid: %u, nkeys: %d, snapshot: %s",
-              get_namespace_name(RelationGetNamespace(relation)), relname,
-              relid, nkeys, ExportSnapshot(snapshot));
+  DEBUG_ENTER("relation: %s.%s, relid: %u, nkeys: %d, snapshot: %u-%u",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation), RelationGetRelid(relation),
+              nkeys, snapshot ? snapshot->xmin : InvalidTransactionId,
+              snapshot ? snapshot->xmax : InvalidTransactionId);
+  TRACE_ARROW_SCAN_START(relation->rd_locator.relNumber);
 
   scan = (ArrowScanDesc *)palloc0(sizeof(ArrowScanDesc));
 
@@ -95,8 +118,18 @@ static TableScanDesc arrowam_scan_begin(Relation relation, Snapshot snapshot,
   scan->base.rs_flags = flags;
   scan->base.rs_parallel = parallel_scan;
 
-  scan->index = 0;
-  scan->length = -1;
+  scan->runs = ArrowVisibilityGet(relation->rd_locator.relNumber, O_RDWR);
+  scan->nruns = scan->runs->length;
+  scan->nrows = ArrowVisibilityRows(scan->runs);
+  pg_read_barrier();
+  ArrowDeletesGet(relation->rd_locator.relNumber, O_RDWR, &scan->deletes);
+  scan->chunk = -1;
+  scan->limit = parallel_scan ? 0 : PG_INT64_MAX;
+
+  /* Scans are reported to the cumulative statistics like scans of heap
+   * tables, so they show up in pg_stat_user_tables. */
+  if (flags & SO_TYPE_SEQSCAN)
+    pgstat_count_heap_scan(relation);
 
   if (flags & (SO_TYPE_SEQSCAN | SO_TYPE_SAMPLESCAN)) {
     /*
@@ -108,7 +141,8 @@ static TableScanDesc arrowam_scan_begin(Relation relation, Snapshot snapshot,
     PredicateLockRelation(relation, snapshot);
   }
 
-  DEBUG_LEAVE("relation: %s, relid: %u", relname, relid);
+  DEBUG_LEAVE("relation: %s, relid: %u", RelationGetRelationName(relation),
+              RelationGetRelid(relation));
 
   return (TableScanDesc)scan;
 }
@@ -117,6 +151,12 @@ static void arrowam_scan_end(TableScanDesc sscan) {
   ArrowScanDesc *scan = (ArrowScanDesc *)sscan;
   DEBUG_ENTER("");
 
+  if (scan->nscanned > 0)
+    pg_atomic_fetch_add_u64(&ArrowArrayCounters(scan->runs)->rows_scanned,
+                            scan->nscanned);
+  TRACE_ARROW_SCAN_DONE(scan->base.rs_rd->rd_locator.relNumber,
+                        scan->nscanned);
+
   RelationDecrementReferenceCount(scan->base.rs_rd);
   pfree(scan);
 
@@ -127,54 +167,191 @@ static void arrowam_scan_rescan(TableScanDesc scan, ScanKey key,
                                 bool set_params, bool allow_strat,
                                 bool allow_sync, bool allow_pagemode) {
   ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+  if (scan->rs_flags & SO_TYPE_SEQSCAN)
+    pgstat_count_heap_scan(scan->rs_rd);
+  ascan->run = 0;
   ascan->index = 0;
+  ascan->end = 0;
+  ascan->start = 0;
+  ascan->limit = scan->rs_parallel ? 0 : PG_INT64_MAX;
+  ascan->pscanstarted = false;
+  ascan->chunk = -1;
+  ascan->ntuples = 0;
+  ascan->tuple = 0;
+  ascan->sample_first = 0;
+  ascan->sample_end = 0;
+}
+
+/*
+ * Move the scan to the next row of the current run that is not
+ * deleted.
+ *
+ * Chunks without deletes are not checked at all, and otherwise whole
+ * words of deleted rows are skipped at a time. Returns false if there
+ * are no more rows in the run.
+ */
+static bool arrowam_scan_skip_deleted(ArrowScanDesc *ascan) {
+  while (ascan->index < ascan->end) {
+    const int64 chunk = ascan->index / ARROW_CHUNK_ROWS;
+    const int64 bit = ascan->index % ARROW_CHUNK_ROWS;
+    uint64 word;
+
+    if (chunk != ascan->chunk) {
+      ascan->chunk = chunk;
+      ascan->masked = ArrowDeletesMask(&ascan->deletes, chunk,
+                                       ascan->base.rs_snapshot, ascan->mask);
+    }
+
+    if (!ascan->masked)
+      return true;
+
+    word = ascan->mask[bit / 64] >> (bit % 64);
+    if (word != 0) {
+      ascan->index += pg_rightmost_one_pos64(word);
+      return ascan->index < ascan->end;
+    }
+    ascan->index += 64 - bit % 64;
+  }
+  return false;
+}
+
+/*
+ * Claim the next chunk of a parallel scan.
+ *
+ * Chunks are handed out like the blocks of a parallel heap scan, and
+ * the scan continues with the first run that has rows in the chunk.
+ * Returns false if all chunks have been claimed.
+ */
+static bool arrowam_scan_next_chunk(ArrowScanDesc *ascan) {
+  Relation relation = ascan->base.rs_rd;
+  ParallelBlockTableScanDesc pbscan =
+      (ParallelBlockTableScanDesc)ascan->base.rs_parallel;
+  BlockNumber block;
+  int64 low = 0;
+  int64 high = ascan->nruns;
+
+  if (!ascan->pscanstarted) {
+    table_block_parallelscan_startblock_init(relation, &ascan->pscanwork,
+                                             pbscan);
+    ascan->pscanstarted = true;
+  }
+
+  block = table_block_parallelscan_nextpage(relation, &ascan->pscanwork,
+                                            pbscan);
+  if (block == InvalidBlockNumber)
+    return false;
+
+  ascan->start = (int64)block * ARROW_CHUNK_ROWS;
+  ascan->limit = ascan->start + ARROW_CHUNK_ROWS;
+  ascan->index = 0;
+  ascan->end = 0;
+
+  /* Find the first run that ends after the start of the chunk */
+  while (low < high) {
+    const int64 mid = low + (high - low) / 2;
+    ArrowInsertRun *run = ArrowVisibilityRun(ascan->runs, mid);
+    if (run->first + run->count <= ascan->start)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  ascan->run = low;
+
+  return true;
 }
 
 static bool arrowam_scan_getnextslot(TableScanDesc scan,
                                      ScanDirection direction,
                                      TupleTableSlot *slot) {
   ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
-  ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
 
-  DEBUG_ENTER("scan.index: %ld, scan.length: %ld, tts_tableOid: %d",
-              ascan->index, ascan->length, slot->tts_tableOid);
+  DEBUG_ENTER("scan.run: %ld, scan.index: %ld, tts_tableOid: %d", ascan->run,
+              ascan->index, slot->tts_tableOid);
+
+  /* Move to the next run that is visible, if the current one is done.
+   * Visibility is only checked once for each run. Runs are clipped to
+   * the claimed chunk, which is all rows unless the scan is parallel. */
+  while (!arrowam_scan_skip_deleted(ascan)) {
+    ArrowInsertRun *run;
+
+    if (ascan->run >= ascan->nruns ||
+        ArrowVisibilityRun(ascan->runs, ascan->run)->first >= ascan->limit) {
+      if (scan->rs_parallel != NULL && arrowam_scan_next_chunk(ascan))
+        continue;
+      ExecClearTuple(slot);
+      DEBUG_LEAVE("no more runs");
+      return false;
+    }
+
+    run = ArrowVisibilityRun(ascan->runs, ascan->run++);
+    if (ArrowRunSatisfiesSnapshot(run, scan->rs_snapshot)) {
+      ascan->index = Max(run->first, ascan->start);
+      ascan->end = Min(run->first + run->count, ascan->limit);
+    }
+  }
+
+  ExecStoreArrowRow(slot, scan->rs_rd->rd_locator.relNumber, ascan->index++);
+  ++ascan->nscanned;
+  pgstat_count_heap_getnext(scan->rs_rd);
 
-  if (ascan->length >= 0 && ascan->index == ascan->length)
-    return false;
+  DEBUG_LEAVE("scan.index: %ld, scan.end: %ld", ascan->index, ascan->end);
 
-  /*
-   * Open first segment if scan descriptor not initialized.
-   *
-   * We assume that there is at least one column in the table. We need
-   * this to get the length of the array.
-   *
-   * TODO: We could also use a segment zero to store xmin and xmax as
-   * a structure, which might be needed to support MVCC and repeatable
-   * read isolation, but right now we do not have support for storing
-   * structures in arrays.
-   */
-  if (ascan->length == -1) {
-    aslot->columns[0] = ArrowArrayGet(
-        scan->rs_rd->rd_id, &slot->tts_tupleDescriptor->attrs[0], O_RDWR);
-    ascan->length = aslot->columns[0]->length;
-    aslot->base.tts_nvalid = 1;
-  }
+  return true;
+}
 
-  aslot->index = ascan->index++;
-  slot->tts_nvalid = 0;
-  slot->tts_flags &= ~TTS_FLAG_EMPTY;
+/*
+ * Fetch a row into a slot, if it is visible to the snapshot.
+ *
+ * If the row is not visible and all_dead is not NULL, it is set to
+ * indicate if the row is dead to everybody, in which case index
+ * entries pointing to it can be removed.
+ */
+static bool arrowam_fetch_row(Relation relation, ItemPointer tid,
+                              Snapshot snapshot, TupleTableSlot *slot,
+                              bool *all_dead) {
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  const int64 row = ArrowItemPointerGetRow(tid);
+  ArrowArray *runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  ArrowInsertRun *run;
+  ArrowDeletes deletes;
+
+  if (all_dead)
+    *all_dead = false;
+
+  pg_read_barrier();
+  run = ArrowVisibilityFind(runs, row);
+  if (run == NULL)
+    return false;
 
-  DEBUG_LOG("slot.index: %ld, slot.tts_nvalid: %d", aslot->index,
-            aslot->base.tts_nvalid);
+  if (!ArrowRunSatisfiesSnapshot(run, snapshot)) {
+    if (all_dead)
+      *all_dead = (run->flags & ARROW_XID_INVALID) != 0;
+    return false;
+  }
 
-  DEBUG_LEAVE("scan.index: %ld, scan.length: %ld, more: %s", ascan->index,
-              ascan->length, YESNO(ascan->index < ascan->length));
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+  if (ArrowRowDeleted(&deletes, row, snapshot)) {
+    /* Only deletes visible to everybody are in the dead bitmap, which
+     * is all that is checked for SnapshotAny. */
+    if (all_dead)
+      *all_dead = ArrowRowDeleted(&deletes, row, SnapshotAny);
+    return false;
+  }
 
+  ExecClearTuple(slot);
+  ExecStoreArrowRow(slot, relnumber, row);
+  slot->tts_tableOid = RelationGetRelid(relation);
   return true;
 }
 
+/*
+ * Index fetches look up rows directly using the row number in the
+ * item pointer, so there is no state to keep other than the relation.
+ */
 static IndexFetchTableData *arrowam_index_fetch_begin(Relation relation) {
-  return NULL;
+  IndexFetchTableData *scan = palloc0(sizeof(IndexFetchTableData));
+  scan->rel = relation;
+  return scan;
 }
 
 static void arrowam_index_fetch_reset(IndexFetchTableData *scan) {
@@ -182,7 +359,7 @@ static void arrowam_index_fetch_reset(IndexFetchTableData *scan) {
 }
 
 static void arrowam_index_fetch_end(IndexFetchTableData *scan) {
-  /* nothing to do here */
+  pfree(scan);
 }
 
 static __attribute__((unused)) const char *show_tid(ItemPointer tid) {
@@ -196,7 +373,9 @@ static bool arrowam_index_fetch_tuple(struct IndexFetchTableData *scan,
                                       ItemPointer tid, Snapshot snapshot,
                                       TupleTableSlot *slot, bool *call_again,
                                       bool *all_dead) {
-  return 0;
+  /* There are no update chains, so there is never another version */
+  *call_again = false;
+  return arrowam_fetch_row(scan->rel, tid, snapshot, slot, all_dead);
 }
 
 /* ------------------------------------------------------------------------
@@ -207,7 +386,7 @@ static bool arrowam_index_fetch_tuple(struct IndexFetchTableData *scan,
 
 static bool arrowam_fetch_row_version(Relation relation, ItemPointer tid,
                                       Snapshot snapshot, TupleTableSlot *slot) {
-  return false;
+  return arrowam_fetch_row(relation, tid, snapshot, slot, NULL);
 }
 
 static void arrowam_get_latest_tid(TableScanDesc sscan, ItemPointer tid) {
@@ -215,13 +394,25 @@ static void arrowam_get_latest_tid(TableScanDesc sscan, ItemPointer tid) {
 }
 
 static bool arrowam_tuple_tid_valid(TableScanDesc scan, ItemPointer tid) {
-  return false;
+  ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+  return ItemPointerIsValid(tid) &&
+         ArrowItemPointerGetRow(tid) < ArrowVisibilityRows(ascan->runs);
 }
 
 static bool arrowam_tuple_satisfies_snapshot(Relation relation,
                                              TupleTableSlot *slot,
                                              Snapshot snapshot) {
-  return false;
+  ArrowTupleTableSlot *aslot = (ArrowTupleTableSlot *)slot;
+  const RelFileNumber relnumber = relation->rd_locator.relNumber;
+  ArrowArray *runs = ArrowVisibilityGet(relnumber, O_RDWR);
+  ArrowInsertRun *run = ArrowVisibilityFind(runs, aslot->index);
+  ArrowDeletes deletes;
+
+  if (run == NULL || !ArrowRunSatisfiesSnapshot(run, snapshot))
+    return false;
+
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+  return !ArrowRowDeleted(&deletes, aslot->index, snapshot);
 }
 
 static TransactionId arrowam_index_delete_tuples(Relation rel,
@@ -239,49 +430,92 @@ static TransactionId arrowam_index_delete_tuples(Relation rel,
 static void arrowam_tuple_insert(Relation relation, TupleTableSlot *slot,
                                  CommandId cid, int options,
                                  BulkInsertState bistate) {
-  const Oid relid = RelationGetRelid(relation);
   DEBUG_ENTER("relation: %s.%s, slot: %s",
               get_namespace_name(RelationGetNamespace(relation)),
               RelationGetRelationName(relation), show_slot(slot)->data);
 
-  ExecInsertArrowSlot(relation, relid, slot, cid, options);
+  ExecInsertArrowSlots(relation, &slot, 1, cid, options);
+  pgstat_count_heap_insert(relation, 1);
 
   DEBUG_LEAVE("relation: %s.%s",
               get_namespace_name(RelationGetNamespace(relation)),
               RelationGetRelationName(relation));
 }
+
+/*
+ * Insert a row for INSERT ... ON CONFLICT.
+ *
+ * Conflicts are only found when inserting into the indexes, so the row
+ * is appended like any other row and deleted again when completing the
+ * insert if there was a conflict.
+ */
 static void arrowam_tuple_insert_speculative(Relation relation,
                                              TupleTableSlot *slot,
                                              CommandId cid, int options,
                                              BulkInsertState bistate,
                                              uint32 specToken) {
-  /* nothing to do */
+  DEBUG_ENTER("relation: %s.%s, slot: %s",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation), show_slot(slot)->data);
+
+  ExecInsertArrowSlots(relation, &slot, 1, cid, options);
+  pgstat_count_heap_insert(relation, 1);
+
+  DEBUG_LEAVE("relation: %s.%s",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation));
 }
 
 static void arrowam_tuple_complete_speculative(Relation relation,
                                                TupleTableSlot *slot,
                                                uint32 spekToken,
                                                bool succeeded) {
-  /* nothing to do */
+  DEBUG_ENTER("relation: %s.%s, tid: %s, succeeded: %d",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation), show_tid(&slot->tts_tid),
+              succeeded);
+
+  if (!succeeded)
+    ArrowDeleteSpeculative(relation, ArrowItemPointerGetRow(&slot->tts_tid));
+
+  DEBUG_LEAVE("relation: %s.%s",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation));
 }
 
 static void arrowam_multi_insert(Relation relation, TupleTableSlot **slots,
                                  int ntuples, CommandId cid, int options,
                                  BulkInsertState bistate) {
-  /* nothing to do */
+  DEBUG_ENTER("relation: %s.%s, ntuples: %d",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation), ntuples);
+
+  ExecInsertArrowSlots(relation, slots, ntuples, cid, options);
+  pgstat_count_heap_insert(relation, ntuples);
+
+  DEBUG_LEAVE("relation: %s.%s",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation));
 }
 
 static TM_Result arrowam_tuple_delete(Relation relation, ItemPointer tid,
                                       CommandId cid, Snapshot snapshot,
                                       Snapshot crosscheck, bool wait,
                                       TM_FailureData *tmfd, bool changingPart) {
-  DEBUG_ENTER("relation: %s.%s, snapshot: %s, ",
+  TM_Result result;
+
+  DEBUG_ENTER("relation: %s.%s, tid: %s",
               get_namespace_name(RelationGetNamespace(relation)),
-              RelationGetRelationName(relation), ExportSnapshot(snapshot));
-  DEBUG_LEAVE("relation: %s.%s, snapshot: %s, ",
+              RelationGetRelationName(relation), show_tid(tid));
+
+  result = ArrowDeleteRow(relation, tid, cid, crosscheck, wait, tmfd);
+  if (result == TM_Ok)
+    pgstat_count_heap_delete(relation);
+
+  DEBUG_LEAVE("relation: %s.%s, result: %d",
               get_namespace_name(RelationGetNamespace(relation)),
-              RelationGetRelationName(relation), ExportSnapshot(snapshot));
-  return TM_Ok;
+              RelationGetRelationName(relation), result);
+  return result;
 }
 
 static TM_Result arrowam_tuple_update(Relation rel, ItemPointer otid,
@@ -290,21 +524,65 @@ static TM_Result arrowam_tuple_update(Relation rel, ItemPointer otid,
                                       bool wait, TM_FailureData *tmfd,
                                       LockTupleMode *lockmode,
                                       TU_UpdateIndexes *update_indexes) {
-  const char *nsname = get_namespace_name(RelationGetNamespace(rel));
-  const char *relname = RelationGetRelationName(rel);
-  DEBUG_ENTER("relation: %s.%s, snapshot: %s, ", nsname, relname,
-              ExportSnapshot(snapshot));
-  DEBUG_LEAVE("relation: %s.%s, snapshot: %s, ", nsname, relname,
-              ExportSnapshot(snapshot));
-  return TM_Ok;
+  TM_Result result;
+
+  DEBUG_ENTER("relation: %s.%s, otid: %s",
+              get_namespace_name(RelationGetNamespace(rel)),
+              RelationGetRelationName(rel), show_tid(otid));
+
+  /*
+   * Rows are never changed in place, so an update deletes the old
+   * version and appends the new version. The link from the old version
+   * to the new one lets a concurrent update of the same row move on to
+   * the new version.
+   */
+  result = ArrowDeleteRow(rel, otid, cid, crosscheck, wait, tmfd);
+  if (result == TM_Ok) {
+    ExecInsertArrowSlots(rel, &slot, 1, cid, 0);
+    ArrowUpdateLinkAdd(rel, ArrowItemPointerGetRow(otid),
+                       ArrowItemPointerGetRow(&slot->tts_tid));
+    pgstat_count_heap_update(rel, false, false);
+    *lockmode = LockTupleExclusive;
+    *update_indexes = TU_All;
+  }
+
+  DEBUG_LEAVE("relation: %s.%s, result: %d",
+              get_namespace_name(RelationGetNamespace(rel)),
+              RelationGetRelationName(rel), result);
+  return result;
 }
 
+/*
+ * Lock a row and return it in the slot.
+ *
+ * The row is returned whatever the outcome, like for heap tables, and
+ * when following updates, `tid` is changed to the version that was
+ * locked.
+ */
 static TM_Result arrowam_tuple_lock(Relation relation, ItemPointer tid,
                                     Snapshot snapshot, TupleTableSlot *slot,
                                     CommandId cid, LockTupleMode mode,
                                     LockWaitPolicy wait_policy, uint8 flags,
                                     TM_FailureData *tmfd) {
-  return TM_Ok;
+  TM_Result result;
+
+  DEBUG_ENTER("relation: %s.%s, tid: %s, mode: %d",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation), show_tid(tid), mode);
+
+  result = ArrowLockRow(relation, tid, cid, mode, wait_policy,
+                        (flags & TUPLE_LOCK_FLAG_FIND_LAST_VERSION) != 0,
+                        tmfd);
+
+  ExecClearTuple(slot);
+  ExecStoreArrowRow(slot, relation->rd_locator.relNumber,
+                    ArrowItemPointerGetRow(tid));
+  slot->tts_tableOid = RelationGetRelid(relation);
+
+  DEBUG_LEAVE("relation: %s.%s, result: %d",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation), result);
+  return result;
 }
 
 static void arrowam_finish_bulk_insert(Relation relation, int options) {
@@ -315,65 +593,309 @@ static void arrowam_relation_set_new_filelocator(
     Relation relation, const RelFileLocator *newrlocator, char persistence,
     TransactionId *freezeXid, MultiXactId *minmulti) {
   TupleDesc tupdesc;
+  ArrowDeletes deletes;
+  SMgrRelation srel;
   DEBUG_ENTER("relation: %s.%s, node.tablespace: %s (%d)",
               get_namespace_name(RelationGetNamespace(relation)),
               RelationGetRelationName(relation),
               get_tablespace_name(newrlocator->spcOid), newrlocator->spcOid);
 
+  /*
+   * The new segments should go away if the transaction aborts. If
+   * the relation already had storage, which is the case for
+   * TRUNCATE, the old segments go away when the transaction commits.
+   *
+   * This is scheduled before creating the segments so that segments
+   * are not left behind if we fail to create some of them.
+   */
+  ArrowScheduleUnlink(MyDatabaseId, newrlocator->relNumber, false);
+  if (RelFileNumberIsValid(relation->rd_locator.relNumber) &&
+      relation->rd_locator.relNumber != newrlocator->relNumber)
+    ArrowScheduleUnlink(MyDatabaseId, relation->rd_locator.relNumber, true);
+
+  /* The rows are kept in shared memory, but bitmap scans and ANALYZE
+   * prefetch blocks of the main fork, so it has to exist. It stays
+   * empty until the rows reach a second segment file, see
+   * ArrowVisibilityExtendFork(). */
+  srel = RelationCreateStorage(*newrlocator, persistence, true);
+  smgrclose(srel);
+
+  ArrowVisibilityGet(newrlocator->relNumber, O_RDWR | O_CREAT | O_EXCL);
+  ArrowDeletesGet(newrlocator->relNumber, O_RDWR | O_CREAT | O_EXCL,
+                  &deletes);
+  ArrowUpdateLinksGet(newrlocator->relNumber, O_RDWR | O_CREAT | O_EXCL);
   tupdesc = relation->rd_att;
   for (int i = 0; i < tupdesc->natts; ++i)
-    ArrowArrayGet(relation->rd_id, &tupdesc->attrs[i],
+    ArrowArrayGet(newrlocator->relNumber, &tupdesc->attrs[i],
                   O_RDWR | O_CREAT | O_EXCL);
+  ArrowDeltaCreate(newrlocator->relNumber, tupdesc);
+
+  /* Like for heap tables, no transaction older than the oldest running
+   * one can have rows in the new storage. */
+  *freezeXid = RecentXmin;
+  *minmulti = GetOldestMultiXactId();
 
   DEBUG_LEAVE("relation: %s.%s",
               get_namespace_name(RelationGetNamespace(relation)),
               RelationGetRelationName(relation));
 }
 
-static void arrowam_relation_nontransactional_truncate(Relation relation) {}
+/*
+ * Truncate a relation that was created (or given new storage) in the
+ * current transaction.
+ *
+ * Since no other backends can see the relation, we can just reset
+ * the arrays in place.
+ */
+static void arrowam_relation_nontransactional_truncate(Relation relation) {
+  TupleDesc tupdesc = RelationGetDescr(relation);
+  ArrowDeletes deletes;
+  ArrowSortInfo info;
+
+  DEBUG_ENTER("relation: %s.%s",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation));
+
+  ArrowArrayReset(ArrowVisibilityGet(relation->rd_locator.relNumber, O_RDWR));
+  ArrowDeletesGet(relation->rd_locator.relNumber, O_RDWR, &deletes);
+  ArrowArrayReset(deletes.chunks);
+  ArrowArrayReset(deletes.records);
+  ArrowArrayReset(ArrowUpdateLinksGet(relation->rd_locator.relNumber, O_RDWR));
+  for (int i = 0; i < tupdesc->natts; ++i)
+    ArrowArrayReset(ArrowArrayGet(relation->rd_locator.relNumber,
+                                  TupleDescAttr(tupdesc, i), O_RDWR));
+  ArrowDeltaReset(relation);
+  if (ArrowSortInfoGet(relation->rd_locator.relNumber, &info))
+    ArrowSortInfoSet(relation->rd_locator.relNumber, InvalidOid, 0);
+
+  DEBUG_LEAVE("relation: %s.%s",
+              get_namespace_name(RelationGetNamespace(relation)),
+              RelationGetRelationName(relation));
+}
 
 static void arrowam_copy_data(Relation relation,
                               const RelFileLocator *newrlocator) {}
 
+/*
+ * Rewrite an arrow table for CLUSTER and VACUUM FULL.
+ *
+ * The rows are always sorted in memory, whatever the planner thinks
+ * about using the index, and VACUUM FULL sorts on the clustered index
+ * if there is one.
+ */
 static void arrowam_copy_for_cluster(Relation OldTable, Relation NewTable,
                                      Relation OldIndex, bool use_sort,
                                      TransactionId OldestXmin,
                                      TransactionId *xid_cutoff,
                                      MultiXactId *multi_cutoff,
                                      double *num_tuples, double *tups_vacuumed,
-                                     double *tups_recently_dead) {}
+                                     double *tups_recently_dead) {
+  *tups_vacuumed = 0;
+  *tups_recently_dead = 0;
+  *num_tuples = ArrowClusterRelation(OldTable, NewTable, OldIndex, OldestXmin,
+                                     tups_vacuumed, tups_recently_dead);
+}
 
+/*
+ * Vacuum an arrow table.
+ *
+ * This freezes the runs of rows that are visible to everybody and
+ * folds deletes that are visible to everybody into the dead bitmaps,
+ * which allows scans to skip the visibility checks for them. Chunks
+ * with many deleted rows are then compacted, if possible, unless this
+ * is autovacuum, which should not lock out queries while the indexes
+ * are rebuilt.
+ */
 static void arrowam_vacuum(Relation relation, VacuumParams *params,
-                           BufferAccessStrategy bstrategy) {}
+                           BufferAccessStrategy bstrategy) {
+  const int elevel = (params->options & VACOPT_VERBOSE) ? INFO : DEBUG2;
+  ArrowVacuumRelation(relation, elevel, !IsAutoVacuumWorkerProcess());
+}
 
+/*
+ * Move ANALYZE to a block.
+ *
+ * Blocks are chunks, so all rows of the chunk are returned. Deletes
+ * are resolved for the whole chunk at once: rows in the dead bitmap
+ * are gone, like tuples that VACUUM removed from a heap table, while
+ * rows deleted by committed transactions, or by the current one, are
+ * dead.
+ */
 static bool arrowam_scan_analyze_next_block(TableScanDesc scan,
                                             BlockNumber blockno,
                                             BufferAccessStrategy bstrategy) {
-  return false;
+  ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+  const int64 first = (int64)blockno * ARROW_CHUNK_ROWS;
+
+  if (first >= ascan->nrows)
+    return false;
+
+  ascan->chunk = blockno;
+  ascan->index = first;
+  ascan->end = Min(first + ARROW_CHUNK_ROWS, ascan->nrows);
+  ascan->masked = ArrowDeletesMask(&ascan->deletes, ascan->chunk,
+                                   SnapshotSelf, ascan->mask);
+  if (ascan->masked)
+    ArrowDeletesMask(&ascan->deletes, ascan->chunk, SnapshotAny, ascan->kept);
+  return true;
 }
 
+/*
+ * Return the next live row of the block for ANALYZE.
+ *
+ * Rows are counted like heap tuples: rows of aborted inserts and
+ * deleted rows are dead, and rows inserted by transactions that are
+ * still running are not counted at all. Rows that other transactions
+ * are deleting are still live.
+ */
 static bool arrowam_scan_analyze_next_tuple(TableScanDesc scan,
                                             TransactionId OldestXmin,
                                             double *liverows, double *deadrows,
                                             TupleTableSlot *slot) {
+  ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+
+  while (ascan->index < ascan->end) {
+    const int64 row = ascan->index++;
+    const int bit = row % ARROW_CHUNK_ROWS;
+    const uint64 rowbit = UINT64CONST(1) << (bit % 64);
+
+    if (ascan->masked && (ascan->kept[bit / 64] & rowbit) == 0)
+      continue;
+
+    if (row < ascan->sample_first || row >= ascan->sample_end) {
+      ArrowInsertRun *run = ArrowVisibilityFind(ascan->runs, row);
+      if (run != NULL) {
+        ascan->sample_first = run->first;
+        ascan->sample_end = run->first + run->count;
+        ascan->sample_visible = ArrowRunSatisfiesSnapshot(run, SnapshotSelf);
+        ascan->sample_aborted = (run->flags & ARROW_XID_INVALID) != 0;
+      } else {
+        ascan->sample_first = row;
+        ascan->sample_end = row + 1;
+        ascan->sample_visible = false;
+        ascan->sample_aborted = false;
+      }
+    }
+
+    if (!ascan->sample_visible) {
+      if (ascan->sample_aborted)
+        *deadrows += 1;
+      continue;
+    }
+
+    if (ascan->masked && (ascan->mask[bit / 64] & rowbit) == 0) {
+      *deadrows += 1;
+      continue;
+    }
+
+    ExecStoreArrowRow(slot, scan->rs_rd->rd_locator.relNumber, row);
+    slot->tts_tableOid = RelationGetRelid(scan->rs_rd);
+    *liverows += 1;
+    return true;
+  }
+
+  ExecClearTuple(slot);
   return false;
 }
 
+/*
+ * Scan the relation and add index entries for all rows that some
+ * transaction might still see.
+ *
+ * Chunks are used as blocks, so the block range is a range of chunks.
+ * Rows deleted by committed transactions are passed as not alive, so
+ * that unique indexes do not consider them conflicting.
+ */
 static double arrowam_index_build_range_scan(
     Relation tableRelation, Relation indexRelation, IndexInfo *indexInfo,
     bool allow_sync, bool anyvisible, bool progress, BlockNumber start_blockno,
     BlockNumber numblocks, IndexBuildCallback callback, void *callback_state,
     TableScanDesc scan) {
-  return 0;
+  const RelFileNumber relnumber = tableRelation->rd_locator.relNumber;
+  const int64 first = (int64)start_blockno * ARROW_CHUNK_ROWS;
+  const int64 last = numblocks == InvalidBlockNumber
+                         ? PG_INT64_MAX
+                         : first + (int64)numblocks * ARROW_CHUNK_ROWS;
+  Datum values[INDEX_MAX_KEYS];
+  bool isnull[INDEX_MAX_KEYS];
+  SnapshotData SnapshotNonVacuumable;
+  EState *estate = CreateExecutorState();
+  ExprContext *econtext = GetPerTupleExprContext(estate);
+  TupleTableSlot *slot = table_slot_create(tableRelation, NULL);
+  ExprState *predicate = ExecPrepareQual(indexInfo->ii_Predicate, estate);
+  ArrowDeletes deletes;
+  double reltuples = 0;
+
+  DEBUG_ENTER("relation: %s, index: %s", RelationGetRelationName(tableRelation),
+              RelationGetRelationName(indexRelation));
+
+  econtext->ecxt_scantuple = slot;
+
+  if (scan == NULL) {
+    InitNonVacuumableSnapshot(SnapshotNonVacuumable,
+                              GlobalVisTestFor(tableRelation));
+    scan = table_beginscan_strat(tableRelation, &SnapshotNonVacuumable, 0,
+                                 NULL, true, allow_sync);
+  }
+
+  ArrowDeletesGet(relnumber, O_RDWR, &deletes);
+
+  while (table_scan_getnextslot(scan, ForwardScanDirection, slot)) {
+    const int64 row = ArrowItemPointerGetRow(&slot->tts_tid);
+
+    CHECK_FOR_INTERRUPTS();
+
+    if (row < first || row >= last)
+      continue;
+
+    MemoryContextReset(econtext->ecxt_per_tuple_memory);
+
+    if (predicate != NULL && !ExecQual(predicate, econtext))
+      continue;
+
+    FormIndexDatum(indexInfo, slot, estate, values, isnull);
+    callback(indexRelation, &slot->tts_tid, values, isnull,
+             !ArrowRowDeleted(&deletes, row, SnapshotSelf), callback_state);
+    reltuples += 1;
+  }
+
+  table_endscan(scan);
+  ExecDropSingleTupleTableSlot(slot);
+  FreeExecutorState(estate);
+
+  /* These may have been pointing to the now-gone estate */
+  indexInfo->ii_ExpressionsState = NIL;
+  indexInfo->ii_PredicateState = NULL;
+
+  DEBUG_LEAVE("reltuples: %.0f", reltuples);
+  return reltuples;
 }
 
 static void arrowam_index_validate_scan(Relation tableRelation,
                                         Relation indexRelation,
                                         IndexInfo *indexInfo, Snapshot snapshot,
-                                        ValidateIndexState *state) {}
+                                        ValidateIndexState *state) {
+  ereport(ERROR,
+          (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+           errmsg("arrow tables do not support concurrent index builds")));
+}
+
+/*
+ * Each chunk of rows is presented as a block of the main fork, which
+ * makes the block numbers of item pointers consistent with the size
+ * of the relation. The main fork holds no data, but it is extended so
+ * that these blocks can be prefetched, see ArrowVisibilityExtendFork().
+ */
+static BlockNumber arrowam_relation_blocks(Relation relation) {
+  ArrowArray *runs =
+      ArrowVisibilityGet(relation->rd_locator.relNumber, O_RDWR);
+  return (ArrowVisibilityRows(runs) + ARROW_CHUNK_ROWS - 1) / ARROW_CHUNK_ROWS;
+}
 
 static uint64 arrowam_relation_size(Relation relation, ForkNumber forkNumber) {
-  return 0;
+  if (forkNumber != MAIN_FORKNUM && forkNumber != InvalidForkNumber)
+    return 0;
+  return (uint64)arrowam_relation_blocks(relation) * BLCKSZ;
 }
 
 static bool arrowam_relation_needs_toast_table(Relation relation) {
@@ -383,32 +905,179 @@ static bool arrowam_relation_needs_toast_table(Relation relation) {
 static void arrowam_estimate_rel_size(Relation relation, int32 *attr_widths,
                                       BlockNumber *pages, double *tuples,
                                       double *allvisfrac) {
-  *attr_widths = 0;
-  *tuples = 0;
+  ArrowArray *runs =
+      ArrowVisibilityGet(relation->rd_locator.relNumber, O_RDWR);
+
+  /* Deleted rows are counted as well, but VACUUM eventually compacts
+   * chunks with many deleted rows. */
+  *tuples = ArrowVisibilityRows(runs);
+  *pages = arrowam_relation_blocks(relation);
   *allvisfrac = 0;
-  *pages = 0;
 }
 
+/*
+ * Move a bitmap scan to a block.
+ *
+ * Blocks are chunks, so the offsets map directly to positions in the
+ * chunk. The rows of the block that are visible are collected here,
+ * using the delete mask of the chunk and checking the snapshot once
+ * for each run, so that returning the rows is just a matter of
+ * storing references to them in the slot.
+ *
+ * Lossy pages have no offsets, so all rows of the chunk are checked
+ * and the executor rechecks the conditions.
+ */
 static bool arrowam_scan_bitmap_next_block(TableScanDesc scan,
                                            TBMIterateResult *tbmres) {
-  return false;
+  ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+  const int64 first = (int64)tbmres->blockno * ARROW_CHUNK_ROWS;
+  const int64 nrows = ArrowVisibilityRows(ascan->runs);
+  const int ntuples =
+      tbmres->ntuples >= 0 ? tbmres->ntuples : ARROW_CHUNK_ROWS;
+  ArrowInsertRun *run = NULL;
+  bool visible = false;
+
+  ascan->ntuples = 0;
+  ascan->tuple = 0;
+
+  if (first >= nrows)
+    return false;
+
+  ascan->chunk = tbmres->blockno;
+  ascan->masked = ArrowDeletesMask(&ascan->deletes, ascan->chunk,
+                                   scan->rs_snapshot, ascan->mask);
+
+  for (int i = 0; i < ntuples; ++i) {
+    const int bit = tbmres->ntuples >= 0 ? tbmres->offsets[i] - 1 : i;
+    const int64 row = first + bit;
+
+    Assert(bit < ARROW_CHUNK_ROWS);
+
+    /* Offsets are sorted, so there is nothing more in the block */
+    if (row >= nrows)
+      break;
+
+    if (ascan->masked &&
+        (ascan->mask[bit / 64] & (UINT64CONST(1) << (bit % 64))) == 0)
+      continue;
+
+    if (run == NULL || row >= run->first + run->count) {
+      run = ArrowVisibilityFind(ascan->runs, row);
+      visible =
+          run != NULL && ArrowRunSatisfiesSnapshot(run, scan->rs_snapshot);
+    }
+
+    if (visible)
+      ascan->tuples[ascan->ntuples++] = bit;
+  }
+
+  return ascan->ntuples > 0;
 }
 
 static bool arrowam_scan_bitmap_next_tuple(TableScanDesc scan,
                                            TBMIterateResult *tbmres,
                                            TupleTableSlot *slot) {
-  return false;
+  ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+
+  if (ascan->tuple >= ascan->ntuples)
+    return false;
+
+  ExecStoreArrowRow(slot, scan->rs_rd->rd_locator.relNumber,
+                    (int64)tbmres->blockno * ARROW_CHUNK_ROWS +
+                        ascan->tuples[ascan->tuple++]);
+  slot->tts_tableOid = RelationGetRelid(scan->rs_rd);
+  pgstat_count_heap_fetch(scan->rs_rd);
+  return true;
 }
 
+/*
+ * Move a sample scan to the next block.
+ *
+ * Chunks are used as blocks, so sampling methods that pick blocks,
+ * like SYSTEM, pick whole chunks and the other chunks are never
+ * looked at. Other sampling methods, like BERNOULLI, get all chunks
+ * in order.
+ */
 static bool arrowam_scan_sample_next_block(TableScanDesc scan,
                                            SampleScanState *scanstate) {
-  return false;
+  ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+  TsmRoutine *tsm = scanstate->tsmroutine;
+  const BlockNumber nblocks =
+      (ascan->nrows + ARROW_CHUNK_ROWS - 1) / ARROW_CHUNK_ROWS;
+  BlockNumber blockno;
+
+  if (tsm->NextSampleBlock)
+    blockno = tsm->NextSampleBlock(scanstate, nblocks);
+  else
+    blockno = ascan->chunk < 0 ? 0 : ascan->chunk + 1;
+
+  if (!BlockNumberIsValid(blockno) || blockno >= nblocks) {
+    ascan->chunk = -1;
+    return false;
+  }
+
+  ascan->chunk = blockno;
+  ascan->masked = ArrowDeletesMask(&ascan->deletes, ascan->chunk,
+                                   scan->rs_snapshot, ascan->mask);
+  return true;
 }
 
+/*
+ * Return the next row of the block picked by the sampling method
+ * that is visible.
+ *
+ * Only the picked rows are checked for visibility, and the snapshot is
+ * checked once for each run.
+ */
 static bool arrowam_scan_sample_next_tuple(TableScanDesc scan,
                                            SampleScanState *scanstate,
                                            TupleTableSlot *slot) {
-  return false;
+  ArrowScanDesc *ascan = (ArrowScanDesc *)scan;
+  TsmRoutine *tsm = scanstate->tsmroutine;
+  const int64 first = ascan->chunk * ARROW_CHUNK_ROWS;
+  const OffsetNumber maxoffset = Min(ascan->nrows - first, ARROW_CHUNK_ROWS);
+
+  for (;;) {
+    OffsetNumber offset;
+    int bit;
+    int64 row;
+
+    CHECK_FOR_INTERRUPTS();
+
+    offset = tsm->NextSampleTuple(scanstate, ascan->chunk, maxoffset);
+    if (!OffsetNumberIsValid(offset)) {
+      ExecClearTuple(slot);
+      return false;
+    }
+
+    bit = offset - 1;
+    row = first + bit;
+
+    if (ascan->masked &&
+        (ascan->mask[bit / 64] & (UINT64CONST(1) << (bit % 64))) == 0)
+      continue;
+
+    if (row < ascan->sample_first || row >= ascan->sample_end) {
+      ArrowInsertRun *run = ArrowVisibilityFind(ascan->runs, row);
+      if (run != NULL) {
+        ascan->sample_first = run->first;
+        ascan->sample_end = run->first + run->count;
+        ascan->sample_visible =
+            ArrowRunSatisfiesSnapshot(run, scan->rs_snapshot);
+      } else {
+        ascan->sample_first = row;
+        ascan->sample_end = row + 1;
+        ascan->sample_visible = false;
+      }
+    }
+
+    if (ascan->sample_visible) {
+      ExecStoreArrowRow(slot, scan->rs_rd->rd_locator.relNumber, row);
+      slot->tts_tableOid = RelationGetRelid(scan->rs_rd);
+      pgstat_count_heap_getnext(scan->rs_rd);
+      return true;
+    }
+  }
 }
 
 static const TableAmRoutine arrowam_methods = {
@@ -469,9 +1138,133 @@ static const TableAmRoutine arrowam_methods = {
 
 Datum arrowam_handler(PG_FUNCTION_ARGS) { PG_RETURN_POINTER(&arrowam_methods); }
 
+/*
+ * Object access hook to drop the segments of arrow tables and sorted
+ * indexes.
+ *
+ * Dropping a table does not call into the table access method, so we
+ * catch drops of relations here and unlink the segments when the
+ * transaction commits. The relation is locked exclusively when this
+ * is called, so it is safe to open it.
+ *
+ * This requires the module to be loaded in the backend that drops
+ * the relation, which is always the case if it is preloaded. Segments
+ * that escape anyway can be removed with arrow_cleanup().
+ */
+static void arrowam_object_access(ObjectAccessType access, Oid classId,
+                                  Oid objectId, int subId, void *arg) {
+  if (prev_object_access_hook)
+    prev_object_access_hook(access, classId, objectId, subId, arg);
+
+  if (access == OAT_DROP && classId == RelationRelationId && subId == 0) {
+    Relation relation = RelationIdGetRelation(objectId);
+    if (RelationIsValid(relation)) {
+      if (relation->rd_tableam == &arrowam_methods ||
+          RelationIsArrowIndex(relation))
+        ArrowScheduleUnlink(MyDatabaseId, relation->rd_locator.relNumber,
+                            true);
+      RelationClose(relation);
+    }
+  }
+}
+
+/*
+ * Recompute the memory accounting when the server starts or restarts
+ * after a crash. With EXEC_BACKEND, this hook also runs in each new
+ * backend, which must leave the counter alone.
+ */
+static void arrowam_shmem_startup(void) {
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  if (!IsUnderPostmaster)
+    ArrowAccountingReset();
+}
+
 /*
  * The function _PG_init gets called with the database id set in
  * variable MyDatabaseId if you load a function from it. If loaded
  * using preload flags, it will be 0.
  */
-void _PG_init(void) { ArrowPageSize = sysconf(_SC_PAGESIZE); }
+void _PG_init(void) {
+  ArrowPageSize = sysconf(_SC_PAGESIZE);
+
+  DefineCustomIntVariable(
+      "arrow.max_memory",
+      "Maximum amount of shared memory used by arrow tables.",
+      "Creating or growing a segment that would exceed this limit fails. "
+      "The value -1 means that there is no limit.",
+      &ArrowMaxMemory, -1, -1, INT_MAX, PGC_SIGHUP, GUC_UNIT_KB, NULL, NULL,
+      NULL);
+
+  DefineCustomRealVariable(
+      "arrow.compaction_threshold",
+      "Fraction of deleted rows in a chunk that triggers compaction.",
+      "Vacuum compacts the rows of a table starting at the first chunk "
+      "where at least this fraction of the rows are deleted.",
+      &ArrowCompactionThreshold, 0.2, 0.0, 1.0, PGC_USERSET, 0, NULL, NULL,
+      NULL);
+
+  DefineCustomIntVariable(
+      "arrow.delta_rows",
+      "Maximum number of rows kept in the delta store of a table.",
+      "Inserts of at most this many rows write the rows to the delta "
+      "store of the table, which is merged into the columns when it is "
+      "full. The value 0 means that inserts always write to the columns.",
+      &ArrowDeltaRows, 0, 0, INT_MAX, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomBoolVariable(
+      "arrow.enable_hashjoin",
+      "Enables the planner's use of arrow hash joins.",
+      "Arrow hash joins probe a hash table of the inner relation with "
+      "the key column of an arrow table, reading rows in batches.",
+      &ArrowEnableHashJoin, true, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomBoolVariable(
+      "arrow.enable_agg",
+      "Enables the planner's use of arrow aggregation.",
+      "Arrow aggregation computes grouped counts, sums, averages, and "
+      "extremes of integer columns while scanning an arrow table.",
+      &ArrowEnableAgg, true, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomStringVariable(
+      "arrow.worker_database",
+      "Database whose arrow tables are maintained in the background.",
+      "The maintenance worker only runs if the module is loaded using "
+      "shared_preload_libraries. An empty string disables the worker.",
+      &ArrowWorkerDatabase, "postgres", PGC_POSTMASTER, 0, NULL, NULL,
+      NULL);
+
+  DefineCustomIntVariable(
+      "arrow.worker_naptime",
+      "Time to sleep between rounds of the maintenance worker.",
+      "In each round, the maintenance worker merges the delta stores, "
+      "freezes rows, prunes deletes, and compacts each arrow table.",
+      &ArrowWorkerNaptime, 10000, 1, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS,
+      NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "arrow.worker_delay",
+      "Time to sleep after the maintenance worker maintained a table.",
+      "Larger values spread the work of the maintenance worker over a "
+      "longer time, leaving more room for foreground queries.",
+      &ArrowWorkerDelay, 100, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL,
+      NULL, NULL);
+  MarkGUCPrefixReserved("arrow");
+
+  prev_object_access_hook = object_access_hook;
+  object_access_hook = arrowam_object_access;
+
+  ArrowClusteredScanInit();
+  ArrowHashJoinInit();
+  ArrowAggInit();
+
+  RegisterXactCallback(ArrowStorageXactCallback, NULL);
+  RegisterSubXactCallback(ArrowStorageSubXactCallback, NULL);
+
+  if (process_shared_preload_libraries_in_progress) {
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = arrowam_shmem_startup;
+    ArrowWorkerRegister();
+  }
+}
@@ -0,0 +1,2 @@
+-- Grouped aggregate over the scan table.
+select c1, count(*), sum(:column), max(:column) from bench_scan group by c1;
@@ -0,0 +1,2 @@
+-- Append throughput: insert :batch rows of the type under test.
+insert into bench_append select v from bench_values limit :batch;
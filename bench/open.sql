@@ -0,0 +1,3 @@
+-- Run with --connect, so every transaction maps the segments of all
+-- the columns in a new backend.
+select * from bench_scan limit 1;
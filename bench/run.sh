@@ -0,0 +1,151 @@
+#!/bin/sh
+#
+# Licensed to the Apache Software Foundation (ASF) under one or more
+# contributor license agreements.  See the NOTICE file distributed
+# with this work for additional information regarding copyright
+# ownership.  The ASF licenses this file to you under the Apache
+# License, Version 2.0 (the "License"); you may not use this file
+# except in compliance with the License.  You may obtain a copy of
+# the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied.  See the License for the specific language governing
+# permissions and limitations under the License.
+
+# Benchmarks for arrow tables, run against the server given by the
+# usual libpq environment variables. Results are written to standard
+# output as CSV with one measurement per line:
+#
+#   benchmark,type,columns,rows,metric,value,unit
+#
+# Settings, from the environment:
+#
+#   PSQL, PGBENCH     programs to use
+#   BENCH_ROWS        row counts of the scan table
+#   BENCH_WIDTHS      column counts of the scan table
+#   BENCH_TYPES       column types for the append benchmark
+#   BENCH_BATCHES     rows per insert for the append benchmark
+#   BENCH_TIME        seconds to run each pgbench script
+#   BENCH_GHZ         clock rate of the server, to report cycles per row
+
+set -eu
+
+dir=$(dirname "$0")
+
+PSQL=${PSQL:-psql}
+PGBENCH=${PGBENCH:-pgbench}
+BENCH_ROWS=${BENCH_ROWS:-"100000 1000000"}
+BENCH_WIDTHS=${BENCH_WIDTHS:-"1 4 16 64"}
+BENCH_TYPES=${BENCH_TYPES:-"bool int2 int4 int8 float8 date timestamptz uuid"}
+BENCH_BATCHES=${BENCH_BATCHES:-"1 1000"}
+BENCH_TIME=${BENCH_TIME:-5}
+BENCH_GHZ=${BENCH_GHZ:-}
+
+sql() {
+  "$PSQL" -X -q -t -A -v ON_ERROR_STOP=1 -c "$1"
+}
+
+# Run a pgbench script and print its average latency in milliseconds.
+bench() {
+  script=$1
+  shift
+  "$PGBENCH" -n -T "$BENCH_TIME" -f "$dir/$script" "$@" 2>&1 |
+    awk '/^latency average/ { print $4 }'
+}
+
+emit() {
+  echo "$1,$2,$3,$4,$5,$6,$7"
+}
+
+# Expression giving the value of row i for each type in BENCH_TYPES.
+value() {
+  case $1 in
+    bool) echo "i % 2 = 0" ;;
+    int2) echo "(i % 32767)::int2" ;;
+    int4) echo "i::int4" ;;
+    int8) echo "i::int8" ;;
+    float4) echo "i::float4" ;;
+    float8) echo "i::float8" ;;
+    date) echo "date '2000-01-01' + i % 100000" ;;
+    timestamptz) echo "timestamptz '2000-01-01' + i * interval '1 s'" ;;
+    uuid) echo "md5(i::text)::uuid" ;;
+    *) echo "unknown type $1" >&2; exit 1 ;;
+  esac
+}
+
+sql "create extension if not exists arrow"
+
+echo "benchmark,type,columns,rows,metric,value,unit"
+
+for type in $BENCH_TYPES; do
+  sql "drop table if exists bench_append, bench_values;
+       create table bench_values as
+         select $(value "$type") as v from generate_series(1, 1000) i;
+       create table bench_append (v $type) using arrow"
+  for batch in $BENCH_BATCHES; do
+    sql "truncate bench_append"
+    ms=$(bench append.sql -D batch="$batch")
+    emit append "$type" 1 "$batch" rows_per_s \
+      "$(echo "$ms $batch" | awk '{ printf "%.0f", $2 * 1000 / $1 }')" rows/s
+  done
+done
+sql "drop table bench_append, bench_values"
+
+for rows in $BENCH_ROWS; do
+  for width in $BENCH_WIDTHS; do
+    columns=$(seq -f "c%g bigint" -s ", " 1 "$width")
+    values=$(seq 2 "$width" | sed 's/.*/i/' | paste -s -d, -)
+    sql "drop table if exists bench_scan;
+         create table bench_scan ($columns) using arrow;
+         insert into bench_scan
+           select i % 64${values:+, $values} from generate_series(1, $rows) i;
+         vacuum bench_scan"
+    bytes=$(sql "select sum(bytes_used) from pg_stat_arrow
+                  where relid = 'bench_scan'::regclass")
+    last=c$width
+
+    # The scan reads the columns of each row up to the last one, so
+    # the time per row grows with the cost of deforming each column.
+    ms=$(PGOPTIONS="-c arrow.enable_agg=off" bench scan.sql -D column="$last")
+    emit scan int8 "$width" "$rows" gb_per_s \
+      "$(echo "$ms $bytes" | awk '{ printf "%.3f", $2 / $1 / 1e6 }')" GB/s
+    ns=$(echo "$ms $rows" | awk '{ printf "%.2f", $1 * 1e6 / $2 }')
+    emit deform int8 "$width" "$rows" ns_per_row "$ns" ns
+    emit deform int8 "$width" "$rows" ns_per_column \
+      "$(echo "$ns $width" | awk '{ printf "%.2f", $1 / $2 }')" ns
+    if [ -n "$BENCH_GHZ" ]; then
+      emit deform int8 "$width" "$rows" cycles_per_row \
+        "$(echo "$ns $BENCH_GHZ" | awk '{ printf "%.1f", $1 * $2 }')" cycles
+    fi
+
+    for agg in on off; do
+      ms=$(PGOPTIONS="-c arrow.enable_agg=$agg" bench agg.sql -D column="$last")
+      emit "agg_$agg" int8 "$width" "$rows" rows_per_s \
+        "$(echo "$ms $rows" | awk '{ printf "%.0f", $2 * 1000 / $1 }')" rows/s
+    done
+
+    # Each transaction of the script is a new backend, which maps the
+    # segments of the table, so the counters of arrow_profile give the
+    # time for a segment and for the whole table. Both lines of the
+    # counters and the transaction count are joined as one record.
+    before=$(sql "select segment_opens, open_time from arrow_profile
+                   where relid = 'bench_scan'::regclass")
+    xacts=$("$PGBENCH" -n -C -T "$BENCH_TIME" -f "$dir/open.sql" 2>&1 |
+              awk '/^number of transactions actually processed/ {
+                     split($6, n, "/"); print n[1] }')
+    after=$(sql "select segment_opens, open_time from arrow_profile
+                  where relid = 'bench_scan'::regclass")
+    echo "$before|$after|$xacts" | awk -F'|' '
+      $5 > 0 && $3 > $1 {
+        printf "open,int8,%d,%d,us_per_segment,%.2f,us\n", \
+          W, R, ($4 - $2) * 1000 / ($3 - $1)
+        printf "open,int8,%d,%d,ms_per_table,%.3f,ms\n", \
+          W, R, ($4 - $2) / $5
+      }' W="$width" R="$rows"
+  done
+done
+sql "drop table bench_scan"
@@ -0,0 +1,2 @@
+-- Sequential scan reading every column up to :column of each row.
+select sum(:column) from bench_scan;
@@ -24,6 +24,7 @@
 #include <executor/tuptable.h>
 #include <lib/stringinfo.h>
 #include <utils/lsyscache.h>
+#include <utils/memutils.h>
 
 /* Call the output function for a value given the type and append the string
  * representation to the provided buffer. */
@@ -40,8 +41,23 @@ static void ValueOut(StringInfo buf, Oid typid, Datum value, bool isnull) {
     appendStringInfoString(buf, OutputFunctionCall(&typoutputfinfo, value));
 }
 
+/* The strings are only used in a single message, so each function
+ * reuses its buffer instead of allocating a new one for each call. The
+ * result is valid until the next call. */
+static StringInfo ResetBuffer(StringInfo* info) {
+  if (*info == NULL) {
+    MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+    *info = makeStringInfo();
+    MemoryContextSwitchTo(oldcxt);
+  } else {
+    resetStringInfo(*info);
+  }
+  return *info;
+}
+
 StringInfo show_slot(TupleTableSlot* slot) {
-  StringInfo info = makeStringInfo();
+  static StringInfo buffer = NULL;
+  StringInfo info = ResetBuffer(&buffer);
   int natt = 0;
 
   appendStringInfoString(info, "(");
@@ -62,8 +78,9 @@ StringInfo show_slot(TupleTableSlot* slot) {
 }
 
 StringInfo key_to_string(const ArrowSegmentKey* key) {
-  StringInfo info = makeStringInfo();
-  appendStringInfo(info, "(%u, %u, %u)", key->bk_dbid, key->bk_relid,
-                   key->bk_attno);
+  static StringInfo buffer = NULL;
+  StringInfo info = ResetBuffer(&buffer);
+  appendStringInfo(info, "(%u, %u, %d, %d)", key->bk_dbid, key->bk_relnumber,
+                   key->bk_attno, key->bk_child);
   return info;
 }
@@ -0,0 +1,30 @@
+# CLUSTER and VACUUM FULL keep rows deleted by transactions that some
+# snapshot does not see yet, together with their deletes, so that the
+# rows stay visible to that snapshot and invisible to everybody else.
+
+setup
+{
+  create extension if not exists arrow;
+  create table test_cluster_snapshot(a int) using arrow;
+  insert into test_cluster_snapshot select generate_series(1, 10);
+  create table test_cluster_other(a int);
+}
+
+teardown
+{
+  drop table test_cluster_snapshot, test_cluster_other;
+}
+
+session s1
+step s1_begin { begin isolation level repeatable read; }
+step s1_snapshot { select count(*) from test_cluster_other; }
+step s1_count { select count(*), sum(a) from test_cluster_snapshot; }
+step s1_commit { commit; }
+
+session s2
+step s2_delete { delete from test_cluster_snapshot where a <= 3; }
+step s2_vacuum { vacuum full test_cluster_snapshot; }
+step s2_count { select count(*), sum(a) from test_cluster_snapshot; }
+
+permutation s1_begin s1_snapshot s2_delete s2_vacuum s1_count s2_count s1_commit
+permutation s2_delete s2_vacuum s1_count s2_count
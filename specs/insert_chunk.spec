@@ -0,0 +1,32 @@
+# Inserts from different transactions reserve rows next to each other
+# in the same chunk and fill them after releasing the extension lock.
+# Validity bits and boolean bitmaps of such rows share bytes, so check
+# that each row keeps its own values and nulls, also when one of the
+# transactions aborts.
+
+setup
+{
+  create extension if not exists arrow;
+  create table test_insert_chunk(a int, b int, c bool) using arrow;
+}
+
+teardown
+{
+  drop table test_insert_chunk;
+}
+
+session s1
+setup { begin; }
+step s1_insert { insert into test_insert_chunk select n, nullif(n % 3, 0), n % 2 = 0 from generate_series(1, 5) n; }
+step s1_copy { copy test_insert_chunk (a) from program 'seq 21 25'; }
+step s1_commit { commit; }
+step s1_check { select a, coalesce(b::text, '-') as b, coalesce(c::int::text, '-') as c from test_insert_chunk order by a; }
+
+session s2
+setup { begin; }
+step s2_insert { insert into test_insert_chunk select n, case when n % 2 = 1 then n * 10 end, case when n % 3 <> 0 then n % 2 = 1 end from generate_series(101, 105) n; }
+step s2_commit { commit; }
+step s2_abort { abort; }
+
+permutation s1_insert s2_insert s1_copy s2_commit s1_commit s1_check
+permutation s1_insert s2_insert s1_copy s2_abort s1_commit s1_check
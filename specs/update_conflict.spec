@@ -0,0 +1,34 @@
+# Updates and deletes of a row that a concurrent transaction updated
+# move on to the new version in READ COMMITTED, and row locks make
+# them wait, like for heap tables.
+
+setup
+{
+  create extension if not exists arrow;
+  create table test_update_conflict(id int, x int) using arrow;
+  insert into test_update_conflict values (1, 0), (2, 0);
+}
+
+teardown
+{
+  drop table test_update_conflict;
+}
+
+session s1
+step s1_begin { begin; }
+step s1_update { update test_update_conflict set x = x + 1 where id = 1; }
+step s1_lock { select id, x from test_update_conflict where id = 1 for update; }
+step s1_share { select id, x from test_update_conflict where id = 1 for share; }
+step s1_commit { commit; }
+
+session s2
+step s2_update { update test_update_conflict set x = x + 10 where id = 1; }
+step s2_delete { delete from test_update_conflict where id = 1; }
+step s2_share { select id, x from test_update_conflict where id = 1 for share; }
+step s2_nowait { select id, x from test_update_conflict where id = 1 for update nowait; }
+step s2_check { select id, x from test_update_conflict order by id; }
+
+permutation s1_begin s1_update s2_update s1_commit s2_check
+permutation s1_begin s1_update s2_delete s1_commit s2_check
+permutation s1_begin s1_lock s2_update s1_commit s2_check
+permutation s1_begin s1_share s2_share s2_nowait s1_commit s2_check
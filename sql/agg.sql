@@ -0,0 +1,44 @@
+create table test_agg(id int, grp int, small smallint, big bigint) using arrow;
+insert into test_agg
+  select n, n % 5, (n % 3)::smallint, n * 1000000000::bigint
+    from generate_series(1, 1000) n;
+insert into test_agg values (1001, null, null, null), (1002, 1, null, null);
+
+explain (costs off)
+select grp, count(*), sum(id) from test_agg group by grp;
+explain (costs off)
+select count(*) from test_agg where id > 500;
+
+-- Groups on integer and smallint columns, and a group for nulls
+select grp, count(*), count(big), sum(id), min(big), max(small), avg(id)
+  from test_agg group by grp order by grp;
+select small, count(*), sum(small), avg(small), min(id), max(id)
+  from test_agg group by small order by small;
+
+-- Without a grouping column there is always one group
+select count(*), sum(id), min(id), max(id), avg(id) from test_agg;
+select count(*), sum(id), min(id), max(id), avg(id) from test_agg
+ where id > 2000;
+
+-- Restrictions and deleted rows
+delete from test_agg where id <= 100;
+select grp, count(*), sum(id) from test_agg
+ where small = 1 group by grp order by grp;
+
+-- Expressions over aggregates and the grouping column
+select grp * 10 as g, sum(id) / count(*) as mean
+  from test_agg group by grp order by 1;
+
+-- Results are the same as for a regular aggregate
+set arrow.enable_agg = off;
+select grp, count(*), sum(id) from test_agg
+ where small = 1 group by grp order by grp;
+select grp * 10 as g, sum(id) / count(*) as mean
+  from test_agg group by grp order by 1;
+reset arrow.enable_agg;
+
+-- Unsupported aggregates use the regular aggregate node
+explain (costs off)
+select grp, count(distinct small) from test_agg group by grp;
+
+drop table test_agg;
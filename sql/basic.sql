@@ -22,3 +22,16 @@ where a is null or b is null;
 
 drop table test_arrow_int, test_heap_int;
 drop table test_arrow_float, test_heap_float;
+
+-- Columns are only read from the row when they are needed
+create table test_arrow_wide(a int, b bigint, c smallint, d float8) using arrow;
+insert into test_arrow_wide
+  select n, n * 10, n % 7, n / 4.0 from generate_series(1, 20) n;
+select d, a from test_arrow_wide where c = 3 and b > 50;
+select * from test_arrow_wide order by d desc limit 3;
+
+-- Tuples for sorts are formed directly from the columns
+insert into test_arrow_wide values (21, null, 1, 6.5), (22, 220, null, null);
+select * from test_arrow_wide order by d desc nulls last limit 3;
+select a, b from test_arrow_wide order by b desc nulls first limit 2;
+drop table test_arrow_wide;
@@ -0,0 +1,26 @@
+create table test_bitmap(a int, b int) using arrow;
+insert into test_bitmap select a, a % 100 from generate_series(1, 2000) a;
+create index test_bitmap_a on test_bitmap(a);
+create index test_bitmap_b on test_bitmap(b);
+
+set enable_seqscan = off;
+set enable_indexscan = off;
+
+explain (costs off) select * from test_bitmap where a = 10 or b = 20;
+select count(*), sum(a) from test_bitmap where a = 10 or b = 20;
+select count(*), sum(a) from test_bitmap where a <= 1000 and b = 5;
+select * from test_bitmap where b = 99 and a > 1500 order by a;
+
+-- Deleted rows are not returned, but rows inserted by the current
+-- transaction are
+delete from test_bitmap where a = 120;
+begin;
+insert into test_bitmap values (10, 10);
+select count(*), sum(a) from test_bitmap where a = 10 or b = 20;
+rollback;
+select count(*), sum(a) from test_bitmap where a = 10 or b = 20;
+
+reset enable_seqscan;
+reset enable_indexscan;
+
+drop table test_bitmap;
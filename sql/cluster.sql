@@ -0,0 +1,51 @@
+create table test_cluster(a int, b int) using arrow;
+create index test_cluster_a on test_cluster using btree (a);
+insert into test_cluster select (n * 37) % 100, n from generate_series(1, 100) n;
+delete from test_cluster where b % 10 = 0;
+select a, b from test_cluster limit 5;
+
+-- The clustered index declares the sort key, and CLUSTER rewrites the
+-- rows in that order, leaving out the deleted rows
+alter table test_cluster cluster on test_cluster_a;
+cluster test_cluster;
+select a, b from test_cluster limit 5;
+select count(*), sum(a), sum(b) from test_cluster;
+
+-- Scans advertise the order, so there is no need to sort
+set enable_indexscan = off;
+set enable_bitmapscan = off;
+explain (costs off) select * from test_cluster order by a;
+select * from test_cluster order by a limit 5;
+
+-- Plans made while the table was sorted still return rows in order
+-- after new rows are appended
+prepare sorted as select a, b from test_cluster order by a limit 3;
+explain (costs off) execute sorted;
+insert into test_cluster values (-1, -1);
+execute sorted;
+explain (costs off) select * from test_cluster order by a;
+
+-- VACUUM FULL sorts on the clustered index as well
+vacuum full test_cluster;
+select a, b from test_cluster limit 3;
+explain (costs off) select * from test_cluster order by a;
+
+-- Sorted tables can be merge joined directly
+create table test_cluster_other(a int, c int) using arrow;
+create index test_cluster_other_a on test_cluster_other (a desc);
+insert into test_cluster_other select (n * 13) % 100, n from generate_series(0, 99) n;
+alter table test_cluster_other cluster on test_cluster_other_a;
+cluster test_cluster_other;
+select a, c from test_cluster_other limit 3;
+set enable_hashjoin = off;
+set enable_nestloop = off;
+select count(*), sum(b), sum(c)
+  from test_cluster join test_cluster_other using (a);
+reset enable_hashjoin;
+reset enable_nestloop;
+
+reset enable_indexscan;
+reset enable_bitmapscan;
+deallocate sorted;
+
+drop table test_cluster, test_cluster_other;
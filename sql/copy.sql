@@ -0,0 +1,108 @@
+-- Bulk loading of files into arrow tables
+\getenv abs_builddir PG_ABS_BUILDDIR
+\set csv_file :abs_builddir '/results/copy.csv'
+\set text_file :abs_builddir '/results/copy.txt'
+\set binary_file :abs_builddir '/results/copy.bin'
+\set arrow_file :abs_builddir '/results/copy.arrow'
+\set arrow_bad_file :abs_builddir '/results/copy_bad.arrow'
+
+create table test_copy(a int, b bigint not null, c date, d timestamp, e bool)
+  using arrow;
+create index test_copy_a on test_copy(a);
+
+copy (select i, i * 10, date '2024-01-01' + i,
+             timestamp '2024-01-01' + i * interval '1 hour', i % 3 = 0
+        from generate_series(1, 10000) i)
+  to :'csv_file' with (format csv);
+select arrow_copy_from('test_copy', :'csv_file');
+select count(*), sum(a), sum(b), sum(c - date '2024-01-01') as days,
+       max(d) = timestamp '2024-01-01' + interval '10000 hours' as max_d,
+       count(*) filter (where e) as e
+  from test_copy;
+
+-- Index entries are inserted for the loaded rows
+set enable_seqscan = off;
+select a, b from test_copy where a = 4242;
+reset enable_seqscan;
+
+-- Rows in the delta store are merged before the loaded rows
+set arrow.delta_rows = 4;
+insert into test_copy values (0, 0, null, null, null);
+copy (select i, i * 10, null, null, null from generate_series(10001, 10100) i)
+  to :'binary_file' with (format binary);
+select arrow_copy_from('test_copy', :'binary_file', 'binary');
+select a, b from test_copy offset 9999 limit 3;
+set enable_seqscan = off;
+select a, b from test_copy where a = 10042;
+reset enable_seqscan;
+reset arrow.delta_rows;
+
+copy (select null::int, 1::bigint, null::date, null::timestamp, null::bool)
+  to :'text_file' with (format text);
+select arrow_copy_from('test_copy', :'text_file', 'text');
+select count(*), count(a) from test_copy;
+
+-- Constraints are checked
+copy (select 1, null::bigint, null::date, null::timestamp, null::bool)
+  to :'text_file' with (format text);
+select arrow_copy_from('test_copy', :'text_file', 'text');
+create unique index test_copy_b on test_copy(b);
+copy (select 2, 10::bigint, null::date, null::timestamp, null::bool)
+  to :'text_file' with (format text);
+select arrow_copy_from('test_copy', :'text_file', 'text');
+select arrow_copy_from('test_copy', :'csv_file', 'parquet');
+create table test_copy_heap(a int);
+select arrow_copy_from('test_copy_heap', :'csv_file');
+
+-- Arrow IPC streams with the columns in the same representation
+create table test_copy_arrow(a int, b float8, c date, d bool) using arrow;
+select lo_from_bytea(0, decode(
+  'ffffffff000100001000000000000a000c000600050008000a00000000010400' ||
+  '0c00000008000800000004000800000004000000040000009c0000005c000000' ||
+  '300000000400000084ffffff0000010610000000180000000400000000000000' ||
+  '01000000640000000400040004000000acffffff000001081000000014000000' ||
+  '04000000000000000100000063000000daffffff00000000d4ffffff00000103' ||
+  '1000000018000000040000000000000001000000620006000800060006000000' ||
+  '00000200100014000800060007000c0000001000100000000000010210000000' ||
+  '1c0000000400000000000000010000006100000008000c000800070008000000' ||
+  '0000000120000000ffffffff1801000014000000000000000c00160006000500' ||
+  '08000c000c0000000003040018000000800000000000000000000a0018000c00' ||
+  '040008000a0000009c0000001000000005000000000000000000000008000000' ||
+  '0000000000000000010000000000000008000000000000001400000000000000' ||
+  '2000000000000000010000000000000028000000000000002800000000000000' ||
+  '5000000000000000010000000000000058000000000000001400000000000000' ||
+  '7000000000000000010000000000000078000000000000000100000000000000' ||
+  '0000000004000000050000000000000001000000000000000500000000000000' ||
+  '0100000000000000050000000000000001000000000000000500000000000000' ||
+  '01000000000000001b0000000000000001000000020000000000000004000000' ||
+  '05000000000000001d00000000000000000000000000f83f0000000000000000' ||
+  '0000000000000a400000000000001040000000000000f0bf1b00000000000000' ||
+  '0b4d0000464d00000000000000000000ffffffff000000001b00000000000000' ||
+  '0900000000000000ffffffff00000000', 'hex')) as arrow_lo \gset
+select lo_export(:arrow_lo, :'arrow_file');
+select lo_unlink(:arrow_lo);
+select arrow_copy_from('test_copy_arrow', :'arrow_file', 'arrow');
+select a, b, c - date '1970-01-01' as days, d from test_copy_arrow;
+
+create table test_copy_mismatch(a bigint, b float8, c date, d bool)
+  using arrow;
+select arrow_copy_from('test_copy_mismatch', :'arrow_file', 'arrow');
+select arrow_copy_from('test_copy', :'arrow_file', 'arrow');
+
+-- Values are copied without calling the input functions, so domains
+-- and values out of the range of the type are rejected
+create domain test_copy_positive as int check (value > 0);
+create table test_copy_domain(a test_copy_positive, b float8, c date, d bool)
+  using arrow;
+select arrow_copy_from('test_copy_domain', :'arrow_file', 'arrow');
+select lo_from_bytea(0, overlay(pg_read_binary_file(:'arrow_file')
+                                placing '\x01000080'::bytea from 653))
+  as arrow_lo \gset
+select lo_export(:arrow_lo, :'arrow_bad_file');
+select lo_unlink(:arrow_lo);
+select arrow_copy_from('test_copy_arrow', :'arrow_bad_file', 'arrow');
+select count(*) from test_copy_arrow;
+
+drop table test_copy, test_copy_heap, test_copy_arrow, test_copy_mismatch,
+  test_copy_domain;
+drop domain test_copy_positive;
@@ -0,0 +1,30 @@
+create table test_delete(a int, b int) using arrow;
+insert into test_delete select a, 2 * a from generate_series(1, 1000) a;
+
+delete from test_delete where a % 2 = 0;
+select count(*), sum(a) from test_delete;
+
+-- Deleted rows are visible again if the transaction aborts
+begin;
+delete from test_delete where a <= 500;
+select count(*) from test_delete;
+rollback;
+select count(*) from test_delete;
+
+-- Rows deleted by an earlier command are not visible
+begin;
+delete from test_delete where a = 1;
+delete from test_delete where a = 1;
+select count(*) from test_delete;
+commit;
+
+-- Delete whole chunks of rows and fold the deletes
+delete from test_delete where a between 257 and 768;
+select count(*), min(a), max(a) from test_delete;
+vacuum test_delete;
+select count(*), min(a), max(a) from test_delete;
+
+-- Item pointers are based on the row number
+select ctid, a, b from test_delete where a < 10 order by a;
+
+drop table test_delete;
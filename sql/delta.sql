@@ -0,0 +1,65 @@
+-- Tables where all columns have a fixed length get a delta store
+create table test_delta(a int, b bigint, c date, d timestamp) using arrow;
+create table test_delta_text(a int, b text) using arrow;
+select relid, attnum from arrow_segments
+ where relid in ('test_delta'::regclass, 'test_delta_text'::regclass)
+   and attnum = -6;
+
+-- Small inserts go to the delta store
+set arrow.delta_rows = 4;
+insert into test_delta values (1, 10, '2024-01-01', null);
+insert into test_delta values (2, null, '2024-01-02', null);
+insert into test_delta values (3, 30, null, null);
+select attnum, row_count from arrow_segments
+ where relid = 'test_delta'::regclass and attnum in (-6, 1)
+ order by attnum;
+
+-- Rows in the delta store are visible to scans and indexes
+select a, b, c - date '2024-01-01' as days from test_delta order by a;
+create index test_delta_a on test_delta(a);
+set enable_seqscan = off;
+select a, b from test_delta where a = 2;
+reset enable_seqscan;
+
+update test_delta set b = 20 where a = 2;
+delete from test_delta where a = 3;
+select a, b from test_delta order by a;
+
+-- Values that cannot be stored in the columns are rejected when they
+-- are inserted, not when they are merged
+insert into test_delta values (9, 90, null, '294276-12-31 23:59:59');
+
+-- The delta store is merged into the columns when it is full
+insert into test_delta values (4, 40, '2024-01-04', null);
+select attnum, row_count from arrow_segments
+ where relid = 'test_delta'::regclass and attnum in (-6, 1)
+ order by attnum;
+select a, b, c - date '2024-01-01' as days from test_delta order by a;
+
+-- Vacuum merges the delta store
+vacuum test_delta;
+select attnum, row_count from arrow_segments
+ where relid = 'test_delta'::regclass and attnum = -6;
+
+-- Inserts that do not use the delta store merge it first, so that
+-- the rows stay in order
+insert into test_delta values (5, 50, null, null), (6, 60, null, null);
+set arrow.delta_rows = 0;
+insert into test_delta values (7, 70, null, null);
+select attnum, row_count from arrow_segments
+ where relid = 'test_delta'::regclass and attnum = -6;
+select a, b from test_delta order by a;
+
+-- Truncating the table empties the delta store
+set arrow.delta_rows = 4;
+begin;
+truncate test_delta;
+insert into test_delta values (8, 80, null, null);
+select a, b from test_delta;
+commit;
+
+insert into test_delta_text values (1, 'one');
+select * from test_delta_text;
+
+reset arrow.delta_rows;
+drop table test_delta, test_delta_text;
@@ -0,0 +1,42 @@
+create table test_fact(id int, dim int, amount bigint) using arrow;
+create table test_dim(id int, name text);
+insert into test_dim select n, 'dim ' || n from generate_series(1, 10) n;
+insert into test_fact select n, n % 12, n from generate_series(1, 1000) n;
+insert into test_fact values (1001, null, 1001);
+
+set enable_mergejoin = off;
+set enable_nestloop = off;
+
+explain (costs off)
+select f.id, d.name from test_fact f join test_dim d on f.dim = d.id
+ where f.id < 5;
+select f.id, d.name from test_fact f join test_dim d on f.dim = d.id
+ where f.id < 5 order by f.id;
+
+-- Rows without a match, rows with null keys, and deleted rows are not
+-- part of the result
+delete from test_fact where id <= 100;
+select d.name, count(*), sum(f.amount)
+  from test_fact f join test_dim d on f.dim = d.id
+ group by d.name order by d.name;
+
+-- Duplicate keys on the inner side return all matches
+insert into test_dim values (3, 'three');
+select d.name, count(*)
+  from test_fact f join test_dim d on f.dim = d.id
+ where d.id = 3 group by d.name order by d.name;
+
+-- Other join clauses are checked on the joined rows
+select count(*) from test_fact f join test_dim d
+    on f.dim = d.id and f.amount < d.id * 100;
+
+-- Results are the same as for a regular hash join
+set arrow.enable_hashjoin = off;
+select count(*) from test_fact f join test_dim d
+    on f.dim = d.id and f.amount < d.id * 100;
+reset arrow.enable_hashjoin;
+
+reset enable_mergejoin;
+reset enable_nestloop;
+
+drop table test_fact, test_dim;
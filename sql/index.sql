@@ -0,0 +1,62 @@
+create table test_index(a int, b int) using arrow;
+insert into test_index select a, 2 * a from generate_series(1, 1000) a;
+create index test_index_a on test_index(a);
+
+set enable_seqscan = off;
+set enable_bitmapscan = off;
+
+explain (costs off) select * from test_index where a = 471;
+select * from test_index where a = 471;
+select * from test_index where a between 100 and 104;
+
+-- Rows can be fetched using the item pointer
+select ctid, a, b from test_index where ctid = '(1,5)';
+
+-- Deleted rows and old versions of updated rows are not returned
+delete from test_index where a = 471;
+update test_index set b = 0 where a = 472;
+select * from test_index where a between 470 and 473;
+
+-- Returning the deleted row needs to fetch it
+update test_index set b = 1 where a = 1 returning *;
+delete from test_index where a = 2 returning *;
+
+-- Old versions of updated rows do not conflict when building a
+-- unique index
+create unique index test_index_a_key on test_index(a);
+insert into test_index values (1, 1);
+insert into test_index values (2, 4);
+
+-- Compaction moves rows, so the indexes are rebuilt
+set arrow.compaction_threshold = 0;
+vacuum test_index;
+reset arrow.compaction_threshold;
+
+select ctid, a, b from test_index where a in (1, 2, 1000) order by a;
+select * from test_index where a between 470 and 473;
+
+reset enable_seqscan;
+reset enable_bitmapscan;
+
+drop table test_index;
+
+-- Parallel scans and parallel index builds claim chunks, so each row
+-- is returned and indexed once
+create table test_index_parallel(a int) using arrow;
+insert into test_index_parallel select generate_series(1, 100000);
+set parallel_setup_cost = 0;
+set parallel_tuple_cost = 0;
+set min_parallel_table_scan_size = 0;
+set max_parallel_workers_per_gather = 2;
+set max_parallel_maintenance_workers = 2;
+select count(*), sum(a) from test_index_parallel;
+create index test_index_parallel_a on test_index_parallel(a);
+set enable_seqscan = off;
+select count(*), sum(a) from test_index_parallel where a > 0;
+reset enable_seqscan;
+reset parallel_setup_cost;
+reset parallel_tuple_cost;
+reset min_parallel_table_scan_size;
+reset max_parallel_workers_per_gather;
+reset max_parallel_maintenance_workers;
+drop table test_index_parallel;
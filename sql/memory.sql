@@ -0,0 +1,42 @@
+create table test_memory(a int, b bigint) using arrow;
+
+-- Insert enough rows to make the segments grow a few times
+insert into test_memory select a, a from generate_series(1, 10000) a;
+select count(*), sum(a), sum(b) from test_memory;
+
+select attnum, row_count,
+       capacity >= row_count as fits,
+       bytes_used <= bytes_reserved as within
+  from arrow_segments
+ where relid = 'test_memory'::regclass
+ order by attnum;
+
+select arrow_memory_reserved() >= sum(bytes_reserved)
+  from arrow_segments
+ where relid = 'test_memory'::regclass;
+
+-- The limit is for the whole cluster, so it cannot be set in a
+-- session, and growing beyond it should give an error
+set arrow.max_memory = '1MB';
+alter system set arrow.max_memory = '1MB';
+select pg_reload_conf();
+select pg_sleep(1);
+\set VERBOSITY terse
+insert into test_memory select a, a from generate_series(1, 1000000) a;
+\set VERBOSITY default
+
+-- Creating the segments of a table beyond the limit fails as well, and
+-- leaves no segments behind
+alter system set arrow.max_memory = 1;
+select pg_reload_conf();
+select pg_sleep(1);
+\set VERBOSITY terse
+create table test_memory_full(a int) using arrow;
+\set VERBOSITY default
+alter system reset arrow.max_memory;
+select pg_reload_conf();
+select pg_sleep(1);
+select count(*) from arrow_orphans()
+ where dbid = (select oid from pg_database where datname = current_database());
+
+drop table test_memory;
@@ -0,0 +1,44 @@
+create table test_mvcc(a int) using arrow;
+
+-- Rows inserted by aborted transactions are not visible
+begin;
+insert into test_mvcc values (1), (2);
+select count(*) from test_mvcc;
+rollback;
+select count(*) from test_mvcc;
+
+insert into test_mvcc values (3);
+select * from test_mvcc;
+
+-- Rows inserted by aborted subtransactions are not visible
+begin;
+insert into test_mvcc values (4);
+savepoint sp;
+insert into test_mvcc values (5);
+rollback to sp;
+insert into test_mvcc values (6);
+select * from test_mvcc order by a;
+commit;
+select * from test_mvcc order by a;
+
+-- Rows inserted by a command are not visible to the command itself
+insert into test_mvcc select a + 10 from test_mvcc;
+select * from test_mvcc order by a;
+
+-- Freezing rows does not change what is visible
+vacuum test_mvcc;
+select * from test_mvcc order by a;
+
+-- Bulk loading frozen rows
+begin;
+create table test_freeze(a int, b bigint) using arrow;
+copy test_freeze from stdin with (freeze);
+1	10
+2	20
+3	30
+\.
+select * from test_freeze order by a;
+commit;
+select count(*), sum(b) from test_freeze;
+
+drop table test_mvcc, test_freeze;
@@ -0,0 +1,48 @@
+-- Arrays are stored with the list layout and composites with the
+-- struct layout, with the elements and fields in child arrays.
+create type test_point as (x float8, y float8, z float8);
+create table test_nested(id int, v float4[], p test_point, tags int4[])
+  using arrow;
+
+insert into test_nested values
+  (1, '{1,2,3}', '(1,2,3)', '{}'),
+  (2, null, null, null),
+  (3, '{4,null,6}', '(4,,6)', '{7}'),
+  (4, '{}', '(,,)', '{8,9}');
+
+select * from test_nested;
+select id, v[2], (p).y, array_length(v, 1), cardinality(tags)
+  from test_nested order by id;
+select id, v from test_nested order by v;
+
+-- Elements of many rows span several chunks of the child arrays.
+insert into test_nested
+  select i, array[i, i + 1, i + 2, i + 3]::float4[],
+         row(i, 2 * i, 3 * i)::test_point, array[i]
+  from generate_series(10, 1009) i;
+select count(*), sum(v[4]), sum((p).z), sum(tags[1])
+  from test_nested where id >= 10;
+
+-- Vacuum moves the elements and fields along with the rows.
+delete from test_nested where id >= 10 and id % 2 = 0;
+vacuum test_nested;
+select count(*), sum(v[4]), sum((p).z), sum(tags[1])
+  from test_nested where id >= 10;
+select * from test_nested where id < 12 order by id;
+
+-- Only one-dimensional arrays starting at 1 can be stored.
+insert into test_nested(id, v) values (5, '{{1,2},{3,4}}');
+insert into test_nested(id, v) values (5, '[2:3]={1,2}');
+insert into test_nested(id, v) values (6, '{5}');
+select id, v from test_nested where id between 5 and 9;
+
+-- New storage gets new child arrays.
+truncate test_nested;
+insert into test_nested values (1, '{1}', '(1,1,1)', '{1}');
+select * from test_nested;
+
+-- Arrays of variable-length types cannot be stored.
+create table test_text_array(a text[]) using arrow;
+
+drop table test_nested;
+drop type test_point;
@@ -0,0 +1,20 @@
+create table test_profile(a int, b bigint) using arrow;
+
+-- Both inserts are counted, whether they are one row or many
+insert into test_profile select a, a from generate_series(1, 1000) a;
+insert into test_profile values (1001, 1001);
+
+-- Sequential scans count the rows they return
+set arrow.enable_agg = off;
+select count(*) from test_profile;
+select count(*) from test_profile where a > 500;
+reset arrow.enable_agg;
+
+select rows_inserted, rows_scanned,
+       segment_opens > 0 as opened,
+       open_time >= 0 as timed,
+       bytes_mapped > 0 as mapped
+  from arrow_profile
+ where relid = 'test_profile'::regclass;
+
+drop table test_profile;
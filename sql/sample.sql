@@ -0,0 +1,29 @@
+create table test_sample(a int) using arrow;
+insert into test_sample select a from generate_series(1, 100000) a;
+
+-- Sampling everything or nothing
+select count(*) from test_sample tablesample system (100);
+select count(*) from test_sample tablesample bernoulli (100);
+select count(*) from test_sample tablesample system (0);
+select count(*) from test_sample tablesample bernoulli (0);
+
+-- Samples are roughly the requested fraction of the rows
+select count(*) between 5000 and 15000
+  from test_sample tablesample system (10) repeatable (0);
+select count(*) between 9000 and 11000
+  from test_sample tablesample bernoulli (10) repeatable (0);
+
+-- Repeatable samples return the same rows
+select (select sum(a) from test_sample tablesample system (5) repeatable (42)) =
+       (select sum(a) from test_sample tablesample system (5) repeatable (42));
+select (select sum(a) from test_sample tablesample bernoulli (5) repeatable (42)) =
+       (select sum(a) from test_sample tablesample bernoulli (5) repeatable (42));
+
+-- Deleted rows are not sampled
+delete from test_sample where a % 2 = 0;
+select count(*) from test_sample tablesample system (100);
+select count(*) from test_sample tablesample bernoulli (100);
+select count(*) filter (where a % 2 = 0)
+  from test_sample tablesample bernoulli (50) repeatable (1);
+
+drop table test_sample;
@@ -0,0 +1,53 @@
+create table test_sorted(a int, b bigint) using arrow;
+insert into test_sorted select a, a % 1000 from generate_series(1, 10000) a;
+create index test_sorted_a on test_sorted using arrow_sorted (a);
+create index test_sorted_b on test_sorted using arrow_sorted (b);
+
+set enable_seqscan = off;
+set enable_bitmapscan = off;
+
+explain (costs off) select * from test_sorted where a = 4711;
+select * from test_sorted where a = 4711;
+select count(*), sum(a) from test_sorted where a between 100 and 199;
+select count(*) from test_sorted where b = 17::bigint;
+select count(*) from test_sorted where b > 990::bigint;
+select count(*) from test_sorted where b < 0::bigint;
+
+-- New rows are added to the unsorted tail, which is merged into the
+-- sorted part when a chunk is full
+insert into test_sorted select a, a % 1000 from generate_series(10001, 10300) a;
+select count(*) from test_sorted where b = 17::bigint;
+select count(*), min(a), max(a) from test_sorted where a >= 10250;
+insert into test_sorted values (5, 5);
+select * from test_sorted where a = 5;
+
+-- Deleted rows are not returned
+delete from test_sorted where a = 4711;
+select * from test_sorted where a = 4711;
+
+-- Bitmap scans work as well
+set enable_indexscan = off;
+set enable_bitmapscan = on;
+select count(*), sum(a) from test_sorted where a between 100 and 199;
+reset enable_indexscan;
+
+select attnum, row_count
+  from arrow_segments
+ where relid = 'test_sorted_a'::regclass
+ order by attnum;
+
+-- Rebuilding the index releases the old segments
+reindex index test_sorted_a;
+select count(*) from arrow_segments where attnum in (-3, -4);
+select count(*), sum(a) from test_sorted where a between 100 and 199;
+
+-- Sorted indexes can only be used with arrow tables
+create table test_heap(a int);
+create index test_heap_a on test_heap using arrow_sorted (a);
+drop table test_heap;
+
+reset enable_seqscan;
+reset enable_bitmapscan;
+
+drop table test_sorted;
+select count(*) from arrow_segments where attnum in (-3, -4);
@@ -0,0 +1,55 @@
+create table test_stats(a int, b bool, c date, d int[]) using arrow;
+insert into test_stats
+select a, a % 2 = 0,
+       case when a % 3 = 0 then null else date '2024-01-01' + a end,
+       array[a, a]
+  from generate_series(1, 1000) a;
+delete from test_stats where a <= 100;
+update test_stats set b = not b where a = 500;
+
+-- The columns include the deleted rows and the old version of the
+-- updated row
+select attnum, attname, encoding, row_count, null_count, chunks,
+       bytes_used <= bytes_reserved as within
+  from pg_stat_arrow
+ where relid = 'test_stats'::regclass
+ order by attnum;
+
+-- Scans and changes are counted as for heap tables
+set arrow.enable_agg = off;
+select count(*) from test_stats;
+reset arrow.enable_agg;
+select pg_stat_force_next_flush();
+select seq_scan, seq_tup_read, n_tup_ins, n_tup_upd, n_tup_del,
+       n_live_tup, n_dead_tup
+  from pg_stat_user_tables
+ where relid = 'test_stats'::regclass;
+
+-- VACUUM reports the rows left and moves relfrozenxid past the
+-- transactions that changed the table
+select age(relfrozenxid) as age
+  from pg_class
+ where oid = 'test_stats'::regclass \gset
+vacuum test_stats;
+select pg_stat_force_next_flush();
+select n_live_tup, vacuum_count
+  from pg_stat_user_tables
+ where relid = 'test_stats'::regclass;
+select age(relfrozenxid) < :age as advanced
+  from pg_class
+ where oid = 'test_stats'::regclass;
+
+-- ANALYZE samples the rows of each chunk
+analyze test_stats;
+select reltuples from pg_class where oid = 'test_stats'::regclass;
+select attname, null_frac, n_distinct
+  from pg_stats
+ where tablename = 'test_stats' and attname in ('a', 'b')
+ order by attname;
+
+-- Only arrow tables have column statistics
+create table test_stats_heap(a int);
+select * from arrow_column_stats('test_stats_heap');
+
+drop table test_stats;
+drop table test_stats_heap;
@@ -0,0 +1,34 @@
+create table test_truncate(a int, b int) using arrow;
+
+insert into test_truncate select a, 2 * a from generate_series(1,10) as a;
+select count(*) from test_truncate;
+
+truncate test_truncate;
+select count(*) from test_truncate;
+
+insert into test_truncate select a, 2 * a from generate_series(1,5) as a;
+select count(*), sum(a) from test_truncate;
+
+-- Truncate is transactional, so rolling back restores the old rows.
+begin;
+truncate test_truncate;
+insert into test_truncate values (100, 200);
+select count(*), sum(a) from test_truncate;
+rollback;
+select count(*), sum(a) from test_truncate;
+
+-- Truncating a table created in the same transaction resets it in
+-- place.
+begin;
+create table test_truncate_local(a int) using arrow;
+insert into test_truncate_local values (1), (2);
+truncate test_truncate_local;
+insert into test_truncate_local values (3);
+select * from test_truncate_local;
+commit;
+
+drop table test_truncate, test_truncate_local;
+
+-- Dropped tables should not leave any segments behind.
+select count(*) from arrow_orphans()
+where dbid = (select oid from pg_database where datname = current_database());
@@ -0,0 +1,55 @@
+set datestyle = 'ISO, YMD';
+set timezone = 'UTC';
+
+-- Booleans are stored as bits, and dates and timestamps are stored
+-- relative to the Unix epoch.
+create table test_types(id int, flag bool, day date, ts timestamp,
+                        tstz timestamptz) using arrow;
+
+insert into test_types values
+  (1, true, '2024-02-29', '2024-02-29 12:34:56.789', '2024-02-29 12:34:56+00'),
+  (2, false, '1970-01-01', '1970-01-01 00:00:00', '1970-01-01 00:00:00+00'),
+  (3, null, null, null, null),
+  (4, true, '1900-01-01', '1999-12-31 23:59:59.999999',
+   '2000-01-01 00:00:00+00'),
+  (5, false, 'infinity', '-infinity', 'infinity');
+
+select * from test_types;
+select * from test_types order by day, id;
+select id from test_types where flag order by id;
+select id from test_types where ts < '1970-01-02' order by id;
+
+-- Timestamps close to the end of the range do not fit once they are
+-- moved to the Unix epoch.
+insert into test_types(id, ts) values (6, '294276-12-31 23:59:59');
+select count(*) from test_types;
+
+-- Other fixed-length types are stored as they are.
+create table test_binary(id int, u uuid, span interval, o oid) using arrow;
+
+insert into test_binary values
+  (1, 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11', '1 year 2 mons 3 days 04:05:06',
+   1234),
+  (2, '00000000-0000-0000-0000-000000000000', '-1 day', 0),
+  (3, null, null, null),
+  (4, 'ffffffff-ffff-ffff-ffff-ffffffffffff', '00:00:00.000001', 4294967295);
+
+select * from test_binary;
+select * from test_binary order by u;
+select id from test_binary where span > '1 day' order by id;
+
+-- Bits of rows that are moved by vacuum move with them.
+create table test_bools(a int, b bool) using arrow;
+insert into test_bools
+  select i, case when i % 5 = 0 then null else i % 3 = 0 end
+  from generate_series(1, 600) i;
+select b, count(*) from test_bools group by b order by b;
+delete from test_bools where a <= 300;
+vacuum test_bools;
+select b, count(*) from test_bools group by b order by b;
+select count(*), sum(a) from test_bools where b;
+
+-- Variable-length types cannot be stored.
+create table test_text(a int, b text) using arrow;
+
+drop table test_types, test_binary, test_bools;
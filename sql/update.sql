@@ -0,0 +1,55 @@
+create table test_update(a int, b int) using arrow;
+insert into test_update select a, a from generate_series(1, 1000) a;
+
+update test_update set b = -b where a % 10 = 0;
+select count(*), sum(b) from test_update;
+
+-- The old versions are visible again if the transaction aborts
+begin;
+update test_update set b = 0;
+select count(*), sum(b) from test_update;
+rollback;
+select count(*), sum(b) from test_update;
+
+-- Updating a row twice in the same transaction
+begin;
+update test_update set b = b + 1 where a = 1;
+update test_update set b = b + 1 where a = 1;
+select a, b from test_update where a = 1;
+commit;
+
+-- Vacuum compacts the rows and releases the deleted rows
+set arrow.compaction_threshold = 0.05;
+vacuum test_update;
+reset arrow.compaction_threshold;
+
+select count(*), sum(b) from test_update;
+select a, b from test_update where a between 8 and 12 order by a;
+
+select attnum, row_count
+  from arrow_segments
+ where relid = 'test_update'::regclass
+ order by attnum;
+
+-- Rows can still be updated and deleted after compaction
+update test_update set b = 0 where a <= 500;
+delete from test_update where a > 900;
+select count(*), sum(b) from test_update;
+
+drop table test_update;
+
+-- INSERT ... ON CONFLICT inserts the rows that do not conflict and
+-- updates or skips the others
+create table test_upsert(a int primary key, b int) using arrow;
+insert into test_upsert select a, a from generate_series(1, 10) a;
+insert into test_upsert select a, 0 from generate_series(6, 15) a
+    on conflict do nothing;
+select count(*), sum(b) from test_upsert;
+insert into test_upsert values (1, 100), (20, 20)
+    on conflict (a) do update set b = excluded.b;
+select a, b from test_upsert where a in (1, 20) order by a;
+select count(*), sum(b) from test_upsert;
+insert into test_upsert values (2, 1), (2, 2)
+    on conflict (a) do update set b = excluded.b;
+select a, b from test_upsert where a = 2;
+drop table test_upsert;